@@ -1,11 +1,17 @@
 /**
  * Context Switch Benchmark
  *
- * Measures context switch latency for LibUThread.
+ * Measures context switch latency for LibUThread: two threads yielding to
+ * each other, and a generator resumed and yielding, which switches without
+ * the scheduler.
+ *
+ * Built once per context backend: bench_context_switch uses the configured
+ * switch, bench_context_switch_ucontext the portable ucontext fallback.
  *
  * @file context_switch.c
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -18,6 +24,10 @@
 #define NUM_SWITCHES 10000
 #define NUM_ITERATIONS 5
 
+#ifndef BENCH_CONTEXT_BACKEND
+#define BENCH_CONTEXT_BACKEND "ucontext"
+#endif
+
 static uthread_t thread_a;
 static uthread_t thread_b;
 static volatile int turn = 0;
@@ -63,6 +73,15 @@ static void *pong_thread(void *arg)
     return NULL;
 }
 
+/* Yields until resumed with NULL */
+static void *bench_gen(void *arg)
+{
+    (void)arg;
+    while (uthread_gen_yield(NULL) != NULL) {
+    }
+    return NULL;
+}
+
 /* ==========================================================================
  * Helper Functions
  * ========================================================================== */
@@ -74,7 +93,7 @@ static uint64_t get_time_ns(void)
     return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
-static void run_benchmark(sched_policy_t policy, const char *name)
+static void run_benchmark(sched_policy_t policy, const char *name, bool traced)
 {
     printf("\n--- %s Scheduler ---\n", name);
 
@@ -89,6 +108,11 @@ static void run_benchmark(sched_policy_t policy, const char *name)
         /* Disable preemption for accurate measurement */
         uthread_set_preemption(false);
 
+        /* Measure the cost of recording every switch */
+        if (traced) {
+            uthread_trace_start(0);
+        }
+
         turn = 0;
         switches_done = 0;
 
@@ -116,6 +140,52 @@ static void run_benchmark(sched_policy_t policy, const char *name)
     printf("Average: %.2f ns/switch\n", avg_ns);
 }
 
+/* A resume and its yield count as two switches, as a ping-pong round does */
+static void run_generator_benchmark(void)
+{
+    printf("\n--- Generator resume/yield ---\n");
+
+    double total_ns = 0;
+
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+        if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+            fprintf(stderr, "Failed to initialize\n");
+            return;
+        }
+        uthread_set_preemption(false);
+
+        uthread_gen_t gen;
+        if (uthread_gen_create(&gen, bench_gen, NULL, 0) != 0) {
+            fprintf(stderr, "Failed to create generator\n");
+            uthread_shutdown();
+            return;
+        }
+        uthread_gen_resume(gen, NULL, NULL);
+
+        uint64_t start = get_time_ns();
+
+        for (int i = 0; i < NUM_SWITCHES / 2; i++) {
+            uthread_gen_resume(gen, gen, NULL);
+        }
+
+        uint64_t end = get_time_ns();
+
+        uthread_gen_resume(gen, NULL, NULL);
+        uthread_gen_destroy(gen);
+        uthread_shutdown();
+
+        double elapsed_ns = (double)(end - start);
+        double per_switch_ns = elapsed_ns / NUM_SWITCHES;
+        total_ns += per_switch_ns;
+
+        printf("Iteration %d: %.2f ns/switch (%.2f us total)\n",
+               iter + 1, per_switch_ns, elapsed_ns / 1000.0);
+    }
+
+    double avg_ns = total_ns / NUM_ITERATIONS;
+    printf("Average: %.2f ns/switch\n", avg_ns);
+}
+
 /* ==========================================================================
  * Main
  * ========================================================================== */
@@ -123,11 +193,14 @@ static void run_benchmark(sched_policy_t policy, const char *name)
 int main(void)
 {
     printf("=== Context Switch Benchmark ===\n");
+    printf("Context backend: %s\n", BENCH_CONTEXT_BACKEND);
     printf("Switches: %d, Iterations: %d\n", NUM_SWITCHES, NUM_ITERATIONS);
 
-    run_benchmark(SCHED_ROUND_ROBIN, "Round-Robin");
-    run_benchmark(SCHED_PRIORITY, "Priority");
-    run_benchmark(SCHED_CFS, "CFS");
+    run_benchmark(SCHED_ROUND_ROBIN, "Round-Robin", false);
+    run_benchmark(SCHED_PRIORITY, "Priority", false);
+    run_benchmark(SCHED_CFS, "CFS", false);
+    run_benchmark(SCHED_ROUND_ROBIN, "Round-Robin (traced)", true);
+    run_generator_benchmark();
 
     printf("\n=== Benchmark Complete ===\n");
 
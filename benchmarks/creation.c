@@ -1,11 +1,15 @@
 /**
  * Thread Creation Benchmark
  *
- * Measures thread creation and join latency for LibUThread.
+ * Measures thread creation and join latency for LibUThread, the cost of
+ * short-lived spawn/join cycles with and without the stack cache, the
+ * cost of the same unit of work submitted as a task instead, and spawning
+ * threads that share expensive setup by cloning a parked template.
  *
  * @file creation.c
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -18,6 +22,10 @@
 #define NUM_THREADS 1000
 #define NUM_ITERATIONS 5
 
+/* Per-thread state built by the setup before threads diverge */
+#define SETUP_WORDS 512
+#define SETUP_ROUNDS 8
+
 /* ==========================================================================
  * Minimal Thread Function
  * ========================================================================== */
@@ -28,6 +36,38 @@ static void *empty_thread(void *arg)
     return NULL;
 }
 
+static void empty_task(void *arg)
+{
+    (void)arg;
+}
+
+/* Stands in for parsing configuration into per-request state */
+static unsigned int setup_state(unsigned int *state)
+{
+    unsigned int h = 2166136261u;
+    for (int r = 0; r < SETUP_ROUNDS; r++) {
+        for (int i = 0; i < SETUP_WORDS; i++) {
+            h = (h ^ (unsigned int)(i + r)) * 16777619u;
+            state[i] ^= h;
+        }
+    }
+    return state[h % SETUP_WORDS];
+}
+
+/* Does the setup itself, or (cloned) continues from the template's */
+static void *setup_thread(void *arg)
+{
+    unsigned int state[SETUP_WORDS] = {0};
+    volatile unsigned int sink = setup_state(state);
+
+    if (arg != NULL) {
+        uthread_clone_park();
+    }
+    sink += state[0];
+    (void)sink;
+    return NULL;
+}
+
 /* ==========================================================================
  * Helper Functions
  * ========================================================================== */
@@ -92,6 +132,117 @@ static void run_benchmark(sched_policy_t policy, const char *name)
            1e9 / avg_create, 1e9 / avg_join);
 }
 
+static void run_cycle_benchmark(bool cached)
+{
+    printf("\n--- Spawn/join cycle (%s) ---\n",
+           cached ? "stack cache" : "no cache");
+
+    uthread_set_stack_cache(cached ? UTHREAD_STACK_CACHE_DEFAULT : 0);
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        fprintf(stderr, "Failed to initialize\n");
+        return;
+    }
+    uthread_set_preemption(false);
+
+    if (cached) {
+        uthread_stack_prewarm(0, 1);
+    }
+    uthread_reset_stats();
+
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < NUM_THREADS * NUM_ITERATIONS; i++) {
+        uthread_t thread;
+        uthread_create(&thread, NULL, empty_thread, NULL);
+        uthread_join(thread, NULL);
+    }
+    uint64_t end = get_time_ns();
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+    uthread_shutdown();
+
+    printf("Average: %.2f ns/cycle\n",
+           (double)(end - start) / (NUM_THREADS * NUM_ITERATIONS));
+    printf("Stack cache: %lu hits, %lu misses\n",
+           (unsigned long)stats.stack_cache_hits,
+           (unsigned long)stats.stack_cache_misses);
+
+    uthread_set_stack_cache(UTHREAD_STACK_CACHE_DEFAULT);
+}
+
+static void run_task_benchmark(void)
+{
+    printf("\n--- Task submit/complete ---\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        fprintf(stderr, "Failed to initialize\n");
+        return;
+    }
+    uthread_set_preemption(false);
+    uthread_reset_stats();
+
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < NUM_THREADS * NUM_ITERATIONS; i++) {
+        uthread_task_submit(empty_task, NULL);
+    }
+    uthread_task_group_wait();
+    uint64_t end = get_time_ns();
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+    uthread_shutdown();
+
+    printf("Average: %.2f ns/task\n",
+           (double)(end - start) / (NUM_THREADS * NUM_ITERATIONS));
+    printf("Threads created: %d for %lu tasks\n",
+           stats.total_threads, (unsigned long)stats.tasks_completed);
+}
+
+static void run_clone_benchmark(void)
+{
+    printf("\n--- Spawn with setup: create vs clone (%d-byte state) ---\n",
+           (int)(SETUP_WORDS * sizeof(unsigned int)));
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        fprintf(stderr, "Failed to initialize\n");
+        return;
+    }
+    uthread_set_preemption(false);
+    uthread_stack_prewarm(0, 1);
+
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < NUM_THREADS; i++) {
+        uthread_t thread;
+        uthread_create(&thread, NULL, setup_thread, NULL);
+        uthread_join(thread, NULL);
+    }
+    uint64_t created = get_time_ns() - start;
+
+    /* The template sets up once and parks */
+    uthread_t tmpl;
+    uthread_create(&tmpl, NULL, setup_thread, &tmpl);
+    uthread_yield();
+
+    start = get_time_ns();
+    for (int i = 0; i < NUM_THREADS; i++) {
+        uthread_t thread;
+        if (uthread_clone(&thread, tmpl, NULL) != 0) {
+            fprintf(stderr, "Failed to clone\n");
+            break;
+        }
+        uthread_join(thread, NULL);
+    }
+    uint64_t cloned = get_time_ns() - start;
+
+    uthread_clone_release(tmpl, NULL);
+    uthread_join(tmpl, NULL);
+    uthread_shutdown();
+
+    printf("Create + setup: %.2f ns/cycle\n", (double)created / NUM_THREADS);
+    printf("Clone:          %.2f ns/cycle\n", (double)cloned / NUM_THREADS);
+}
+
 /* ==========================================================================
  * Main
  * ========================================================================== */
@@ -105,6 +256,11 @@ int main(void)
     run_benchmark(SCHED_PRIORITY, "Priority");
     run_benchmark(SCHED_CFS, "CFS");
 
+    run_cycle_benchmark(false);
+    run_cycle_benchmark(true);
+    run_task_benchmark();
+    run_clone_benchmark();
+
     printf("\n=== Benchmark Complete ===\n");
 
     return 0;
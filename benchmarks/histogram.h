@@ -0,0 +1,127 @@
+/**
+ * Latency Histogram
+ *
+ * HDR-style log-linear histogram for the benchmark suite: values below
+ * 32 have a bucket each, and every power of two above is split into 32
+ * buckets, so any recorded value is reported within about 3%. Recording
+ * is an atomic add, so threads of any kind may share one histogram.
+ *
+ * @file histogram.h
+ */
+
+#ifndef BENCH_HISTOGRAM_H
+#define BENCH_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* ==========================================================================
+ * Configuration
+ * ========================================================================== */
+
+#define HIST_SUB_BITS   5
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/** Histogram of nanosecond values */
+struct histogram {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+};
+
+/* ==========================================================================
+ * Recording
+ * ========================================================================== */
+
+static inline int hist_index(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT) {
+        return (int)value;
+    }
+
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exp - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1);
+    return (exp - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + sub;
+}
+
+/* Middle of the range of values that land in a bucket */
+static inline uint64_t hist_value(int index)
+{
+    if (index < HIST_SUB_COUNT) {
+        return (uint64_t)index;
+    }
+
+    int exp = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int sub = index % HIST_SUB_COUNT;
+    uint64_t width = 1ULL << (exp - HIST_SUB_BITS);
+    return ((uint64_t)(HIST_SUB_COUNT + sub) << (exp - HIST_SUB_BITS)) + width / 2;
+}
+
+static inline void hist_reset(struct histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static inline void hist_record(struct histogram *h, uint64_t value)
+{
+    __atomic_fetch_add(&h->counts[hist_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max &&
+           !__atomic_compare_exchange_n(&h->max, &max, value, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        /* max reloaded by the failed exchange */
+    }
+}
+
+/** Add the counts of `src` to `dst` (not thread-safe) */
+static inline void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/* ==========================================================================
+ * Queries
+ * ========================================================================== */
+
+/** Value below which a fraction `q` (0..1) of the samples fall */
+static inline uint64_t hist_percentile(const struct histogram *h, double q)
+{
+    if (h->total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(q * (double)h->total);
+    if (target >= h->total) {
+        target = h->total - 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > target) {
+            uint64_t value = hist_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+static inline double hist_mean(const struct histogram *h)
+{
+    return h->total ? (double)h->sum / (double)h->total : 0.0;
+}
+
+#endif /* BENCH_HISTOGRAM_H */
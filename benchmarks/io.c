@@ -0,0 +1,227 @@
+/**
+ * I/O Benchmark
+ *
+ * Measures request throughput of the I/O wrappers: pairs of threads
+ * exchange small messages over socketpairs, and a set of threads read
+ * 4 KiB blocks from a file with uthread_pread().
+ *
+ * Built once per backend: bench_io uses the configured one,
+ * bench_io_uring the io_uring backend. The backend in use is reported by
+ * uthread_io_backend(); with io_uring the number of io_uring_enter()
+ * calls per request is printed as well.
+ *
+ * @file io.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "uthread.h"
+
+/* ==========================================================================
+ * Configuration
+ * ========================================================================== */
+
+#define NUM_PAIRS 16
+#define NUM_ROUNDS 2000
+#define NUM_READERS 16
+#define NUM_READS 2000
+#define BLOCK_SIZE 4096
+#define FILE_BLOCKS 256
+#define NUM_ITERATIONS 3
+
+/* ==========================================================================
+ * Helper Functions
+ * ========================================================================== */
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void print_ring_stats(uint64_t requests)
+{
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+
+    if (stats.io_ring_requests > 0) {
+        printf("  io_uring_enter calls/request: %.3f\n",
+               (double)stats.io_ring_enters / (double)requests);
+    }
+}
+
+/* ==========================================================================
+ * Socket Ping-Pong
+ * ========================================================================== */
+
+static void *client_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[64] = {0};
+
+    for (int i = 0; i < NUM_ROUNDS; i++) {
+        uthread_write(fd, buf, sizeof(buf));
+        uthread_read(fd, buf, sizeof(buf));
+    }
+
+    return NULL;
+}
+
+static void *echo_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char buf[64];
+
+    for (int i = 0; i < NUM_ROUNDS; i++) {
+        ssize_t n = uthread_read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        uthread_write(fd, buf, (size_t)n);
+    }
+
+    return NULL;
+}
+
+static void benchmark_ping_pong(void)
+{
+    printf("\n--- Socket Ping-Pong (%d pairs) ---\n", NUM_PAIRS);
+
+    double total_ns = 0;
+
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+        int sv[NUM_PAIRS][2];
+        uthread_t threads[NUM_PAIRS * 2];
+
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            socketpair(AF_UNIX, SOCK_STREAM, 0, sv[i]);
+        }
+        uthread_reset_stats();
+
+        uint64_t start = get_time_ns();
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            uthread_create(&threads[2 * i], NULL, echo_thread, &sv[i][1]);
+            uthread_create(&threads[2 * i + 1], NULL, client_thread, &sv[i][0]);
+        }
+        for (int i = 0; i < NUM_PAIRS * 2; i++) {
+            uthread_join(threads[i], NULL);
+        }
+        uint64_t end = get_time_ns();
+
+        uint64_t requests = (uint64_t)NUM_PAIRS * NUM_ROUNDS * 4;
+        double per_rt_ns = (double)(end - start) / (NUM_PAIRS * NUM_ROUNDS);
+        total_ns += per_rt_ns;
+
+        printf("Iteration %d: %.2f ns/round trip\n", iter + 1, per_rt_ns);
+        print_ring_stats(requests);
+
+        for (int i = 0; i < NUM_PAIRS; i++) {
+            uthread_close(sv[i][0]);
+            uthread_close(sv[i][1]);
+        }
+    }
+
+    printf("Average: %.2f ns/round trip\n", total_ns / NUM_ITERATIONS);
+}
+
+/* ==========================================================================
+ * File Reads
+ * ========================================================================== */
+
+static int g_file;
+
+static void *file_reader_thread(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+    char *buf = malloc(BLOCK_SIZE);
+
+    for (int i = 0; i < NUM_READS; i++) {
+        off_t block = (off_t)(rand_r(&seed) % FILE_BLOCKS);
+        uthread_pread(g_file, buf, BLOCK_SIZE, block * BLOCK_SIZE);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void benchmark_file_reads(void)
+{
+    printf("\n--- File Reads (%d threads, %d B blocks) ---\n",
+           NUM_READERS, BLOCK_SIZE);
+
+    char path[] = "/tmp/uthread_bench_io_XXXXXX";
+    g_file = mkstemp(path);
+    if (g_file < 0) {
+        fprintf(stderr, "mkstemp failed\n");
+        return;
+    }
+    unlink(path);
+
+    char *block = calloc(1, BLOCK_SIZE);
+    for (int i = 0; i < FILE_BLOCKS; i++) {
+        pwrite(g_file, block, BLOCK_SIZE, (off_t)i * BLOCK_SIZE);
+    }
+    free(block);
+
+    double total_ns = 0;
+
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+        uthread_t threads[NUM_READERS];
+        uthread_reset_stats();
+
+        uint64_t start = get_time_ns();
+        for (int i = 0; i < NUM_READERS; i++) {
+            uthread_create(&threads[i], NULL, file_reader_thread,
+                           (void *)(uintptr_t)(i + 1));
+        }
+        for (int i = 0; i < NUM_READERS; i++) {
+            uthread_join(threads[i], NULL);
+        }
+        uint64_t end = get_time_ns();
+
+        uint64_t requests = (uint64_t)NUM_READERS * NUM_READS;
+        double per_read_ns = (double)(end - start) / (double)requests;
+        total_ns += per_read_ns;
+
+        printf("Iteration %d: %.2f ns/read\n", iter + 1, per_read_ns);
+        print_ring_stats(requests);
+    }
+
+    printf("Average: %.2f ns/read\n", total_ns / NUM_ITERATIONS);
+
+    uthread_close(g_file);
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread I/O Benchmark ===\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        fprintf(stderr, "Failed to initialize\n");
+        return 1;
+    }
+
+    /* Disable preemption for accurate measurement */
+    uthread_set_preemption(false);
+
+    printf("I/O backend: %s\n", uthread_io_backend());
+
+    benchmark_ping_pong();
+    benchmark_file_reads();
+
+    uthread_shutdown();
+
+    printf("\n=== Benchmark Complete ===\n");
+
+    return 0;
+}
@@ -3,9 +3,18 @@
  *
  * Measures mutex lock/unlock performance for LibUThread.
  *
+ * Built once per preemption control: bench_mutex uses the configured one,
+ * bench_mutex_sigmask masks SIGALRM with sigprocmask() on every
+ * preemption_disable()/preemption_enable().
+ *
+ * The queued-waiter benchmark compares the normal and adaptive mutex
+ * types when the holder regularly blocks others, on one and on several
+ * workers.
+ *
  * @file mutex.c
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -19,6 +28,10 @@
 #define NUM_ITERATIONS 5
 #define NUM_THREADS 4
 
+#ifndef BENCH_PREEMPTION_CONTROL
+#define BENCH_PREEMPTION_CONTROL "sigprocmask"
+#endif
+
 static uthread_mutex_t g_mutex;
 static int g_counter;
 
@@ -134,6 +147,81 @@ static void benchmark_contended(sched_policy_t policy, const char *name)
     printf("Rate: %.0f operations/sec\n", 1e9 / (total_ns / NUM_ITERATIONS));
 }
 
+/* ==========================================================================
+ * Queued-Waiter Benchmark
+ * ========================================================================== */
+
+#define YIELD_EVERY 100
+
+static void *queueing_worker(void *arg)
+{
+    worker_args_t *args = (worker_args_t *)arg;
+
+    for (int i = 0; i < args->operations; i++) {
+        uthread_mutex_lock(&g_mutex);
+        g_counter++;
+        /* Let the others run into the held mutex now and then */
+        if (i % YIELD_EVERY == 0) {
+            uthread_yield();
+        }
+        uthread_mutex_unlock(&g_mutex);
+    }
+
+    return NULL;
+}
+
+static void benchmark_queued(int type, int num_workers, const char *name)
+{
+    printf("\n--- Queued Waiters (%s, %d worker%s) ---\n",
+           name, num_workers, num_workers == 1 ? "" : "s");
+
+    double total_ns = 0;
+    int ops_per_thread = NUM_OPERATIONS / NUM_THREADS;
+
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+        if (uthread_init_workers(SCHED_ROUND_ROBIN, num_workers) != 0) {
+            fprintf(stderr, "Failed to initialize\n");
+            return;
+        }
+
+        uthread_mutexattr_t attr;
+        uthread_mutexattr_init(&attr);
+        uthread_mutexattr_settype(&attr, type);
+        uthread_mutex_init(&g_mutex, &attr);
+        uthread_mutexattr_destroy(&attr);
+        g_counter = 0;
+
+        worker_args_t args = { .operations = ops_per_thread };
+        uthread_t threads[NUM_THREADS];
+
+        uint64_t start = get_time_ns();
+
+        for (int i = 0; i < NUM_THREADS; i++) {
+            uthread_create(&threads[i], NULL, queueing_worker, &args);
+        }
+
+        for (int i = 0; i < NUM_THREADS; i++) {
+            uthread_join(threads[i], NULL);
+        }
+
+        uint64_t end = get_time_ns();
+
+        uthread_stats_t stats;
+        uthread_get_stats(&stats);
+
+        uthread_mutex_destroy(&g_mutex);
+        uthread_shutdown();
+
+        double per_op_ns = (double)(end - start) / (ops_per_thread * NUM_THREADS);
+        total_ns += per_op_ns;
+
+        printf("Iteration %d: %.2f ns/lock-unlock (switches=%lu)\n",
+               iter + 1, per_op_ns, (unsigned long)stats.context_switches);
+    }
+
+    printf("Average: %.2f ns/lock-unlock\n", total_ns / NUM_ITERATIONS);
+}
+
 /* ==========================================================================
  * Main
  * ========================================================================== */
@@ -141,6 +229,7 @@ static void benchmark_contended(sched_policy_t policy, const char *name)
 int main(void)
 {
     printf("=== Mutex Benchmark ===\n");
+    printf("Preemption control: %s\n", BENCH_PREEMPTION_CONTROL);
     printf("Operations: %d, Iterations: %d\n", NUM_OPERATIONS, NUM_ITERATIONS);
 
     /* Need library initialized for uncontended test */
@@ -160,6 +249,12 @@ int main(void)
     benchmark_contended(SCHED_PRIORITY, "Priority");
     benchmark_contended(SCHED_CFS, "CFS");
 
+    /* Normal vs adaptive with waiters queued on the mutex */
+    benchmark_queued(UTHREAD_MUTEX_NORMAL, 1, "Normal");
+    benchmark_queued(UTHREAD_MUTEX_ADAPTIVE, 1, "Adaptive");
+    benchmark_queued(UTHREAD_MUTEX_NORMAL, 4, "Normal");
+    benchmark_queued(UTHREAD_MUTEX_ADAPTIVE, 4, "Adaptive");
+
     printf("\n=== Benchmark Complete ===\n");
 
     return 0;
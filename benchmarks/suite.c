@@ -0,0 +1,1443 @@
+/**
+ * Benchmark Suite
+ *
+ * One harness for the latency-sensitive paths of LibUThread: every
+ * workload runs a warmup and several repetitions, records the latency of
+ * each operation in a log-linear histogram, and reports throughput with
+ * p50/p99/p99.9/max. The same workloads can run on pthreads for
+ * comparison, results can be written as JSON, and a previous JSON run
+ * can serve as a baseline that fails the run when p50 or throughput
+ * regress past a threshold.
+ *
+ * Usage: bench_suite [--quick] [--reps N] [--warmup N] [--workers N]
+ *                    [--filter TEXT] [--pthread] [--json FILE]
+ *                    [--baseline FILE] [--threshold PCT]
+ *
+ * @file suite.c
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uthread.h"
+#include "histogram.h"
+
+/* ==========================================================================
+ * Configuration
+ * ========================================================================== */
+
+#define DEFAULT_REPS        5
+#define DEFAULT_WARMUP      1
+#define DEFAULT_THRESHOLD   10.0        /* Percent */
+#define STORM_STACK_SIZE    (32 * 1024)
+#define SEM_BUFFER_SIZE     16
+#define CHAN_CAPACITY       16
+#define CHAN_BATCH          16
+#define MAX_RESULTS         64
+
+/* Work per repetition; --quick divides it by QUICK_DIVISOR */
+#define PINGPONG_ROUNDS     20000
+#define STORM_TOTAL_YIELDS  200000
+#define WAKE_TOTAL          200000
+#define CREATE_JOIN_OPS     5000
+#define MUTEX_OPS           200000
+#define CONTENDED_OPS       20000
+#define CONDVAR_ROUNDS      20000
+#define BROADCAST_ROUNDS    400
+#define SEM_ITEMS           50000
+#define CHAN_ITEMS          100000
+#define RWLOCK_OPS          100000
+#define SLEEP_OPS           100
+#define QUICK_DIVISOR       20
+
+static struct {
+    int reps;
+    int warmup;
+    int workers;
+    int divisor;
+    bool pthread;
+    const char *filter;
+    const char *json_path;
+    const char *baseline_path;
+    double threshold;
+} g_opts = {
+    .reps = DEFAULT_REPS,
+    .warmup = DEFAULT_WARMUP,
+    .workers = 1,
+    .divisor = 1,
+    .threshold = DEFAULT_THRESHOLD,
+};
+
+/* ==========================================================================
+ * Timing
+ * ========================================================================== */
+
+static double g_ns_per_tick = 1.0;
+static bool g_use_tsc = false;
+static double g_timer_overhead_ns;
+
+static uint64_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Timestamp for one sample: the TSC where available, it costs far less */
+static inline uint64_t now_ticks(void)
+{
+#if defined(__x86_64__)
+    if (g_use_tsc) {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    return clock_ns();
+}
+
+static inline uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return (uint64_t)((double)ticks * g_ns_per_tick);
+}
+
+static void timing_init(void)
+{
+#if defined(__x86_64__)
+    /* Sample the TSC against CLOCK_MONOTONIC for 20ms */
+    uint64_t ns0 = clock_ns();
+    uint64_t tsc0 = __builtin_ia32_rdtsc();
+    while (clock_ns() - ns0 < 20 * 1000 * 1000) {
+        /* spin */
+    }
+    uint64_t ns1 = clock_ns();
+    uint64_t tsc1 = __builtin_ia32_rdtsc();
+
+    if (tsc1 > tsc0) {
+        g_ns_per_tick = (double)(ns1 - ns0) / (double)(tsc1 - tsc0);
+        g_use_tsc = true;
+    }
+#endif
+
+    /* What taking one timestamp costs; every sample includes about one */
+    uint64_t start = clock_ns();
+    uint64_t t = 0;
+    for (int i = 0; i < 100000; i++) {
+        t += now_ticks();
+    }
+    g_timer_overhead_ns = (double)(clock_ns() - start) / 100000.0;
+    (void)t;
+}
+
+/* ==========================================================================
+ * Threading Backends
+ * ========================================================================== */
+
+typedef union {
+    uthread_t u;
+    pthread_t p;
+} bench_thread_t;
+
+typedef union {
+    uthread_mutex_t u;
+    pthread_mutex_t p;
+} bench_mutex_t;
+
+typedef union {
+    uthread_cond_t u;
+    pthread_cond_t p;
+} bench_cond_t;
+
+typedef union {
+    uthread_sem_t u;
+    sem_t p;
+} bench_sem_t;
+
+typedef union {
+    uthread_rwlock_t u;
+    pthread_rwlock_t p;
+} bench_rwlock_t;
+
+/* pthreads have no channel: the usual mutex and two condvars around a ring */
+struct pt_chan {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint64_t ring[CHAN_CAPACITY];
+    size_t head;
+    size_t tail;
+};
+
+typedef union {
+    uthread_chan_t u;
+    struct pt_chan p;
+} bench_chan_t;
+
+/** The primitives a workload uses, implemented by both libraries */
+struct bench_ops {
+    const char *name;
+    int (*init)(sched_policy_t policy);
+    void (*shutdown)(void);
+    int (*create)(bench_thread_t *t, size_t stack, void *(*fn)(void *), void *arg);
+    void (*join)(bench_thread_t t);
+    void (*yield)(void);
+    void (*sleep_ms)(unsigned int ms);
+    void (*mutex_init)(bench_mutex_t *m);
+    void (*mutex_lock)(bench_mutex_t *m);
+    void (*mutex_unlock)(bench_mutex_t *m);
+    void (*mutex_destroy)(bench_mutex_t *m);
+    void (*cond_init)(bench_cond_t *c);
+    void (*cond_wait)(bench_cond_t *c, bench_mutex_t *m);
+    void (*cond_signal)(bench_cond_t *c);
+    void (*cond_broadcast)(bench_cond_t *c);
+    void (*cond_destroy)(bench_cond_t *c);
+    void (*sem_init)(bench_sem_t *s, unsigned int value);
+    void (*sem_wait)(bench_sem_t *s);
+    void (*sem_post)(bench_sem_t *s);
+    void (*sem_destroy)(bench_sem_t *s);
+    void (*rwlock_init)(bench_rwlock_t *l);
+    void (*rwlock_init_biased)(bench_rwlock_t *l);
+    void (*rwlock_rdlock)(bench_rwlock_t *l);
+    void (*rwlock_wrlock)(bench_rwlock_t *l);
+    void (*rwlock_unlock)(bench_rwlock_t *l);
+    void (*rwlock_destroy)(bench_rwlock_t *l);
+    void (*chan_init)(bench_chan_t *c);
+    void (*chan_send_batch)(bench_chan_t *c, const uint64_t *items, size_t n);
+    size_t (*chan_recv_batch)(bench_chan_t *c, uint64_t *items, size_t n);
+    void (*chan_destroy)(bench_chan_t *c);
+};
+
+/* --- LibUThread --- */
+
+static int ut_init(sched_policy_t policy)
+{
+    if (g_opts.workers > 1) {
+        return uthread_init_workers(SCHED_ROUND_ROBIN, g_opts.workers);
+    }
+    return uthread_init(policy);
+}
+
+static int ut_create(bench_thread_t *t, size_t stack, void *(*fn)(void *), void *arg)
+{
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    if (stack != 0) {
+        uthread_attr_setstacksize(&attr, stack);
+    }
+    int ret = uthread_create(&t->u, &attr, fn, arg);
+    uthread_attr_destroy(&attr);
+    return ret;
+}
+
+static void ut_join(bench_thread_t t) { uthread_join(t.u, NULL); }
+static void ut_mutex_init(bench_mutex_t *m) { uthread_mutex_init(&m->u, NULL); }
+static void ut_mutex_lock(bench_mutex_t *m) { uthread_mutex_lock(&m->u); }
+static void ut_mutex_unlock(bench_mutex_t *m) { uthread_mutex_unlock(&m->u); }
+static void ut_mutex_destroy(bench_mutex_t *m) { uthread_mutex_destroy(&m->u); }
+static void ut_cond_init(bench_cond_t *c) { uthread_cond_init(&c->u, NULL); }
+static void ut_cond_wait(bench_cond_t *c, bench_mutex_t *m) { uthread_cond_wait(&c->u, &m->u); }
+static void ut_cond_signal(bench_cond_t *c) { uthread_cond_signal(&c->u); }
+static void ut_cond_broadcast(bench_cond_t *c) { uthread_cond_broadcast(&c->u); }
+static void ut_cond_destroy(bench_cond_t *c) { uthread_cond_destroy(&c->u); }
+static void ut_sem_init(bench_sem_t *s, unsigned int v) { uthread_sem_init(&s->u, 0, v); }
+static void ut_sem_wait(bench_sem_t *s) { uthread_sem_wait(&s->u); }
+static void ut_sem_post(bench_sem_t *s) { uthread_sem_post(&s->u); }
+static void ut_sem_destroy(bench_sem_t *s) { uthread_sem_destroy(&s->u); }
+static void ut_rwlock_init(bench_rwlock_t *l) { uthread_rwlock_init(&l->u, NULL); }
+static void ut_rwlock_init_biased(bench_rwlock_t *l)
+{
+    uthread_rwlockattr_t attr;
+    uthread_rwlockattr_init(&attr);
+    uthread_rwlockattr_setreadbias(&attr, 1);
+    uthread_rwlock_init(&l->u, &attr);
+}
+static void ut_rwlock_rdlock(bench_rwlock_t *l) { uthread_rwlock_rdlock(&l->u); }
+static void ut_rwlock_wrlock(bench_rwlock_t *l) { uthread_rwlock_wrlock(&l->u); }
+static void ut_rwlock_unlock(bench_rwlock_t *l) { uthread_rwlock_unlock(&l->u); }
+static void ut_rwlock_destroy(bench_rwlock_t *l) { uthread_rwlock_destroy(&l->u); }
+static void ut_chan_init(bench_chan_t *c) { uthread_chan_init(&c->u, sizeof(uint64_t), CHAN_CAPACITY); }
+static void ut_chan_destroy(bench_chan_t *c) { uthread_chan_destroy(&c->u); }
+
+static void ut_chan_send_batch(bench_chan_t *c, const uint64_t *items, size_t n)
+{
+    if (n == 1) {
+        uthread_chan_send(&c->u, items);
+        return;
+    }
+    for (size_t sent = 0, done = 0; done < n; done += sent) {
+        uthread_chan_send_batch(&c->u, items + done, n - done, &sent);
+    }
+}
+
+static size_t ut_chan_recv_batch(bench_chan_t *c, uint64_t *items, size_t n)
+{
+    if (n == 1) {
+        uthread_chan_recv(&c->u, items);
+        return 1;
+    }
+    size_t received = 0;
+    uthread_chan_recv_batch(&c->u, items, n, &received);
+    return received;
+}
+
+static const struct bench_ops g_uthread_ops = {
+    .name = "uthread",
+    .init = ut_init,
+    .shutdown = uthread_shutdown,
+    .create = ut_create,
+    .join = ut_join,
+    .yield = uthread_yield,
+    .sleep_ms = uthread_sleep,
+    .mutex_init = ut_mutex_init,
+    .mutex_lock = ut_mutex_lock,
+    .mutex_unlock = ut_mutex_unlock,
+    .mutex_destroy = ut_mutex_destroy,
+    .cond_init = ut_cond_init,
+    .cond_wait = ut_cond_wait,
+    .cond_signal = ut_cond_signal,
+    .cond_broadcast = ut_cond_broadcast,
+    .cond_destroy = ut_cond_destroy,
+    .sem_init = ut_sem_init,
+    .sem_wait = ut_sem_wait,
+    .sem_post = ut_sem_post,
+    .sem_destroy = ut_sem_destroy,
+    .rwlock_init = ut_rwlock_init,
+    .rwlock_init_biased = ut_rwlock_init_biased,
+    .rwlock_rdlock = ut_rwlock_rdlock,
+    .rwlock_wrlock = ut_rwlock_wrlock,
+    .rwlock_unlock = ut_rwlock_unlock,
+    .rwlock_destroy = ut_rwlock_destroy,
+    .chan_init = ut_chan_init,
+    .chan_send_batch = ut_chan_send_batch,
+    .chan_recv_batch = ut_chan_recv_batch,
+    .chan_destroy = ut_chan_destroy,
+};
+
+/* --- pthreads --- */
+
+static int pt_init(sched_policy_t policy) { (void)policy; return 0; }
+static void pt_shutdown(void) { }
+
+static int pt_create(bench_thread_t *t, size_t stack, void *(*fn)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stack != 0) {
+        pthread_attr_setstacksize(&attr, stack);
+    }
+    int ret = pthread_create(&t->p, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    return ret;
+}
+
+static void pt_join(bench_thread_t t) { pthread_join(t.p, NULL); }
+static void pt_yield(void) { sched_yield(); }
+
+static void pt_sleep_ms(unsigned int ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        /* Sleep out the remainder */
+    }
+}
+
+static void pt_mutex_init(bench_mutex_t *m) { pthread_mutex_init(&m->p, NULL); }
+static void pt_mutex_lock(bench_mutex_t *m) { pthread_mutex_lock(&m->p); }
+static void pt_mutex_unlock(bench_mutex_t *m) { pthread_mutex_unlock(&m->p); }
+static void pt_mutex_destroy(bench_mutex_t *m) { pthread_mutex_destroy(&m->p); }
+static void pt_cond_init(bench_cond_t *c) { pthread_cond_init(&c->p, NULL); }
+static void pt_cond_wait(bench_cond_t *c, bench_mutex_t *m) { pthread_cond_wait(&c->p, &m->p); }
+static void pt_cond_signal(bench_cond_t *c) { pthread_cond_signal(&c->p); }
+static void pt_cond_broadcast(bench_cond_t *c) { pthread_cond_broadcast(&c->p); }
+static void pt_cond_destroy(bench_cond_t *c) { pthread_cond_destroy(&c->p); }
+static void pt_sem_init(bench_sem_t *s, unsigned int v) { sem_init(&s->p, 0, v); }
+static void pt_sem_wait(bench_sem_t *s) { while (sem_wait(&s->p) == -1 && errno == EINTR) { } }
+static void pt_sem_post(bench_sem_t *s) { sem_post(&s->p); }
+static void pt_sem_destroy(bench_sem_t *s) { sem_destroy(&s->p); }
+static void pt_rwlock_init(bench_rwlock_t *l) { pthread_rwlock_init(&l->p, NULL); }
+static void pt_rwlock_rdlock(bench_rwlock_t *l) { pthread_rwlock_rdlock(&l->p); }
+static void pt_rwlock_wrlock(bench_rwlock_t *l) { pthread_rwlock_wrlock(&l->p); }
+static void pt_rwlock_unlock(bench_rwlock_t *l) { pthread_rwlock_unlock(&l->p); }
+static void pt_rwlock_destroy(bench_rwlock_t *l) { pthread_rwlock_destroy(&l->p); }
+
+static void pt_chan_init(bench_chan_t *c)
+{
+    memset(&c->p, 0, sizeof(c->p));
+    pthread_mutex_init(&c->p.lock, NULL);
+    pthread_cond_init(&c->p.not_empty, NULL);
+    pthread_cond_init(&c->p.not_full, NULL);
+}
+
+static void pt_chan_destroy(bench_chan_t *c)
+{
+    pthread_cond_destroy(&c->p.not_full);
+    pthread_cond_destroy(&c->p.not_empty);
+    pthread_mutex_destroy(&c->p.lock);
+}
+
+static void pt_chan_send_batch(bench_chan_t *c, const uint64_t *items, size_t n)
+{
+    struct pt_chan *q = &c->p;
+
+    pthread_mutex_lock(&q->lock);
+    for (size_t i = 0; i < n; i++) {
+        while (q->tail - q->head == CHAN_CAPACITY) {
+            pthread_cond_signal(&q->not_empty);
+            pthread_cond_wait(&q->not_full, &q->lock);
+        }
+        q->ring[q->tail++ % CHAN_CAPACITY] = items[i];
+    }
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static size_t pt_chan_recv_batch(bench_chan_t *c, uint64_t *items, size_t n)
+{
+    struct pt_chan *q = &c->p;
+    size_t count = 0;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->tail == q->head) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    while (count < n && q->head != q->tail) {
+        items[count++] = q->ring[q->head++ % CHAN_CAPACITY];
+    }
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+
+    return count;
+}
+
+static const struct bench_ops g_pthread_ops = {
+    .name = "pthread",
+    .init = pt_init,
+    .shutdown = pt_shutdown,
+    .create = pt_create,
+    .join = pt_join,
+    .yield = pt_yield,
+    .sleep_ms = pt_sleep_ms,
+    .mutex_init = pt_mutex_init,
+    .mutex_lock = pt_mutex_lock,
+    .mutex_unlock = pt_mutex_unlock,
+    .mutex_destroy = pt_mutex_destroy,
+    .cond_init = pt_cond_init,
+    .cond_wait = pt_cond_wait,
+    .cond_signal = pt_cond_signal,
+    .cond_broadcast = pt_cond_broadcast,
+    .cond_destroy = pt_cond_destroy,
+    .sem_init = pt_sem_init,
+    .sem_wait = pt_sem_wait,
+    .sem_post = pt_sem_post,
+    .sem_destroy = pt_sem_destroy,
+    .rwlock_init = pt_rwlock_init,
+    .rwlock_init_biased = pt_rwlock_init,
+    .rwlock_rdlock = pt_rwlock_rdlock,
+    .rwlock_wrlock = pt_rwlock_wrlock,
+    .rwlock_unlock = pt_rwlock_unlock,
+    .rwlock_destroy = pt_rwlock_destroy,
+    .chan_init = pt_chan_init,
+    .chan_send_batch = pt_chan_send_batch,
+    .chan_recv_batch = pt_chan_recv_batch,
+    .chan_destroy = pt_chan_destroy,
+};
+
+/* ==========================================================================
+ * Workloads
+ * ========================================================================== */
+
+/** One repetition of a workload */
+struct run {
+    const struct bench_ops *ops;
+    int threads;                    /**< Threads the workload spawns */
+    long ops_count;                 /**< Operations to perform in total */
+    struct histogram *hist;         /**< Per-operation latency in ticks */
+};
+
+/* Shared between the threads of the running workload */
+static struct run *g_run;
+static volatile int g_turn;
+static volatile long g_counter;
+static bench_mutex_t g_mutex;
+static bench_cond_t g_cond;
+static bench_cond_t g_cond_arrived;
+static bench_sem_t g_sem_items;
+static bench_sem_t g_sem_slots;
+static bench_rwlock_t g_rwlock;
+static uint64_t g_ring[SEM_BUFFER_SIZE];
+static long g_shared_value;
+
+/* Start `n` copies of `fn` (argument: index) and wait for all of them */
+static void spawn_and_join(struct run *r, int n, size_t stack, void *(*fn)(void *))
+{
+    bench_thread_t *threads = calloc((size_t)n, sizeof(*threads));
+    int started = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (r->ops->create(&threads[i], stack, fn, (void *)(intptr_t)i) != 0) {
+            fprintf(stderr, "bench_suite: thread %d of %d failed to start\n", i, n);
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        r->ops->join(threads[i]);
+    }
+
+    free(threads);
+}
+
+/* --- Yield ping-pong: round trip of two threads handing over by yielding --- */
+
+static void *pingpong_thread(void *arg)
+{
+    int me = (int)(intptr_t)arg;
+    struct run *r = g_run;
+    long rounds = r->ops_count;
+
+    for (long i = 0; i < rounds; i++) {
+        uint64_t start = now_ticks();
+        while (g_turn != me) {
+            r->ops->yield();
+        }
+        g_turn = !me;
+        r->ops->yield();
+        if (me == 0) {
+            hist_record(r->hist, now_ticks() - start);
+        }
+    }
+
+    return NULL;
+}
+
+static void wl_yield_pingpong(struct run *r)
+{
+    g_turn = 0;
+    spawn_and_join(r, 2, 0, pingpong_thread);
+}
+
+/* --- Yield storm: per-yield latency with N runnable threads --- */
+
+static void *storm_thread(void *arg)
+{
+    (void)arg;
+    struct run *r = g_run;
+    long yields = r->ops_count / r->threads;
+
+    for (long i = 0; i < yields; i++) {
+        uint64_t start = now_ticks();
+        r->ops->yield();
+        hist_record(r->hist, now_ticks() - start);
+    }
+
+    return NULL;
+}
+
+static void wl_yield_storm(struct run *r)
+{
+    spawn_and_join(r, r->threads, STORM_STACK_SIZE, storm_thread);
+}
+
+/* --- Wake storm: latency of waking a thread into a run queue of up to N --- */
+
+static bench_sem_t *g_wake_sems;
+static bench_sem_t g_wake_done;
+
+static void *wake_thread(void *arg)
+{
+    int me = (int)(intptr_t)arg;
+    struct run *r = g_run;
+    long rounds = r->ops_count / r->threads;
+
+    /* Report in, then sleep on our own semaphore until woken */
+    r->ops->sem_post(&g_wake_done);
+    for (long i = 0; i < rounds; i++) {
+        r->ops->sem_wait(&g_wake_sems[me]);
+        r->ops->sem_post(&g_wake_done);
+    }
+
+    return NULL;
+}
+
+/*
+ * Each post enqueues a blocked thread without switching to it, so the
+ * samples time the run queue insert as the queue fills to N threads.
+ */
+static void wl_wake_storm(struct run *r)
+{
+    int n = r->threads;
+    long rounds = r->ops_count / n;
+    bench_thread_t *threads = calloc((size_t)n, sizeof(*threads));
+    g_wake_sems = calloc((size_t)n, sizeof(*g_wake_sems));
+
+    r->ops->sem_init(&g_wake_done, 0);
+    for (int i = 0; i < n; i++) {
+        r->ops->sem_init(&g_wake_sems[i], 0);
+    }
+
+    /* Wake in a fixed shuffled order, so the TCBs are not walked in address order */
+    int *order = malloc((size_t)n * sizeof(*order));
+    unsigned int seed = 1;
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)(rand_r(&seed) % (unsigned int)(i + 1));
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    int started = 0;
+    for (int i = 0; i < n; i++) {
+        if (r->ops->create(&threads[i], STORM_STACK_SIZE, wake_thread,
+                           (void *)(intptr_t)i) != 0) {
+            fprintf(stderr, "bench_suite: thread %d of %d failed to start\n", i, n);
+            break;
+        }
+        started++;
+    }
+
+    /* A thread that failed to start would never report in */
+    if (started == n) {
+        for (int i = 0; i < n; i++) {
+            r->ops->sem_wait(&g_wake_done);
+        }
+        for (long round = 0; round < rounds; round++) {
+            for (int i = 0; i < n; i++) {
+                uint64_t start = now_ticks();
+                r->ops->sem_post(&g_wake_sems[order[i]]);
+                hist_record(r->hist, now_ticks() - start);
+            }
+            for (int i = 0; i < n; i++) {
+                r->ops->sem_wait(&g_wake_done);
+            }
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        r->ops->join(threads[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        r->ops->sem_destroy(&g_wake_sems[i]);
+    }
+    r->ops->sem_destroy(&g_wake_done);
+    free(g_wake_sems);
+    free(order);
+    free(threads);
+}
+
+/* --- Create/join: latency of starting and reaping an empty thread --- */
+
+static void *empty_thread(void *arg)
+{
+    return arg;
+}
+
+static void wl_create_join(struct run *r)
+{
+    for (long i = 0; i < r->ops_count; i++) {
+        bench_thread_t t;
+        uint64_t start = now_ticks();
+        if (r->ops->create(&t, 0, empty_thread, NULL) != 0) {
+            break;
+        }
+        r->ops->join(t);
+        hist_record(r->hist, now_ticks() - start);
+    }
+}
+
+/* --- Mutex: lock/unlock pairs alone, and with holders that get switched out --- */
+
+static void wl_mutex_uncontended(struct run *r)
+{
+    r->ops->mutex_init(&g_mutex);
+
+    for (long i = 0; i < r->ops_count; i++) {
+        uint64_t start = now_ticks();
+        r->ops->mutex_lock(&g_mutex);
+        g_counter++;
+        r->ops->mutex_unlock(&g_mutex);
+        hist_record(r->hist, now_ticks() - start);
+    }
+
+    r->ops->mutex_destroy(&g_mutex);
+}
+
+static void *contended_thread(void *arg)
+{
+    (void)arg;
+    struct run *r = g_run;
+    long ops = r->ops_count / r->threads;
+
+    for (long i = 0; i < ops; i++) {
+        uint64_t start = now_ticks();
+        r->ops->mutex_lock(&g_mutex);
+        hist_record(r->hist, now_ticks() - start);
+
+        /* Give up the CPU while holding it, so others queue behind us */
+        g_counter++;
+        r->ops->yield();
+        r->ops->mutex_unlock(&g_mutex);
+    }
+
+    return NULL;
+}
+
+static void wl_mutex_contended(struct run *r)
+{
+    r->ops->mutex_init(&g_mutex);
+    spawn_and_join(r, r->threads, 0, contended_thread);
+    r->ops->mutex_destroy(&g_mutex);
+}
+
+/* --- Condvar ping-pong: round trip of a turn passed through a condvar --- */
+
+static void *condvar_thread(void *arg)
+{
+    int me = (int)(intptr_t)arg;
+    struct run *r = g_run;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        uint64_t start = now_ticks();
+        r->ops->mutex_lock(&g_mutex);
+        while (g_turn != me) {
+            r->ops->cond_wait(&g_cond, &g_mutex);
+        }
+        g_turn = !me;
+        r->ops->cond_signal(&g_cond);
+        r->ops->mutex_unlock(&g_mutex);
+        if (me == 0) {
+            hist_record(r->hist, now_ticks() - start);
+        }
+    }
+
+    return NULL;
+}
+
+static void wl_condvar_pingpong(struct run *r)
+{
+    g_turn = 0;
+    r->ops->mutex_init(&g_mutex);
+    r->ops->cond_init(&g_cond);
+    spawn_and_join(r, 2, 0, condvar_thread);
+    r->ops->cond_destroy(&g_cond);
+    r->ops->mutex_destroy(&g_mutex);
+}
+
+/* --- Condvar broadcast: cost of waking every waiter at once --- */
+
+/* Broadcast with the mutex held, so waiters cannot take it on waking */
+static bool g_broadcast_locked;
+
+static void *broadcaster_thread(void *arg)
+{
+    (void)arg;
+    struct run *r = g_run;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        r->ops->mutex_lock(&g_mutex);
+        while (g_counter < r->threads) {
+            r->ops->cond_wait(&g_cond_arrived, &g_mutex);
+        }
+        g_counter = 0;
+        g_turn = (int)i + 1;
+        if (!g_broadcast_locked) {
+            r->ops->mutex_unlock(&g_mutex);
+        }
+
+        uint64_t start = now_ticks();
+        r->ops->cond_broadcast(&g_cond);
+        hist_record(r->hist, now_ticks() - start);
+
+        if (g_broadcast_locked) {
+            r->ops->mutex_unlock(&g_mutex);
+        }
+    }
+
+    return NULL;
+}
+
+static void *broadcast_thread(void *arg)
+{
+    if ((intptr_t)arg == 0) {
+        return broadcaster_thread(arg);
+    }
+
+    struct run *r = g_run;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        r->ops->mutex_lock(&g_mutex);
+        if (++g_counter == r->threads) {
+            r->ops->cond_signal(&g_cond_arrived);
+        }
+        while (g_turn == (int)i) {
+            r->ops->cond_wait(&g_cond, &g_mutex);
+        }
+        r->ops->mutex_unlock(&g_mutex);
+    }
+
+    return NULL;
+}
+
+static void run_cond_broadcast(struct run *r, bool locked)
+{
+    g_broadcast_locked = locked;
+    g_turn = 0;
+    g_counter = 0;
+    r->ops->mutex_init(&g_mutex);
+    r->ops->cond_init(&g_cond);
+    r->ops->cond_init(&g_cond_arrived);
+    spawn_and_join(r, r->threads + 1, STORM_STACK_SIZE, broadcast_thread);
+    r->ops->cond_destroy(&g_cond_arrived);
+    r->ops->cond_destroy(&g_cond);
+    r->ops->mutex_destroy(&g_mutex);
+}
+
+static void wl_cond_broadcast(struct run *r) { run_cond_broadcast(r, false); }
+static void wl_cond_broadcast_locked(struct run *r) { run_cond_broadcast(r, true); }
+
+/* --- Semaphore producer/consumer: item latency through a bounded buffer --- */
+
+static void *producer_thread(void *arg)
+{
+    (void)arg;
+    struct run *r = g_run;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        r->ops->sem_wait(&g_sem_slots);
+        g_ring[i % SEM_BUFFER_SIZE] = now_ticks();
+        r->ops->sem_post(&g_sem_items);
+    }
+
+    return NULL;
+}
+
+static void *consumer_thread(void *arg)
+{
+    (void)arg;
+    struct run *r = g_run;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        r->ops->sem_wait(&g_sem_items);
+        uint64_t stamp = g_ring[i % SEM_BUFFER_SIZE];
+        r->ops->sem_post(&g_sem_slots);
+        hist_record(r->hist, now_ticks() - stamp);
+    }
+
+    return NULL;
+}
+
+static void *prodcons_thread(void *arg)
+{
+    return ((intptr_t)arg == 0) ? producer_thread(arg) : consumer_thread(arg);
+}
+
+static void wl_sem_prodcons(struct run *r)
+{
+    r->ops->sem_init(&g_sem_items, 0);
+    r->ops->sem_init(&g_sem_slots, SEM_BUFFER_SIZE);
+    spawn_and_join(r, 2, 0, prodcons_thread);
+    r->ops->sem_destroy(&g_sem_slots);
+    r->ops->sem_destroy(&g_sem_items);
+}
+
+/* --- Semaphore RPC: round trip of a request/reply pair among yielders --- */
+
+static bench_sem_t g_rpc_request;
+static bench_sem_t g_rpc_reply;
+static volatile int g_rpc_done;
+
+static void *rpc_thread(void *arg)
+{
+    int me = (int)(intptr_t)arg;
+    struct run *r = g_run;
+
+    if (me == 0) {
+        for (long i = 0; i < r->ops_count; i++) {
+            uint64_t start = now_ticks();
+            r->ops->sem_post(&g_rpc_request);
+            r->ops->sem_wait(&g_rpc_reply);
+            hist_record(r->hist, now_ticks() - start);
+        }
+        g_rpc_done = 1;
+    } else if (me == 1) {
+        for (long i = 0; i < r->ops_count; i++) {
+            r->ops->sem_wait(&g_rpc_request);
+            r->ops->sem_post(&g_rpc_reply);
+        }
+    } else {
+        /* Background load: every wait lets these run unless handed off */
+        while (!g_rpc_done) {
+            r->ops->yield();
+        }
+    }
+
+    return NULL;
+}
+
+static void wl_sem_rpc(struct run *r)
+{
+    g_rpc_done = 0;
+    r->ops->sem_init(&g_rpc_request, 0);
+    r->ops->sem_init(&g_rpc_reply, 0);
+    /* Client and server, then the yielders */
+    spawn_and_join(r, 2 + r->threads, 0, rpc_thread);
+    r->ops->sem_destroy(&g_rpc_reply);
+    r->ops->sem_destroy(&g_rpc_request);
+}
+
+/* --- Channels: item latency, built by hand from a mutex or a channel --- */
+
+static bench_chan_t g_chan;
+static bench_mutex_t g_queue_lock;
+static bench_cond_t g_queue_not_empty;
+static bench_cond_t g_queue_not_full;
+static long g_queue_head;
+static long g_queue_tail;
+static size_t g_chan_batch;
+
+static void *queue_thread(void *arg)
+{
+    struct run *r = g_run;
+    bool producer = (intptr_t)arg == 0;
+
+    for (long i = 0; i < r->ops_count; i++) {
+        r->ops->mutex_lock(&g_queue_lock);
+        if (producer) {
+            while (g_queue_tail - g_queue_head == SEM_BUFFER_SIZE) {
+                r->ops->cond_wait(&g_queue_not_full, &g_queue_lock);
+            }
+            g_ring[g_queue_tail++ % SEM_BUFFER_SIZE] = now_ticks();
+            r->ops->cond_signal(&g_queue_not_empty);
+            r->ops->mutex_unlock(&g_queue_lock);
+        } else {
+            while (g_queue_tail == g_queue_head) {
+                r->ops->cond_wait(&g_queue_not_empty, &g_queue_lock);
+            }
+            uint64_t stamp = g_ring[g_queue_head++ % SEM_BUFFER_SIZE];
+            r->ops->cond_signal(&g_queue_not_full);
+            r->ops->mutex_unlock(&g_queue_lock);
+            hist_record(r->hist, now_ticks() - stamp);
+        }
+    }
+
+    return NULL;
+}
+
+static void wl_queue_prodcons(struct run *r)
+{
+    g_queue_head = 0;
+    g_queue_tail = 0;
+    r->ops->mutex_init(&g_queue_lock);
+    r->ops->cond_init(&g_queue_not_empty);
+    r->ops->cond_init(&g_queue_not_full);
+    spawn_and_join(r, 2, 0, queue_thread);
+    r->ops->cond_destroy(&g_queue_not_full);
+    r->ops->cond_destroy(&g_queue_not_empty);
+    r->ops->mutex_destroy(&g_queue_lock);
+}
+
+static void *chan_thread(void *arg)
+{
+    struct run *r = g_run;
+    uint64_t items[CHAN_BATCH];
+
+    if ((intptr_t)arg == 0) {
+        for (long i = 0; i < r->ops_count; i += (long)g_chan_batch) {
+            uint64_t stamp = now_ticks();
+            for (size_t k = 0; k < g_chan_batch; k++) {
+                items[k] = stamp;
+            }
+            r->ops->chan_send_batch(&g_chan, items, g_chan_batch);
+        }
+    } else {
+        for (long i = 0; i < r->ops_count; ) {
+            size_t n = r->ops->chan_recv_batch(&g_chan, items, g_chan_batch);
+            uint64_t now = now_ticks();
+            for (size_t k = 0; k < n; k++) {
+                hist_record(r->hist, now - items[k]);
+            }
+            i += (long)n;
+        }
+    }
+
+    return NULL;
+}
+
+static void run_chan_prodcons(struct run *r, size_t batch)
+{
+    g_chan_batch = batch;
+    r->ops->chan_init(&g_chan);
+    spawn_and_join(r, 2, 0, chan_thread);
+    r->ops->chan_destroy(&g_chan);
+}
+
+static void wl_chan_prodcons(struct run *r) { run_chan_prodcons(r, 1); }
+static void wl_chan_batch(struct run *r) { run_chan_prodcons(r, CHAN_BATCH); }
+
+/* --- Rwlock read-mostly: acquire latency, one write in ten (or 1000) --- */
+
+static int g_rwlock_write_every;
+
+static void *rwlock_thread(void *arg)
+{
+    unsigned int seed = (unsigned int)(intptr_t)arg + 1;
+    struct run *r = g_run;
+    long ops = r->ops_count / r->threads;
+    long sink = 0;
+
+    for (long i = 0; i < ops; i++) {
+        bool write = (rand_r(&seed) % (unsigned int)g_rwlock_write_every) == 0;
+
+        uint64_t start = now_ticks();
+        if (write) {
+            r->ops->rwlock_wrlock(&g_rwlock);
+        } else {
+            r->ops->rwlock_rdlock(&g_rwlock);
+        }
+        hist_record(r->hist, now_ticks() - start);
+
+        if (write) {
+            g_shared_value++;
+        } else {
+            sink += g_shared_value;
+        }
+        r->ops->rwlock_unlock(&g_rwlock);
+
+        /* Interleave with the other threads inside and outside the lock */
+        if ((i & 15) == 15) {
+            r->ops->yield();
+        }
+    }
+
+    return (void *)(intptr_t)sink;
+}
+
+static void wl_rwlock_read_mostly(struct run *r)
+{
+    g_rwlock_write_every = 10;
+    r->ops->rwlock_init(&g_rwlock);
+    spawn_and_join(r, r->threads, 0, rwlock_thread);
+    r->ops->rwlock_destroy(&g_rwlock);
+}
+
+/* A configuration cache: 99.9% reads, plain and read-biased */
+static void run_config_cache(struct run *r, bool biased)
+{
+    g_rwlock_write_every = 1000;
+    if (biased) {
+        r->ops->rwlock_init_biased(&g_rwlock);
+    } else {
+        r->ops->rwlock_init(&g_rwlock);
+    }
+    spawn_and_join(r, r->threads, 0, rwlock_thread);
+    r->ops->rwlock_destroy(&g_rwlock);
+}
+
+static void wl_config_cache(struct run *r) { run_config_cache(r, false); }
+static void wl_config_cache_biased(struct run *r) { run_config_cache(r, true); }
+
+/* --- Sleep accuracy: lateness of a 1ms sleep --- */
+
+static void wl_sleep_accuracy(struct run *r)
+{
+    uint64_t requested = (uint64_t)(1000000.0 / g_ns_per_tick);
+
+    for (long i = 0; i < r->ops_count; i++) {
+        uint64_t start = now_ticks();
+        r->ops->sleep_ms(1);
+        uint64_t elapsed = now_ticks() - start;
+        hist_record(r->hist, elapsed > requested ? elapsed - requested : 0);
+    }
+}
+
+/* ==========================================================================
+ * Workload Table
+ * ========================================================================== */
+
+struct workload {
+    const char *name;
+    void (*run)(struct run *r);
+    int threads;
+    long ops;                       /**< Before --quick */
+    sched_policy_t policy;
+    const char *unit;               /**< What one sample measures */
+};
+
+static const struct workload g_workloads[] = {
+    { "yield_pingpong", wl_yield_pingpong, 2, PINGPONG_ROUNDS, SCHED_ROUND_ROBIN, "round trip" },
+    { "yield_storm/100", wl_yield_storm, 100, STORM_TOTAL_YIELDS, SCHED_ROUND_ROBIN, "yield" },
+    { "create_join", wl_create_join, 1, CREATE_JOIN_OPS, SCHED_ROUND_ROBIN, "create+join" },
+    { "mutex_uncontended", wl_mutex_uncontended, 1, MUTEX_OPS, SCHED_ROUND_ROBIN, "lock+unlock" },
+    { "mutex_contended/4", wl_mutex_contended, 4, CONTENDED_OPS, SCHED_ROUND_ROBIN, "lock" },
+    { "condvar_pingpong", wl_condvar_pingpong, 2, CONDVAR_ROUNDS, SCHED_ROUND_ROBIN, "round trip" },
+    { "cond_broadcast/1k", wl_cond_broadcast, 1000, BROADCAST_ROUNDS, SCHED_ROUND_ROBIN, "broadcast" },
+    { "cond_broadcast_locked/1k", wl_cond_broadcast_locked, 1000, BROADCAST_ROUNDS, SCHED_ROUND_ROBIN, "broadcast" },
+    { "sem_prodcons", wl_sem_prodcons, 2, SEM_ITEMS, SCHED_ROUND_ROBIN, "item" },
+    { "sem_rpc/16", wl_sem_rpc, 16, PINGPONG_ROUNDS, SCHED_ROUND_ROBIN, "round trip" },
+    { "queue_prodcons", wl_queue_prodcons, 2, CHAN_ITEMS, SCHED_ROUND_ROBIN, "item" },
+    { "chan_prodcons", wl_chan_prodcons, 2, CHAN_ITEMS, SCHED_ROUND_ROBIN, "item" },
+    { "chan_batch/16", wl_chan_batch, 2, CHAN_ITEMS, SCHED_ROUND_ROBIN, "item" },
+    { "rwlock_read_mostly/1", wl_rwlock_read_mostly, 1, RWLOCK_OPS, SCHED_ROUND_ROBIN, "acquire" },
+    { "rwlock_read_mostly/4", wl_rwlock_read_mostly, 4, RWLOCK_OPS, SCHED_ROUND_ROBIN, "acquire" },
+    { "rwlock_read_mostly/16", wl_rwlock_read_mostly, 16, RWLOCK_OPS, SCHED_ROUND_ROBIN, "acquire" },
+    { "rwlock_config_cache/16", wl_config_cache, 16, RWLOCK_OPS, SCHED_ROUND_ROBIN, "acquire" },
+    { "rwlock_config_cache_biased/16", wl_config_cache_biased, 16, RWLOCK_OPS, SCHED_ROUND_ROBIN, "acquire" },
+    { "sleep_1ms", wl_sleep_accuracy, 1, SLEEP_OPS, SCHED_ROUND_ROBIN, "lateness" },
+
+    /* Scheduler policies under load */
+    { "sched_rr/10", wl_yield_storm, 10, STORM_TOTAL_YIELDS, SCHED_ROUND_ROBIN, "yield" },
+    { "sched_rr/1k", wl_yield_storm, 1000, STORM_TOTAL_YIELDS, SCHED_ROUND_ROBIN, "yield" },
+    { "sched_rr/10k", wl_yield_storm, 10000, STORM_TOTAL_YIELDS, SCHED_ROUND_ROBIN, "yield" },
+    { "sched_priority/10", wl_yield_storm, 10, STORM_TOTAL_YIELDS, SCHED_PRIORITY, "yield" },
+    { "sched_priority/1k", wl_yield_storm, 1000, STORM_TOTAL_YIELDS, SCHED_PRIORITY, "yield" },
+    { "sched_priority/10k", wl_yield_storm, 10000, STORM_TOTAL_YIELDS, SCHED_PRIORITY, "yield" },
+    { "sched_cfs/10", wl_yield_storm, 10, STORM_TOTAL_YIELDS, SCHED_CFS, "yield" },
+    { "sched_cfs/1k", wl_yield_storm, 1000, STORM_TOTAL_YIELDS, SCHED_CFS, "yield" },
+    { "sched_cfs/10k", wl_yield_storm, 10000, STORM_TOTAL_YIELDS, SCHED_CFS, "yield" },
+    { "sched_cfs_wake/10k", wl_wake_storm, 10000, WAKE_TOTAL, SCHED_CFS, "wake" },
+    { "sched_cfs_broadcast/1k", wl_cond_broadcast, 1000, BROADCAST_ROUNDS, SCHED_CFS, "broadcast" },
+    { "sched_cfs_group/10", wl_yield_storm, 10, STORM_TOTAL_YIELDS, SCHED_CFS_GROUP, "yield" },
+    { "sched_cfs_group/1k", wl_yield_storm, 1000, STORM_TOTAL_YIELDS, SCHED_CFS_GROUP, "yield" },
+    { "sched_cfs_group/10k", wl_yield_storm, 10000, STORM_TOTAL_YIELDS, SCHED_CFS_GROUP, "yield" },
+    { "sched_cfs_group_wake/10k", wl_wake_storm, 10000, WAKE_TOTAL, SCHED_CFS_GROUP, "wake" },
+    { "sched_cfs_group_broadcast/1k", wl_cond_broadcast, 1000, BROADCAST_ROUNDS, SCHED_CFS_GROUP, "broadcast" },
+};
+
+#define NUM_WORKLOADS ((int)(sizeof(g_workloads) / sizeof(g_workloads[0])))
+
+/* ==========================================================================
+ * Runner
+ * ========================================================================== */
+
+struct result {
+    const char *name;
+    const char *backend;
+    const char *unit;
+    int threads;
+    long ops;                       /**< Samples per repetition */
+    double ops_per_sec;             /**< Median over repetitions */
+    uint64_t p50, p99, p999, max;   /**< Nanoseconds, all repetitions */
+    double mean;
+};
+
+static struct result g_results[MAX_RESULTS];
+static int g_num_results;
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static bool run_workload(const struct workload *wl, const struct bench_ops *ops)
+{
+    long ops_count = wl->ops / g_opts.divisor;
+
+    /* pthreads have a single policy: run its scaling entries once */
+    if (ops == &g_pthread_ops && wl->policy != SCHED_ROUND_ROBIN) {
+        return false;
+    }
+
+    /* M:N mode always schedules round-robin */
+    if (g_opts.workers > 1 && ops == &g_uthread_ops &&
+        wl->policy != SCHED_ROUND_ROBIN) {
+        return false;
+    }
+
+    /* Every storm thread yields at least a few times */
+    if (ops_count < wl->threads * 4L) {
+        ops_count = wl->threads * 4L;
+    }
+
+    if (ops->init(wl->policy) != 0) {
+        fprintf(stderr, "bench_suite: %s: init failed\n", wl->name);
+        return false;
+    }
+
+    struct histogram *total = calloc(1, sizeof(*total));
+    struct histogram *rep_hist = calloc(1, sizeof(*rep_hist));
+    double *rates = calloc((size_t)g_opts.reps, sizeof(double));
+
+    for (int rep = -g_opts.warmup; rep < g_opts.reps; rep++) {
+        hist_reset(rep_hist);
+
+        struct run r = {
+            .ops = ops,
+            .threads = wl->threads,
+            .ops_count = ops_count,
+            .hist = rep_hist,
+        };
+        g_run = &r;
+        g_counter = 0;
+
+        uint64_t start = clock_ns();
+        wl->run(&r);
+        uint64_t elapsed = clock_ns() - start;
+
+        if (rep < 0) {
+            continue;
+        }
+
+        rates[rep] = elapsed ? (double)rep_hist->total * 1e9 / (double)elapsed : 0;
+        hist_merge(total, rep_hist);
+    }
+
+    ops->shutdown();
+
+    qsort(rates, (size_t)g_opts.reps, sizeof(double), compare_double);
+
+    struct result *res = &g_results[g_num_results++];
+    res->name = wl->name;
+    res->backend = ops->name;
+    res->unit = wl->unit;
+    res->threads = wl->threads;
+    res->ops = ops_count;
+    res->ops_per_sec = rates[g_opts.reps / 2];
+    res->p50 = ticks_to_ns(hist_percentile(total, 0.50));
+    res->p99 = ticks_to_ns(hist_percentile(total, 0.99));
+    res->p999 = ticks_to_ns(hist_percentile(total, 0.999));
+    res->max = ticks_to_ns(total->max);
+    res->mean = hist_mean(total) * g_ns_per_tick;
+
+    free(rates);
+    free(rep_hist);
+    free(total);
+
+    return true;
+}
+
+/* ==========================================================================
+ * Output
+ * ========================================================================== */
+
+static void print_header(void)
+{
+    printf("%-22s %-8s %14s %10s %10s %10s %12s  %s\n",
+           "workload", "backend", "ops/s", "p50 ns", "p99 ns", "p99.9 ns",
+           "max ns", "sample");
+}
+
+static void print_result(const struct result *res)
+{
+    printf("%-22s %-8s %14.0f %10lu %10lu %10lu %12lu  %s\n",
+           res->name, res->backend, res->ops_per_sec,
+           (unsigned long)res->p50, (unsigned long)res->p99,
+           (unsigned long)res->p999, (unsigned long)res->max, res->unit);
+    fflush(stdout);
+}
+
+/* One result per line, so the baseline reader needs no JSON parser */
+static int write_json(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fprintf(f, "{\"suite\":\"libuthread\",\"workers\":%d,\"reps\":%d,"
+            "\"timer_overhead_ns\":%.1f,\"results\":[\n",
+            g_opts.workers, g_opts.reps, g_timer_overhead_ns);
+
+    for (int i = 0; i < g_num_results; i++) {
+        const struct result *res = &g_results[i];
+        fprintf(f, "{\"name\":\"%s\",\"backend\":\"%s\",\"threads\":%d,"
+                "\"ops\":%ld,\"ops_per_sec\":%.1f,\"mean_ns\":%.1f,"
+                "\"p50_ns\":%lu,\"p99_ns\":%lu,\"p999_ns\":%lu,\"max_ns\":%lu}%s\n",
+                res->name, res->backend, res->threads, res->ops,
+                res->ops_per_sec, res->mean,
+                (unsigned long)res->p50, (unsigned long)res->p99,
+                (unsigned long)res->p999, (unsigned long)res->max,
+                (i + 1 < g_num_results) ? "," : "");
+    }
+
+    fprintf(f, "]}\n");
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* ==========================================================================
+ * Regression Gate
+ * ========================================================================== */
+
+/* Extract "key":value from a result line written by write_json() */
+static bool json_field(const char *line, const char *key, char *out, size_t len)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char *p = strstr(line, pattern);
+    if (p == NULL) {
+        return false;
+    }
+    p += strlen(pattern);
+    if (*p == '"') {
+        p++;
+    }
+
+    size_t n = strcspn(p, "\",}");
+    if (n >= len) {
+        n = len - 1;
+    }
+    memcpy(out, p, n);
+    out[n] = '\0';
+    return true;
+}
+
+/**
+ * Compare against a baseline run: a workload regresses when its p50 grew
+ * or its throughput shrank by more than the threshold.
+ *
+ * @return Number of regressions, or -1 if the baseline cannot be read
+ */
+static int check_baseline(const char *path, double threshold)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    int regressions = 0;
+    int compared = 0;
+    char line[1024];
+    double limit = threshold / 100.0;
+
+    printf("\n--- Baseline %s (threshold %.1f%%) ---\n", path, threshold);
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[64], backend[16], p50[32], rate[32];
+        if (!json_field(line, "name", name, sizeof(name)) ||
+            !json_field(line, "backend", backend, sizeof(backend)) ||
+            !json_field(line, "p50_ns", p50, sizeof(p50)) ||
+            !json_field(line, "ops_per_sec", rate, sizeof(rate))) {
+            continue;
+        }
+
+        for (int i = 0; i < g_num_results; i++) {
+            const struct result *res = &g_results[i];
+            if (strcmp(res->name, name) != 0 || strcmp(res->backend, backend) != 0) {
+                continue;
+            }
+
+            double base_p50 = atof(p50);
+            double base_rate = atof(rate);
+            bool slower = base_p50 > 0 && res->p50 > base_p50 * (1.0 + limit);
+            bool fewer = base_rate > 0 && res->ops_per_sec < base_rate * (1.0 - limit);
+
+            compared++;
+            if (slower || fewer) {
+                regressions++;
+                printf("REGRESSION %-22s %-8s p50 %.0f -> %lu ns, %.0f -> %.0f ops/s\n",
+                       name, backend, base_p50, (unsigned long)res->p50,
+                       base_rate, res->ops_per_sec);
+            }
+        }
+    }
+
+    fclose(f);
+
+    printf("%d workloads compared, %d regressed\n", compared, regressions);
+    return regressions;
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --quick            %dx less work per repetition\n"
+            "  --reps N           measured repetitions (default %d)\n"
+            "  --warmup N         unmeasured repetitions first (default %d)\n"
+            "  --workers N        run LibUThread in M:N mode on N workers\n"
+            "  --filter TEXT      only workloads whose name contains TEXT\n"
+            "  --pthread          also run every workload on pthreads\n"
+            "  --json FILE        write results as JSON\n"
+            "  --baseline FILE    fail if results regress against a JSON run\n"
+            "  --threshold PCT    allowed regression (default %.0f%%)\n",
+            prog, QUICK_DIVISOR, DEFAULT_REPS, DEFAULT_WARMUP, DEFAULT_THRESHOLD);
+}
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--quick") == 0) {
+            g_opts.divisor = QUICK_DIVISOR;
+            g_opts.reps = 3;
+        } else if (strcmp(arg, "--pthread") == 0) {
+            g_opts.pthread = true;
+        } else if (value != NULL && strcmp(arg, "--reps") == 0) {
+            g_opts.reps = atoi(value); i++;
+        } else if (value != NULL && strcmp(arg, "--warmup") == 0) {
+            g_opts.warmup = atoi(value); i++;
+        } else if (value != NULL && strcmp(arg, "--workers") == 0) {
+            g_opts.workers = atoi(value); i++;
+        } else if (value != NULL && strcmp(arg, "--filter") == 0) {
+            g_opts.filter = value; i++;
+        } else if (value != NULL && strcmp(arg, "--json") == 0) {
+            g_opts.json_path = value; i++;
+        } else if (value != NULL && strcmp(arg, "--baseline") == 0) {
+            g_opts.baseline_path = value; i++;
+        } else if (value != NULL && strcmp(arg, "--threshold") == 0) {
+            g_opts.threshold = atof(value); i++;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (g_opts.reps < 1 || g_opts.warmup < 0 || g_opts.workers < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    timing_init();
+
+    printf("=== LibUThread Benchmark Suite ===\n");
+    printf("Workers: %d, repetitions: %d (+%d warmup)%s, timer overhead: %.1f ns\n\n",
+           g_opts.workers, g_opts.reps, g_opts.warmup,
+           g_opts.divisor > 1 ? ", quick" : "", g_timer_overhead_ns);
+    print_header();
+
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        const struct workload *wl = &g_workloads[i];
+        if (g_opts.filter != NULL && strstr(wl->name, g_opts.filter) == NULL) {
+            continue;
+        }
+
+        if (run_workload(wl, &g_uthread_ops)) {
+            print_result(&g_results[g_num_results - 1]);
+        }
+        if (g_opts.pthread && run_workload(wl, &g_pthread_ops)) {
+            print_result(&g_results[g_num_results - 1]);
+        }
+    }
+
+    if (g_opts.json_path != NULL && write_json(g_opts.json_path) != 0) {
+        return 1;
+    }
+
+    if (g_opts.baseline_path != NULL) {
+        int regressions = check_baseline(g_opts.baseline_path, g_opts.threshold);
+        if (regressions != 0) {
+            return 1;
+        }
+    }
+
+    printf("\n=== Benchmark Complete ===\n");
+
+    return 0;
+}
@@ -15,6 +15,9 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,9 +27,15 @@ extern "C" {
  * Constants and Limits
  * ========================================================================== */
 
-/** Maximum number of concurrent threads */
+/** Threads the registry has room for at init (it grows on demand) */
 #define UTHREAD_MAX_THREADS     1024
 
+/** Maximum number of kernel threads (workers) in M:N mode */
+#define UTHREAD_MAX_WORKERS     64
+
+/** Bit of worker `id` in a thread affinity mask (uthread_attr_setaffinity()) */
+#define UTHREAD_WORKER(id)      (UINT64_C(1) << (id))
+
 /** Default stack size (64 KB) */
 #define UTHREAD_STACK_DEFAULT   (64 * 1024)
 
@@ -36,20 +45,34 @@ extern "C" {
 /** Maximum stack size (8 MB) */
 #define UTHREAD_STACK_MAX       (8 * 1024 * 1024)
 
+/** Default number of released stacks (per size) and descriptors cached */
+#define UTHREAD_STACK_CACHE_DEFAULT 64
+
 /** Maximum thread name length */
 #define UTHREAD_NAME_MAX        32
 
-/** Number of priority levels */
+/**
+ * Number of priority levels. May be raised (up to 4096) when building the
+ * library; applications must be compiled with the same value.
+ */
+#ifndef UTHREAD_PRIORITY_LEVELS
 #define UTHREAD_PRIORITY_LEVELS 32
+#endif
 
 /** Default priority (middle) */
-#define UTHREAD_PRIORITY_DEFAULT 16
+#define UTHREAD_PRIORITY_DEFAULT (UTHREAD_PRIORITY_LEVELS / 2)
 
 /** Lowest priority */
 #define UTHREAD_PRIORITY_MIN    0
 
 /** Highest priority */
-#define UTHREAD_PRIORITY_MAX    31
+#define UTHREAD_PRIORITY_MAX    (UTHREAD_PRIORITY_LEVELS - 1)
+
+/** Weight of a new scheduling group, that of one nice-0 thread */
+#define UTHREAD_GROUP_WEIGHT_DEFAULT 1024
+
+/** Largest scheduling group weight */
+#define UTHREAD_GROUP_WEIGHT_MAX     (256 * 1024)
 
 /** Default timeslice in nanoseconds (10 ms) */
 #define UTHREAD_TIMESLICE_DEFAULT_NS (10 * 1000 * 1000)
@@ -85,6 +108,9 @@ extern "C" {
 /** No such thread */
 #define UTHREAD_ESRCH           3
 
+/** Channel closed */
+#define UTHREAD_EPIPE           32
+
 /* ==========================================================================
  * Type Definitions
  * ========================================================================== */
@@ -92,11 +118,18 @@ extern "C" {
 /** Thread handle (opaque) */
 typedef struct uthread *uthread_t;
 
+/** Scheduling group handle (opaque), see uthread_group_create() */
+typedef struct uthread_group *uthread_group_t;
+
+/** Generator handle (opaque), see uthread_gen_create() */
+typedef struct uthread_gen *uthread_gen_t;
+
 /** Scheduling policy */
 typedef enum sched_policy {
     SCHED_ROUND_ROBIN = 0,      /**< Round-robin scheduling */
     SCHED_PRIORITY    = 1,      /**< Priority-based scheduling */
-    SCHED_CFS         = 2       /**< Completely Fair Scheduler */
+    SCHED_CFS         = 2,      /**< Completely Fair Scheduler */
+    SCHED_CFS_GROUP   = 3       /**< CFS over scheduling groups, for many threads */
 } sched_policy_t;
 
 /** Thread state */
@@ -114,13 +147,34 @@ typedef enum uthread_detachstate {
     UTHREAD_CREATE_DETACHED = 1     /**< Thread is detached */
 } uthread_detachstate_t;
 
+/** How thread stacks are backed by memory (see uthread_set_stack_mode()) */
+typedef enum uthread_stack_mode {
+    UTHREAD_STACK_COMMITTED = 0,    /**< Full size charged up front (default) */
+    UTHREAD_STACK_LAZY      = 1,    /**< MAP_NORESERVE, pages returned when cached */
+    UTHREAD_STACK_GROWABLE  = 2     /**< Lazy, and grown past the size on overflow */
+} uthread_stack_mode_t;
+
 /** Mutex type */
 typedef enum uthread_mutex_type {
     UTHREAD_MUTEX_NORMAL     = 0,   /**< Normal mutex (default) */
     UTHREAD_MUTEX_RECURSIVE  = 1,   /**< Recursive mutex */
-    UTHREAD_MUTEX_ERRORCHECK = 2    /**< Error-checking mutex */
+    UTHREAD_MUTEX_ERRORCHECK = 2,   /**< Error-checking mutex */
+    UTHREAD_MUTEX_ADAPTIVE   = 3    /**< Waits briefly for the owner before blocking */
 } uthread_mutex_type_t;
 
+/** Order in which a read-write lock admits waiting readers and writers */
+typedef enum uthread_rwlock_policy {
+    UTHREAD_RWLOCK_PREFER_WRITER = 0, /**< Waiting writers go first (default) */
+    UTHREAD_RWLOCK_PREFER_READER = 1, /**< Readers enter unless a writer holds it */
+    UTHREAD_RWLOCK_PHASE_FAIR    = 2  /**< Read and write phases alternate */
+} uthread_rwlock_policy_t;
+
+/** Kind of lock described by uthread_lock_stats_t */
+typedef enum uthread_lock_kind {
+    UTHREAD_LOCK_MUTEX  = 0,        /**< uthread_mutex_t */
+    UTHREAD_LOCK_RWLOCK = 1         /**< uthread_rwlock_t */
+} uthread_lock_kind_t;
+
 /* ==========================================================================
  * Thread Attributes
  * ========================================================================== */
@@ -132,22 +186,34 @@ typedef struct uthread_attr {
     int nice;                       /**< Nice value for CFS (-20 to +19) */
     uthread_detachstate_t detach_state; /**< Joinable or detached */
     char name[UTHREAD_NAME_MAX];    /**< Optional thread name */
+    uint64_t affinity;              /**< Workers allowed to run it, 0 = any */
+    uthread_group_t group;          /**< Scheduling group, NULL = the creator's */
 } uthread_attr_t;
 
 /* ==========================================================================
  * Synchronization Primitives
  * ========================================================================== */
 
-/** Forward declaration of wait queue */
-struct wait_queue;
+struct uthread_internal;
+struct lock_stats;
+struct chan_waiter;
+
+/** Queue of blocked threads (members are managed by the library) */
+struct wait_queue {
+    struct uthread_internal *head;
+    struct uthread_internal *tail;
+    int count;
+};
 
 /** Mutex structure */
 typedef struct uthread_mutex {
     volatile int lock;              /**< Lock state: 0=unlocked, 1=locked */
     uthread_t owner;                /**< Thread holding the lock */
-    struct wait_queue *waiters;     /**< Queue of waiting threads */
+    struct wait_queue waiters;      /**< Queue of waiting threads */
     uthread_mutex_type_t type;      /**< Mutex type */
     int recursion_count;            /**< Recursion count for recursive mutex */
+    int spin_estimate;              /**< Adaptive: spins that usually suffice */
+    struct lock_stats *stats;       /**< Contention counters, once collected */
     bool initialized;               /**< True if properly initialized */
 } uthread_mutex_t;
 
@@ -175,6 +241,8 @@ typedef struct uthread_sem {
     bool initialized;               /**< True if properly initialized */
 } uthread_sem_t;
 
+struct rwlock_bias;
+
 /** Read-Write lock structure */
 typedef struct uthread_rwlock {
     volatile int readers;           /**< Number of active readers */
@@ -183,14 +251,65 @@ typedef struct uthread_rwlock {
     struct wait_queue *read_waiters;  /**< Waiting readers */
     struct wait_queue *write_waiters; /**< Waiting writers */
     int pending_writers;            /**< Count of pending writers */
+    uthread_rwlock_policy_t policy; /**< Admission order */
+    uint64_t write_phases;          /**< Write holds released (phase-fair) */
+    int read_grants;                /**< Readers woken into a read phase, not yet in */
+    struct rwlock_bias *bias;       /**< Per-worker read indicators, if read-biased */
+    struct lock_stats *stats;       /**< Contention counters, once collected */
     bool initialized;               /**< True if properly initialized */
 } uthread_rwlock_t;
 
 /** Read-Write lock attributes */
 typedef struct uthread_rwlockattr {
-    int prefer_writer;              /**< Prefer writers over readers */
+    int prefer_writer;              /**< Deprecated: with the default policy, 0 prefers readers */
+    uthread_rwlock_policy_t policy; /**< Admission order */
+    bool read_biased;               /**< Readers mark per-worker slots */
 } uthread_rwlockattr_t;
 
+/** Threads parked on one side of a channel (managed by the library) */
+struct chan_waitq {
+    struct chan_waiter *head;
+    struct chan_waiter *tail;
+};
+
+/** Bounded multi-producer, multi-consumer channel of fixed-size items */
+typedef struct uthread_chan {
+    unsigned char *buffer;          /**< Ring of capacity items */
+    size_t elem_size;               /**< Bytes per item */
+    size_t capacity;                /**< Power of two, 0 if unbuffered */
+    size_t head;                    /**< Items received so far */
+    size_t tail;                    /**< Items buffered so far */
+    struct chan_waitq senders;      /**< Parked while the ring is full */
+    struct chan_waitq receivers;    /**< Parked while the ring is empty */
+    bool closed;                    /**< uthread_chan_close() was called */
+    bool initialized;               /**< True if properly initialized */
+} uthread_chan_t;
+
+/** Continuation queued by uthread_future_then() (managed by the library) */
+struct future_callback;
+
+/** Single-assignment value that threads can wait for */
+typedef struct uthread_future {
+    struct wait_queue waiters;      /**< Threads in uthread_future_await() */
+    void *value;                    /**< Value, once set */
+    struct future_callback *callbacks; /**< Pending continuations, newest first */
+    bool ready;                     /**< uthread_future_set() was called */
+    bool initialized;               /**< True if properly initialized */
+} uthread_future_t;
+
+/** Direction of a uthread_select() case */
+typedef enum uthread_chan_dir {
+    UTHREAD_CHAN_SEND = 0,
+    UTHREAD_CHAN_RECV = 1
+} uthread_chan_dir_t;
+
+/** One channel operation offered to uthread_select() */
+typedef struct uthread_select_case {
+    uthread_chan_t *chan;           /**< Channel, or NULL to skip the case */
+    uthread_chan_dir_t dir;         /**< Send or receive */
+    void *item;                     /**< Item to send, or where to receive */
+} uthread_select_case_t;
+
 /* ==========================================================================
  * Static Initializers
  * ========================================================================== */
@@ -199,9 +318,11 @@ typedef struct uthread_rwlockattr {
 #define UTHREAD_MUTEX_INITIALIZER { \
     .lock = 0, \
     .owner = NULL, \
-    .waiters = NULL, \
+    .waiters = { NULL, NULL, 0 }, \
     .type = UTHREAD_MUTEX_NORMAL, \
     .recursion_count = 0, \
+    .spin_estimate = 0, \
+    .stats = NULL, \
     .initialized = true \
 }
 
@@ -212,6 +333,15 @@ typedef struct uthread_rwlockattr {
     .initialized = true \
 }
 
+/** Static initializer for future */
+#define UTHREAD_FUTURE_INITIALIZER { \
+    .waiters = { NULL, NULL, 0 }, \
+    .value = NULL, \
+    .callbacks = NULL, \
+    .ready = false, \
+    .initialized = true \
+}
+
 /** Static initializer for rwlock */
 #define UTHREAD_RWLOCK_INITIALIZER { \
     .readers = 0, \
@@ -220,6 +350,11 @@ typedef struct uthread_rwlockattr {
     .read_waiters = NULL, \
     .write_waiters = NULL, \
     .pending_writers = 0, \
+    .policy = UTHREAD_RWLOCK_PREFER_WRITER, \
+    .write_phases = 0, \
+    .read_grants = 0, \
+    .bias = NULL, \
+    .stats = NULL, \
     .initialized = true \
 }
 
@@ -236,6 +371,67 @@ typedef struct uthread_rwlockattr {
  */
 int uthread_init(sched_policy_t policy);
 
+/**
+ * Initialize the threading library in M:N mode.
+ *
+ * Runs user threads on `num_workers` kernel threads: the calling thread
+ * plus num_workers - 1 pthreads. Each worker has its own run queue and
+ * steals from others when it runs dry. The main thread always stays on
+ * the calling kernel thread. With one worker this is uthread_init().
+ *
+ * Kernel-thread state such as errno and _Thread_local variables belongs
+ * to the worker, so it can change when a thread migrates.
+ *
+ * Workers are pinned to CPUs of the process's affinity mask, grouped by
+ * NUMA node so that consecutive workers share one (see
+ * uthread_set_worker_pinning()). Thread stacks are then allocated on the
+ * node of the worker a thread starts on, and an idle worker steals from
+ * workers on its own node before crossing to another.
+ *
+ * The cooperative library (uthread_coop) runs a single worker: 0 means
+ * one, and more are rejected with UTHREAD_EINVAL.
+ *
+ * @param policy      Scheduling policy (only SCHED_ROUND_ROBIN when
+ *                    num_workers > 1)
+ * @param num_workers Number of workers, or 0 for one per online CPU
+ * @return 0 on success, error code on failure
+ */
+int uthread_init_workers(sched_policy_t policy, int num_workers);
+
+/**
+ * Get the index of the worker running the calling thread.
+ *
+ * @return Worker index (0 is the thread that called uthread_init),
+ *         or -1 if not initialized
+ */
+int uthread_worker_id(void);
+
+/**
+ * Get the number of workers.
+ *
+ * @return Number of workers, or 0 if not initialized
+ */
+int uthread_get_num_workers(void);
+
+/**
+ * Get the NUMA node of the worker running the calling thread.
+ *
+ * @return Node number, 0 when workers are not pinned or there is no NUMA
+ *         information, or -1 if not initialized
+ */
+int uthread_worker_node(void);
+
+/**
+ * Choose whether M:N workers are pinned to CPUs. Must be called before
+ * uthread_init_workers(); pinning is on by default. The calling thread is
+ * worker 0 and gets its affinity back at shutdown. Without pinning,
+ * placement ignores NUMA nodes.
+ *
+ * @param enabled Nonzero to pin workers
+ * @return 0 on success, UTHREAD_EBUSY if already initialized
+ */
+int uthread_set_worker_pinning(int enabled);
+
 /**
  * Shutdown the threading library.
  * Waits for all threads to terminate.
@@ -279,7 +475,8 @@ int uthread_create(uthread_t *thread,
  *
  * @param thread    Thread to wait for
  * @param retval    Pointer to store return value (NULL to ignore)
- * @return 0 on success, error code on failure
+ * @return 0 on success, UTHREAD_ESRCH if the thread was already joined,
+ *         other error code on failure
  */
 int uthread_join(uthread_t thread, void **retval);
 
@@ -296,6 +493,20 @@ int uthread_detach(uthread_t thread);
  */
 void uthread_yield(void);
 
+/**
+ * Yield the CPU directly to another thread.
+ *
+ * The caller goes to the back of the run queue as with uthread_yield(),
+ * but `thread` runs next instead of the queue head. Use it to pass control
+ * to a partner in a request/response exchange without a scheduling pass.
+ * If `thread` is not ready (running, blocked, exited) or cannot run on
+ * this worker, the caller yields normally and UTHREAD_EAGAIN is returned.
+ *
+ * @param thread    Thread to run next
+ * @return 0 on success, error code on failure
+ */
+int uthread_yield_to(uthread_t thread);
+
 /**
  * Terminate calling thread.
  *
@@ -329,11 +540,24 @@ void uthread_sleep(unsigned int milliseconds);
 /**
  * Get the thread ID.
  *
+ * IDs are not reused while the thread is alive. The ID of an exited
+ * thread may come back only after its registry slot has been recycled
+ * 2048 times.
+ *
  * @param thread Thread handle
  * @return Thread ID, or -1 if invalid
  */
 int uthread_get_tid(uthread_t thread);
 
+/**
+ * Find a live thread by ID. O(1).
+ *
+ * @param tid Thread ID from uthread_get_tid()
+ * @return Thread handle, or NULL if no live thread has this ID (it was
+ *         never assigned, or the thread has been joined or released)
+ */
+uthread_t uthread_lookup(int tid);
+
 /**
  * Set thread name (for debugging).
  *
@@ -353,6 +577,86 @@ int uthread_setname(uthread_t thread, const char *name);
  */
 int uthread_getname(uthread_t thread, char *name, size_t len);
 
+/* ==========================================================================
+ * Tasks
+ * ========================================================================== */
+
+/**
+ * Submit a run-to-completion task.
+ *
+ * `fn(arg)` runs later on the stack of a pooled runner thread rather than
+ * a thread of its own, so submitting thousands of short tasks creates at
+ * most one runner per worker. A task may block on any uthread primitive;
+ * its runner then stays with it until it returns and another runner takes
+ * over the queue. Tasks must return rather than call uthread_exit().
+ *
+ * The task belongs to the group of the caller: the calling thread, or the
+ * calling task when submitted from inside one.
+ *
+ * @param fn  Task function
+ * @param arg Argument passed to fn
+ * @return 0 on success, error code on failure
+ */
+int uthread_task_submit(void (*fn)(void *), void *arg);
+
+/**
+ * Wait for all tasks submitted by the caller to complete.
+ *
+ * A task counts as complete once the tasks it submitted have completed
+ * too. Tasks wait for their own submissions implicitly before completing,
+ * and threads before exiting.
+ *
+ * @return 0 on success, error code on failure
+ */
+int uthread_task_group_wait(void);
+
+/* ==========================================================================
+ * Thread Cloning
+ * ========================================================================== */
+
+/**
+ * Park the calling thread as a template for uthread_clone(), typically
+ * after setup that every copy shares.
+ *
+ * Returns in each clone, with the `arg` it was cloned with, and in the
+ * template itself once uthread_clone_release() is called, with the value
+ * given there. Returns NULL at once in the main thread, a generator or a
+ * task, which cannot be templates.
+ *
+ * @return Clone argument or release value
+ */
+void *uthread_clone_park(void);
+
+/**
+ * Spawn a copy of a thread parked in uthread_clone_park().
+ *
+ * The clone gets a cached stack of the template's size holding a copy of
+ * the part the template was using, so it continues from the park with the
+ * same locals instead of repeating the setup; the copy is the only cost
+ * beyond creating a thread. Words on the stack that point into the
+ * template's stack are moved to the clone's; everything else is shared,
+ * so memory the template allocated (including its arena) is not copied.
+ * The clone inherits priority, nice value, group, affinity, detach state
+ * and name.
+ *
+ * @param clone Where to store the new thread's handle
+ * @param src   Parked template
+ * @param arg   Value uthread_clone_park() returns in the clone
+ * @return 0 on success, UTHREAD_EINVAL if `src` is not parked as a template
+ *         (or its stack has grown past its size), UTHREAD_ENOMEM on failure
+ */
+int uthread_clone(uthread_t *clone, uthread_t src, void *arg);
+
+/**
+ * Let a template return from uthread_clone_park(). It can no longer be
+ * cloned; clones already made are unaffected.
+ *
+ * @param src   Parked template
+ * @param value Value uthread_clone_park() returns in the template
+ * @return 0 on success, UTHREAD_EINVAL if `src` is not parked as a template
+ */
+int uthread_clone_release(uthread_t src, void *value);
+
 /* ==========================================================================
  * Thread Attributes
  * ========================================================================== */
@@ -427,6 +731,25 @@ int uthread_attr_setnice(uthread_attr_t *attr, int nice);
  */
 int uthread_attr_getnice(const uthread_attr_t *attr, int *nice);
 
+/**
+ * Set the scheduling group a thread is created in (SCHED_CFS_GROUP).
+ *
+ * @param attr  Attribute object
+ * @param group Group from uthread_group_create(), or NULL to join the
+ *              creating thread's group (the default)
+ * @return 0 on success, error code on failure
+ */
+int uthread_attr_setgroup(uthread_attr_t *attr, uthread_group_t group);
+
+/**
+ * Get the scheduling group from attributes.
+ *
+ * @param attr  Attribute object
+ * @param group Pointer to store the group (NULL if the creator's)
+ * @return 0 on success, error code on failure
+ */
+int uthread_attr_getgroup(const uthread_attr_t *attr, uthread_group_t *group);
+
 /**
  * Set detached state.
  *
@@ -454,6 +777,30 @@ int uthread_attr_getdetachstate(const uthread_attr_t *attr, int *detachstate);
  */
 int uthread_attr_setname(uthread_attr_t *attr, const char *name);
 
+/**
+ * Restrict new threads to a set of workers (M:N mode).
+ *
+ * Bit i, UTHREAD_WORKER(i), allows worker i. A thread starts on the
+ * creating worker if allowed, or else on the least loaded allowed
+ * worker, and is never stolen by one outside the set. Bits beyond the
+ * number of workers are ignored; uthread_create() fails with
+ * UTHREAD_EINVAL if none of the remaining bits is set.
+ *
+ * @param attr    Attribute object
+ * @param workers Worker mask, 0 for any worker (default)
+ * @return 0 on success, error code on failure
+ */
+int uthread_attr_setaffinity(uthread_attr_t *attr, uint64_t workers);
+
+/**
+ * Get the worker mask from attributes.
+ *
+ * @param attr    Attribute object
+ * @param workers Pointer to store the mask
+ * @return 0 on success, error code on failure
+ */
+int uthread_attr_getaffinity(const uthread_attr_t *attr, uint64_t *workers);
+
 /* ==========================================================================
  * Mutex Operations
  * ========================================================================== */
@@ -744,6 +1091,15 @@ int uthread_rwlock_trywrlock(uthread_rwlock_t *rwlock);
  */
 int uthread_rwlock_unlock(uthread_rwlock_t *rwlock);
 
+/**
+ * Turn a held write lock into a read lock, without letting a writer in
+ * between. Readers the lock's policy admits alongside are woken.
+ *
+ * @param rwlock Read-write lock, write-locked by the caller
+ * @return 0 on success, UTHREAD_EPERM if the caller is not the writer
+ */
+int uthread_rwlock_downgrade(uthread_rwlock_t *rwlock);
+
 /**
  * Initialize read-write lock attributes.
  *
@@ -760,6 +1116,319 @@ int uthread_rwlockattr_init(uthread_rwlockattr_t *attr);
  */
 int uthread_rwlockattr_destroy(uthread_rwlockattr_t *attr);
 
+/**
+ * Set the order in which waiting readers and writers are admitted.
+ *
+ * UTHREAD_RWLOCK_PREFER_WRITER holds new readers back while a writer
+ * waits and hands a released write lock to the next writer, so readers
+ * can starve. UTHREAD_RWLOCK_PREFER_READER lets readers in whenever no
+ * writer holds the lock, so writers can starve. UTHREAD_RWLOCK_PHASE_FAIR
+ * alternates: a released write lock goes to every reader waiting at that
+ * point, and the readers that hold the lock when a writer arrives are the
+ * last ones in before it, so each side waits at most one phase of the
+ * other.
+ *
+ * @param attr   Attribute structure
+ * @param policy A uthread_rwlock_policy_t value
+ * @return 0 on success, UTHREAD_EINVAL for an unknown policy
+ */
+int uthread_rwlockattr_setpolicy(uthread_rwlockattr_t *attr, int policy);
+
+/**
+ * Get the admission order.
+ *
+ * @param attr   Attribute structure
+ * @param policy Output policy, after applying the deprecated prefer_writer
+ * @return 0 on success, error code on failure
+ */
+int uthread_rwlockattr_getpolicy(const uthread_rwlockattr_t *attr, int *policy);
+
+/**
+ * Make the lock read-biased: while no writer is around, readers take it
+ * by incrementing a counter of their own worker instead of the shared
+ * reader count, so read-mostly locks scale across M:N workers. A writer
+ * revokes the bias and waits for the counters to drain; the bias comes
+ * back once readers have had the lock to themselves for several times
+ * as long as the revocation took. Costs a cache line per worker.
+ *
+ * @param attr    Attribute structure
+ * @param enabled Nonzero for a read-biased lock
+ * @return 0 on success, error code on failure
+ */
+int uthread_rwlockattr_setreadbias(uthread_rwlockattr_t *attr, int enabled);
+
+/**
+ * Get whether the lock is read-biased.
+ *
+ * @param attr    Attribute structure
+ * @param enabled Output flag
+ * @return 0 on success, error code on failure
+ */
+int uthread_rwlockattr_getreadbias(const uthread_rwlockattr_t *attr, int *enabled);
+
+/* ==========================================================================
+ * Channel Operations
+ * ========================================================================== */
+
+/**
+ * Initialize a channel.
+ *
+ * A sender that finds a receiver parked copies its item straight into the
+ * receiver's buffer; otherwise items pass through a ring of `capacity`
+ * slots. An unbuffered channel (capacity 0) completes a send only by
+ * handing it to a receiver.
+ *
+ * @param chan      Channel to initialize
+ * @param elem_size Size of one item in bytes
+ * @param capacity  Ring size: 0 or a power of two
+ * @return 0 on success, UTHREAD_EINVAL or UTHREAD_ENOMEM on failure
+ */
+int uthread_chan_init(uthread_chan_t *chan, size_t elem_size, size_t capacity);
+
+/**
+ * Destroy a channel.
+ *
+ * @param chan Channel to destroy
+ * @return 0 on success, UTHREAD_EBUSY if threads are parked on it
+ */
+int uthread_chan_destroy(uthread_chan_t *chan);
+
+/**
+ * Close a channel. Parked senders and receivers fail with UTHREAD_EPIPE,
+ * as do later sends; receives drain the buffered items first.
+ *
+ * @param chan Channel to close
+ * @return 0 on success, UTHREAD_EPIPE if already closed
+ */
+int uthread_chan_close(uthread_chan_t *chan);
+
+/**
+ * Send an item, blocking while the channel is full.
+ *
+ * @param chan Channel
+ * @param item Item of the channel's elem_size, copied
+ * @return 0 on success, UTHREAD_EPIPE if the channel is closed
+ */
+int uthread_chan_send(uthread_chan_t *chan, const void *item);
+
+/**
+ * Send an item without blocking.
+ *
+ * @param chan Channel
+ * @param item Item to copy
+ * @return 0 on success, UTHREAD_EAGAIN if full, UTHREAD_EPIPE if closed
+ */
+int uthread_chan_trysend(uthread_chan_t *chan, const void *item);
+
+/**
+ * Send an item, blocking until an absolute CLOCK_MONOTONIC deadline.
+ *
+ * @param chan    Channel
+ * @param item    Item to copy
+ * @param abstime Absolute timeout
+ * @return 0 on success, UTHREAD_ETIMEDOUT, or UTHREAD_EPIPE if closed
+ */
+int uthread_chan_timedsend(uthread_chan_t *chan, const void *item,
+                           const struct timespec *abstime);
+
+/**
+ * Receive an item, blocking while the channel is empty.
+ *
+ * @param chan Channel
+ * @param item Where to copy the item
+ * @return 0 on success, UTHREAD_EPIPE if closed and drained
+ */
+int uthread_chan_recv(uthread_chan_t *chan, void *item);
+
+/**
+ * Receive an item without blocking.
+ *
+ * @param chan Channel
+ * @param item Where to copy the item
+ * @return 0 on success, UTHREAD_EAGAIN if empty, UTHREAD_EPIPE if closed
+ *         and drained
+ */
+int uthread_chan_tryrecv(uthread_chan_t *chan, void *item);
+
+/**
+ * Receive an item, blocking until an absolute CLOCK_MONOTONIC deadline.
+ *
+ * @param chan    Channel
+ * @param item    Where to copy the item
+ * @param abstime Absolute timeout
+ * @return 0 on success, UTHREAD_ETIMEDOUT, or UTHREAD_EPIPE if closed and
+ *         drained
+ */
+int uthread_chan_timedrecv(uthread_chan_t *chan, void *item,
+                           const struct timespec *abstime);
+
+/**
+ * Send up to `count` items in one call: blocks until the first can be
+ * sent, then sends as many more as fit without blocking.
+ *
+ * @param chan  Channel
+ * @param items Array of items
+ * @param count Number of items in the array
+ * @param sent  Set to the number of items sent
+ * @return 0 on success, UTHREAD_EPIPE if closed before any was sent
+ */
+int uthread_chan_send_batch(uthread_chan_t *chan, const void *items,
+                            size_t count, size_t *sent);
+
+/**
+ * Receive up to `count` items in one call: blocks until one is
+ * available, then takes as many more as are ready.
+ *
+ * @param chan     Channel
+ * @param items    Array with room for `count` items
+ * @param count    Array size in items
+ * @param received Set to the number of items received
+ * @return 0 on success, UTHREAD_EPIPE if closed and drained
+ */
+int uthread_chan_recv_batch(uthread_chan_t *chan, void *items,
+                            size_t count, size_t *received);
+
+/**
+ * Block until one of several channel operations can complete, and
+ * perform it. Ready cases are tried starting from a rotating position so
+ * that no case starves.
+ *
+ * @param cases    Operations to wait for (NULL channels are skipped)
+ * @param ncases   Number of cases
+ * @param abstime  Absolute CLOCK_MONOTONIC timeout, or NULL to wait for
+ *                 ever; a deadline already passed only polls
+ * @param selected Set to the index of the case performed, -1 if none
+ * @return Result of the case performed (0, or UTHREAD_EPIPE if its
+ *         channel is closed), or UTHREAD_ETIMEDOUT
+ */
+int uthread_select(uthread_select_case_t *cases, int ncases,
+                   const struct timespec *abstime, int *selected);
+
+/* ==========================================================================
+ * Generators and Futures
+ * ========================================================================== */
+
+/**
+ * Create a generator: a function that runs on its own stack, taken from
+ * the stack cache, and hands values back to whoever resumes it.
+ *
+ * A generator is not a thread. It is never scheduled; it runs only inside
+ * uthread_gen_resume(), as the thread that called it, so blocking or being
+ * preempted in the generator blocks or preempts that thread. A resume and
+ * the matching uthread_gen_yield() each cost one register switch.
+ *
+ * The body must not call uthread_exit(). It may create, resume and yield
+ * other generators.
+ *
+ * @param gen        Where to store the handle
+ * @param fn         Body, receiving `arg`; its return value is the last one
+ *                   uthread_gen_resume() reports
+ * @param arg        Argument for the body
+ * @param stack_size Stack size, or 0 for the default
+ * @return 0 on success, UTHREAD_EINVAL or UTHREAD_ENOMEM on failure
+ */
+int uthread_gen_create(uthread_gen_t *gen, void *(*fn)(void *), void *arg,
+                       size_t stack_size);
+
+/**
+ * Destroy a generator. One that has not finished is discarded where it
+ * last yielded, without unwinding its stack.
+ *
+ * @param gen Generator to destroy
+ * @return 0 on success, UTHREAD_EBUSY if it is running
+ */
+int uthread_gen_destroy(uthread_gen_t gen);
+
+/**
+ * Run a generator until it yields or returns.
+ *
+ * A generator may be resumed by any thread, but by only one at a time.
+ *
+ * @param gen Generator
+ * @param in  Value its uthread_gen_yield() returns; ignored by the first
+ *            resume, which starts the body
+ * @param out Set to the value yielded or returned (may be NULL)
+ * @return 0 if it yielded, UTHREAD_EPIPE if it has returned (also on every
+ *         resume after that), UTHREAD_EBUSY if it is already running
+ */
+int uthread_gen_resume(uthread_gen_t gen, void *in, void **out);
+
+/**
+ * Hand a value to the resumer of the calling generator and suspend until
+ * the next uthread_gen_resume().
+ *
+ * @param value Value to hand back
+ * @return The `in` of the resume that continued the generator, or NULL if
+ *         not called from a generator
+ */
+void *uthread_gen_yield(void *value);
+
+/**
+ * Get the innermost generator the calling thread is running.
+ *
+ * @return Generator handle, or NULL if not in a generator
+ */
+uthread_gen_t uthread_gen_self(void);
+
+/**
+ * Initialize a future.
+ *
+ * @param future Future to initialize
+ * @return 0 on success, UTHREAD_EINVAL on failure
+ */
+int uthread_future_init(uthread_future_t *future);
+
+/**
+ * Destroy a future. Continuations still pending are dropped.
+ *
+ * @param future Future to destroy
+ * @return 0 on success, UTHREAD_EBUSY if threads are waiting for it
+ */
+int uthread_future_destroy(uthread_future_t *future);
+
+/**
+ * Set a future's value, waking every thread waiting for it, then run its
+ * continuations in the order they were added, in the calling thread.
+ *
+ * @param future Future
+ * @param value  Value
+ * @return 0 on success, UTHREAD_EBUSY if it was already set
+ */
+int uthread_future_set(uthread_future_t *future, void *value);
+
+/**
+ * Wait until a future is set.
+ *
+ * @param future Future
+ * @param value  Set to its value (may be NULL)
+ * @return 0 on success, UTHREAD_EINVAL on failure
+ */
+int uthread_future_await(uthread_future_t *future, void **value);
+
+/**
+ * Get a future's value without waiting.
+ *
+ * @param future Future
+ * @param value  Set to its value (may be NULL)
+ * @return 0 on success, UTHREAD_EAGAIN if it is not set yet
+ */
+int uthread_future_try(uthread_future_t *future, void **value);
+
+/**
+ * Run `fn(value, arg)` once a future is set: in the thread that sets it,
+ * or right away in the caller if it already is.
+ *
+ * @param future Future to continue
+ * @param fn     Continuation
+ * @param arg    Second argument for `fn`
+ * @param next   Future set to what `fn` returns, or NULL, which allows
+ *               chaining continuations
+ * @return 0 on success, UTHREAD_EINVAL or UTHREAD_ENOMEM on failure
+ */
+int uthread_future_then(uthread_future_t *future,
+                        void *(*fn)(void *value, void *arg), void *arg,
+                        uthread_future_t *next);
+
 /* ==========================================================================
  * Scheduler Control (Advanced)
  * ========================================================================== */
@@ -767,8 +1436,10 @@ int uthread_rwlockattr_destroy(uthread_rwlockattr_t *attr);
 /**
  * Set the timeslice duration (affects preemption).
  *
+ * At least 1ms, or 50us when built with the tickless timer.
+ *
  * @param ns Timeslice in nanoseconds
- * @return 0 on success, error code on failure
+ * @return 0 on success, UTHREAD_EINVAL if ns is too short
  */
 int uthread_set_timeslice(uint64_t ns);
 
@@ -782,6 +1453,9 @@ uint64_t uthread_get_timeslice(void);
 /**
  * Enable or disable preemption.
  *
+ * The cooperative library (uthread_coop) has no preemption timer: this
+ * does nothing and returns false.
+ *
  * @param enable true to enable, false to disable
  * @return Previous state
  */
@@ -823,6 +1497,324 @@ int uthread_setnice(uthread_t thread, int nice);
  */
 int uthread_getnice(uthread_t thread, int *nice);
 
+/* ==========================================================================
+ * Scheduling Groups
+ *
+ * Under SCHED_CFS_GROUP threads belong to groups, much like cgroups: each
+ * group keeps its ready threads in a heap of its own and is scheduled
+ * fairly by its weight against the other groups, then picks fairly by
+ * nice value among its threads. A group with weight 2048 gets twice the
+ * CPU of one with 1024 while both have runnable threads, however many
+ * threads each has. Threads in no group form the root group, of weight
+ * UTHREAD_GROUP_WEIGHT_DEFAULT. A new thread joins the group of the
+ * thread creating it unless its attributes name another.
+ * ========================================================================== */
+
+/**
+ * Create a scheduling group. Only available under SCHED_CFS_GROUP; groups
+ * still existing at uthread_shutdown() are destroyed with the library.
+ *
+ * @param group  Pointer to store the new group
+ * @param weight Share of the CPU (1 to UTHREAD_GROUP_WEIGHT_MAX)
+ * @return 0 on success, UTHREAD_EINVAL for a bad weight or another
+ *         policy, UTHREAD_ENOMEM if out of memory
+ */
+int uthread_group_create(uthread_group_t *group, int weight);
+
+/**
+ * Destroy a scheduling group.
+ *
+ * @param group Group to destroy
+ * @return 0 on success, UTHREAD_EBUSY while threads that have not exited
+ *         belong to it
+ */
+int uthread_group_destroy(uthread_group_t group);
+
+/**
+ * Change a group's weight. Takes effect for the time its threads run from
+ * now on.
+ *
+ * @param group  Group to modify
+ * @param weight New weight (1 to UTHREAD_GROUP_WEIGHT_MAX)
+ * @return 0 on success, error code on failure
+ */
+int uthread_group_setweight(uthread_group_t group, int weight);
+
+/**
+ * Get a group's weight.
+ *
+ * @param group  Group to query
+ * @param weight Pointer to store the weight
+ * @return 0 on success, error code on failure
+ */
+int uthread_group_getweight(uthread_group_t group, int *weight);
+
+/**
+ * Move a thread to another group. Its vruntime keeps its distance from
+ * the front of the old group's queue, measured from the new one's.
+ *
+ * @param thread Thread to move
+ * @param group  New group, or NULL for the root group
+ * @return 0 on success, UTHREAD_EINVAL outside SCHED_CFS_GROUP
+ */
+int uthread_setgroup(uthread_t thread, uthread_group_t group);
+
+/**
+ * Get the group a thread belongs to.
+ *
+ * @param thread Thread to query
+ * @param group  Pointer to store the group (NULL for the root group)
+ * @return 0 on success, error code on failure
+ */
+int uthread_getgroup(uthread_t thread, uthread_group_t *group);
+
+/* ==========================================================================
+ * Stack Cache
+ * ========================================================================== */
+
+/**
+ * Pre-allocate and fault in stacks (and thread descriptors) so that the
+ * next `count` thread creations with this stack size need no allocation.
+ * Typically called right after uthread_init(). Cached memory is released
+ * by uthread_shutdown().
+ *
+ * @param stack_size Stack size in bytes (0 for UTHREAD_STACK_DEFAULT)
+ * @param count      Number of stacks to keep ready (capped by the cache limit)
+ * @return 0 on success, UTHREAD_EAGAIN if no size bucket is free,
+ *         error code on failure
+ */
+int uthread_stack_prewarm(size_t stack_size, int count);
+
+/**
+ * Set how many released stacks (per stack size) and thread descriptors
+ * are kept for reuse. Anything above the new limit is freed.
+ *
+ * @param max_cached Cache limit (0 disables caching)
+ * @return 0 on success, error code on failure
+ */
+int uthread_set_stack_cache(int max_cached);
+
+/**
+ * Choose how thread stacks are backed. Must be called before
+ * uthread_init(); cached stacks of the previous mode are released.
+ *
+ * UTHREAD_STACK_COMMITTED maps each stack at its full size and keeps the
+ * pages of cached stacks. UTHREAD_STACK_LAZY maps with MAP_NORESERVE so
+ * only touched pages count, and hands all but the top 8KB of a stack back
+ * to the kernel when it is cached. UTHREAD_STACK_GROWABLE additionally
+ * reserves 8MB of address space per stack, makes only the requested size
+ * accessible, and extends it in place from the SIGSEGV on the first page
+ * below, so threads can be created with UTHREAD_STACK_MIN and still
+ * recurse deeply. Growth installs a SIGSEGV handler that passes other
+ * faults on to the previous disposition.
+ *
+ * @param mode Stack mode
+ * @return 0 on success, UTHREAD_EBUSY if the library is initialized,
+ *         UTHREAD_EINVAL for an unknown mode
+ */
+int uthread_set_stack_mode(uthread_stack_mode_t mode);
+
+/**
+ * Get the deepest stack use of a thread so far, in bytes rounded up to
+ * pages. Measured from the stack pages that are resident, so a stack
+ * reused from the cache in UTHREAD_STACK_COMMITTED mode also counts
+ * pages touched by its previous thread.
+ *
+ * @param thread Thread to query
+ * @return Bytes of stack used, or 0 if unknown (invalid thread, or the
+ *         main thread, which runs on the process stack)
+ */
+size_t uthread_stack_high_watermark(uthread_t thread);
+
+/* ==========================================================================
+ * Thread Arenas
+ *
+ * Every thread has a private bump allocator for short-lived memory such as
+ * per-request buffers. Allocating moves a pointer within the thread's
+ * current 64KB block; a new block comes from a pool shared by all threads,
+ * so the common path is neither a malloc() nor a lock. Nothing is freed
+ * individually: uthread_arena_rewind() drops everything since a mark,
+ * uthread_arena_reset() drops everything, and the arena is released when
+ * the thread exits, so its memory must not be handed to other threads
+ * that outlive it.
+ * ========================================================================== */
+
+/** Position in the calling thread's arena, from uthread_arena_mark() */
+typedef struct uthread_arena_mark {
+    void *block;                    /**< Current block at the mark */
+    void *large;                    /**< Newest large allocation at the mark */
+    void *ptr;                      /**< Next free byte at the mark */
+} uthread_arena_mark_t;
+
+/**
+ * Allocate from the calling thread's arena. The memory is aligned to 16
+ * bytes and not initialized. Sizes larger than a block get a mapping of
+ * their own, released with the arena.
+ *
+ * @param size Bytes to allocate
+ * @return The memory, or NULL if out of memory or not called from a uthread
+ */
+void *uthread_arena_alloc(size_t size);
+
+/**
+ * Allocate zeroed memory for `count` objects of `size` bytes from the
+ * calling thread's arena.
+ *
+ * @param count Number of objects
+ * @param size  Size of each object
+ * @return The memory, or NULL on overflow, out of memory or outside a uthread
+ */
+void *uthread_arena_calloc(size_t count, size_t size);
+
+/**
+ * Record the current position of the calling thread's arena.
+ *
+ * @return Mark to pass to uthread_arena_rewind()
+ */
+uthread_arena_mark_t uthread_arena_mark(void);
+
+/**
+ * Release everything the calling thread allocated from its arena since
+ * `mark`, which must come from the same thread and not have been rewound
+ * past already.
+ *
+ * @param mark Position from uthread_arena_mark()
+ */
+void uthread_arena_rewind(uthread_arena_mark_t mark);
+
+/**
+ * Release everything in the calling thread's arena. Its blocks go back
+ * to the shared pool in one step.
+ */
+void uthread_arena_reset(void);
+
+/* ==========================================================================
+ * Non-blocking I/O
+ *
+ * These follow the contract of the system calls they wrap (-1 with errno
+ * set on failure), but park only the calling thread while the descriptor
+ * is not ready. The descriptor is switched to O_NONBLOCK on first use.
+ * Before uthread_init() they behave like the plain system calls.
+ *
+ * Close descriptors used with these functions with uthread_close(). A
+ * plain close() is safe while no thread is waiting on the descriptor and
+ * it is not in the uthread_io_register_files() set; a new descriptor that
+ * gets the same number then works as usual.
+ * ========================================================================== */
+
+/**
+ * Read from a file descriptor, parking the thread until data is available.
+ *
+ * @param fd    File descriptor
+ * @param buf   Destination buffer
+ * @param count Maximum bytes to read
+ * @return Bytes read (0 at end of file), or -1 with errno set
+ */
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/**
+ * Write to a file descriptor, parking the thread until there is room.
+ * Like write(2), this may write fewer than `count` bytes.
+ *
+ * @param fd    File descriptor
+ * @param buf   Source buffer
+ * @param count Bytes to write
+ * @return Bytes written, or -1 with errno set
+ */
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/**
+ * Accept a connection, parking the thread until one is pending.
+ * The new socket is blocking and close-on-exec.
+ *
+ * @param fd      Listening socket
+ * @param addr    Peer address (may be NULL)
+ * @param addrlen In: size of addr, out: length of the address
+ * @return New socket, or -1 with errno set
+ */
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+/**
+ * Connect a socket, parking the thread until the connection completes.
+ *
+ * @param fd      Socket
+ * @param addr    Peer address
+ * @param addrlen Length of addr
+ * @return 0 on success, or -1 with errno set
+ */
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * Read from a file at an offset. With the io_uring backend the thread
+ * parks while the kernel performs the read; otherwise this is pread(2).
+ *
+ * @param fd     File descriptor
+ * @param buf    Destination buffer
+ * @param count  Maximum bytes to read
+ * @param offset File offset
+ * @return Bytes read, or -1 with errno set
+ */
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset);
+
+/**
+ * Write to a file at an offset. See uthread_pread().
+ *
+ * @param fd     File descriptor
+ * @param buf    Source buffer
+ * @param count  Bytes to write
+ * @param offset File offset
+ * @return Bytes written, or -1 with errno set
+ */
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+/**
+ * Wait until a descriptor is ready. Leaves the descriptor's flags alone.
+ *
+ * @param fd         File descriptor
+ * @param events     poll(2) events to wait for (POLLIN, POLLOUT, ...)
+ * @param timeout_ms Timeout in ms (0 = check only, negative = no timeout)
+ * @return poll(2) revents, 0 on timeout, or -1 with errno set
+ */
+int uthread_poll_fd(int fd, short events, int timeout_ms);
+
+/**
+ * Close a descriptor used with the functions above. Threads parked on it
+ * are woken and see the error of their retried call.
+ *
+ * @param fd File descriptor
+ * @return Result of close(2)
+ */
+int uthread_close(int fd);
+
+/**
+ * Register descriptors with the io_uring backend. Later requests on them
+ * skip the per-request file lookup. Replaces any previous set; pass
+ * NULL/0 to unregister. Best called before I/O starts.
+ *
+ * @param fds   Descriptors
+ * @param count Number of descriptors
+ * @return 0 on success, -1 with errno set (ENOSYS without io_uring)
+ */
+int uthread_io_register_files(const int *fds, unsigned int count);
+
+/**
+ * Register buffers with the io_uring backend. Reads and writes whose
+ * buffer lies inside one of them are done without per-request page
+ * pinning. Replaces any previous set; pass NULL/0 to unregister.
+ *
+ * @param iovs  Buffers
+ * @param count Number of buffers
+ * @return 0 on success, -1 with errno set (ENOSYS without io_uring)
+ */
+int uthread_io_register_buffers(const struct iovec *iovs, unsigned int count);
+
+/**
+ * Get the name of the backend serving the I/O wrappers.
+ *
+ * @return "io_uring" or "epoll"
+ */
+const char *uthread_io_backend(void);
+
 /* ==========================================================================
  * Statistics and Debugging
  * ========================================================================== */
@@ -836,6 +1828,19 @@ typedef struct uthread_stats {
     uint64_t context_switches;      /**< Total context switches */
     uint64_t scheduler_invocations; /**< Scheduler calls */
     uint64_t total_runtime_ns;      /**< Total runtime */
+    uint64_t stack_cache_hits;      /**< Stacks reused from the pool */
+    uint64_t stack_cache_misses;    /**< Stacks that had to be mapped */
+    uint64_t stack_growths;         /**< Growable stacks extended on overflow */
+    uint64_t tcb_cache_hits;        /**< Thread descriptors reused */
+    uint64_t tcb_cache_misses;      /**< Thread descriptors allocated */
+    uint64_t work_steals;           /**< Threads stolen between workers */
+    uint64_t cross_node_steals;     /**< Of those, stolen from another NUMA node */
+    uint64_t direct_handoffs;       /**< Switches straight to a woken partner */
+    uint64_t io_ring_requests;      /**< io_uring requests completed */
+    uint64_t io_ring_enters;        /**< io_uring_enter() system calls */
+    uint64_t timer_ticks;           /**< Preemption timer ticks handled */
+    uint64_t tasks_completed;       /**< Tasks run to completion */
+    uint64_t task_promotions;       /**< Tasks that blocked and kept their runner */
 } uthread_stats_t;
 
 /**
@@ -856,6 +1861,197 @@ void uthread_reset_stats(void);
  */
 void uthread_debug_dump(void);
 
+/* ==========================================================================
+ * Contention Statistics
+ * ========================================================================== */
+
+/** Per-thread scheduling statistics */
+typedef struct uthread_thread_stats {
+    int tid;                        /**< Thread ID */
+    char name[UTHREAD_NAME_MAX];    /**< Thread name */
+    uthread_state_t state;          /**< Current state */
+    uint64_t voluntary_switches;    /**< Left the CPU by yielding or blocking */
+    uint64_t involuntary_switches;  /**< Left the CPU by being preempted */
+    uint64_t run_ns;                /**< Time RUNNING */
+    uint64_t ready_ns;              /**< Time READY, waiting for a CPU (*) */
+    uint64_t max_ready_ns;          /**< Longest single wait for a CPU (*) */
+    uint64_t blocked_ns;            /**< Time BLOCKED (*) */
+} uthread_thread_stats_t;
+
+/** Per-lock contention statistics (all collected only while enabled) */
+typedef struct uthread_lock_stats {
+    const void *lock;               /**< Address of the mutex or rwlock */
+    uthread_lock_kind_t kind;       /**< Which of the two it is */
+    uint64_t acquisitions;          /**< Times taken */
+    uint64_t contended;             /**< Acquisitions that had to wait */
+    uint64_t wait_ns;               /**< Total time spent waiting */
+    uint64_t max_hold_ns;           /**< Longest time held (readers: as a group) */
+} uthread_lock_stats_t;
+
+/**
+ * Enable or disable contention statistics: the fields marked (*) in
+ * uthread_thread_stats_t and the per-lock counters. While disabled they
+ * cost a predicted branch at each switch, wakeup, and lock or unlock.
+ * Switch counts and run time are always collected.
+ *
+ * May be called at any time, before or after uthread_init(). A mutex or
+ * rwlock gets its counters on first acquisition while enabled, and loses
+ * them when destroyed.
+ *
+ * @param enabled true to collect
+ */
+void uthread_set_contention_stats(bool enabled);
+
+/**
+ * Get the statistics of one live thread.
+ *
+ * @param thread Thread handle
+ * @param stats  Receives the statistics
+ * @return 0 on success, UTHREAD_EINVAL for NULL arguments
+ */
+int uthread_get_thread_stats(uthread_t thread, uthread_thread_stats_t *stats);
+
+/**
+ * Iterate over the statistics of all live threads.
+ *
+ * Start with `*cursor` set to 0 and call until it returns false. Threads
+ * created or exiting meanwhile may or may not be visited.
+ *
+ * @param cursor Iteration state
+ * @param stats  Receives the next thread's statistics
+ * @return true if `stats` was filled, false at the end
+ */
+bool uthread_thread_stats_next(int *cursor, uthread_thread_stats_t *stats);
+
+/**
+ * Iterate over the counters of all mutexes and rwlocks that have them,
+ * in the same way as uthread_thread_stats_next().
+ *
+ * @param cursor Iteration state, 0 to start
+ * @param stats  Receives the next lock's counters
+ * @return true if `stats` was filled, false at the end
+ */
+bool uthread_lock_stats_next(int *cursor, uthread_lock_stats_t *stats);
+
+/* ==========================================================================
+ * Tracing
+ * ========================================================================== */
+
+/**
+ * Start recording scheduling events.
+ *
+ * Each worker records into a fixed-size ring that keeps the most recent
+ * events: context switches, blocking, wakeups, preemption ticks,
+ * contended mutexes and sleeps, with thread IDs and timestamps. Recording
+ * an event costs a few nanoseconds; while tracing is stopped it costs a
+ * branch. Starting again discards the previous trace.
+ *
+ * @param events_per_worker Ring capacity, rounded up to a power of two,
+ *                          or 0 for the default (65536)
+ * @return 0 on success, UTHREAD_EBUSY if already tracing, error code on failure
+ */
+int uthread_trace_start(size_t events_per_worker);
+
+/**
+ * Stop recording. The recorded events stay available for export until
+ * the next uthread_trace_start() or uthread_shutdown().
+ */
+void uthread_trace_stop(void);
+
+/**
+ * Write the recorded events as a Chrome trace (JSON), which
+ * chrome://tracing and Perfetto (ui.perfetto.dev) open. Each worker is a
+ * track showing which thread ran when; other events are instants.
+ *
+ * May be called while tracing. Scheduling pauses until the file is written.
+ *
+ * @param path File to create or overwrite
+ * @return 0 on success, UTHREAD_EINVAL if nothing was traced, or the
+ *         errno value if the file could not be written
+ */
+int uthread_trace_export(const char *path);
+
+/* ==========================================================================
+ * Profiling and Introspection
+ * ========================================================================== */
+
+/**
+ * Start sampling the running threads.
+ *
+ * Each worker's timer ticks at least once per period while profiling,
+ * and each tick records the thread it interrupted and up to eight frames
+ * of its call stack into a per-worker ring that keeps the most recent
+ * samples. Stacks are walked along frame pointers, so code compiled with
+ * -fomit-frame-pointer (the -O2 default) shows only the frame the sample
+ * landed in; build with -fno-omit-frame-pointer for full stacks (a leaf
+ * function without a frame still hides its direct caller). The main
+ * thread and generator bodies are sampled without callers. Idle workers
+ * and threads running with preemption off (uthread_set_preemption())
+ * take no samples. Starting again discards the previous profile.
+ *
+ * @param period_us          Sampling period in microseconds, or 0 for
+ *                           the default (1000)
+ * @param samples_per_worker Ring capacity, rounded up to a power of two,
+ *                           or 0 for the default (32768)
+ * @return 0 on success, UTHREAD_EBUSY if already profiling, UTHREAD_EINVAL
+ *         for a period under 20us or in a cooperative build, error code
+ *         on failure
+ */
+int uthread_profile_start(unsigned int period_us, size_t samples_per_worker);
+
+/**
+ * Stop sampling. The samples stay available for export until the next
+ * uthread_profile_start() or uthread_shutdown().
+ */
+void uthread_profile_stop(void);
+
+/**
+ * Write the samples as folded stacks, the input of flamegraph.pl and
+ * speedscope: one line per distinct stack, rooted at the thread as
+ * "name[tid]", with frames from outermost to innermost and the number of
+ * samples, e.g. "worker[5];main_loop;parse 42". Frames are named from
+ * the dynamic symbol table (link executables with -rdynamic for their own
+ * functions); others are written as module+0xoffset, for addr2line.
+ *
+ * May be called while profiling. Scheduling pauses until the file is written.
+ *
+ * @param path File to create or overwrite
+ * @return 0 on success, UTHREAD_EINVAL if nothing was profiled, or the
+ *         errno value if the file could not be written
+ */
+int uthread_profile_export(const char *path);
+
+/**
+ * Serve live scheduler snapshots on a Unix stream socket.
+ *
+ * Each connection gets a line-oriented text snapshot: the scheduler and
+ * worker state with run-queue depths, one line per live thread (state,
+ * worker, priority, switches, run, ready and blocked time, name), and
+ * the lock contention counters of uthread_set_contention_stats(). A
+ * client that sends "watch <ms>" first gets one every <ms> milliseconds
+ * until it hangs up:
+ *
+ *     socat - UNIX-CONNECT:/run/app.sock </dev/null
+ *     echo 'watch 1000' | socat - UNIX-CONNECT:/run/app.sock
+ *
+ * A kernel thread of its own serves the socket, and each snapshot is
+ * taken by a worker at its next switch or tick. If none gets there within
+ * a second, the reply says that the workers are stuck and shows what
+ * they were running.
+ *
+ * @param path Socket to create; a stale socket there is replaced
+ * @return 0 on success, UTHREAD_EBUSY if already serving, UTHREAD_EINVAL
+ *         for a bad path, or the errno value if the socket could not be
+ *         created
+ */
+int uthread_introspect_start(const char *path);
+
+/**
+ * Stop serving snapshots and remove the socket. Also done by
+ * uthread_shutdown().
+ */
+void uthread_introspect_stop(void);
+
 #ifdef __cplusplus
 }
 #endif
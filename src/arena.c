@@ -0,0 +1,375 @@
+/**
+ * LibUThread Arenas and Slab Caches
+ *
+ * Both draw on one pool of ARENA_BLOCK_SIZE blocks. A thread arena bumps a
+ * pointer through its current block and takes another from the pool when
+ * it runs out; the blocks go back to the pool in one splice when the arena
+ * is reset or its thread exits (a cleanup handler queued on first use).
+ * Allocations that do not fit a block are mapped on their own.
+ *
+ * Slab caches cut blocks into equal objects for the library's own
+ * allocations and keep freed objects on a list for the next one. Their
+ * blocks are never returned.
+ *
+ * Pool and slab state is protected by disabling preemption; an arena is
+ * only touched by its own thread, so the bump path takes no lock. Blocks
+ * are faulted in by the thread that first uses them, which places them on
+ * its worker's NUMA node.
+ *
+ * @file arena.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/* Usable bytes of a block, past its header */
+#define ARENA_HEADER        ((sizeof(struct arena_block) + 15) & ~(size_t)15)
+#define ARENA_PAYLOAD       (ARENA_BLOCK_SIZE - ARENA_HEADER)
+
+/* Free blocks, linked through their headers */
+static struct {
+    struct arena_block *free;
+    int count;
+} g_blocks;
+
+struct slab_cache g_slab_wait_queues = SLAB_CACHE_INIT(struct wait_queue);
+
+/* ==========================================================================
+ * Block Pool
+ * ========================================================================== */
+
+static struct arena_block *block_map(size_t size)
+{
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct arena_block *b = mem;
+    b->next = NULL;
+    b->size = size;
+    return b;
+}
+
+/* Called with preemption disabled */
+static struct arena_block *block_get(void)
+{
+    struct arena_block *b = g_blocks.free;
+
+    if (b == NULL) {
+        return block_map(ARENA_BLOCK_SIZE);
+    }
+
+    g_blocks.free = b->next;
+    g_blocks.count--;
+    b->next = NULL;
+    return b;
+}
+
+/*
+ * Put a chain of `count` blocks back, `oldest` being its last. Called with
+ * preemption disabled.
+ */
+static void blocks_put(struct arena_block *newest, struct arena_block *oldest, int count)
+{
+    oldest->next = g_blocks.free;
+    g_blocks.free = newest;
+    g_blocks.count += count;
+
+    /* Unmap what the cache has no room for */
+    while (g_blocks.count > ARENA_BLOCK_CACHE) {
+        struct arena_block *b = g_blocks.free;
+        g_blocks.free = b->next;
+        g_blocks.count--;
+        munmap(b, b->size);
+    }
+}
+
+/** Unmap the free blocks; called from uthread_shutdown() */
+void arena_drain(void)
+{
+    while (g_blocks.free != NULL) {
+        struct arena_block *b = g_blocks.free;
+        g_blocks.free = b->next;
+        munmap(b, b->size);
+    }
+    g_blocks.count = 0;
+}
+
+/* ==========================================================================
+ * Slab Caches
+ * ========================================================================== */
+
+/**
+ * Allocate a zeroed object. Takes the scheduler lock itself, so it may be
+ * called with or without preemption disabled.
+ *
+ * @param cache Cache of the object's type
+ * @return The object, or NULL if out of memory
+ */
+void *slab_alloc(struct slab_cache *cache)
+{
+    preemption_disable();
+
+    if (cache->free == NULL) {
+        /* Carve a fresh block, keeping the objects in address order */
+        struct arena_block *b = block_get();
+        if (b == NULL) {
+            preemption_enable();
+            return NULL;
+        }
+
+        char *base = (char *)b + ARENA_HEADER;
+        size_t n = ARENA_PAYLOAD / cache->size;
+        for (size_t i = n; i-- > 0;) {
+            void **obj = (void **)(base + i * cache->size);
+            *obj = cache->free;
+            cache->free = obj;
+        }
+    }
+
+    void **obj = cache->free;
+    cache->free = *obj;
+
+    preemption_enable();
+
+    memset(obj, 0, cache->size);
+    return obj;
+}
+
+/**
+ * Return an object to its cache.
+ *
+ * @param cache  Cache it was allocated from
+ * @param object Object, or NULL
+ */
+void slab_free(struct slab_cache *cache, void *object)
+{
+    if (object == NULL) {
+        return;
+    }
+
+    preemption_disable();
+    *(void **)object = cache->free;
+    cache->free = object;
+    preemption_enable();
+}
+
+/** Allocate and initialize a wait queue */
+struct wait_queue *wait_queue_alloc(void)
+{
+    struct wait_queue *wq = slab_alloc(&g_slab_wait_queues);
+    if (wq != NULL) {
+        wait_queue_init(wq);
+    }
+    return wq;
+}
+
+/** Destroy and free a wait queue from wait_queue_alloc() */
+void wait_queue_free(struct wait_queue *wq)
+{
+    if (wq == NULL) {
+        return;
+    }
+    wait_queue_destroy(wq);
+    slab_free(&g_slab_wait_queues, wq);
+}
+
+/* ==========================================================================
+ * Thread Arenas
+ * ========================================================================== */
+
+/* Unmap large allocations newer than `stop` (preemption disabled) */
+static void arena_release_large(struct thread_arena *a, struct arena_block *stop)
+{
+    while (a->large != stop && a->large != NULL) {
+        struct arena_block *b = a->large;
+        a->large = b->next;
+        munmap(b, b->size);
+    }
+}
+
+/* Give everything back; also the cleanup handler run at exit */
+static void arena_release(void *arg)
+{
+    struct thread_arena *a = arg;
+
+    preemption_disable();
+
+    if (a->blocks != NULL) {
+        blocks_put(a->blocks, a->oldest, a->nblocks);
+    }
+    arena_release_large(a, NULL);
+
+    a->blocks = NULL;
+    a->oldest = NULL;
+    a->nblocks = 0;
+    a->ptr = NULL;
+    a->end = NULL;
+
+    preemption_enable();
+}
+
+/**
+ * Release the arena of a TCB being freed. Exit already released it through
+ * its cleanup handler; this covers threads that never exited, such as the
+ * main thread at shutdown, without running anyone's cleanup handlers.
+ */
+void arena_thread_release(struct uthread_internal *thread)
+{
+    struct thread_arena *a = &thread->cold->arena;
+    if (a->blocks != NULL || a->large != NULL) {
+        arena_release(a);
+    }
+}
+
+/* Arena of the calling uthread, or NULL outside one */
+static struct thread_arena *arena_self(void)
+{
+    if (!g_scheduler.initialized || t_worker == NULL) {
+        return NULL;
+    }
+
+    struct uthread_internal *self = CURRENT_THREAD();
+    if (self == NULL || self == &t_worker->idle_thread) {
+        return NULL;
+    }
+    return &self->cold->arena;
+}
+
+/* The current block is full: add a block, or map `size` on its own */
+static void *arena_refill(struct thread_arena *a, size_t size)
+{
+    void *p = NULL;
+
+    preemption_disable();
+
+    /* The first allocation arranges for the release at exit */
+    if (!a->registered) {
+        if (thread_cleanup_push(CURRENT_THREAD(), arena_release, a) != UTHREAD_SUCCESS) {
+            preemption_enable();
+            return NULL;
+        }
+        a->registered = true;
+    }
+
+    if (size > ARENA_PAYLOAD) {
+        struct arena_block *b = block_map(ARENA_HEADER + size);
+        if (b != NULL) {
+            b->next = a->large;
+            a->large = b;
+            p = (char *)b + ARENA_HEADER;
+        }
+    } else {
+        struct arena_block *b = block_get();
+        if (b != NULL) {
+            b->next = a->blocks;
+            a->blocks = b;
+            if (a->oldest == NULL) {
+                a->oldest = b;
+            }
+            a->nblocks++;
+
+            p = (char *)b + ARENA_HEADER;
+            a->ptr = (char *)p + size;
+            a->end = (char *)b + ARENA_BLOCK_SIZE;
+        }
+    }
+
+    preemption_enable();
+
+    return p;
+}
+
+void *uthread_arena_alloc(size_t size)
+{
+    struct thread_arena *a = arena_self();
+    if (a == NULL || size > SIZE_MAX - 15) {
+        return NULL;
+    }
+
+    size = (size == 0) ? 16 : (size + 15) & ~(size_t)15;
+
+    if ((size_t)(a->end - a->ptr) >= size) {
+        void *p = a->ptr;
+        a->ptr += size;
+        return p;
+    }
+
+    return arena_refill(a, size);
+}
+
+void *uthread_arena_calloc(size_t count, size_t size)
+{
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *p = uthread_arena_alloc(count * size);
+    if (p != NULL) {
+        memset(p, 0, count * size);
+    }
+    return p;
+}
+
+uthread_arena_mark_t uthread_arena_mark(void)
+{
+    uthread_arena_mark_t mark = { NULL, NULL, NULL };
+
+    struct thread_arena *a = arena_self();
+    if (a != NULL) {
+        mark.block = a->blocks;
+        mark.large = a->large;
+        mark.ptr = a->ptr;
+    }
+    return mark;
+}
+
+void uthread_arena_rewind(uthread_arena_mark_t mark)
+{
+    struct thread_arena *a = arena_self();
+    if (a == NULL) {
+        return;
+    }
+
+    preemption_disable();
+
+    if (mark.block == NULL) {
+        /* Marked before the first block */
+        if (a->blocks != NULL) {
+            blocks_put(a->blocks, a->oldest, a->nblocks);
+        }
+        a->blocks = NULL;
+        a->oldest = NULL;
+        a->nblocks = 0;
+        a->ptr = NULL;
+        a->end = NULL;
+    } else {
+        /* Blocks started after the mark go back, newest first */
+        struct arena_block *stop = mark.block;
+        while (a->blocks != stop) {
+            struct arena_block *b = a->blocks;
+            a->blocks = b->next;
+            a->nblocks--;
+            blocks_put(b, b, 1);
+        }
+        a->ptr = mark.ptr;
+        a->end = (char *)stop + ARENA_BLOCK_SIZE;
+    }
+    arena_release_large(a, mark.large);
+
+    preemption_enable();
+}
+
+void uthread_arena_reset(void)
+{
+    struct thread_arena *a = arena_self();
+    if (a != NULL) {
+        arena_release(a);
+    }
+}
@@ -0,0 +1,590 @@
+/**
+ * LibUThread Channels
+ *
+ * Bounded multi-producer, multi-consumer channels: a power-of-two ring of
+ * fixed-size items, with senders parked while it is full and receivers
+ * while it is empty.
+ *
+ * A parked operation is a chan_waiter record on the blocked thread's
+ * stack, linked on the channel instead of the TCB going on a wait queue,
+ * so that a select can park one thread on several channels at once. The
+ * partner that completes a parked operation does the copy itself: a
+ * sender writes straight into a parked receiver's buffer, a receiver that
+ * frees a slot refills it from the first parked sender, and the woken
+ * thread returns without touching the channel again.
+ *
+ * A thread that timed out leaves its records linked until it runs again;
+ * partners drop records whose thread is no longer blocked.
+ *
+ * All state is protected by disabling preemption.
+ *
+ * @file chan.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Deadlines of a parked operation besides an absolute time */
+#define CHAN_TRY        0               /**< Fail instead of blocking */
+#define CHAN_FOREVER    UINT64_MAX      /**< Block until completed */
+
+/* Rotates the case uthread_select() tries first */
+static unsigned int g_select_seq;
+
+/* ==========================================================================
+ * Waiter Queues
+ * ========================================================================== */
+
+static void chan_waitq_push(struct chan_waitq *q, struct chan_waiter *w)
+{
+    w->next = NULL;
+    w->prev = q->tail;
+    if (q->tail != NULL) {
+        q->tail->next = w;
+    } else {
+        q->head = w;
+    }
+    q->tail = w;
+    w->queued = true;
+}
+
+static void chan_waitq_unlink(struct chan_waitq *q, struct chan_waiter *w)
+{
+    if (w->prev != NULL) {
+        w->prev->next = w->next;
+    } else {
+        q->head = w->next;
+    }
+    if (w->next != NULL) {
+        w->next->prev = w->prev;
+    } else {
+        q->tail = w->prev;
+    }
+    w->next = NULL;
+    w->prev = NULL;
+    w->queued = false;
+}
+
+static inline struct chan_waitq *chan_waiter_queue(struct chan_waiter *w)
+{
+    return w->send ? &w->chan->senders : &w->chan->receivers;
+}
+
+/* Unlink the cases of a wait that are still queued */
+static void chan_wait_dequeue(struct chan_wait *wait)
+{
+    for (int i = 0; i < wait->ncases; i++) {
+        struct chan_waiter *w = &wait->cases[i];
+        if (w->queued) {
+            chan_waitq_unlink(chan_waiter_queue(w), w);
+        }
+    }
+}
+
+/**
+ * First parked operation whose thread still waits for it. Records left by
+ * threads that timed out are dropped on the way.
+ */
+static struct chan_waiter *chan_waitq_first(struct chan_waitq *q)
+{
+    struct chan_waiter *w;
+
+    while ((w = q->head) != NULL) {
+        if (w->wait->thread->state == UTHREAD_STATE_BLOCKED) {
+            return w;
+        }
+        chan_waitq_unlink(q, w);
+    }
+
+    return NULL;
+}
+
+/* Complete a parked operation whose copy is done and wake its thread */
+static void chan_fire(struct chan_waiter *w, int result)
+{
+    struct chan_wait *wait = w->wait;
+
+    wait->fired = (int)(w - wait->cases);
+    wait->result = result;
+    chan_wait_dequeue(wait);
+    scheduler_unblock_partner(wait->thread);
+}
+
+/* ==========================================================================
+ * Ring Buffer
+ * ========================================================================== */
+
+/* Copy n items in at the tail, wrapping with at most two copies */
+static void chan_ring_put(uthread_chan_t *chan, const unsigned char *src, size_t n)
+{
+    size_t es = chan->elem_size;
+    size_t at = chan->tail & (chan->capacity - 1);
+    size_t first = chan->capacity - at;
+    if (first > n) {
+        first = n;
+    }
+
+    memcpy(chan->buffer + at * es, src, first * es);
+    memcpy(chan->buffer, src + first * es, (n - first) * es);
+    chan->tail += n;
+}
+
+/* Copy n items out from the head */
+static void chan_ring_get(uthread_chan_t *chan, unsigned char *dst, size_t n)
+{
+    size_t es = chan->elem_size;
+    size_t at = chan->head & (chan->capacity - 1);
+    size_t first = chan->capacity - at;
+    if (first > n) {
+        first = n;
+    }
+
+    memcpy(dst, chan->buffer + at * es, first * es);
+    memcpy(dst + first * es, chan->buffer, (n - first) * es);
+    chan->head += n;
+}
+
+/**
+ * Send as many of n items as can go without blocking: to parked receivers
+ * first (the ring is empty while any is parked), then into the ring.
+ *
+ * @return Number of items sent
+ */
+static size_t chan_put(uthread_chan_t *chan, const unsigned char *items, size_t n)
+{
+    size_t es = chan->elem_size;
+    size_t done = 0;
+    struct chan_waiter *w;
+
+    while (done < n && (w = chan_waitq_first(&chan->receivers)) != NULL) {
+        memcpy(w->item, items + done * es, es);
+        chan_fire(w, UTHREAD_SUCCESS);
+        done++;
+    }
+
+    size_t space = chan->capacity - (chan->tail - chan->head);
+    size_t count = n - done < space ? n - done : space;
+    if (count > 0) {
+        chan_ring_put(chan, items + done * es, count);
+        done += count;
+    }
+
+    return done;
+}
+
+/**
+ * Receive up to n items without blocking. Slots freed in the ring are
+ * refilled from parked senders in order; an unbuffered channel takes
+ * items straight from them.
+ *
+ * @return Number of items received
+ */
+static size_t chan_get(uthread_chan_t *chan, unsigned char *items, size_t n)
+{
+    size_t es = chan->elem_size;
+    size_t done = 0;
+    struct chan_waiter *w;
+
+    while (done < n) {
+        size_t avail = chan->tail - chan->head;
+
+        if (avail > 0) {
+            size_t count = n - done < avail ? n - done : avail;
+            chan_ring_get(chan, items + done * es, count);
+            done += count;
+
+            while (chan->tail - chan->head < chan->capacity &&
+                   (w = chan_waitq_first(&chan->senders)) != NULL) {
+                chan_ring_put(chan, w->item, 1);
+                chan_fire(w, UTHREAD_SUCCESS);
+            }
+        } else if ((w = chan_waitq_first(&chan->senders)) != NULL) {
+            memcpy(items + done * es, w->item, es);
+            chan_fire(w, UTHREAD_SUCCESS);
+            done++;
+        } else {
+            break;
+        }
+    }
+
+    return done;
+}
+
+/* One operation without blocking: UTHREAD_SUCCESS, EAGAIN or EPIPE */
+static int chan_try(uthread_chan_t *chan, void *item, bool send)
+{
+    if (send) {
+        if (chan->closed) {
+            return UTHREAD_EPIPE;
+        }
+        return chan_put(chan, item, 1) == 1 ? UTHREAD_SUCCESS : UTHREAD_EAGAIN;
+    }
+
+    if (chan_get(chan, item, 1) == 1) {
+        return UTHREAD_SUCCESS;
+    }
+    return chan->closed ? UTHREAD_EPIPE : UTHREAD_EAGAIN;
+}
+
+/* ==========================================================================
+ * Blocking
+ * ========================================================================== */
+
+/**
+ * Park the caller on the cases of `wait` until a partner completes one.
+ * Called with preemption disabled.
+ *
+ * @return Result of the completed case, or UTHREAD_ETIMEDOUT
+ */
+static int chan_block(struct chan_wait *wait, uint64_t deadline)
+{
+    for (;;) {
+        for (int i = 0; i < wait->ncases; i++) {
+            struct chan_waiter *w = &wait->cases[i];
+            if (w->chan != NULL && !w->queued) {
+                chan_waitq_push(chan_waiter_queue(w), w);
+            }
+        }
+
+        int ret = UTHREAD_SUCCESS;
+        if (deadline == CHAN_FOREVER) {
+            wait->thread->state = UTHREAD_STATE_BLOCKED;
+            scheduler_schedule();
+        } else {
+            ret = scheduler_block_until(NULL, deadline);
+        }
+
+        if (wait->fired >= 0) {
+            return wait->result;
+        }
+        if (ret == UTHREAD_ETIMEDOUT) {
+            chan_wait_dequeue(wait);
+            return UTHREAD_ETIMEDOUT;
+        }
+    }
+}
+
+/* Block on a single operation; called with preemption disabled */
+static int chan_park(uthread_chan_t *chan, void *item, bool send, uint64_t deadline)
+{
+    struct uthread_internal *self = scheduler_current();
+
+    if (deadline == CHAN_TRY) {
+        return UTHREAD_EAGAIN;
+    }
+    if (self == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    if (deadline != CHAN_FOREVER && get_time_ns() >= deadline) {
+        return UTHREAD_ETIMEDOUT;
+    }
+
+    struct chan_waiter w = { .chan = chan, .item = item, .send = send };
+    struct chan_wait wait = { .thread = self, .cases = &w, .ncases = 1, .fired = -1 };
+    w.wait = &wait;
+
+    return chan_block(&wait, deadline);
+}
+
+static int chan_op(uthread_chan_t *chan, void *item, bool send, uint64_t deadline)
+{
+    if (chan == NULL || item == NULL || !chan->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    int ret = chan_try(chan, item, send);
+    if (ret == UTHREAD_EAGAIN) {
+        ret = chan_park(chan, item, send, deadline);
+    }
+
+    preemption_enable();
+
+    return ret;
+}
+
+static inline uint64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+/* ==========================================================================
+ * Channel Functions
+ * ========================================================================== */
+
+int uthread_chan_init(uthread_chan_t *chan, size_t elem_size, size_t capacity)
+{
+    if (chan == NULL || elem_size == 0) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Positions are masked into the ring, so it must be a power of two */
+    if ((capacity & (capacity - 1)) != 0 || capacity > SIZE_MAX / elem_size) {
+        return UTHREAD_EINVAL;
+    }
+
+    memset(chan, 0, sizeof(*chan));
+    chan->elem_size = elem_size;
+    chan->capacity = capacity;
+
+    if (capacity > 0) {
+        chan->buffer = malloc(capacity * elem_size);
+        if (chan->buffer == NULL) {
+            return UTHREAD_ENOMEM;
+        }
+    }
+
+    chan->initialized = true;
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_chan_destroy(uthread_chan_t *chan)
+{
+    if (chan == NULL || !chan->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    /* Cannot destroy if threads are parked */
+    if (chan_waitq_first(&chan->senders) != NULL ||
+        chan_waitq_first(&chan->receivers) != NULL) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    chan->initialized = false;
+
+    preemption_enable();
+
+    free(chan->buffer);
+    chan->buffer = NULL;
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_chan_close(uthread_chan_t *chan)
+{
+    if (chan == NULL || !chan->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (chan->closed) {
+        preemption_enable();
+        return UTHREAD_EPIPE;
+    }
+    chan->closed = true;
+
+    /* Receivers only park on an empty ring, so none has anything left */
+    struct chan_waiter *w;
+    while ((w = chan_waitq_first(&chan->receivers)) != NULL) {
+        chan_fire(w, UTHREAD_EPIPE);
+    }
+    while ((w = chan_waitq_first(&chan->senders)) != NULL) {
+        chan_fire(w, UTHREAD_EPIPE);
+    }
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_chan_send(uthread_chan_t *chan, const void *item)
+{
+    return chan_op(chan, (void *)item, true, CHAN_FOREVER);
+}
+
+int uthread_chan_trysend(uthread_chan_t *chan, const void *item)
+{
+    return chan_op(chan, (void *)item, true, CHAN_TRY);
+}
+
+int uthread_chan_timedsend(uthread_chan_t *chan, const void *item,
+                           const struct timespec *abstime)
+{
+    if (abstime == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    return chan_op(chan, (void *)item, true, timespec_to_ns(abstime));
+}
+
+int uthread_chan_recv(uthread_chan_t *chan, void *item)
+{
+    return chan_op(chan, item, false, CHAN_FOREVER);
+}
+
+int uthread_chan_tryrecv(uthread_chan_t *chan, void *item)
+{
+    return chan_op(chan, item, false, CHAN_TRY);
+}
+
+int uthread_chan_timedrecv(uthread_chan_t *chan, void *item,
+                           const struct timespec *abstime)
+{
+    if (abstime == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    return chan_op(chan, item, false, timespec_to_ns(abstime));
+}
+
+int uthread_chan_send_batch(uthread_chan_t *chan, const void *items,
+                            size_t count, size_t *sent)
+{
+    if (chan == NULL || items == NULL || sent == NULL || !chan->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    *sent = 0;
+    if (count == 0) {
+        return UTHREAD_SUCCESS;
+    }
+
+    const unsigned char *src = items;
+    int ret = UTHREAD_SUCCESS;
+    size_t done = 0;
+
+    preemption_disable();
+
+    if (chan->closed) {
+        ret = UTHREAD_EPIPE;
+    } else {
+        done = chan_put(chan, src, count);
+        if (done == 0) {
+            /* Wait for room for the first item, then send what fits */
+            ret = chan_park(chan, (void *)src, true, CHAN_FOREVER);
+            if (ret == UTHREAD_SUCCESS) {
+                done = 1 + chan_put(chan, src + chan->elem_size, count - 1);
+            }
+        }
+    }
+
+    preemption_enable();
+
+    *sent = done;
+    return ret;
+}
+
+int uthread_chan_recv_batch(uthread_chan_t *chan, void *items,
+                            size_t count, size_t *received)
+{
+    if (chan == NULL || items == NULL || received == NULL || !chan->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    *received = 0;
+    if (count == 0) {
+        return UTHREAD_SUCCESS;
+    }
+
+    unsigned char *dst = items;
+    int ret = UTHREAD_SUCCESS;
+
+    preemption_disable();
+
+    size_t done = chan_get(chan, dst, count);
+    if (done == 0) {
+        if (chan->closed) {
+            ret = UTHREAD_EPIPE;
+        } else {
+            /* Wait for the first item, then take what else is ready */
+            ret = chan_park(chan, dst, false, CHAN_FOREVER);
+            if (ret == UTHREAD_SUCCESS) {
+                done = 1 + chan_get(chan, dst + chan->elem_size, count - 1);
+            }
+        }
+    }
+
+    preemption_enable();
+
+    *received = done;
+    return ret;
+}
+
+/* ==========================================================================
+ * Select
+ * ========================================================================== */
+
+int uthread_select(uthread_select_case_t *cases, int ncases,
+                   const struct timespec *abstime, int *selected)
+{
+    if (cases == NULL || ncases <= 0 || selected == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    for (int i = 0; i < ncases; i++) {
+        if (cases[i].chan != NULL &&
+            (!cases[i].chan->initialized || cases[i].item == NULL)) {
+            return UTHREAD_EINVAL;
+        }
+    }
+
+    *selected = -1;
+    uint64_t deadline = abstime != NULL ? timespec_to_ns(abstime) : CHAN_FOREVER;
+
+    /* Allocated up front, so that nothing is allocated with preemption off */
+    struct chan_waiter stack_cases[CHAN_SELECT_STACK_CASES];
+    struct chan_waiter *records = stack_cases;
+    if (ncases > CHAN_SELECT_STACK_CASES) {
+        records = malloc((size_t)ncases * sizeof(*records));
+        if (records == NULL) {
+            return UTHREAD_ENOMEM;
+        }
+    }
+
+    preemption_disable();
+
+    /* Start from a rotating case so that a busy channel cannot starve the rest */
+    int start = (int)(g_select_seq++ % (unsigned int)ncases);
+    int ret = UTHREAD_EAGAIN;
+
+    for (int k = 0; k < ncases && ret == UTHREAD_EAGAIN; k++) {
+        int i = (start + k) % ncases;
+        if (cases[i].chan == NULL) {
+            continue;
+        }
+        ret = chan_try(cases[i].chan, cases[i].item, cases[i].dir == UTHREAD_CHAN_SEND);
+        if (ret != UTHREAD_EAGAIN) {
+            *selected = i;
+        }
+    }
+
+    if (ret == UTHREAD_EAGAIN) {
+        struct uthread_internal *self = scheduler_current();
+
+        if (self == NULL) {
+            ret = UTHREAD_EINVAL;
+        } else if (deadline != CHAN_FOREVER && get_time_ns() >= deadline) {
+            ret = UTHREAD_ETIMEDOUT;
+        } else {
+            struct chan_wait wait = {
+                .thread = self, .cases = records, .ncases = ncases, .fired = -1
+            };
+            for (int i = 0; i < ncases; i++) {
+                records[i] = (struct chan_waiter) {
+                    .wait = &wait,
+                    .chan = cases[i].chan,
+                    .item = cases[i].item,
+                    .send = cases[i].dir == UTHREAD_CHAN_SEND,
+                };
+            }
+
+            ret = chan_block(&wait, deadline);
+            *selected = wait.fired;
+        }
+    }
+
+    preemption_enable();
+
+    if (records != stack_cases) {
+        free(records);
+    }
+
+    return ret;
+}
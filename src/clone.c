@@ -0,0 +1,184 @@
+/**
+ * LibUThread Thread Cloning
+ *
+ * A template thread parks in uthread_clone_park() after setup that its
+ * clones should not repeat. The park saves the template's registers at
+ * the top of its own frame (context_snapshot()) and blocks below them, so
+ * the stack from there up stays exactly as it was at the park. A clone is
+ * a new thread whose stack gets a copy of that part, with pointers into
+ * the template's stack moved to the same offset in its own
+ * (context_clone()); its first switch returns from the snapshot into
+ * uthread_clone_park(), which tells the clone from the template by the
+ * thread it now runs as.
+ *
+ * Template state is protected by disabling preemption.
+ *
+ * @file clone.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** A parked template, on its own stack in uthread_clone_park() */
+struct clone_template {
+    context_slot_t snapshot;            /**< Registers at the park */
+    struct uthread_internal *thread;    /**< The template */
+    void *value;                        /**< Given by uthread_clone_release() */
+    bool released;
+};
+
+/* Runs below the snapshot until released */
+static void clone_block(void *arg)
+{
+    struct clone_template *tmpl = arg;
+    struct uthread_internal *self = tmpl->thread;
+
+    preemption_disable();
+
+    self->cold->clone_template = tmpl;
+    while (!tmpl->released) {
+        self->state = UTHREAD_STATE_BLOCKED;
+        scheduler_schedule();
+    }
+
+    preemption_enable();
+}
+
+void *uthread_clone_park(void)
+{
+    if (!g_scheduler.initialized) {
+        return NULL;
+    }
+
+    struct uthread_internal *self = scheduler_current();
+    /* The main thread runs on the process stack, which is not ours to copy */
+    if (self == NULL || self->cold->stack_base == NULL ||
+        self->cold->generator != NULL || self->task != NULL) {
+        return NULL;
+    }
+
+    struct clone_template tmpl = { .thread = self };
+    context_snapshot(&tmpl.snapshot, clone_block, &tmpl);
+
+    /* Released, or a clone's first switch */
+    struct uthread_internal *now = scheduler_current();
+    if (now != tmpl.thread) {
+        /* The switch that started us is complete, as in context_entry_wrapper */
+        t_worker->switching_from = NULL;
+        preemption_restore(0);
+        return now->cold->clone_arg;
+    }
+
+    return tmpl.value;
+}
+
+int uthread_clone(uthread_t *clone, uthread_t src, void *arg)
+{
+    if (!g_scheduler.initialized || clone == NULL || src == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *s = (struct uthread_internal *)src;
+
+    preemption_disable();
+
+    struct clone_template *tmpl = s->cold->clone_template;
+    if (tmpl == NULL) {
+        preemption_enable();
+        return UTHREAD_EINVAL;
+    }
+
+    thread_reap_zombies();
+
+    struct uthread_internal *t = thread_alloc();
+    if (t == NULL) {
+        preemption_enable();
+        return UTHREAD_ENOMEM;
+    }
+
+    /* Scheduling parameters and identity of the template */
+    t->priority = s->priority;
+    t->nice = s->nice;
+    t->weight = s->weight;
+    t->affinity = s->affinity;
+    t->cold->detached = s->cold->detached;
+    memcpy(t->cold->name, s->cold->name, UTHREAD_NAME_MAX);
+    t->cold->start_routine = s->cold->start_routine;
+    t->cold->arg = s->cold->arg;
+
+    uthread_group_t group;
+    uthread_getgroup(src, &group);
+    sched_group_join(t, group);
+
+    struct worker *home = worker_home(t);
+    if (home != t_worker) {
+        t->worker = home;
+    }
+
+    if (thread_setup_stack(t, s->cold->stack_size, home->node) != 0 ||
+        t->cold->stack_size != s->cold->stack_size) {
+        thread_free(t);
+        preemption_enable();
+        return UTHREAD_ENOMEM;
+    }
+
+    /* The stack above the park, and a context resuming it */
+    int ret = context_clone(t, s, &tmpl->snapshot);
+    if (ret != UTHREAD_SUCCESS) {
+        thread_free(t);
+        preemption_enable();
+        return ret;
+    }
+    t->cold->clone_arg = arg;
+    t->state = UTHREAD_STATE_READY;
+
+    ret = registry_add(t);
+    if (ret != UTHREAD_SUCCESS) {
+        thread_free(t);
+        preemption_enable();
+        return ret;
+    }
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        t->state_since = sched_clock_ns();
+    }
+    g_scheduler.ops->enqueue(t);
+    timer_queue_changed();
+
+    g_scheduler.total_threads_created++;
+
+    *clone = (uthread_t)t;
+
+    UTHREAD_DEBUG("Cloned thread %d from %d", t->tid, s->tid);
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_clone_release(uthread_t src, void *value)
+{
+    if (!g_scheduler.initialized || src == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *s = (struct uthread_internal *)src;
+
+    preemption_disable();
+
+    struct clone_template *tmpl = s->cold->clone_template;
+    if (tmpl == NULL) {
+        preemption_enable();
+        return UTHREAD_EINVAL;
+    }
+
+    s->cold->clone_template = NULL;
+    tmpl->value = value;
+    tmpl->released = true;
+    scheduler_unblock(s);
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
@@ -3,11 +3,19 @@
  *
  * Condition variables for thread synchronization.
  *
+ * Signal and broadcast use wait morphing, like futex FUTEX_CMP_REQUEUE: a
+ * waiter whose mutex is held, or already promised to a thread woken by
+ * the same call, is moved onto the mutex's wait queue rather than made
+ * runnable, and is woken from there by an unlock. Only a thread that can
+ * take the mutex straight away is made runnable, so a broadcast costs one
+ * context switch per waiter instead of two.
+ *
  * @file condvar.c
  */
 
 #define _GNU_SOURCE
 #include "internal.h"
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -52,11 +60,10 @@ int uthread_cond_init(uthread_cond_t *cond, const uthread_condattr_t *attr)
     cond->signal_seq = 0;
 
     /* Allocate wait queue */
-    cond->waiters = malloc(sizeof(struct wait_queue));
+    cond->waiters = wait_queue_alloc();
     if (cond->waiters == NULL) {
         return UTHREAD_ENOMEM;
     }
-    wait_queue_init(cond->waiters);
 
     cond->initialized = true;
 
@@ -80,8 +87,7 @@ int uthread_cond_destroy(uthread_cond_t *cond)
 
     /* Free wait queue */
     if (cond->waiters != NULL) {
-        wait_queue_destroy(cond->waiters);
-        free(cond->waiters);
+        wait_queue_free(cond->waiters);
         cond->waiters = NULL;
     }
 
@@ -90,6 +96,53 @@ int uthread_cond_destroy(uthread_cond_t *cond)
     return UTHREAD_SUCCESS;
 }
 
+/*
+ * Allocate the wait queue of a condvar created with the static initializer
+ * on first use.
+ * Done under the scheduler lock so two workers cannot both allocate.
+ */
+static int cond_lazy_init(uthread_cond_t *cond)
+{
+    int result = UTHREAD_SUCCESS;
+
+    preemption_disable();
+
+    if (cond->waiters == NULL) {
+        cond->waiters = wait_queue_alloc();
+        if (cond->waiters == NULL) {
+            result = UTHREAD_ENOMEM;
+        } else {
+            cond->initialized = true;
+        }
+    }
+
+    preemption_enable();
+
+    return result;
+}
+
+/*
+ * Wake up to `max` waiters, oldest first, requeueing onto their mutex
+ * those that could not take it yet. Called with preemption disabled.
+ */
+static void cond_wake(uthread_cond_t *cond, int max)
+{
+    uthread_mutex_t *claimed = NULL;
+    struct uthread_internal *thread;
+
+    while (max-- > 0 && (thread = wait_queue_remove(cond->waiters)) != NULL) {
+        uthread_mutex_t *mutex = thread->cond_mutex;
+
+        if (mutex != NULL && (mutex->lock != 0 || mutex == claimed)) {
+            mutex_requeue_locked(mutex, thread);
+        } else {
+            /* Free mutex: this thread takes it when it runs */
+            claimed = mutex;
+            scheduler_unblock(thread);
+        }
+    }
+}
+
 int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex)
 {
     if (cond == NULL || mutex == NULL) {
@@ -97,13 +150,8 @@ int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex)
     }
 
     /* Handle uninitialized condvar (static initializer) */
-    if (!cond->initialized) {
-        cond->waiters = malloc(sizeof(struct wait_queue));
-        if (cond->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(cond->waiters);
-        cond->initialized = true;
+    if (cond->waiters == NULL && cond_lazy_init(cond) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     preemption_disable();
@@ -119,42 +167,24 @@ int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex)
 
     /* Add ourselves to the wait queue */
     self->state = UTHREAD_STATE_BLOCKED;
+    self->cond_mutex = mutex;
     wait_queue_add(cond->waiters, self);
 
     /* Release the mutex atomically with blocking */
-    mutex->lock = 0;
-    mutex->owner = NULL;
-
-    /* Wake one waiter on the mutex if any */
-    if (mutex->waiters != NULL && !wait_queue_empty(mutex->waiters)) {
-        wait_queue_wake_one(mutex->waiters);
-    }
+    mutex_release_locked(mutex);
 
-    /* Enable preemption and schedule another thread */
-    preemption_enable();
+    /* Schedule another thread; preemption stays disabled across the switch */
     scheduler_schedule();
 
     /*
-     * When we wake up, we need to reacquire the mutex.
+     * When we wake up, we need to reacquire the mutex, possibly from its
+     * queue if a signal moved us there.
      * We might have been woken spuriously, so we don't check seq.
      */
-    preemption_disable();
-
-    /* Try to reacquire the mutex */
-    while (mutex->lock != 0) {
-        /* Block on mutex */
-        self->state = UTHREAD_STATE_BLOCKED;
-        wait_queue_add(mutex->waiters, self);
-
-        preemption_enable();
-        scheduler_schedule();
-        preemption_disable();
-    }
+    self->cond_mutex = NULL;
 
-    /* Acquired the mutex */
-    mutex->lock = 1;
-    mutex->owner = self;
-    mutex->recursion_count = 1;
+    /* Reacquire the mutex, blocking on it if it is held */
+    mutex_acquire_locked(mutex, self);
 
     preemption_enable();
 
@@ -171,13 +201,8 @@ int uthread_cond_timedwait(uthread_cond_t *cond,
     }
 
     /* Handle uninitialized condvar */
-    if (!cond->initialized) {
-        cond->waiters = malloc(sizeof(struct wait_queue));
-        if (cond->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(cond->waiters);
-        cond->initialized = true;
+    if (cond->waiters == NULL && cond_lazy_init(cond) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     /* Convert abstime to deadline in nanoseconds */
@@ -194,61 +219,20 @@ int uthread_cond_timedwait(uthread_cond_t *cond,
 
     uint64_t seq = cond->signal_seq;
 
-    /* Add ourselves to the wait queue */
-    self->state = UTHREAD_STATE_BLOCKED;
-    wait_queue_add(cond->waiters, self);
-
     /* Release the mutex */
-    mutex->lock = 0;
-    mutex->owner = NULL;
-
-    if (mutex->waiters != NULL && !wait_queue_empty(mutex->waiters)) {
-        wait_queue_wake_one(mutex->waiters);
-    }
+    self->cond_mutex = mutex;
+    mutex_release_locked(mutex);
 
     /*
-     * Wait loop with timeout check.
-     * This is a simplified implementation - a proper one would
-     * use a sleep queue with deadline-based wakeup.
+     * Block on the condvar with a deadline. A signal removes us from the
+     * sleep queue; otherwise the scheduler pulls us off the wait queue
+     * when the deadline passes.
      */
-    int result = UTHREAD_SUCCESS;
-    bool timed_out = false;
-
-    while (self->blocked_queue != NULL) {  /* Still in wait queue */
-        preemption_enable();
-
-        /* Check timeout */
-        uint64_t now = get_time_ns();
-        if (now >= deadline) {
-            timed_out = true;
-            /* Remove from wait queue */
-            preemption_disable();
-            wait_queue_remove_specific(cond->waiters, self);
-            break;
-        }
-
-        /* Yield and wait a bit */
-        scheduler_schedule();
-        preemption_disable();
-    }
-
-    if (timed_out) {
-        result = UTHREAD_ETIMEDOUT;
-    }
+    int result = scheduler_block_until(cond->waiters, deadline);
+    self->cond_mutex = NULL;
 
     /* Reacquire the mutex */
-    while (mutex->lock != 0) {
-        self->state = UTHREAD_STATE_BLOCKED;
-        wait_queue_add(mutex->waiters, self);
-
-        preemption_enable();
-        scheduler_schedule();
-        preemption_disable();
-    }
-
-    mutex->lock = 1;
-    mutex->owner = self;
-    mutex->recursion_count = 1;
+    mutex_acquire_locked(mutex, self);
 
     preemption_enable();
 
@@ -263,13 +247,8 @@ int uthread_cond_signal(uthread_cond_t *cond)
     }
 
     /* Handle uninitialized condvar */
-    if (!cond->initialized) {
-        cond->waiters = malloc(sizeof(struct wait_queue));
-        if (cond->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(cond->waiters);
-        cond->initialized = true;
+    if (cond->waiters == NULL && cond_lazy_init(cond) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     preemption_disable();
@@ -277,9 +256,9 @@ int uthread_cond_signal(uthread_cond_t *cond)
     /* Increment sequence number */
     cond->signal_seq++;
 
-    /* Wake one waiting thread */
+    /* Wake one waiting thread, or move it onto its held mutex */
     if (cond->waiters != NULL && !wait_queue_empty(cond->waiters)) {
-        wait_queue_wake_one(cond->waiters);
+        cond_wake(cond, 1);
     }
 
     preemption_enable();
@@ -294,13 +273,8 @@ int uthread_cond_broadcast(uthread_cond_t *cond)
     }
 
     /* Handle uninitialized condvar */
-    if (!cond->initialized) {
-        cond->waiters = malloc(sizeof(struct wait_queue));
-        if (cond->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(cond->waiters);
-        cond->initialized = true;
+    if (cond->waiters == NULL && cond_lazy_init(cond) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     preemption_disable();
@@ -308,9 +282,9 @@ int uthread_cond_broadcast(uthread_cond_t *cond)
     /* Increment sequence number */
     cond->signal_seq++;
 
-    /* Wake all waiting threads */
+    /* Wake all waiting threads; at most one runs, the rest queue on the mutex */
     if (cond->waiters != NULL) {
-        wait_queue_wake_all(cond->waiters);
+        cond_wake(cond, INT_MAX);
     }
 
     preemption_enable();
@@ -1,7 +1,8 @@
 /**
  * LibUThread Context Management
  *
- * Implements context switching using ucontext API.
+ * Implements context switching using either the ucontext API or, when
+ * built with UTHREAD_ASM_CONTEXT, a hand-written x86-64 register switch.
  *
  * @file context.c
  */
@@ -11,6 +12,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 /**
  * Thread entry wrapper function.
@@ -23,13 +27,16 @@ void context_entry_wrapper(void)
     struct uthread_internal *self = scheduler_current();
 
     UTHREAD_ASSERT(self != NULL);
-    UTHREAD_ASSERT(self->start_routine != NULL);
+    UTHREAD_ASSERT(self->cold->start_routine != NULL);
 
-    /* Enable preemption now that we're running */
-    preemption_enable();
+    /* The switch that started us is complete */
+    t_worker->switching_from = NULL;
+
+    /* New threads start with preemption enabled */
+    preemption_restore(0);
 
     /* Call the user's thread function */
-    void *retval = self->start_routine(self->arg);
+    void *retval = self->cold->start_routine(self->cold->arg);
 
     /* Thread returned normally - call exit */
     uthread_exit(retval);
@@ -38,36 +45,242 @@ void context_entry_wrapper(void)
     UTHREAD_ASSERT(0 && "context_entry_wrapper: uthread_exit returned");
 }
 
+#ifdef UTHREAD_ASM_CONTEXT
+
+/** Default MXCSR: all exceptions masked, round to nearest */
+#define CONTEXT_MXCSR_DEFAULT   0x1F80
+
+/** Default x87 control word: all exceptions masked, extended precision */
+#define CONTEXT_FPUCW_DEFAULT   0x037F
+
 /**
- * Initialize a thread's context.
+ * Initialize a context that starts in `entry` on the thread's stack.
  *
- * Sets up the ucontext structure so the thread will start
- * execution at context_entry_wrapper.
+ * Builds the frame context_swap() expects at the top of the thread's
+ * stack, so the first switch "returns" into `entry` with the stack
+ * aligned as if it had been called.
  *
- * @param thread Thread to initialize
+ * @param thread Thread (or generator) to initialize
+ * @param entry  Function the first switch enters; must not return
  */
-void context_init(struct uthread_internal *thread)
+void context_init_entry(struct uthread_internal *thread, void (*entry)(void))
+{
+    UTHREAD_ASSERT(thread != NULL);
+    UTHREAD_ASSERT(thread->cold->stack_base != NULL);
+    UTHREAD_ASSERT(thread->cold->stack_size >= UTHREAD_STACK_MIN);
+
+    uintptr_t top = (uintptr_t)thread->cold->stack_base + thread->cold->stack_size;
+    top &= ~(uintptr_t)15;
+
+    uint64_t *sp = (uint64_t *)top;
+
+    *--sp = 0;                                  /* Fake return address */
+    *--sp = (uint64_t)(uintptr_t)entry;
+    *--sp = 0;                                  /* rbp */
+    *--sp = 0;                                  /* rbx */
+    *--sp = 0;                                  /* r12 */
+    *--sp = 0;                                  /* r13 */
+    *--sp = 0;                                  /* r14 */
+    *--sp = 0;                                  /* r15 */
+    *--sp = CONTEXT_MXCSR_DEFAULT;
+    *--sp = CONTEXT_FPUCW_DEFAULT;
+
+    thread->context_sp = sp;
+}
+
+/**
+ * Initialize the context of the calling thread.
+ *
+ * Nothing needs capturing: the frame is saved on the first switch away.
+ *
+ * @param thread Thread structure for the caller
+ * @return 0 on success
+ */
+int context_init_self(struct uthread_internal *thread)
+{
+    UTHREAD_ASSERT(thread != NULL);
+
+    thread->context_sp = NULL;
+    return 0;
+}
+
+#else /* !UTHREAD_ASM_CONTEXT */
+
+/**
+ * Initialize a context that starts in `entry` on the thread's stack.
+ *
+ * Sets up the ucontext structure so the first switch starts execution
+ * at `entry`.
+ *
+ * @param thread Thread (or generator) to initialize
+ * @param entry  Function the first switch enters; must not return
+ */
+void context_init_entry(struct uthread_internal *thread, void (*entry)(void))
 {
     UTHREAD_ASSERT(thread != NULL);
-    UTHREAD_ASSERT(thread->stack_base != NULL);
-    UTHREAD_ASSERT(thread->stack_size >= UTHREAD_STACK_MIN);
+    UTHREAD_ASSERT(thread->cold->stack_base != NULL);
+    UTHREAD_ASSERT(thread->cold->stack_size >= UTHREAD_STACK_MIN);
 
     /* Get current context as a base */
-    if (getcontext(&thread->context) == -1) {
+    if (getcontext(&thread->cold->context) == -1) {
         perror("getcontext");
         abort();
     }
 
     /* Set up the stack */
-    thread->context.uc_stack.ss_sp = thread->stack_base;
-    thread->context.uc_stack.ss_size = thread->stack_size;
-    thread->context.uc_stack.ss_flags = 0;
+    thread->cold->context.uc_stack.ss_sp = thread->cold->stack_base;
+    thread->cold->context.uc_stack.ss_size = thread->cold->stack_size;
+    thread->cold->context.uc_stack.ss_flags = 0;
 
     /* No successor context - thread will call uthread_exit */
-    thread->context.uc_link = NULL;
+    thread->cold->context.uc_link = NULL;
+
+    /* Start with the timer signal deliverable (preemption depth 0) */
+    sigdelset(&thread->cold->context.uc_sigmask, PREEMPT_SIGNAL);
 
     /* Create the context to start at our wrapper function */
-    makecontext(&thread->context, context_entry_wrapper, 0);
+    makecontext(&thread->cold->context, entry, 0);
+}
+
+/**
+ * Initialize the context of the calling thread.
+ *
+ * @param thread Thread structure for the caller
+ * @return 0 on success, -1 on failure
+ */
+int context_init_self(struct uthread_internal *thread)
+{
+    UTHREAD_ASSERT(thread != NULL);
+
+    return getcontext(&thread->cold->context);
+}
+
+/**
+ * Save the caller's registers into `slot`, then call fn(arg). A copy of
+ * the stack from the saved stack pointer up, resumed through the slot,
+ * returns from here without calling fn.
+ *
+ * @param slot Where to save the registers
+ * @param fn   Function to call below the saved frame
+ * @param arg  Argument for fn
+ */
+void context_snapshot(context_slot_t *slot, void (*fn)(void *), void *arg)
+{
+    volatile bool taken = false;
+
+    if (getcontext(slot) == -1) {
+        perror("getcontext");
+        abort();
+    }
+
+    /* Copies were taken while fn ran, so they skip it */
+    if (!taken) {
+        taken = true;
+        fn(arg);
+    }
+}
+
+#endif /* UTHREAD_ASM_CONTEXT */
+
+/**
+ * Initialize a thread's context to start at context_entry_wrapper.
+ *
+ * @param thread Thread to initialize
+ */
+void context_init(struct uthread_internal *thread)
+{
+    context_init_entry(thread, context_entry_wrapper);
+}
+
+/**
+ * Save the registers into `from` and resume `to`, with nothing else: no
+ * statistics, no preemption depth, no scheduler state. Generators switch
+ * this way while running as the thread that resumed them.
+ *
+ * @param from Slot to save the caller in
+ * @param to   Slot to resume
+ */
+void context_swap_slots(context_slot_t *from, context_slot_t *to)
+{
+#ifdef UTHREAD_ASM_CONTEXT
+    context_swap(from, *to);
+#else
+    if (swapcontext(from, to) == -1) {
+        perror("swapcontext");
+        abort();
+    }
+#endif
+}
+
+/**
+ * Give `to` a copy of the stack `from` was using when `snapshot` was saved
+ * (see context_snapshot()), and a context that resumes it there.
+ *
+ * `to` must have a stack of the same size. Words of the copy and saved
+ * registers that point into `from`'s stack are moved to the same offset in
+ * `to`'s; nothing else is adjusted.
+ *
+ * @param to       Thread to set up
+ * @param from     Thread the snapshot was taken on
+ * @param snapshot Registers saved by context_snapshot() on `from`
+ * @return 0 on success, UTHREAD_EINVAL if the snapshot is not within
+ *         `from`'s stack
+ */
+int context_clone(struct uthread_internal *to, const struct uthread_internal *from,
+                  const context_slot_t *snapshot)
+{
+    UTHREAD_ASSERT(to->cold->stack_size == from->cold->stack_size);
+
+    uintptr_t lo = (uintptr_t)from->cold->stack_base;
+    uintptr_t hi = lo + from->cold->stack_size;
+    uintptr_t delta = (uintptr_t)to->cold->stack_base - lo;
+
+#ifdef UTHREAD_ASM_CONTEXT
+    uintptr_t sp = (uintptr_t)*snapshot;
+#else
+    /*
+     * The lowest register pointing into the stack is taken as the stack
+     * pointer: copying from below it only copies more.
+     */
+    uintptr_t sp = hi;
+    to->cold->context = *snapshot;
+    uintptr_t *regs = (uintptr_t *)&to->cold->context.uc_mcontext;
+    size_t nregs = sizeof(to->cold->context.uc_mcontext) / sizeof(uintptr_t);
+    for (size_t i = 0; i < nregs; i++) {
+        if (regs[i] >= lo && regs[i] < hi) {
+            if (regs[i] < sp) {
+                sp = regs[i];
+            }
+            regs[i] += delta;
+        }
+    }
+#if defined(__x86_64__)
+    to->cold->context.uc_mcontext.fpregs = &to->cold->context.__fpregs_mem;
+#endif
+    to->cold->context.uc_stack.ss_sp = to->cold->stack_base;
+    to->cold->context.uc_stack.ss_size = to->cold->stack_size;
+    to->cold->context.uc_link = NULL;
+#endif
+
+    if (sp < lo || sp >= hi) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Copy the used part, then move the pointers into it */
+    sp &= ~(uintptr_t)(sizeof(uintptr_t) - 1);
+    memcpy((void *)(sp + delta), (void *)sp, hi - sp);
+
+    for (uintptr_t *w = (uintptr_t *)(sp + delta); w < (uintptr_t *)(hi + delta); w++) {
+        if (*w >= lo && *w < hi) {
+            *w += delta;
+        }
+    }
+
+#ifdef UTHREAD_ASM_CONTEXT
+    to->context_sp = (void *)(sp + delta);
+#endif
+
+    return UTHREAD_SUCCESS;
 }
 
 /**
@@ -84,24 +297,43 @@ void context_switch_to(struct uthread_internal *from, struct uthread_internal *t
     UTHREAD_ASSERT(from != NULL);
     UTHREAD_ASSERT(to != NULL);
 
-    /* Record timing */
-    uint64_t now = get_time_ns();
-    if (from->start_time > 0) {
-        uint64_t elapsed = now - from->start_time;
-        from->total_runtime += elapsed;
-    }
-    to->start_time = now;
-
     /* Update statistics */
     g_scheduler.context_switches++;
+    trace_record(TRACE_SWITCH, from->tid, to->tid);
+
+    /* Preemption depth belongs to the thread, not the CPU */
+    from->preempt_count = preemption_save();
 
     /* Swap contexts - saves 'from' and restores 'to' */
-    if (swapcontext(&from->context, &to->context) == -1) {
+#ifdef UTHREAD_ASM_CONTEXT
+    context_swap(&from->context_sp, to->context_sp);
+#else
+    if (swapcontext(&from->cold->context, &to->cold->context) == -1) {
         perror("swapcontext");
         abort();
     }
+#endif
 
     /* When we return here, 'from' has been scheduled again */
+    t_worker->switching_from = NULL;
+    preemption_restore(from->preempt_count);
+}
+
+/**
+ * Start running a thread without saving the current context.
+ *
+ * @param to Target thread
+ */
+void context_start(struct uthread_internal *to)
+{
+    UTHREAD_ASSERT(to != NULL);
+
+#ifdef UTHREAD_ASM_CONTEXT
+    void *discard;
+    context_swap(&discard, to->context_sp);
+#else
+    setcontext(&to->cold->context);
+#endif
 }
 
 /**
@@ -118,6 +350,50 @@ uint64_t get_time_ns(void)
     return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
 }
 
+struct sched_clock g_sched_clock;
+
+/**
+ * Calibrate the runtime accounting clock.
+ *
+ * The TSC is only used when CPUID reports it invariant (constant rate
+ * across P-/C-states), otherwise sched_clock_ns() reads CLOCK_MONOTONIC.
+ * Calibration runs once per process.
+ */
+void sched_clock_init(void)
+{
+    if (g_sched_clock.calibrated) {
+        return;
+    }
+    g_sched_clock.calibrated = true;
+
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+
+    /* CPUID 0x80000007 EDX bit 8: invariant TSC */
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+        !(edx & (1u << 8))) {
+        return;
+    }
+
+    uint64_t ns0 = get_time_ns();
+    uint64_t tsc0 = __builtin_ia32_rdtsc();
+    uint64_t ns1, tsc1;
+    do {
+        ns1 = get_time_ns();
+        tsc1 = __builtin_ia32_rdtsc();
+    } while (ns1 - ns0 < SCHED_CLOCK_CALIBRATE_NS);
+
+    if (tsc1 <= tsc0) {
+        return;
+    }
+
+    g_sched_clock.mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+    g_sched_clock.tsc_base = tsc1;
+    g_sched_clock.ns_base = ns1;
+    g_sched_clock.use_tsc = g_sched_clock.mult != 0;
+#endif
+}
+
 /**
  * Convert nice value to CFS weight.
  *
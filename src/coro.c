@@ -0,0 +1,388 @@
+/**
+ * LibUThread Generators and Futures
+ *
+ * A generator is a function on its own stack that its resumer switches
+ * into and out of directly. It borrows the identity of the thread that
+ * resumes it: the worker's current thread stays the resumer, so the run
+ * queue, statistics and preemption never see the generator, and a
+ * resume/yield pair is two register switches. Blocking or being preempted
+ * in the body blocks or preempts the resumer, whose context slot then
+ * holds the generator's registers until it is switched back in.
+ *
+ * The generator's stack and context live in a TCB that is never
+ * registered or queued, so the stack comes from and returns to the stack
+ * cache like a thread's. The resumer's registers go in a slot of the
+ * generator, not in the resumer's TCB, which a context switch in the body
+ * overwrites. Each thread tracks the generators it is running, innermost
+ * first, so that uthread_gen_yield() knows where to return.
+ *
+ * Futures are single-assignment values with a wait queue and a list of
+ * continuations. Their state is protected by disabling preemption.
+ *
+ * @file coro.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Generator lifecycle */
+enum gen_state {
+    GEN_SUSPENDED = 0,                  /**< Created, or stopped in a yield */
+    GEN_RUNNING,                        /**< Inside uthread_gen_resume() */
+    GEN_DONE                            /**< Body returned */
+};
+
+struct uthread_gen {
+    context_slot_t caller;              /**< Resumer's registers while running */
+    struct uthread_internal *tcb;       /**< Stack and own context */
+    struct uthread_gen *parent;         /**< Generator the resumer was running */
+    void *(*fn)(void *);                /**< Body */
+    void *arg;                          /**< Body argument */
+    void *value;                        /**< Value passed on the last switch */
+    enum gen_state state;
+};
+
+struct future_callback {
+    void *(*fn)(void *value, void *arg);
+    void *arg;
+    uthread_future_t *next;             /**< Set to fn's result, or NULL */
+    struct future_callback *link;
+};
+
+static struct slab_cache g_slab_gens = SLAB_CACHE_INIT(struct uthread_gen);
+static struct slab_cache g_slab_future_callbacks = SLAB_CACHE_INIT(struct future_callback);
+
+/* ==========================================================================
+ * Generators
+ * ========================================================================== */
+
+/* First code run on a generator's stack */
+static void gen_entry(void)
+{
+    struct uthread_gen *gen = scheduler_current()->cold->generator;
+
+    void *retval = gen->fn(gen->arg);
+
+    /* Possibly resumed by another thread since the start */
+    struct uthread_internal *self = scheduler_current();
+    gen = self->cold->generator;
+    self->cold->generator = gen->parent;
+
+    gen->value = retval;
+    gen->state = GEN_DONE;
+    context_swap_slots(context_slot(gen->tcb), &gen->caller);
+
+    UTHREAD_ASSERT(0 && "gen_entry: finished generator resumed");
+}
+
+int uthread_gen_create(uthread_gen_t *gen, void *(*fn)(void *), void *arg,
+                       size_t stack_size)
+{
+    if (gen == NULL || fn == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    if (!g_scheduler.initialized || t_worker == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    if (stack_size == 0) {
+        stack_size = UTHREAD_STACK_DEFAULT;
+    } else if (stack_size < UTHREAD_STACK_MIN) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_gen *g = slab_alloc(&g_slab_gens);
+    if (g == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+
+    preemption_disable();
+
+    g->tcb = thread_alloc();
+    if (g->tcb == NULL) {
+        slab_free(&g_slab_gens, g);
+        preemption_enable();
+        return UTHREAD_ENOMEM;
+    }
+    if (thread_setup_stack(g->tcb, stack_size, t_worker->node) != UTHREAD_SUCCESS) {
+        thread_free(g->tcb);
+        slab_free(&g_slab_gens, g);
+        preemption_enable();
+        return UTHREAD_ENOMEM;
+    }
+
+    preemption_enable();
+
+    g->fn = fn;
+    g->arg = arg;
+    g->state = GEN_SUSPENDED;
+    context_init_entry(g->tcb, gen_entry);
+
+    *gen = g;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_gen_destroy(uthread_gen_t gen)
+{
+    if (gen == NULL) {
+        return UTHREAD_EINVAL;
+    }
+    if (gen->state == GEN_RUNNING) {
+        return UTHREAD_EBUSY;
+    }
+
+    preemption_disable();
+    thread_free(gen->tcb);
+    slab_free(&g_slab_gens, gen);
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_gen_resume(uthread_gen_t gen, void *in, void **out)
+{
+    if (gen == NULL || !g_scheduler.initialized || t_worker == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *self = scheduler_current();
+    if (self == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (gen->state == GEN_RUNNING) {
+        return UTHREAD_EBUSY;
+    }
+    if (gen->state == GEN_DONE) {
+        if (out != NULL) {
+            *out = gen->value;
+        }
+        return UTHREAD_EPIPE;
+    }
+
+    gen->state = GEN_RUNNING;
+    gen->value = in;
+    gen->parent = self->cold->generator;
+    self->cold->generator = gen;
+
+    context_swap_slots(&gen->caller, context_slot(gen->tcb));
+
+    /* Yielded or returned; the generator already popped itself */
+    if (out != NULL) {
+        *out = gen->value;
+    }
+
+    if (gen->state == GEN_DONE) {
+        /* Nothing runs on the stack any more: let the next generator have it */
+        preemption_disable();
+        thread_release_stack(gen->tcb);
+        preemption_enable();
+        return UTHREAD_EPIPE;
+    }
+    return UTHREAD_SUCCESS;
+}
+
+void *uthread_gen_yield(void *value)
+{
+    struct uthread_internal *self = scheduler_current();
+    if (self == NULL || self->cold->generator == NULL) {
+        return NULL;
+    }
+
+    struct uthread_gen *gen = self->cold->generator;
+    self->cold->generator = gen->parent;
+
+    gen->value = value;
+    gen->state = GEN_SUSPENDED;
+    context_swap_slots(context_slot(gen->tcb), &gen->caller);
+
+    /* Resumed, by this thread or another */
+    return gen->value;
+}
+
+uthread_gen_t uthread_gen_self(void)
+{
+    struct uthread_internal *self = scheduler_current();
+    return (self != NULL) ? self->cold->generator : NULL;
+}
+
+/* ==========================================================================
+ * Futures
+ * ========================================================================== */
+
+int uthread_future_init(uthread_future_t *future)
+{
+    if (future == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    memset(future, 0, sizeof(*future));
+    wait_queue_init(&future->waiters);
+    future->initialized = true;
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_future_destroy(uthread_future_t *future)
+{
+    if (future == NULL || !future->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (!wait_queue_empty(&future->waiters)) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    while (future->callbacks != NULL) {
+        struct future_callback *cb = future->callbacks;
+        future->callbacks = cb->link;
+        slab_free(&g_slab_future_callbacks, cb);
+    }
+    future->initialized = false;
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_future_set(uthread_future_t *future, void *value)
+{
+    if (future == NULL || !future->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (future->ready) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    future->value = value;
+    future->ready = true;
+
+    /* Take the continuations, putting them back in the order added */
+    struct future_callback *cbs = NULL;
+    while (future->callbacks != NULL) {
+        struct future_callback *cb = future->callbacks;
+        future->callbacks = cb->link;
+        cb->link = cbs;
+        cbs = cb;
+    }
+
+    /* A lone waiter may run next in our place, as after a semaphore post */
+    if (future->waiters.count == 1) {
+        wait_queue_wake_partner(&future->waiters);
+    } else {
+        wait_queue_wake_all(&future->waiters);
+    }
+
+    preemption_enable();
+
+    while (cbs != NULL) {
+        struct future_callback *cb = cbs;
+        cbs = cb->link;
+
+        void *result = cb->fn(value, cb->arg);
+        if (cb->next != NULL) {
+            uthread_future_set(cb->next, result);
+        }
+        slab_free(&g_slab_future_callbacks, cb);
+    }
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_future_await(uthread_future_t *future, void **value)
+{
+    if (future == NULL || !future->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    struct uthread_internal *self = scheduler_current();
+
+    while (!future->ready) {
+        if (self == NULL) {
+            preemption_enable();
+            return UTHREAD_EINVAL;
+        }
+
+        self->state = UTHREAD_STATE_BLOCKED;
+        wait_queue_add(&future->waiters, self);
+
+        /* Switch away still holding off preemption (and other workers) */
+        scheduler_schedule();
+    }
+
+    if (value != NULL) {
+        *value = future->value;
+    }
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_future_try(uthread_future_t *future, void **value)
+{
+    if (future == NULL || !future->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (!future->ready) {
+        preemption_enable();
+        return UTHREAD_EAGAIN;
+    }
+    if (value != NULL) {
+        *value = future->value;
+    }
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_future_then(uthread_future_t *future,
+                        void *(*fn)(void *value, void *arg), void *arg,
+                        uthread_future_t *next)
+{
+    if (future == NULL || !future->initialized || fn == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (!future->ready) {
+        struct future_callback *cb = slab_alloc(&g_slab_future_callbacks);
+        if (cb == NULL) {
+            preemption_enable();
+            return UTHREAD_ENOMEM;
+        }
+        cb->fn = fn;
+        cb->arg = arg;
+        cb->next = next;
+        cb->link = future->callbacks;
+        future->callbacks = cb;
+        preemption_enable();
+        return UTHREAD_SUCCESS;
+    }
+
+    preemption_enable();
+
+    /* Already set: continue now */
+    void *result = fn(future->value, arg);
+    if (next != NULL) {
+        uthread_future_set(next, result);
+    }
+
+    return UTHREAD_SUCCESS;
+}
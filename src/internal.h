@@ -13,10 +13,18 @@
 
 #include "uthread.h"
 #include <ucontext.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
 
+#ifdef UTHREAD_IO_URING
+#include <linux/io_uring.h>
+#endif
+
 /* ==========================================================================
  * Internal Constants
  * ========================================================================== */
@@ -27,6 +35,18 @@
 /** Stack guard page size */
 #define UTHREAD_GUARD_SIZE      4096
 
+/** Top of a lazily committed stack left resident when it is cached (8KB) */
+#define STACK_KEEP_SIZE         (8 * 1024)
+
+/** Address space reserved for each growable stack (8MB) */
+#define STACK_GROW_RESERVE      UTHREAD_STACK_MAX
+
+/** How much a growable stack is extended past a faulting address (64KB) */
+#define STACK_GROW_CHUNK        (64 * 1024)
+
+/** Alternate signal stack the growth handler runs on */
+#define STACK_FAULT_ALTSTACK    (64 * 1024)
+
 /** CFS target latency in nanoseconds (20ms) */
 #define CFS_TARGET_LATENCY_NS   (20 * 1000 * 1000)
 
@@ -36,79 +56,574 @@
 /** CFS base weight for nice 0 */
 #define CFS_NICE_0_WEIGHT       1024
 
+/** Direct hand-offs in a row on one worker before the run queue gets a turn */
+#define SCHED_HANDOFF_MAX       16
+
+/** Memory block behind thread arenas and slab caches (64KB) */
+#define ARENA_BLOCK_SIZE        (64 * 1024)
+
+/** Free arena blocks kept mapped for reuse */
+#define ARENA_BLOCK_CACHE       64
+
+/*
+ * Preemption signal. The tickless timer uses a real-time signal so that
+ * SIGALRM and alarm() stay available to the application.
+ */
+#ifdef UTHREAD_TICKLESS
+#define PREEMPT_SIGNAL          (SIGRTMIN + 1)
+#else
+#define PREEMPT_SIGNAL          SIGALRM
+#endif
+
+/** Shortest one-shot the tickless timer is armed for (20us) */
+#define TIMER_MIN_NS            (20 * 1000)
+
+/** Shortest timeslice: one-shots can be armed for well under a tick */
+#ifdef UTHREAD_TICKLESS
+#define TIMESLICE_MIN_NS        (50 * 1000)
+#else
+#define TIMESLICE_MIN_NS        (1000 * 1000)
+#endif
+
+/** How long the TSC is sampled against CLOCK_MONOTONIC at startup (1ms) */
+#define SCHED_CLOCK_CALIBRATE_NS (1 * 1000 * 1000)
+
 /* ==========================================================================
  * Wait Queue
  * ========================================================================== */
 
-/** Wait queue for blocking operations */
-struct wait_queue {
-    struct uthread_internal *head;
-    struct uthread_internal *tail;
+/* struct wait_queue is public so mutexes can embed it (see uthread.h) */
+
+/* ==========================================================================
+ * Sleep Queue
+ * ========================================================================== */
+
+/** Deadline-ordered min-heap of sleeping/timed-waiting threads */
+struct sleep_queue {
+    struct uthread_internal **heap;     /**< Sized with the thread registry */
     int count;
 };
 
+/* ==========================================================================
+ * Tasks
+ * ========================================================================== */
+
+/** Tasks submitted from one thread or task that have not completed yet */
+struct task_group {
+    int pending;                        /**< Submitted, not yet completed */
+    struct wait_queue waiters;          /**< Threads in uthread_task_group_wait() */
+};
+
+/** A run-to-completion closure queued by uthread_task_submit() */
+struct uthread_task {
+    void (*fn)(void *);
+    void *arg;
+    struct task_group *parent;          /**< Group the task completes into */
+    struct task_group children;         /**< Tasks this task submitted */
+    struct uthread_task *next;          /**< Queue or freelist linkage */
+};
+
+/**
+ * Task runners: detached threads that run queued tasks back to back on
+ * their own stacks. A runner whose task blocks is promoted to that task's
+ * thread and leaves the pool, so another runner takes over the queue.
+ */
+struct task_state {
+    struct uthread_task *head;          /**< FIFO of tasks not yet started */
+    struct uthread_task *tail;
+    struct uthread_task *free;          /**< Recycled task descriptors */
+    int free_count;
+    int runners;                        /**< Unpromoted runners, parked or not */
+    struct wait_queue idle;             /**< Runners waiting for a task */
+
+    /* Statistics */
+    uint64_t completed;
+    uint64_t promotions;
+};
+
+/** Descriptors kept for reuse once tasks complete */
+#define TASK_FREE_MAX           1024
+
+extern struct task_state g_tasks;
+
+/* ==========================================================================
+ * Thread Registry
+ * ========================================================================== */
+
+/*
+ * A tid is the registry slot plus one in the low bits and the slot's
+ * generation above it, so a tid that outlives its thread no longer
+ * matches once the slot is reused.
+ */
+#define TID_SLOT_BITS           20
+#define TID_SLOT_MASK           ((1 << TID_SLOT_BITS) - 1)
+#define TID_GEN_MASK            ((1 << (31 - TID_SLOT_BITS)) - 1)
+
+/** Most slots a registry can hold (slot + 1 must fit TID_SLOT_MASK) */
+#define REGISTRY_MAX_SLOTS      TID_SLOT_MASK
+
+/** Slab-indexed table of all live threads */
+struct thread_registry {
+    struct uthread_internal **slots;    /**< Thread in each slot, or NULL */
+    uint16_t *generations;              /**< Bumped when a slot is freed */
+    int *free_slots;                    /**< Stack of released slots */
+    int free_count;
+    int used;                           /**< Slots handed out so far */
+    int capacity;
+    int count;                          /**< Live threads */
+    struct uthread_internal *live;      /**< Live list (via reg_next) */
+};
+
 /* ==========================================================================
  * Thread Control Block (TCB)
  * ========================================================================== */
 
-/** Internal thread structure */
-struct uthread_internal {
+/** Cache line size the TCB layout is packed for */
+#define UTHREAD_CACHE_LINE      64
+
+/** Fast read holds of read-biased rwlocks a thread can have at once */
+#define RWLOCK_FAST_HOLDS       4
+
+/** Header at the start of an arena block (or of a large allocation) */
+struct arena_block {
+    struct arena_block *next;               /**< Older block of the same arena */
+    size_t size;                            /**< Mapped size, header included */
+};
+
+/** A thread's bump allocator, see uthread_arena_alloc() */
+struct thread_arena {
+    struct arena_block *blocks;             /**< Current block, older ones after it */
+    struct arena_block *oldest;             /**< Last block, to splice the list */
+    int nblocks;                            /**< Blocks on the list */
+    struct arena_block *large;              /**< Allocations bigger than a block */
+    char *ptr;                              /**< Next free byte of the current block */
+    char *end;                              /**< End of the current block */
+    bool registered;                        /**< Release queued as a cleanup handler */
+};
+
+struct sched_group;
+
+/** Pairing heap linkage (grouped CFS) */
+struct ph_node {
+    struct ph_node *child;                  /**< First child */
+    struct ph_node *next;                   /**< Next sibling */
+    struct ph_node *prev;                   /**< Previous sibling, or parent if first */
+};
+
+/**
+ * Cold part of a TCB: fields touched only when a thread is created, joined
+ * or torn down, at a stack fault, or by the debug and export paths. Kept
+ * out of struct uthread_internal so that run-queue and RB-tree walks do
+ * not drag the context and cleanup arrays through the cache. Allocated
+ * with the TCB and cached with it in the TCB pool.
+ */
+struct uthread_cold {
     /* Identity */
-    int tid;                                /**< Unique thread ID */
     char name[UTHREAD_NAME_MAX];            /**< Thread name */
 
-    /* Execution state */
+#ifndef UTHREAD_ASM_CONTEXT
     ucontext_t context;                     /**< CPU context */
-    uthread_state_t state;                  /**< Current state */
+#endif
 
     /* Stack */
     void *stack_base;                       /**< Allocated stack base */
     size_t stack_size;                      /**< Stack size */
     void *stack_guard;                      /**< Guard page (if used) */
+    void *stack_limit;                      /**< Lowest usable address (growable) */
+    int stack_node;                         /**< NUMA node the stack was placed on */
 
     /* Entry point */
     void *(*start_routine)(void *);         /**< Thread function */
     void *arg;                              /**< Function argument */
     void *retval;                           /**< Return value */
 
-    /* Scheduling */
-    int priority;                           /**< Priority (0-31) */
-    int nice;                               /**< Nice value (-20 to +19) */
-    int weight;                             /**< CFS weight */
-    uint64_t vruntime;                      /**< CFS virtual runtime */
-    uint64_t start_time;                    /**< Last schedule start */
-    uint64_t total_runtime;                 /**< Total execution time */
-    uint64_t timeslice_remaining;           /**< Remaining quantum */
-
-    /* Blocking */
+    /* Join synchronization */
+    struct uthread_internal *joiner;        /**< Thread joining on us */
     struct uthread_internal *waiting_on;    /**< Thread we're joining */
-    struct wait_queue *blocked_queue;       /**< Queue we're blocked on */
-
-    /* Queue linkage (for run queues and wait queues) */
-    struct uthread_internal *next;          /**< Next in queue */
-    struct uthread_internal *prev;          /**< Previous in queue */
+    bool detached;                          /**< Detached thread */
 
-    /* RB-tree linkage (for CFS) */
-    struct uthread_internal *rb_left;       /**< Left child */
-    struct uthread_internal *rb_right;      /**< Right child */
-    struct uthread_internal *rb_parent;     /**< Parent */
-    int rb_color;                           /**< Red or black */
+    /* Registry linkage */
+    int slot;                               /**< Index in the registry */
+    struct uthread_internal *reg_next;      /**< Next live thread */
+    struct uthread_internal *reg_prev;      /**< Previous live thread */
 
     /* Cleanup handlers */
     void (*cleanup_handlers[UTHREAD_CLEANUP_MAX])(void *);
     void *cleanup_args[UTHREAD_CLEANUP_MAX];
     int cleanup_count;
 
+    /* Tasks */
+    struct task_group tasks;                /**< Tasks submitted by this thread */
+
+    /* Arena */
+    struct thread_arena arena;              /**< uthread_arena_alloc() state */
+
+    /* Generators */
+    struct uthread_gen *generator;          /**< Innermost generator running as us */
+
+    /* Clones */
+    struct clone_template *clone_template;  /**< Set while parked as a template */
+    void *clone_arg;                        /**< uthread_clone_park() result of a clone */
+
+    /* Read-biased rwlocks held through a worker slot */
+    struct {
+        uthread_rwlock_t *lock;
+        int slot;                           /**< Worker slot that was marked */
+    } read_holds[RWLOCK_FAST_HOLDS];
+    int read_hold_count;
+};
+
+/**
+ * Internal thread structure: the hot scheduling header.
+ *
+ * The first cache line holds everything a run-queue pass or an RB-tree
+ * walk reads per node; the second the rest of what waking a thread and
+ * switching to it touch. Blocking state and statistics follow, and the
+ * rest lives in the cold part.
+ */
+struct uthread_internal {
+    /* Queue linkage (for run queues and wait queues) */
+    struct uthread_internal *next;          /**< Next in queue */
+    struct uthread_internal *prev;          /**< Previous in queue */
+
+    /* Run-queue position: RB-tree (CFS) or pairing heap (grouped CFS) */
+    union {
+        struct {
+            struct uthread_internal *rb_left;   /**< Left child */
+            struct uthread_internal *rb_right;  /**< Right child */
+            struct uthread_internal *rb_parent; /**< Parent */
+        };
+        struct ph_node ph;                  /**< Node in its group's heap */
+    };
+    uint64_t vruntime;                      /**< CFS virtual runtime */
+    int weight;                             /**< CFS weight */
+    uthread_state_t state;                  /**< Current state */
+    union {
+        struct {
+            int rb_color;                   /**< Red or black */
+            int priority_slot;              /**< Priority queue level + 1, 0 if not queued */
+        };
+        struct sched_group *group;          /**< Group it runs in (grouped CFS), NULL = root */
+    };
+
+    /* Wakeup and context switch */
+    uint64_t timeslice_remaining;           /**< Remaining quantum */
+    struct wait_queue *blocked_queue;       /**< Queue we're blocked on */
+    int tid;                                /**< Unique thread ID */
+    int sleep_index;                        /**< Heap slot + 1, 0 if not sleeping */
+    int priority;                           /**< Priority (0-31) */
+    int preempt_count;                      /**< Saved preemption depth */
+    uint64_t start_time;                    /**< Runtime charged up to here */
+#ifdef UTHREAD_ASM_CONTEXT
+    void *context_sp;                       /**< Saved stack pointer */
+#endif
+
+    /* M:N placement */
+    struct worker *worker;                  /**< Worker that last ran us */
+    struct worker *rq_worker;               /**< Worker whose queue holds us */
+    uint64_t affinity;                      /**< Workers allowed to run us, 0 = any */
+
+    /* Scheduling */
+    int nice;                               /**< Nice value (-20 to +19) */
+    uint64_t total_runtime;                 /**< Total execution time */
+
+    /* Blocking */
+    uint64_t wake_time;                     /**< Sleep deadline (ns) */
+    uint32_t io_events;                     /**< epoll events awaited on an fd */
+    uthread_mutex_t *cond_mutex;            /**< Mutex to retake after a condvar wait */
+    uint64_t lock_wait_since;               /**< When requeued (contention stats) */
+#ifdef UTHREAD_IO_URING
+    int io_result;                          /**< Result of a ring request */
+    int io_ring_fd;                         /**< fd of that request, -1 if closed */
+#endif
+
     /* Flags */
-    bool detached;                          /**< Detached thread */
+    bool timed_out;                         /**< Woken by deadline expiry */
+    bool mutex_handoff;                     /**< Lost a mutex race: take it over */
+    bool mutex_requeued;                    /**< Moved from a condvar onto a mutex */
+    bool pinned;                            /**< Never migrates off worker */
+    bool preempted;                         /**< Requeued by the tick */
     bool cancel_pending;                    /**< Cancellation requested */
     bool in_critical_section;               /**< In critical section */
     bool exited;                            /**< Thread has exited */
+    bool task_promoted;                     /**< Task blocked: runner left the pool */
 
-    /* Join synchronization */
-    struct uthread_internal *joiner;        /**< Thread joining on us */
+    /* Tasks */
+    struct uthread_task *task;              /**< Task being run (runners only) */
+
+    /* Per-thread statistics */
+    uint64_t voluntary_switches;            /**< Left the CPU yielding or blocking */
+    uint64_t involuntary_switches;          /**< Left the CPU preempted */
+    uint64_t state_since;                   /**< Entered READY/BLOCKED (contention stats) */
+    uint64_t ready_ns;                      /**< Time waiting for a CPU */
+    uint64_t max_ready_ns;                  /**< Longest single wait for a CPU */
+    uint64_t blocked_ns;                    /**< Time blocked */
+
+    struct uthread_cold *cold;              /**< Everything off the hot path */
+} __attribute__((aligned(UTHREAD_CACHE_LINE)));
+
+_Static_assert(offsetof(struct uthread_internal, group) + sizeof(void *)
+               <= UTHREAD_CACHE_LINE,
+               "run-queue linkage must fit the first cache line");
+_Static_assert(offsetof(struct uthread_internal, rq_worker) + sizeof(void *)
+               <= 2 * UTHREAD_CACHE_LINE,
+               "wakeup and switch fields must fit the second cache line");
+
+/* ==========================================================================
+ * Read-Biased Rwlocks
+ * ========================================================================== */
+
+/** A revoked bias stays off for this many times as long as revoking took */
+#define RWLOCK_BIAS_INHIBIT     9
+
+/** One worker's count of fast read holds, alone on its cache line */
+struct rwlock_slot {
+    int count;
+} __attribute__((aligned(UTHREAD_CACHE_LINE)));
+
+/**
+ * Read indicators of a read-biased rwlock. While enabled is set no writer
+ * holds or waits for the lock; a writer clears it under the scheduler
+ * lock and then waits for every slot to drain.
+ */
+struct rwlock_bias {
+    int enabled;                            /**< Readers may use the slots */
+    uint64_t inhibit_until;                 /**< Not re-enabled before (ns) */
+    uint64_t revoked_at;                    /**< Revocation being drained (ns) */
+    struct rwlock_slot slots[UTHREAD_MAX_WORKERS];
+};
+
+/* ==========================================================================
+ * Channels
+ * ========================================================================== */
+
+/** Cases of a select kept on the stack; larger selects allocate */
+#define CHAN_SELECT_STACK_CASES 8
+
+/**
+ * A blocked channel operation: one per case, all pointing at one
+ * chan_wait. The partner that completes a case unlinks every other case
+ * of the wait before waking its thread.
+ */
+struct chan_waiter {
+    struct chan_waiter *next;
+    struct chan_waiter *prev;
+    struct chan_wait *wait;                 /**< Shared by the cases */
+    uthread_chan_t *chan;                   /**< NULL for a skipped case */
+    void *item;                             /**< Item to send, or buffer */
+    bool send;                              /**< On the senders queue */
+    bool queued;                            /**< Linked on its channel */
+};
+
+/** A thread parked in a channel operation or select */
+struct chan_wait {
+    struct uthread_internal *thread;
+    struct chan_waiter *cases;
+    int ncases;
+    int fired;                              /**< Case completed, -1 if none */
+    int result;                             /**< UTHREAD_SUCCESS or EPIPE */
+};
+
+/* ==========================================================================
+ * Slab Caches
+ * ========================================================================== */
+
+/**
+ * Fixed-size objects the library allocates internally (wait queues, lock
+ * statistics, task descriptors, fd entries), carved from arena blocks and
+ * freed onto a list, so that creating one never calls malloc(). Blocks
+ * are kept for the life of the process: objects may outlive a shutdown.
+ */
+struct slab_cache {
+    size_t size;                            /**< Object size, 16-byte aligned */
+    void *free;                             /**< Free objects, linked through their first word */
+};
+
+#define SLAB_CACHE_INIT(type) { .size = (sizeof(type) + 15) & ~(size_t)15, .free = NULL }
+
+/** Wait queues of condition variables, semaphores and rwlocks */
+extern struct slab_cache g_slab_wait_queues;
+
+/* ==========================================================================
+ * Contention Statistics
+ * ========================================================================== */
+
+/** Counters of one mutex or rwlock, allocated on first use while enabled */
+struct lock_stats {
+    const void *lock;                       /**< The lock (identity only) */
+    uthread_lock_kind_t kind;
+    int index;                              /**< Slot in g_contention.locks */
+    uint64_t acquisitions;
+    uint64_t contended;                     /**< Acquisitions that had to wait */
+    uint64_t wait_ns;                       /**< Total time spent waiting */
+    uint64_t max_hold_ns;                   /**< Longest time held */
+    uint64_t held_since;                    /**< Taken at, 0 if not timed */
+};
+
+/** Contention statistics switch and lock table (persists across init) */
+struct contention_state {
+    bool enabled;                           /**< uthread_set_contention_stats() */
+    struct lock_stats **locks;
+    int count;
+    int capacity;
+};
+
+extern struct contention_state g_contention;
+
+/* ==========================================================================
+ * Tracing
+ * ========================================================================== */
+
+/** Default and maximum number of events each worker's ring holds */
+#define TRACE_DEFAULT_EVENTS    65536
+#define TRACE_MAX_EVENTS        (1 << 24)
+
+/** Event types recorded in the trace ring */
+enum trace_type {
+    TRACE_SWITCH = 1,                       /**< tid -> arg (next tid) */
+    TRACE_BLOCK,                            /**< tid left the CPU blocked */
+    TRACE_UNBLOCK,                          /**< tid made ready, arg = waker */
+    TRACE_PREEMPT,                          /**< Timer tick interrupted tid */
+    TRACE_LOCK_CONTENDED,                   /**< tid waits, arg = owner tid */
+    TRACE_SLEEP,                            /**< tid sleeps, arg = timeout us */
+};
+
+/** One binary trace record: 24 bytes, written in place */
+struct trace_event {
+    uint64_t time;                          /**< Raw TSC, or ns without one */
+    int32_t tid;
+    int32_t arg;
+    uint32_t type;                          /**< enum trace_type */
+};
+
+/**
+ * Per-worker event ring. Only the owning worker writes to it, and only
+ * with preemption disabled, so recording needs no atomics; old events
+ * are overwritten once the ring wraps.
+ */
+struct trace_ring {
+    struct trace_event *events;
+    uint64_t head;                          /**< Events ever recorded */
+    uint64_t mask;                          /**< Capacity - 1 (power of two) */
+};
+
+/** Whether events are being recorded (read on every hot-path site) */
+extern bool g_trace_enabled;
+
+/* ==========================================================================
+ * Profiling and Introspection
+ * ========================================================================== */
+
+/** Default and maximum number of samples each worker's ring holds */
+#define PROFILE_DEFAULT_SAMPLES 32768
+#define PROFILE_MAX_SAMPLES     (1 << 24)
+
+/** Default sampling period (1ms) */
+#define PROFILE_DEFAULT_PERIOD_NS (1000 * 1000)
+
+/** Return addresses recorded per sample, the interrupted pc included */
+#define PROFILE_MAX_DEPTH       8
+
+/** One sample: the interrupted thread and its innermost frames */
+struct profile_sample {
+    int32_t tid;
+    uint32_t depth;                         /**< Valid entries in pc */
+    uintptr_t pc[PROFILE_MAX_DEPTH];        /**< pc[0] interrupted, then callers */
+    char name[UTHREAD_NAME_MAX];            /**< Thread name, which may exit first */
 };
 
+/**
+ * Per-worker sample ring, written from the timer signal handler. The
+ * handler may interrupt an export on another worker, so it raises `busy`
+ * while it writes and readers wait for it to drop after stopping sampling.
+ */
+struct profile_ring {
+    struct profile_sample *samples;
+    uint64_t head;                          /**< Samples ever recorded */
+    uint64_t mask;                          /**< Capacity - 1 (power of two) */
+    atomic_bool busy;                       /**< Handler writing a sample */
+};
+
+/** Whether the timer handler records samples */
+extern atomic_bool g_profile_enabled;
+
+/** Snapshot hand-off between the introspection server and the workers */
+enum introspect_request {
+    INTROSPECT_IDLE = 0,
+    INTROSPECT_WANTED,                      /**< Take one at the next safe point */
+    INTROSPECT_TAKING,                      /**< A worker is writing it */
+    INTROSPECT_DONE                         /**< Written, server may send it */
+};
+
+/** enum introspect_request, polled at every switch and tick */
+extern atomic_int g_introspect_request;
+
+/* ==========================================================================
+ * Workers (kernel threads)
+ * ========================================================================== */
+
+/**
+ * A kernel thread that runs user threads.
+ *
+ * Worker 0 is the thread that called uthread_init(); further workers are
+ * pthreads started in M:N mode. All scheduler and synchronization state
+ * is shared and protected by the scheduler lock, which a worker holds
+ * while preemption is disabled.
+ */
+struct worker {
+    int id;                                 /**< Index in g_scheduler.workers */
+    pthread_t pthread;                      /**< Kernel thread running the worker */
+    bool started;                           /**< pthread is running */
+
+    struct uthread_internal *current;       /**< Thread running here */
+    struct uthread_internal idle_thread;    /**< Runs when nothing is ready */
+    struct uthread_internal host;           /**< Context of the pthread itself */
+    struct uthread_cold idle_cold;          /**< Cold part of idle_thread */
+    struct uthread_cold host_cold;          /**< Cold part of host */
+    bool in_scheduler;                      /**< Inside scheduler_schedule() */
+    struct uthread_internal *switching_from; /**< Still on the CPU while a switch completes */
+
+    /* Local run queue (work-stealing scheduler) */
+    struct uthread_internal *rq_head;
+    struct uthread_internal *rq_tail;
+    int rq_count;
+    uint32_t steal_seed;                    /**< Victim selection PRNG state */
+    uint64_t steals;                        /**< Threads taken from others */
+    uint64_t remote_steals;                 /**< Of those, from another node */
+
+    /* Placement (M:N with pinning) */
+    int cpu;                                /**< CPU the worker is pinned to, -1 if none */
+    int node;                               /**< NUMA node of that CPU */
+
+    /* Direct hand-off to a thread the running one woke or yielded to */
+    struct uthread_internal *handoff;       /**< Candidate to run next */
+    bool handoff_yield;                     /**< Set by uthread_yield_to() */
+    int handoff_chain;                      /**< Hand-offs since the last dequeue */
+    uint64_t handoffs;                      /**< Switches that bypassed the queue */
+
+    /* Idle wakeup */
+    bool idle;                              /**< Waiting for work */
+    atomic_uint wake_seq;                   /**< Futex word bumped to wake */
+
+    /* Per-worker preemption timer (M:N or tickless mode) */
+    timer_t timer;
+    bool timer_created;
+    uint64_t timer_expiry;                  /**< One-shot due (sched clock), 0 if none */
+
+    /* Growable stacks (UTHREAD_STACK_GROWABLE) */
+    void *fault_stack;                      /**< Alternate stack for SIGSEGV */
+
+    /* Event tracing (uthread_trace_start) */
+    struct trace_ring trace;
+
+    /* Sampling profiler (uthread_profile_start) */
+    struct profile_ring profile;
+};
+
+/** Worker the calling kernel thread belongs to (NULL outside the library) */
+extern _Thread_local struct worker *t_worker
+    __attribute__((tls_model("initial-exec")));
+
 /* ==========================================================================
  * Scheduler Interface
  * ========================================================================== */
@@ -124,6 +639,14 @@ struct scheduler_ops {
     /** Add thread to run queue */
     void (*enqueue)(struct uthread_internal *thread);
 
+    /**
+     * Add a batch of woken threads to the run queue, as if each had been
+     * enqueued in list order. The batch is linked through next/prev, with
+     * head->prev and tail->next NULL.
+     */
+    void (*enqueue_batch)(struct uthread_internal *head,
+                          struct uthread_internal *tail, int count);
+
     /** Remove and return next thread to run */
     struct uthread_internal *(*dequeue)(void);
 
@@ -133,12 +656,21 @@ struct scheduler_ops {
     /** Called when thread yields */
     void (*on_yield)(struct uthread_internal *thread);
 
-    /** Called when timer tick occurs */
-    void (*on_tick)(struct uthread_internal *thread, uint64_t elapsed_ns);
+    /** Charge CPU time used since the last charge (every tick and switch) */
+    void (*account)(struct uthread_internal *thread, uint64_t delta_ns);
+
+    /** Number of threads waiting in the run queue */
+    int (*nr_queued)(void);
 
     /** Check if preemption needed */
     bool (*should_preempt)(struct uthread_internal *current);
 
+    /**
+     * May a queued thread run ahead of the queue's choice because the
+     * thread leaving the CPU woke it (direct hand-off)?
+     */
+    bool (*may_handoff)(struct uthread_internal *thread);
+
     /** Update thread priority/nice */
     void (*update_priority)(struct uthread_internal *thread);
 
@@ -156,16 +688,20 @@ struct scheduler_state {
     sched_policy_t policy;
     struct scheduler_ops *ops;
 
-    /* Current running thread */
-    struct uthread_internal *current;
+    /* Kernel threads running user threads (current/idle live there) */
+    struct worker *workers;
+    int num_workers;
+    int num_nodes;                          /**< NUMA nodes the workers span */
+    bool stopping;                          /**< Workers should exit */
+
+    /* Exited detached threads awaiting release (linked via next) */
+    struct uthread_internal *zombies;
 
-    /* Idle thread (runs when no other thread ready) */
-    struct uthread_internal idle_thread;
+    /* Threads blocked with a deadline */
+    struct sleep_queue sleepers;
 
     /* All threads */
-    struct uthread_internal *all_threads[UTHREAD_MAX_THREADS];
-    int thread_count;
-    int next_tid;
+    struct thread_registry threads;
 
     /* Timing */
     uint64_t timeslice_ns;
@@ -180,7 +716,6 @@ struct scheduler_state {
     /* State flags */
     bool initialized;
     bool preemption_enabled;
-    bool in_scheduler;
 
     /* Signal handling */
     sigset_t block_mask;
@@ -190,6 +725,118 @@ struct scheduler_state {
 /** Global scheduler instance */
 extern struct scheduler_state g_scheduler;
 
+/* ==========================================================================
+ * Stack and TCB Pool
+ * ========================================================================== */
+
+/** Number of distinct stack sizes the pool caches */
+#define UTHREAD_POOL_BUCKETS    8
+
+/** Cached stacks of one size and node, linked through their top word */
+struct stack_bucket {
+    size_t size;                        /**< Usable stack size (0 = unused) */
+    int node;                           /**< NUMA node the stacks are on */
+    void *head;                         /**< Most recently released stack */
+    int count;                          /**< Stacks in this bucket */
+};
+
+/** Caches that let create/exit cycles avoid mmap, munmap and malloc */
+struct thread_pool {
+    struct stack_bucket buckets[UTHREAD_POOL_BUCKETS];
+    struct uthread_internal *free_tcbs; /**< TCB freelist (via next) */
+    int free_tcb_count;
+    int max_cached;                     /**< Per-bucket and TCB limit */
+    uthread_stack_mode_t stack_mode;    /**< How stacks are committed */
+
+    /* Statistics */
+    uint64_t stack_hits;
+    uint64_t stack_misses;
+    uint64_t tcb_hits;
+    uint64_t tcb_misses;
+    uint64_t stack_growths;             /**< Guard faults served by growing */
+};
+
+/** Global pool instance (persists across init/shutdown, drained at shutdown) */
+extern struct thread_pool g_thread_pool;
+
+/* ==========================================================================
+ * Non-blocking I/O
+ * ========================================================================== */
+
+/** Context switches between non-blocking polls while threads wait on I/O */
+#define IO_POLL_INTERVAL        8
+
+/** Threads parked on one file descriptor */
+struct io_fd {
+    struct wait_queue waiters;          /**< Parked threads (any direction) */
+    unsigned int seq;                   /**< Bumped on every readiness event */
+    bool registered;                    /**< Added to the epoll set at some point */
+};
+
+/** epoll state shared by all workers */
+struct io_state {
+    int epfd;                           /**< epoll instance, -1 until first wait */
+    int wakefd;                         /**< eventfd that interrupts the poller */
+    struct io_fd **fds;                 /**< Indexed by fd, NULL if unused */
+    int nfds;                           /**< Size of fds */
+    int waiting;                        /**< Threads parked on any fd */
+    struct worker *poller;              /**< Worker blocked in epoll_wait() */
+    unsigned int polls_skipped;         /**< Switches since the last poll */
+};
+
+extern struct io_state g_io;
+
+#ifdef UTHREAD_IO_URING
+/** Largest transfer one ring request may ask for (as read(2) caps it) */
+#define IO_RING_MAX_LEN         0x7ffff000u
+
+/** Queued requests that are submitted without waiting for idle */
+#define IO_RING_BATCH           32
+
+/** io_uring shared with the kernel (io_uring.c) */
+struct io_ring {
+    int fd;                             /**< Ring, -1 until first use */
+    int eventfd;                        /**< Signalled on completion, in epoll */
+    bool failed;                        /**< Setup failed: use the epoll path */
+
+    /* Submission queue */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned int pending;               /**< SQEs queued but not submitted */
+
+    /* Completion queue */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Mappings */
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+
+    struct wait_queue inflight;         /**< Threads waiting for a CQE */
+
+    /* Registered resources */
+    int *fixed_files;                   /**< fd -> fixed index, -1 if none */
+    int nfixed;                         /**< Size of fixed_files */
+    struct iovec *buffers;              /**< Registered buffers */
+    unsigned int nbuffers;
+
+    /* Statistics */
+    uint64_t requests;                  /**< CQEs reaped */
+    uint64_t enters;                    /**< io_uring_enter() calls */
+};
+
+extern struct io_ring g_ring;
+#endif
+
 /* ==========================================================================
  * Round-Robin Scheduler Data
  * ========================================================================== */
@@ -209,9 +856,22 @@ extern struct scheduler_ops sched_rr_ops;
  * ========================================================================== */
 
 /** Priority scheduler state */
+/** 64-bit words in the non-empty level bitmap */
+#define PRIORITY_BITMAP_WORDS   ((UTHREAD_PRIORITY_LEVELS + 63) / 64)
+
+_Static_assert(PRIORITY_BITMAP_WORDS <= 64,
+               "UTHREAD_PRIORITY_LEVELS exceeds the two-level bitmap");
+
+/** FIFO of ready threads at one priority */
+struct priority_level {
+    struct uthread_internal *head;
+    struct uthread_internal *tail;
+};
+
 struct sched_priority_state {
-    struct uthread_internal *queues[UTHREAD_PRIORITY_LEVELS];
-    uint32_t bitmap;    /* Non-empty queue bitmap */
+    struct priority_level levels[UTHREAD_PRIORITY_LEVELS];
+    uint64_t bitmap[PRIORITY_BITMAP_WORDS]; /* Non-empty levels */
+    uint64_t summary;                       /* Non-zero bitmap words */
     int count;
 };
 
@@ -230,42 +890,201 @@ extern struct scheduler_ops sched_priority_ops;
 struct sched_cfs_state {
     struct uthread_internal *rb_root;
     struct uthread_internal *rb_leftmost;   /* Cache for O(1) access */
-    uint64_t min_vruntime;
+    uint64_t min_vruntime;                  /* Never decreases */
+    uint64_t load;                          /* Sum of queued weights */
     int count;
 };
 
 extern struct sched_cfs_state g_cfs_state;
 extern struct scheduler_ops sched_cfs_ops;
 
+/* ==========================================================================
+ * Grouped CFS Scheduler Data
+ * ========================================================================== */
+
+/**
+ * A scheduling group: CFS over its own threads, and one entity of
+ * weight `weight` in the heap of groups. The group's vruntime advances
+ * by the runtime of each of its threads scaled by the group's weight,
+ * so groups share the CPU by weight however many threads they have.
+ */
+struct sched_group {
+    struct ph_node node;                    /* In the heap of groups */
+    struct ph_node *threads;                /* Heap of its queued threads */
+    uint64_t vruntime;                      /* Group virtual runtime */
+    uint64_t min_vruntime;                  /* Of its threads; never decreases */
+    uint64_t load;                          /* Sum of queued threads' weights */
+    int weight;                             /* Share among groups */
+    int nr_queued;                          /* Threads in the heap */
+    int nr_threads;                         /* Member threads */
+    struct sched_group *next;               /* All created groups */
+    struct sched_group *prev;
+};
+
+/** Grouped CFS scheduler state */
+struct sched_cfs_group_state {
+    struct ph_node *groups;                 /* Heap of groups with queued threads */
+    struct sched_group root;                /* Threads in no group */
+    struct sched_group *created;            /* uthread_group_create() list */
+    uint64_t min_vruntime;                  /* Of groups; never decreases */
+    uint64_t load;                          /* Sum of queued groups' weights */
+    int count;                              /* Queued threads */
+};
+
+extern struct sched_cfs_group_state g_cfs_group_state;
+extern struct scheduler_ops sched_cfs_group_ops;
+
+/* ==========================================================================
+ * Work-Stealing Scheduler Data
+ * ========================================================================== */
+
+/** Per-worker FIFO queues with stealing, used in M:N mode */
+extern struct scheduler_ops sched_ws_ops;
+
 /* ==========================================================================
  * Internal Function Declarations
  * ========================================================================== */
 
 /* Context Management (context.c) */
+
+/** Where a switch saves a context's registers */
+#ifdef UTHREAD_ASM_CONTEXT
+typedef void *context_slot_t;
+#else
+typedef ucontext_t context_slot_t;
+#endif
+
+/** A thread's own context slot */
+static inline context_slot_t *context_slot(struct uthread_internal *thread)
+{
+#ifdef UTHREAD_ASM_CONTEXT
+    return &thread->context_sp;
+#else
+    return &thread->cold->context;
+#endif
+}
+
 void context_init(struct uthread_internal *thread);
+void context_init_entry(struct uthread_internal *thread, void (*entry)(void));
+void context_swap_slots(context_slot_t *from, context_slot_t *to);
+void context_snapshot(context_slot_t *slot, void (*fn)(void *), void *arg);
+int context_clone(struct uthread_internal *to, const struct uthread_internal *from,
+                  const context_slot_t *snapshot);
+int context_init_self(struct uthread_internal *thread);
 void context_switch_to(struct uthread_internal *from, struct uthread_internal *to);
+void context_start(struct uthread_internal *to);
 void context_entry_wrapper(void);
 
+#ifdef UTHREAD_ASM_CONTEXT
+/* Register switch (context_x86_64.S) */
+void context_swap(void **from_sp, void *to_sp);
+#endif
+
 /* Scheduler Core (scheduler.c) */
 void scheduler_init_common(void);
 void scheduler_schedule(void);
 void scheduler_yield(void);
 void scheduler_block(struct wait_queue *wq);
+int scheduler_block_until(struct wait_queue *wq, uint64_t deadline);
 void scheduler_unblock(struct uthread_internal *thread);
+void scheduler_unblock_partner(struct uthread_internal *thread);
+void scheduler_yield_to(struct uthread_internal *thread);
+void scheduler_forget_handoff(struct uthread_internal *thread);
+void scheduler_unblock_batch(struct uthread_internal *head,
+                             struct uthread_internal *tail, int count);
+void scheduler_account(struct uthread_internal *thread, uint64_t now);
 void scheduler_tick(void);
 struct uthread_internal *scheduler_current(void);
-void scheduler_add_thread(struct uthread_internal *thread);
-void scheduler_remove_thread(struct uthread_internal *thread);
+void *scheduler_idle_loop(void *arg);
+
+/* Workers (worker.c) */
+int worker_setup(struct worker *w, int id);
+void worker_release(struct worker *w);
+int workers_start(void);
+void workers_stop(void);
+void worker_kick(struct worker *w);
+void worker_kick_idle(void);
+void worker_kick_idle_for(const struct uthread_internal *thread);
+void workers_place(void);
+void worker_bind(struct worker *w);
+void workers_unbind(void);
+struct worker *worker_home(const struct uthread_internal *thread);
+void worker_wait(struct worker *w, unsigned int seq, uint64_t deadline);
+
+/** Thread currently running on this kernel thread */
+#define CURRENT_THREAD() (t_worker->current)
+
+/** Whether `thread` may run on worker `w`: not pinned elsewhere, in its affinity */
+static inline bool thread_allowed_on(const struct uthread_internal *thread,
+                                     const struct worker *w)
+{
+    if (thread->pinned) {
+        return thread->worker == w;
+    }
+    return thread->affinity == 0 || (thread->affinity & (UINT64_C(1) << w->id)) != 0;
+}
 
 /* Timer/Preemption (timer.c) */
+#ifndef UTHREAD_COOPERATIVE
 int timer_init(void);
 void timer_shutdown(void);
 void timer_start(void);
 void timer_stop(void);
 void timer_set_interval(uint64_t ns);
+void timer_set_sample_period(uint64_t ns);
+void timer_poke(struct worker *w);
+int timer_worker_init(struct worker *w);
+void timer_worker_shutdown(struct worker *w);
+#ifdef UTHREAD_TICKLESS
+void timer_reprogram(struct uthread_internal *next, uint64_t now);
+void timer_queue_changed(void);
+#else
+/* The periodic timer needs no per-switch programming */
+static inline void timer_reprogram(struct uthread_internal *next, uint64_t now)
+{
+    (void)next;
+    (void)now;
+}
+static inline void timer_queue_changed(void) {}
+#endif
 void preemption_disable(void);
 void preemption_enable(void);
+struct worker *preemption_pin(void);
+void preemption_unpin(void);
 bool preemption_is_enabled(void);
+int preemption_save(void);
+void preemption_restore(int count);
+
+#else /* UTHREAD_COOPERATIVE */
+
+/*
+ * Cooperative build: timer.c is left out and threads only switch inside
+ * library calls on a single worker, so there is no tick to defer and no
+ * other kernel thread to lock out. Everything below compiles away.
+ */
+static inline int timer_init(void) { return 0; }
+static inline void timer_shutdown(void) {}
+static inline void timer_start(void) {}
+static inline void timer_stop(void) {}
+static inline void timer_set_interval(uint64_t ns) { (void)ns; }
+static inline void timer_set_sample_period(uint64_t ns) { (void)ns; }
+static inline void timer_poke(struct worker *w) { (void)w; }
+static inline int timer_worker_init(struct worker *w) { (void)w; return 0; }
+static inline void timer_worker_shutdown(struct worker *w) { (void)w; }
+static inline void timer_reprogram(struct uthread_internal *next, uint64_t now)
+{
+    (void)next;
+    (void)now;
+}
+static inline void timer_queue_changed(void) {}
+static inline void preemption_disable(void) {}
+static inline void preemption_enable(void) {}
+static inline struct worker *preemption_pin(void) { return t_worker; }
+static inline void preemption_unpin(void) {}
+static inline bool preemption_is_enabled(void) { return false; }
+static inline int preemption_save(void) { return 0; }
+static inline void preemption_restore(int count) { (void)count; }
+#endif /* UTHREAD_COOPERATIVE */
 
 /* Wait Queue Operations */
 void wait_queue_init(struct wait_queue *wq);
@@ -276,23 +1095,207 @@ struct uthread_internal *wait_queue_remove_specific(struct wait_queue *wq,
                                                      struct uthread_internal *thread);
 bool wait_queue_empty(struct wait_queue *wq);
 void wait_queue_wake_one(struct wait_queue *wq);
+void wait_queue_wake_partner(struct wait_queue *wq);
 void wait_queue_wake_all(struct wait_queue *wq);
 
+/* Sleep Queue Operations */
+void sleep_queue_add(struct uthread_internal *thread, uint64_t deadline);
+void sleep_queue_remove(struct uthread_internal *thread);
+void sleep_queue_expire(uint64_t now);
+uint64_t sleep_queue_next_deadline(void);
+
 /* Thread Internal Operations (uthread.c) */
 struct uthread_internal *thread_alloc(void);
 void thread_free(struct uthread_internal *thread);
-int thread_setup_stack(struct uthread_internal *thread, size_t size);
+int thread_setup_stack(struct uthread_internal *thread, size_t size, int node);
+void thread_release_stack(struct uthread_internal *thread);
 void thread_cleanup(struct uthread_internal *thread);
+int thread_cleanup_push(struct uthread_internal *thread, void (*handler)(void *), void *arg);
+void thread_reap_zombies(void);
+
+/* Thread Registry (registry.c) */
+int registry_init(void);
+void registry_destroy(void);
+int registry_add(struct uthread_internal *thread);
+void registry_remove(struct uthread_internal *thread);
+struct uthread_internal *registry_lookup(int tid);
+bool registry_contains(const struct uthread_internal *thread);
+
+/** Iterate over all live threads; the body must not unregister `t` */
+#define REGISTRY_FOREACH(t) \
+    for (struct uthread_internal *t = g_scheduler.threads.live; \
+         t != NULL; t = t->cold->reg_next)
+
+/* Mutex internals shared with the condition variable (mutex.c) */
+void mutex_acquire_locked(uthread_mutex_t *mutex, struct uthread_internal *self);
+void mutex_requeue_locked(uthread_mutex_t *mutex, struct uthread_internal *thread);
+void mutex_release_locked(uthread_mutex_t *mutex);
+
+/* Non-blocking I/O (io.c) */
+void io_poll(void);
+bool io_idle_claim(struct worker *w);
+void io_idle_wait(struct worker *w, uint64_t deadline);
+void io_kick(struct worker *w);
+void io_shutdown(void);
+int io_epoll_init(void);
+
+#ifdef UTHREAD_IO_URING
+/* io_uring backend (io_uring.c) */
+int ring_setup(void);
+void ring_shutdown(void);
+void ring_poll(bool flush);
+void ring_event(void);
+int ring_submit_wait(const struct io_uring_sqe *req, int64_t *res);
+int ring_register_files(const int *fds, unsigned int count);
+int ring_register_buffers(const struct iovec *iovs, unsigned int count);
+void ring_forget_fd(int fd);
+#endif
+
+/* Tasks (task.c) */
+void task_promote(struct uthread_internal *runner);
+void task_group_sync(struct task_group *group);
+void task_shutdown(void);
+
+/* Slab caches and thread arenas (arena.c) */
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *object);
+struct wait_queue *wait_queue_alloc(void);
+void wait_queue_free(struct wait_queue *wq);
+void arena_thread_release(struct uthread_internal *thread);
+void arena_drain(void);
+
+/* Stack and TCB Pool (pool.c) */
+void *stack_pool_get(size_t size, int node);
+bool stack_pool_put(void *region, size_t size, int node);
+struct uthread_internal *tcb_alloc(void);
+void tcb_free(struct uthread_internal *thread);
+struct uthread_internal *tcb_pool_get(void);
+bool tcb_pool_put(struct uthread_internal *thread);
+void *stack_map(size_t size, bool populate, int node);
+size_t stack_round_size(size_t size);
+size_t stack_reserve_size(size_t size);
+void stack_discard_pages(struct uthread_internal *thread);
+void pool_drain(void);
+int stack_fault_init(void);
+void stack_fault_shutdown(void);
+int stack_fault_worker_init(struct worker *w);
+void stack_fault_worker_shutdown(struct worker *w);
+void stack_fault_fix_frame(void *ucontext);
 
 /* Utility Functions */
 uint64_t get_time_ns(void);
 int nice_to_weight(int nice);
 
+/** Runtime accounting clock: the TSC scaled to ns, or CLOCK_MONOTONIC */
+struct sched_clock {
+    bool calibrated;
+    bool use_tsc;                           /**< Invariant TSC present */
+    uint64_t tsc_base;                      /**< TSC at calibration */
+    uint64_t ns_base;                       /**< get_time_ns() at calibration */
+    uint64_t mult;                          /**< ns per cycle, 32.32 fixed point */
+};
+
+extern struct sched_clock g_sched_clock;
+void sched_clock_init(void);
+
+/** Nanoseconds for runtime accounting, cheap enough for every switch */
+static inline uint64_t sched_clock_ns(void)
+{
+#if defined(__x86_64__)
+    if (g_sched_clock.use_tsc) {
+        uint64_t cycles = __builtin_ia32_rdtsc() - g_sched_clock.tsc_base;
+        return g_sched_clock.ns_base + (uint64_t)
+            ((__extension__ (unsigned __int128)cycles * g_sched_clock.mult) >> 32);
+    }
+#endif
+    return get_time_ns();
+}
+
+/** Timestamp for trace events: raw cycles, converted only on export */
+static inline uint64_t trace_clock(void)
+{
+#if defined(__x86_64__)
+    if (g_sched_clock.use_tsc) {
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    return get_time_ns();
+}
+
+/**
+ * Record a trace event on the calling worker. Costs one predicted branch
+ * while tracing is off. Must be called with preemption disabled.
+ */
+static inline void trace_record(enum trace_type type, int tid, int arg)
+{
+    if (__builtin_expect(!g_trace_enabled, 1)) {
+        return;
+    }
+
+    struct trace_ring *ring = &t_worker->trace;
+    struct trace_event *ev = &ring->events[ring->head & ring->mask];
+    ev->time = trace_clock();
+    ev->tid = tid;
+    ev->arg = arg;
+    ev->type = (uint32_t)type;
+    ring->head++;
+}
+
+/* Tracing (trace.c) */
+void trace_shutdown(void);
+
+/* Profiling (profile.c) */
+void profile_sample(struct worker *w, const void *ucontext);
+void profile_shutdown(void);
+
+/* Introspection endpoint (introspect.c) */
+void introspect_serve(void);
+void introspect_shutdown(void);
+
+/** Answer a pending introspection request; call with preemption disabled */
+static inline void introspect_poll(void)
+{
+    if (__builtin_expect(atomic_load_explicit(&g_introspect_request,
+                                              memory_order_relaxed) ==
+                         INTROSPECT_WANTED, 0)) {
+        introspect_serve();
+    }
+}
+
+/* Contention statistics (stats.c); call only while g_contention.enabled */
+void thread_stats_switch(struct uthread_internal *prev,
+                         struct uthread_internal *next, uint64_t now);
+void thread_stats_wake(struct uthread_internal *thread);
+void lock_stats_acquired(struct lock_stats **slot, const void *lock,
+                         uthread_lock_kind_t kind, uint64_t wait_start,
+                         bool first_holder);
+void lock_stats_released(struct lock_stats *stats, bool last_holder);
+void lock_stats_free(struct lock_stats **slot);
+void contention_stats_reset(void);
+
+/** Start of a wait on a held lock, or 0 when contention stats are off */
+static inline uint64_t lock_wait_start(void)
+{
+    return __builtin_expect(g_contention.enabled, 0) ? sched_clock_ns() : 0;
+}
+
+/** Busy-wait hint for spin loops */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
 /* CFS RB-Tree Operations (sched_cfs.c) */
 void rb_insert(struct uthread_internal *thread);
 void rb_remove(struct uthread_internal *thread);
 struct uthread_internal *rb_leftmost(void);
 
+/* Scheduling group membership (sched_cfs_group.c) */
+void sched_group_join(struct uthread_internal *thread, uthread_group_t group);
+void sched_group_leave(struct uthread_internal *thread);
+
 /* Debug */
 #ifdef DEBUG
 #define UTHREAD_DEBUG(fmt, ...) \
@@ -0,0 +1,528 @@
+/**
+ * LibUThread Introspection Endpoint
+ *
+ * A Unix stream socket that answers every connection with a text
+ * snapshot of the scheduler: the thread table, the run-queue depth of the
+ * active policy and of each worker, and the lock contention counters.
+ * It is served by a plain pthread, so it keeps answering while every user
+ * thread is stuck.
+ *
+ * The library state is only consistent under the scheduler lock, which
+ * a single worker does not even have, so the server never reads it. It
+ * posts a request and pokes every worker (timer_poke(), worker_kick());
+ * the first one to reach a safe point, a switch or a timer tick, writes
+ * the snapshot into the server's buffer with preemption disabled. A
+ * worker that does not answer within INTROSPECT_TIMEOUT_MS is running
+ * with preemption disabled or is blocked in the kernel, and the reply
+ * says so, with what can be read without the lock.
+ *
+ * The snapshot may be written from the timer signal handler, so it is
+ * formatted with snprintf() into a buffer allocated beforehand.
+ *
+ * @file introspect.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/** How long the server waits for a worker to take a snapshot */
+#define INTROSPECT_TIMEOUT_MS   1000
+
+/** Workers are poked again at this interval while a request is open */
+#define INTROSPECT_POKE_MS      10
+
+/** How long a client has to send a command before it gets a snapshot */
+#define INTROSPECT_COMMAND_MS   100
+
+/** Snapshot buffer: fixed part, and room per thread and per lock */
+#define INTROSPECT_BUF_MIN      (16 * 1024)
+#define INTROSPECT_LINE_MAX     192
+
+/* Pending request, polled by introspect_poll() */
+atomic_int g_introspect_request = INTROSPECT_IDLE;
+
+/** Text being built, bounded by a buffer allocated up front */
+struct snapshot {
+    char *buf;
+    size_t cap;
+    size_t len;
+    bool truncated;                         /**< Ran out of room */
+};
+
+/** The endpoint and its server thread */
+struct introspect_server {
+    bool running;                           /**< Started and not yet stopped */
+    atomic_bool stopping;
+    int listen_fd;
+    int stop_pipe[2];                       /**< Written to stop the server */
+    pthread_t thread;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    size_t alloc;                           /**< Size of snapshot.buf */
+    struct snapshot snapshot;               /**< Written by a worker on request */
+};
+
+static struct introspect_server s_server = {
+    .listen_fd = -1,
+    .stop_pipe = { -1, -1 },
+};
+
+/* ==========================================================================
+ * Snapshot
+ * ========================================================================== */
+
+static void snap_printf(struct snapshot *s, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void snap_printf(struct snapshot *s, const char *fmt, ...)
+{
+    if (s->truncated) {
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(s->buf + s->len, s->cap - s->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= s->cap - s->len) {
+        s->buf[s->len] = '\0';
+        s->truncated = true;
+        return;
+    }
+    s->len += (size_t)n;
+}
+
+static const char *introspect_state_name(uthread_state_t state)
+{
+    switch (state) {
+    case UTHREAD_STATE_READY:      return "READY";
+    case UTHREAD_STATE_RUNNING:    return "RUNNING";
+    case UTHREAD_STATE_BLOCKED:    return "BLOCKED";
+    case UTHREAD_STATE_TERMINATED: return "TERMINATED";
+    default:                       return "UNKNOWN";
+    }
+}
+
+/* Tid of the thread running on a worker, 0 while it idles */
+static int introspect_current_tid(const struct worker *w)
+{
+    const struct uthread_internal *t = w->current;
+    return (t != NULL && t != &w->idle_thread) ? t->tid : 0;
+}
+
+/* Write the full snapshot; needs preemption disabled */
+static void introspect_snapshot(struct snapshot *s)
+{
+    snap_printf(s, "# libuthread scheduler snapshot\n");
+    snap_printf(s, "time_ns %lu\n", (unsigned long)get_time_ns());
+    snap_printf(s, "scheduler %s workers %d preemption %s timeslice_ns %lu\n",
+                g_scheduler.ops->name(), g_scheduler.num_workers,
+                g_scheduler.preemption_enabled ? "on" : "off",
+                (unsigned long)g_scheduler.timeslice_ns);
+    snap_printf(s, "threads %d created %d sleeping %d io_waiting %d\n",
+                g_scheduler.threads.count, g_scheduler.total_threads_created,
+                g_scheduler.sleepers.count, g_io.waiting);
+    snap_printf(s, "switches %lu ticks %lu\n",
+                (unsigned long)g_scheduler.context_switches,
+                (unsigned long)g_scheduler.scheduler_ticks);
+    snap_printf(s, "runqueue %s %d\n",
+                g_scheduler.ops->name(), g_scheduler.ops->nr_queued());
+
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        const struct worker *w = &g_scheduler.workers[i];
+        snap_printf(s, "worker %d cpu %d node %d current %d idle %d queued %d "
+                    "steals %lu handoffs %lu\n",
+                    w->id, w->cpu, w->node, introspect_current_tid(w),
+                    w->idle ? 1 : 0, w->rq_count,
+                    (unsigned long)w->steals, (unsigned long)w->handoffs);
+    }
+
+    /* The name goes last: it may contain spaces */
+    REGISTRY_FOREACH(t) {
+        snap_printf(s, "thread %d %s worker %d priority %d nice %d "
+                    "switches %lu/%lu run_ns %lu ready_ns %lu blocked_ns %lu "
+                    "name %s\n",
+                    t->tid, introspect_state_name(t->state),
+                    (t->worker != NULL) ? t->worker->id : -1,
+                    t->priority, t->nice,
+                    (unsigned long)t->voluntary_switches,
+                    (unsigned long)t->involuntary_switches,
+                    (unsigned long)t->total_runtime,
+                    (unsigned long)t->ready_ns,
+                    (unsigned long)t->blocked_ns,
+                    t->cold->name);
+    }
+
+    snap_printf(s, "contention %s locks %d\n",
+                g_contention.enabled ? "on" : "off", g_contention.count);
+    for (int i = 0; i < g_contention.count; i++) {
+        const struct lock_stats *ls = g_contention.locks[i];
+        snap_printf(s, "lock %p %s acquisitions %lu contended %lu wait_ns %lu "
+                    "max_hold_ns %lu\n",
+                    ls->lock, (ls->kind == UTHREAD_LOCK_MUTEX) ? "mutex" : "rwlock",
+                    (unsigned long)ls->acquisitions, (unsigned long)ls->contended,
+                    (unsigned long)ls->wait_ns, (unsigned long)ls->max_hold_ns);
+    }
+
+    snap_printf(s, "end\n");
+}
+
+/*
+ * What the server can tell without a worker: the workers' current
+ * threads and the counters, read without the lock and so possibly torn.
+ */
+static void introspect_fallback(struct snapshot *s)
+{
+    snap_printf(s, "# libuthread scheduler snapshot\n");
+    snap_printf(s, "# no worker reached a safe point within %d ms: a thread "
+                "runs with preemption disabled, or its worker is blocked "
+                "in the kernel\n", INTROSPECT_TIMEOUT_MS);
+    snap_printf(s, "# unlocked reads follow\n");
+    snap_printf(s, "threads %d switches %lu ticks %lu\n",
+                g_scheduler.threads.count,
+                (unsigned long)g_scheduler.context_switches,
+                (unsigned long)g_scheduler.scheduler_ticks);
+
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        const struct worker *w = &g_scheduler.workers[i];
+        snap_printf(s, "worker %d current %d idle %d in_scheduler %d\n",
+                    w->id, introspect_current_tid(w),
+                    w->idle ? 1 : 0, w->in_scheduler ? 1 : 0);
+    }
+
+    snap_printf(s, "end\n");
+}
+
+/**
+ * Take the snapshot a server is waiting for. Called through
+ * introspect_poll() at a switch or tick, with preemption disabled; only
+ * the first worker to get here writes it.
+ */
+void introspect_serve(void)
+{
+    int expected = INTROSPECT_WANTED;
+    if (!atomic_compare_exchange_strong_explicit(&g_introspect_request, &expected,
+                                                 INTROSPECT_TAKING,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        return;
+    }
+
+    introspect_snapshot(&s_server.snapshot);
+
+    atomic_store_explicit(&g_introspect_request, INTROSPECT_DONE,
+                          memory_order_release);
+}
+
+/* ==========================================================================
+ * Server
+ * ========================================================================== */
+
+static void introspect_poke_workers(void)
+{
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (i > 0 && !w->started) {
+            continue;
+        }
+        worker_kick(w);
+        timer_poke(w);
+    }
+}
+
+static void introspect_sleep_ms(int ms)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = (long)ms * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * Have a worker fill s_server.snapshot. Returns false if none did in
+ * time, or the buffer could not be grown.
+ */
+static bool introspect_request(void)
+{
+    struct snapshot *s = &s_server.snapshot;
+
+    /* Unlocked counts, only for sizing: a short buffer truncates */
+    size_t want = INTROSPECT_BUF_MIN +
+        ((size_t)g_scheduler.threads.count + (size_t)g_contention.count) *
+        INTROSPECT_LINE_MAX;
+    if (want > s_server.alloc) {
+        char *buf = realloc(s->buf, want);
+        if (buf == NULL) {
+            return false;
+        }
+        s->buf = buf;
+        s_server.alloc = want;
+    }
+    s->cap = s_server.alloc;
+    s->len = 0;
+    s->truncated = false;
+
+    atomic_store_explicit(&g_introspect_request, INTROSPECT_WANTED,
+                          memory_order_release);
+
+    for (int waited = 0; waited < INTROSPECT_TIMEOUT_MS; waited++) {
+        if (waited % INTROSPECT_POKE_MS == 0) {
+            introspect_poke_workers();
+        }
+        if (atomic_load_explicit(&g_introspect_request, memory_order_acquire) ==
+                INTROSPECT_DONE ||
+            atomic_load(&s_server.stopping)) {
+            break;
+        }
+        introspect_sleep_ms(1);
+    }
+
+    int expected = INTROSPECT_WANTED;
+    if (atomic_compare_exchange_strong(&g_introspect_request, &expected,
+                                       INTROSPECT_IDLE)) {
+        return false;
+    }
+
+    /* Taken: the worker finishes it under the scheduler lock */
+    while (atomic_load_explicit(&g_introspect_request, memory_order_acquire) !=
+           INTROSPECT_DONE) {
+        sched_yield();
+    }
+    atomic_store(&g_introspect_request, INTROSPECT_IDLE);
+
+    return true;
+}
+
+static bool introspect_send(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool introspect_send_snapshot(int fd)
+{
+    if (introspect_request()) {
+        const struct snapshot *s = &s_server.snapshot;
+        if (!introspect_send(fd, s->buf, s->len)) {
+            return false;
+        }
+        if (s->truncated) {
+            static const char note[] = "# truncated\nend\n";
+            return introspect_send(fd, note, sizeof(note) - 1);
+        }
+        return true;
+    }
+
+    char buf[INTROSPECT_BUF_MIN];
+    struct snapshot s = { .buf = buf, .cap = sizeof(buf) };
+    introspect_fallback(&s);
+    return introspect_send(fd, s.buf, s.len);
+}
+
+/*
+ * Serve one connection: a snapshot, or with the command "watch <ms>" a
+ * snapshot every <ms> milliseconds until the client hangs up.
+ */
+static void introspect_client(int fd)
+{
+    /* A client that stops reading must not hold up the server for good */
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    unsigned int interval_ms = 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, INTROSPECT_COMMAND_MS) > 0) {
+        char cmd[64];
+        ssize_t n = recv(fd, cmd, sizeof(cmd) - 1, 0);
+        if (n > 0) {
+            cmd[n] = '\0';
+            if (sscanf(cmd, "watch %u", &interval_ms) != 1) {
+                interval_ms = 0;
+            }
+        }
+    }
+
+    while (introspect_send_snapshot(fd) && interval_ms > 0) {
+        /* Only a hangup or a stop ends the stream, not a half-close */
+        struct pollfd fds[2] = {
+            { .fd = fd, .events = 0 },
+            { .fd = s_server.stop_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, (int)interval_ms) != 0) {
+            break;
+        }
+    }
+}
+
+static void *introspect_main(void *arg)
+{
+    (void)arg;
+
+    while (!atomic_load(&s_server.stopping)) {
+        struct pollfd fds[2] = {
+            { .fd = s_server.listen_fd, .events = POLLIN },
+            { .fd = s_server.stop_pipe[0], .events = POLLIN },
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        int fd = accept4(s_server.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        introspect_client(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* Release the endpoint's descriptors and buffer */
+static void introspect_close(void)
+{
+    if (s_server.listen_fd >= 0) {
+        close(s_server.listen_fd);
+        unlink(s_server.path);
+        s_server.listen_fd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (s_server.stop_pipe[i] >= 0) {
+            close(s_server.stop_pipe[i]);
+            s_server.stop_pipe[i] = -1;
+        }
+    }
+
+    free(s_server.snapshot.buf);
+    s_server.snapshot.buf = NULL;
+    s_server.alloc = 0;
+}
+
+/**
+ * Stop the endpoint if it runs. Called from uthread_shutdown() before the
+ * workers go away.
+ */
+void introspect_shutdown(void)
+{
+    preemption_disable();
+    bool running = s_server.running;
+    s_server.running = false;
+    preemption_enable();
+
+    if (!running) {
+        return;
+    }
+
+    atomic_store(&s_server.stopping, true);
+    ssize_t r = write(s_server.stop_pipe[1], "", 1);
+    (void)r;
+    pthread_join(s_server.thread, NULL);
+
+    introspect_close();
+    atomic_store(&s_server.stopping, false);
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+int uthread_introspect_start(const char *path)
+{
+    if (!g_scheduler.initialized || path == NULL ||
+        strlen(path) >= sizeof(s_server.path)) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    if (s_server.running) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Replace a socket left behind by an earlier run, and nothing else */
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        int err = errno;
+        preemption_enable();
+        return err;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        int err = errno;
+        close(fd);
+        preemption_enable();
+        return err;
+    }
+    strcpy(s_server.path, path);
+    s_server.listen_fd = fd;
+
+    if (listen(fd, 4) != 0 || pipe2(s_server.stop_pipe, O_CLOEXEC) != 0) {
+        int err = errno;
+        introspect_close();
+        preemption_enable();
+        return err;
+    }
+
+    /* No signal meant for a worker may land on the server */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int ret = pthread_create(&s_server.thread, NULL, introspect_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (ret != 0) {
+        introspect_close();
+        preemption_enable();
+        return UTHREAD_EAGAIN;
+    }
+    s_server.running = true;
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+void uthread_introspect_stop(void)
+{
+    if (!g_scheduler.initialized) {
+        return;
+    }
+
+    introspect_shutdown();
+}
@@ -0,0 +1,789 @@
+/**
+ * LibUThread Non-blocking I/O
+ *
+ * Wrappers around read/write/accept/connect that park only the calling
+ * user thread while a file descriptor is not ready. With UTHREAD_IO_URING
+ * the requests go to the io_uring backend (io_uring.c) instead and the
+ * epoll path below is the fallback for kernels without it. The descriptor is
+ * switched to O_NONBLOCK and registered edge-triggered with a shared
+ * epoll instance. Readiness is collected between context switches, on
+ * timer ticks and, while nothing else is runnable, by an idle worker
+ * that blocks in epoll_wait() instead of sleeping on its futex.
+ *
+ * Each descriptor keeps a sequence number that is bumped on every event.
+ * A thread snapshots it before the syscall and only parks if it is
+ * unchanged, so readiness reported between EAGAIN and the park is not
+ * lost. The syscall itself runs with in_critical_section set: the thread
+ * can neither be preempted nor migrate before it has read errno.
+ *
+ * Entries are indexed by fd number, and a descriptor closed with plain
+ * close() leaves its entry behind for the next file to get that number.
+ * So nothing about the file itself is cached: O_NONBLOCK is checked on
+ * every call and the descriptor is added to the epoll set before every
+ * park, EEXIST meaning that it already was.
+ *
+ * @file io.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+/* Global I/O state */
+struct io_state g_io = {
+    .epfd = -1,
+    .wakefd = -1
+};
+
+/* Descriptor entries */
+static struct slab_cache s_fd_slab = SLAB_CACHE_INIT(struct io_fd);
+
+/** Events fetched per epoll_wait() call */
+#define IO_EVENT_BATCH  64
+
+/** Initial size of the descriptor table */
+#define IO_FD_TABLE_MIN 64
+
+/* ==========================================================================
+ * Descriptor Table
+ * ========================================================================== */
+
+/**
+ * Create the epoll instance and the eventfd used to interrupt a poller.
+ *
+ * @return 0 on success, -1 with errno set
+ */
+int io_epoll_init(void)
+{
+    if (g_io.epfd >= 0) {
+        return 0;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        return -1;
+    }
+
+    int wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakefd < 0) {
+        close(epfd);
+        return -1;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = wakefd };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev) != 0) {
+        close(wakefd);
+        close(epfd);
+        return -1;
+    }
+
+    g_io.epfd = epfd;
+    g_io.wakefd = wakefd;
+    return 0;
+}
+
+/* Entry for `fd`, creating it on first use; NULL with errno set on error */
+static struct io_fd *io_fd_get(int fd)
+{
+    if (fd < 0) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if (fd < g_io.nfds && g_io.fds[fd] != NULL) {
+        return g_io.fds[fd];
+    }
+
+    /* Reject closed descriptors before allocating anything */
+    if (fcntl(fd, F_GETFL) < 0) {
+        return NULL;
+    }
+
+    if (fd >= g_io.nfds) {
+        int n = g_io.nfds > 0 ? g_io.nfds : IO_FD_TABLE_MIN;
+        while (n <= fd) {
+            n *= 2;
+        }
+
+        struct io_fd **fds = realloc(g_io.fds, (size_t)n * sizeof(*fds));
+        if (fds == NULL) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(&fds[g_io.nfds], 0, (size_t)(n - g_io.nfds) * sizeof(*fds));
+        g_io.fds = fds;
+        g_io.nfds = n;
+    }
+
+    struct io_fd *f = slab_alloc(&s_fd_slab);
+    if (f == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    wait_queue_init(&f->waiters);
+
+    g_io.fds[fd] = f;
+    return f;
+}
+
+/* Drop the entry for `fd`, waking its waiters so they see the close */
+static void io_fd_forget(int fd)
+{
+    if (fd < 0 || fd >= g_io.nfds || g_io.fds[fd] == NULL) {
+        return;
+    }
+
+    struct io_fd *f = g_io.fds[fd];
+    if (f->registered) {
+        epoll_ctl(g_io.epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    wait_queue_wake_all(&f->waiters);
+
+    g_io.fds[fd] = NULL;
+    slab_free(&s_fd_slab, f);
+}
+
+/* ==========================================================================
+ * Polling
+ * ========================================================================== */
+
+/* Wake the threads parked on fd whose awaited events are in `events` */
+static void io_dispatch(int fd, uint32_t events)
+{
+    if (fd == g_io.wakefd) {
+        uint64_t value;
+        while (read(g_io.wakefd, &value, sizeof(value)) > 0) {
+        }
+        return;
+    }
+#ifdef UTHREAD_IO_URING
+    if (fd == g_ring.eventfd) {
+        ring_event();
+        return;
+    }
+#endif
+
+    if (fd < 0 || fd >= g_io.nfds || g_io.fds[fd] == NULL) {
+        return;
+    }
+
+    struct io_fd *f = g_io.fds[fd];
+    f->seq++;
+
+    struct uthread_internal *t = f->waiters.head;
+    while (t != NULL) {
+        struct uthread_internal *next = t->next;
+        if (t->io_events & events) {
+            wait_queue_remove_specific(&f->waiters, t);
+            scheduler_unblock(t);
+        }
+        t = next;
+    }
+}
+
+static void io_dispatch_all(const struct epoll_event *events, int n)
+{
+    for (int i = 0; i < n; i++) {
+        io_dispatch(events[i].data.fd, events[i].events);
+    }
+}
+
+/**
+ * Collect readiness without blocking and wake the threads it concerns.
+ *
+ * Called with preemption disabled from scheduler_schedule() and
+ * scheduler_tick() while threads are parked on descriptors.
+ */
+void io_poll(void)
+{
+    struct epoll_event events[IO_EVENT_BATCH];
+
+    g_io.polls_skipped = 0;
+
+    int n = epoll_wait(g_io.epfd, events, IO_EVENT_BATCH, 0);
+    if (n > 0) {
+        io_dispatch_all(events, n);
+    }
+}
+
+/**
+ * Become the worker that waits for I/O while idle.
+ *
+ * Called with preemption disabled. Only one worker blocks in epoll_wait()
+ * at a time; the others keep using their futex.
+ *
+ * @param w Calling worker
+ * @return true if `w` must call io_idle_wait() instead of worker_wait()
+ */
+bool io_idle_claim(struct worker *w)
+{
+    bool waiting = g_io.waiting > 0;
+#ifdef UTHREAD_IO_URING
+    waiting = waiting || g_ring.inflight.count > 0;
+#endif
+
+    if (!waiting || g_io.poller != NULL) {
+        return false;
+    }
+
+    g_io.poller = w;
+    return true;
+}
+
+/**
+ * Block in epoll_wait() until I/O is ready, worker_kick() is called, a
+ * signal arrives or the deadline passes. Must be called with preemption
+ * enabled after a successful io_idle_claim().
+ *
+ * @param w        Calling worker
+ * @param deadline Absolute CLOCK_MONOTONIC time in ns, or 0 for none
+ */
+void io_idle_wait(struct worker *w, uint64_t deadline)
+{
+    struct epoll_event events[IO_EVENT_BATCH];
+    int timeout = -1;
+
+    if (deadline != 0) {
+        uint64_t now = get_time_ns();
+        /* Round up so the sleeper is due when we wake */
+        uint64_t ms = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+        timeout = ms > INT_MAX ? INT_MAX : (int)ms;
+    }
+
+    int n = epoll_wait(g_io.epfd, events, IO_EVENT_BATCH, timeout);
+
+    preemption_disable();
+    if (n > 0) {
+        io_dispatch_all(events, n);
+    }
+    if (g_io.poller == w) {
+        g_io.poller = NULL;
+    }
+    preemption_enable();
+}
+
+/**
+ * Interrupt the epoll_wait() of a worker, if it is the poller.
+ *
+ * Called with the scheduler lock held from worker_kick().
+ *
+ * @param w Worker being kicked
+ */
+void io_kick(struct worker *w)
+{
+    if (g_io.poller == w) {
+        uint64_t one = 1;
+        ssize_t r = write(g_io.wakefd, &one, sizeof(one));
+        (void)r;
+    }
+}
+
+/**
+ * Close the epoll instance and free the descriptor table.
+ *
+ * Descriptors are left open and in non-blocking mode.
+ */
+void io_shutdown(void)
+{
+#ifdef UTHREAD_IO_URING
+    ring_shutdown();
+#endif
+
+    for (int fd = 0; fd < g_io.nfds; fd++) {
+        slab_free(&s_fd_slab, g_io.fds[fd]);
+    }
+    free(g_io.fds);
+
+    if (g_io.wakefd >= 0) {
+        close(g_io.wakefd);
+    }
+    if (g_io.epfd >= 0) {
+        close(g_io.epfd);
+    }
+
+    memset(&g_io, 0, sizeof(g_io));
+    g_io.epfd = -1;
+    g_io.wakefd = -1;
+}
+
+/* ==========================================================================
+ * Waiting
+ * ========================================================================== */
+
+/*
+ * Prepare an attempt on `fd`: switch it to O_NONBLOCK if asked, snapshot
+ * its event sequence and enter the critical section that protects errno.
+ * Returns the calling thread, or NULL with errno set.
+ */
+static struct uthread_internal *io_begin(int fd, bool nonblock,
+                                         unsigned int *seq)
+{
+    preemption_disable();
+
+    struct io_fd *f = io_fd_get(fd);
+    if (f == NULL) {
+        int err = errno;
+        preemption_enable();
+        errno = err;
+        return NULL;
+    }
+
+    /* The fd number may have been closed and reused since the last call */
+    if (nonblock) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 ||
+            (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+            int err = errno;
+            preemption_enable();
+            errno = err;
+            return NULL;
+        }
+    }
+
+    *seq = f->seq;
+
+    struct uthread_internal *self = CURRENT_THREAD();
+    self->in_critical_section = true;
+    preemption_enable();
+
+    return self;
+}
+
+/* Leave the critical section entered by io_begin() */
+static void io_end(struct uthread_internal *self)
+{
+    self->in_critical_section = false;
+}
+
+static bool io_would_block(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+/*
+ * Park the caller until one of `events` is reported on `fd`, or until
+ * `deadline` (0 = none). Returns at once if an event arrived since `seq`
+ * was taken. Returns 0 when the caller should retry, UTHREAD_ETIMEDOUT,
+ * or -1 with errno set.
+ */
+static int io_wait(int fd, uint32_t events, unsigned int seq,
+                   uint64_t deadline)
+{
+    preemption_disable();
+
+    struct io_fd *f = io_fd_get(fd);
+    if (f == NULL || io_epoll_init() != 0) {
+        int err = errno;
+        preemption_enable();
+        errno = err;
+        return -1;
+    }
+
+    /* Also when registered: close() drops a file from the set unseen */
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.fd = fd
+    };
+    if (epoll_ctl(g_io.epfd, EPOLL_CTL_ADD, fd, &ev) != 0 && errno != EEXIST) {
+        int err = errno;
+        preemption_enable();
+        errno = err;
+        return -1;
+    }
+    f->registered = true;
+
+    if (f->seq != seq) {
+        preemption_enable();
+        return 0;
+    }
+
+    struct uthread_internal *self = CURRENT_THREAD();
+    self->io_events = events | EPOLLERR | EPOLLHUP;
+
+    g_io.waiting++;
+    /* An idle worker may be waiting on its futex: let it poll for us */
+    if (g_scheduler.num_workers > 1) {
+        worker_kick_idle();
+    }
+
+    int ret = 0;
+    if (deadline != 0) {
+        ret = scheduler_block_until(&f->waiters, deadline);
+    } else {
+        scheduler_block(&f->waiters);
+    }
+
+    g_io.waiting--;
+    preemption_enable();
+
+    return ret;
+}
+
+/* epoll events to wait for that match the poll(2) events requested */
+static uint32_t io_poll_events(short events)
+{
+    uint32_t ev = 0;
+
+    if (events & (POLLIN | POLLPRI)) {
+        ev |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (events & POLLOUT) {
+        ev |= EPOLLOUT;
+    }
+    return ev;
+}
+
+/*
+ * Wait until poll(2) reports one of `events` on fd, or until `deadline`.
+ * Returns the revents, 0 on timeout or -1 with errno set.
+ */
+static int io_poll_until(int fd, short events, uint64_t deadline)
+{
+    for (;;) {
+        unsigned int seq;
+        struct uthread_internal *self = io_begin(fd, false, &seq);
+        if (self == NULL) {
+            return -1;
+        }
+
+        struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+        int n = poll(&pfd, 1, 0);
+        int err = errno;
+        io_end(self);
+
+        if (n != 0) {
+            errno = err;
+            return n > 0 ? pfd.revents : -1;
+        }
+
+        if (deadline != 0 && get_time_ns() >= deadline) {
+            return 0;
+        }
+
+        int ret = io_wait(fd, io_poll_events(events), seq, deadline);
+        if (ret == UTHREAD_ETIMEDOUT) {
+            return 0;
+        }
+        if (ret != 0) {
+            return -1;
+        }
+    }
+}
+
+#ifdef UTHREAD_IO_URING
+/* ==========================================================================
+ * io_uring Requests
+ * ========================================================================== */
+
+/*
+ * Run one request on the ring. Returns true with *ret set (-1 and errno
+ * on failure) if it ran, false if the epoll path must be used instead.
+ */
+static bool io_ring_run(uint8_t opcode, int fd, const void *addr, size_t len,
+                        uint64_t off, uint32_t op_flags, ssize_t *ret)
+{
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)addr;
+    sqe.len = len > IO_RING_MAX_LEN ? IO_RING_MAX_LEN : (uint32_t)len;
+    sqe.off = off;
+    sqe.rw_flags = (int)op_flags;
+
+    int64_t res;
+    if (ring_submit_wait(&sqe, &res) != 0) {
+        return false;
+    }
+
+    if (res < 0) {
+        errno = (int)-res;
+        *ret = -1;
+    } else {
+        *ret = (ssize_t)res;
+    }
+    return true;
+}
+#endif
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+ssize_t uthread_read(int fd, void *buf, size_t count)
+{
+    if (!g_scheduler.initialized) {
+        return read(fd, buf, count);
+    }
+
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (io_ring_run(IORING_OP_READ, fd, buf, count, (uint64_t)-1, 0, &ret)) {
+        return ret;
+    }
+#endif
+
+    for (;;) {
+        unsigned int seq;
+        struct uthread_internal *self = io_begin(fd, true, &seq);
+        if (self == NULL) {
+            return -1;
+        }
+
+        ssize_t n = read(fd, buf, count);
+        int err = errno;
+        io_end(self);
+
+        if (n >= 0 || !io_would_block(err)) {
+            errno = err;
+            return n;
+        }
+
+        if (io_wait(fd, EPOLLIN | EPOLLRDHUP, seq, 0) != 0) {
+            return -1;
+        }
+    }
+}
+
+ssize_t uthread_write(int fd, const void *buf, size_t count)
+{
+    if (!g_scheduler.initialized) {
+        return write(fd, buf, count);
+    }
+
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (io_ring_run(IORING_OP_WRITE, fd, buf, count, (uint64_t)-1, 0, &ret)) {
+        return ret;
+    }
+#endif
+
+    for (;;) {
+        unsigned int seq;
+        struct uthread_internal *self = io_begin(fd, true, &seq);
+        if (self == NULL) {
+            return -1;
+        }
+
+        ssize_t n = write(fd, buf, count);
+        int err = errno;
+        io_end(self);
+
+        if (n >= 0 || !io_would_block(err)) {
+            errno = err;
+            return n;
+        }
+
+        if (io_wait(fd, EPOLLOUT, seq, 0) != 0) {
+            return -1;
+        }
+    }
+}
+
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+    if (!g_scheduler.initialized) {
+        return accept(fd, addr, addrlen);
+    }
+
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (io_ring_run(IORING_OP_ACCEPT, fd, addr, 0, (uint64_t)(uintptr_t)addrlen,
+                    SOCK_CLOEXEC, &ret)) {
+        return (int)ret;
+    }
+#endif
+
+    for (;;) {
+        unsigned int seq;
+        struct uthread_internal *self = io_begin(fd, true, &seq);
+        if (self == NULL) {
+            return -1;
+        }
+
+        int conn = accept4(fd, addr, addrlen, SOCK_CLOEXEC);
+        int err = errno;
+        io_end(self);
+
+        if (conn >= 0 || !io_would_block(err)) {
+            errno = err;
+            return conn;
+        }
+
+        if (io_wait(fd, EPOLLIN, seq, 0) != 0) {
+            return -1;
+        }
+    }
+}
+
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+    if (!g_scheduler.initialized) {
+        return connect(fd, addr, addrlen);
+    }
+
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (io_ring_run(IORING_OP_CONNECT, fd, addr, 0, addrlen, 0, &ret)) {
+        return (int)ret;
+    }
+#endif
+
+    unsigned int seq;
+    struct uthread_internal *self = io_begin(fd, true, &seq);
+    if (self == NULL) {
+        return -1;
+    }
+
+    int r = connect(fd, addr, addrlen);
+    int err = errno;
+    io_end(self);
+
+    if (r == 0 || err != EINPROGRESS) {
+        errno = err;
+        return r;
+    }
+
+    /* The socket turns writable once the handshake has finished */
+    if (io_poll_until(fd, POLLOUT, 0) < 0) {
+        return -1;
+    }
+
+    int so_error = 0;
+    socklen_t len = sizeof(so_error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &so_error, &len) != 0) {
+        return -1;
+    }
+    if (so_error != 0) {
+        errno = so_error;
+        return -1;
+    }
+
+    return 0;
+}
+
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset)
+{
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (g_scheduler.initialized &&
+        io_ring_run(IORING_OP_READ, fd, buf, count, (uint64_t)offset, 0, &ret)) {
+        return ret;
+    }
+#endif
+
+    /* Regular files are always "ready": epoll cannot wait for them */
+    return pread(fd, buf, count, offset);
+}
+
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+#ifdef UTHREAD_IO_URING
+    ssize_t ret;
+    if (g_scheduler.initialized &&
+        io_ring_run(IORING_OP_WRITE, fd, buf, count, (uint64_t)offset, 0, &ret)) {
+        return ret;
+    }
+#endif
+
+    return pwrite(fd, buf, count, offset);
+}
+
+int uthread_poll_fd(int fd, short events, int timeout_ms)
+{
+    if (!g_scheduler.initialized) {
+        struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+        int n = poll(&pfd, 1, timeout_ms);
+        return n > 0 ? pfd.revents : n;
+    }
+
+    uint64_t deadline = 0;
+    if (timeout_ms >= 0) {
+        /* Timeout 0 still makes one readiness check */
+        deadline = get_time_ns() + (uint64_t)timeout_ms * 1000000ULL;
+    }
+
+    return io_poll_until(fd, events, deadline);
+}
+
+int uthread_close(int fd)
+{
+    if (g_scheduler.initialized) {
+        preemption_disable();
+        io_fd_forget(fd);
+#ifdef UTHREAD_IO_URING
+        ring_forget_fd(fd);
+#endif
+        preemption_enable();
+    }
+
+    return close(fd);
+}
+
+int uthread_io_register_files(const int *fds, unsigned int count)
+{
+    if (!g_scheduler.initialized || (fds == NULL && count > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef UTHREAD_IO_URING
+    preemption_disable();
+    int ret = ring_register_files(fds, count);
+    int err = errno;
+    preemption_enable();
+
+    errno = err;
+    return ret;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+int uthread_io_register_buffers(const struct iovec *iovs, unsigned int count)
+{
+    if (!g_scheduler.initialized || (iovs == NULL && count > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef UTHREAD_IO_URING
+    preemption_disable();
+    int ret = ring_register_buffers(iovs, count);
+    int err = errno;
+    preemption_enable();
+
+    errno = err;
+    return ret;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+const char *uthread_io_backend(void)
+{
+#ifdef UTHREAD_IO_URING
+    if (g_scheduler.initialized) {
+        preemption_disable();
+        int ret = ring_setup();
+        preemption_enable();
+
+        if (ret == 0) {
+            return "io_uring";
+        }
+    }
+#endif
+
+    return "epoll";
+}
@@ -0,0 +1,540 @@
+/**
+ * LibUThread io_uring Backend
+ *
+ * Built with -DUTHREAD_IO_URING=ON. The I/O wrappers in io.c hand their
+ * requests to a shared io_uring instead of waiting for epoll readiness:
+ * a thread writes an SQE, parks on the in-flight wait queue, and is made
+ * runnable when its CQE is reaped. Queued SQEs are submitted together
+ * once the worker runs out of runnable threads, and CQEs are read straight
+ * from the shared ring at every scheduling point, so a busy process makes
+ * far fewer than one system call per request. The ring signals an eventfd that sits in the epoll set,
+ * which lets the idle worker sleep in io_idle_wait() as before.
+ *
+ * Registered files and buffers are used automatically: a request on a
+ * registered fd uses its fixed-file index, and a read or write whose
+ * buffer lies inside a registered buffer becomes READ_FIXED/WRITE_FIXED.
+ *
+ * The ring is set up on first use. If the kernel refuses, the wrappers
+ * permanently fall back to the epoll path.
+ *
+ * All ring_* functions must be called with preemption disabled.
+ *
+ * @file io_uring.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* Global ring instance */
+struct io_ring g_ring = {
+    .fd = -1,
+    .eventfd = -1
+};
+
+/** Submission queue size requested from the kernel */
+#define IO_RING_ENTRIES     256
+
+/* ==========================================================================
+ * System Calls
+ * ========================================================================== */
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, const void *arg,
+                                 unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* ==========================================================================
+ * Setup and Teardown
+ * ========================================================================== */
+
+static void ring_unmap(void)
+{
+    if (g_ring.sqes != NULL) {
+        munmap(g_ring.sqes, g_ring.sqes_size);
+    }
+    if (g_ring.cq_map != NULL && g_ring.cq_map != g_ring.sq_map) {
+        munmap(g_ring.cq_map, g_ring.cq_map_size);
+    }
+    if (g_ring.sq_map != NULL) {
+        munmap(g_ring.sq_map, g_ring.sq_map_size);
+    }
+    g_ring.sqes = NULL;
+    g_ring.cq_map = NULL;
+    g_ring.sq_map = NULL;
+}
+
+/* Map the rings of a freshly created io_uring */
+static int ring_map(int fd, const struct io_uring_params *p)
+{
+    g_ring.sq_map_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+    g_ring.cq_map_size = p->cq_off.cqes +
+                         p->cq_entries * sizeof(struct io_uring_cqe);
+
+    bool single = (p->features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && g_ring.cq_map_size > g_ring.sq_map_size) {
+        g_ring.sq_map_size = g_ring.cq_map_size;
+    }
+
+    void *sq = mmap(NULL, g_ring.sq_map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        return -1;
+    }
+    g_ring.sq_map = sq;
+
+    void *cq = sq;
+    if (!single) {
+        cq = mmap(NULL, g_ring.cq_map_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            ring_unmap();
+            return -1;
+        }
+    }
+    g_ring.cq_map = cq;
+
+    g_ring.sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, g_ring.sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        ring_unmap();
+        return -1;
+    }
+    g_ring.sqes = sqes;
+
+    char *sqb = sq;
+    g_ring.sq_head = (unsigned int *)(sqb + p->sq_off.head);
+    g_ring.sq_tail = (unsigned int *)(sqb + p->sq_off.tail);
+    g_ring.sq_mask = *(unsigned int *)(sqb + p->sq_off.ring_mask);
+    g_ring.sq_array = (unsigned int *)(sqb + p->sq_off.array);
+    g_ring.sq_entries = p->sq_entries;
+
+    char *cqb = cq;
+    g_ring.cq_head = (unsigned int *)(cqb + p->cq_off.head);
+    g_ring.cq_tail = (unsigned int *)(cqb + p->cq_off.tail);
+    g_ring.cq_mask = *(unsigned int *)(cqb + p->cq_off.ring_mask);
+    g_ring.cqes = (struct io_uring_cqe *)(cqb + p->cq_off.cqes);
+
+    return 0;
+}
+
+/**
+ * Create the ring on first use.
+ *
+ * @return 0 if the ring is usable, -1 if the epoll path must be used
+ */
+int ring_setup(void)
+{
+    if (g_ring.fd >= 0) {
+        return 0;
+    }
+    if (g_ring.failed || io_epoll_init() != 0) {
+        return -1;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = sys_io_uring_setup(IO_RING_ENTRIES, &p);
+    if (fd < 0) {
+        g_ring.failed = true;
+        return -1;
+    }
+
+    if (ring_map(fd, &p) != 0) {
+        close(fd);
+        g_ring.failed = true;
+        return -1;
+    }
+
+    /* Completions make the eventfd readable for the idle poller */
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = efd };
+    if (efd < 0 ||
+        sys_io_uring_register(fd, IORING_REGISTER_EVENTFD, &efd, 1) != 0 ||
+        epoll_ctl(g_io.epfd, EPOLL_CTL_ADD, efd, &ev) != 0) {
+        if (efd >= 0) {
+            close(efd);
+        }
+        ring_unmap();
+        close(fd);
+        g_ring.failed = true;
+        return -1;
+    }
+
+    g_ring.fd = fd;
+    g_ring.eventfd = efd;
+    wait_queue_init(&g_ring.inflight);
+
+    return 0;
+}
+
+/**
+ * Close the ring and free the registration tables.
+ *
+ * Called from io_shutdown() before the threads waiting on it are freed;
+ * closing the ring cancels their requests.
+ */
+void ring_shutdown(void)
+{
+    if (g_ring.fd >= 0) {
+        ring_unmap();
+        close(g_ring.fd);
+    }
+    if (g_ring.eventfd >= 0) {
+        close(g_ring.eventfd);
+    }
+    free(g_ring.fixed_files);
+    free(g_ring.buffers);
+
+    memset(&g_ring, 0, sizeof(g_ring));
+    g_ring.fd = -1;
+    g_ring.eventfd = -1;
+}
+
+/* ==========================================================================
+ * Submission and Completion
+ * ========================================================================== */
+
+/* Hand the SQEs written so far to the kernel */
+static void ring_enter(void)
+{
+    int n = sys_io_uring_enter(g_ring.fd, g_ring.pending, 0, 0);
+    g_ring.enters++;
+
+    /* On EINTR/EAGAIN/EBUSY the SQEs stay queued for the next attempt */
+    if (n > 0) {
+        g_ring.pending -= (unsigned int)n < g_ring.pending ?
+                          (unsigned int)n : g_ring.pending;
+    }
+}
+
+/* Next free SQE, submitting queued ones if the ring is full */
+static struct io_uring_sqe *ring_get_sqe(void)
+{
+    unsigned int tail = *g_ring.sq_tail;
+    unsigned int head = __atomic_load_n(g_ring.sq_head, __ATOMIC_ACQUIRE);
+
+    if (tail - head >= g_ring.sq_entries) {
+        ring_enter();
+        head = __atomic_load_n(g_ring.sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= g_ring.sq_entries) {
+            return NULL;
+        }
+    }
+
+    unsigned int index = tail & g_ring.sq_mask;
+    g_ring.sq_array[index] = index;
+    return &g_ring.sqes[index];
+}
+
+/* Publish the SQE returned by the last ring_get_sqe() */
+static void ring_commit(void)
+{
+    __atomic_store_n(g_ring.sq_tail, *g_ring.sq_tail + 1, __ATOMIC_RELEASE);
+    g_ring.pending++;
+}
+
+/* Make the threads whose requests completed runnable */
+static void ring_reap(void)
+{
+    unsigned int head = *g_ring.cq_head;
+    unsigned int tail = __atomic_load_n(g_ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &g_ring.cqes[head & g_ring.cq_mask];
+        struct uthread_internal *t =
+            (struct uthread_internal *)(uintptr_t)cqe->user_data;
+
+        if (t != NULL && t->blocked_queue == &g_ring.inflight) {
+            /* Cancelled by uthread_close(): report it like a closed fd */
+            bool closed = cqe->res == -ECANCELED && t->io_ring_fd < 0;
+            t->io_result = closed ? -EBADF : cqe->res;
+            wait_queue_remove_specific(&g_ring.inflight, t);
+            scheduler_unblock(t);
+        }
+        g_ring.requests++;
+        head++;
+    }
+
+    __atomic_store_n(g_ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reap completions and submit queued SQEs.
+ *
+ * Called from scheduler_schedule() and scheduler_tick() while requests
+ * are in flight. Reaping only reads shared memory. Submission is held
+ * back until nothing else is runnable, a tick passes or IO_RING_BATCH
+ * requests are queued, so that one io_uring_enter() carries many.
+ *
+ * @param flush Submit whatever is queued
+ */
+void ring_poll(bool flush)
+{
+    if (g_ring.pending > 0 && (flush || g_ring.pending >= IO_RING_BATCH)) {
+        ring_enter();
+    }
+    ring_reap();
+}
+
+/**
+ * Handle readiness of the completion eventfd reported by epoll.
+ */
+void ring_event(void)
+{
+    uint64_t value;
+    while (read(g_ring.eventfd, &value, sizeof(value)) > 0) {
+    }
+    ring_reap();
+}
+
+/* Use the fixed-file index and fixed buffer registered for this request */
+static void ring_apply_fixed(struct io_uring_sqe *sqe)
+{
+    int fd = sqe->fd;
+    if (fd >= 0 && fd < g_ring.nfixed && g_ring.fixed_files[fd] >= 0) {
+        sqe->fd = g_ring.fixed_files[fd];
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    if (sqe->opcode != IORING_OP_READ && sqe->opcode != IORING_OP_WRITE) {
+        return;
+    }
+
+    uintptr_t start = (uintptr_t)sqe->addr;
+    uintptr_t end = start + sqe->len;
+    for (unsigned int i = 0; i < g_ring.nbuffers; i++) {
+        uintptr_t base = (uintptr_t)g_ring.buffers[i].iov_base;
+        if (start >= base && end <= base + g_ring.buffers[i].iov_len) {
+            sqe->opcode = sqe->opcode == IORING_OP_READ ?
+                          IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = (uint16_t)i;
+            return;
+        }
+    }
+}
+
+/**
+ * Queue a request and park the calling thread until it completes.
+ *
+ * Called with preemption enabled. The SQE is sent to the kernel together
+ * with those of other threads, see ring_poll().
+ *
+ * @param req Request; user_data is filled in here
+ * @param res Kernel result (negative errno on failure)
+ * @return 0 if the request ran, -1 if the ring is unavailable
+ */
+int ring_submit_wait(const struct io_uring_sqe *req, int64_t *res)
+{
+    preemption_disable();
+
+    if (ring_setup() != 0) {
+        preemption_enable();
+        return -1;
+    }
+
+    struct io_uring_sqe *sqe = ring_get_sqe();
+    if (sqe == NULL) {
+        preemption_enable();
+        *res = -EAGAIN;
+        return 0;
+    }
+
+    struct uthread_internal *self = CURRENT_THREAD();
+
+    *sqe = *req;
+    self->io_ring_fd = sqe->fd;
+    ring_apply_fixed(sqe);
+    sqe->user_data = (uint64_t)(uintptr_t)self;
+    ring_commit();
+
+    /* An idle worker may be waiting on its futex: let it poll for us */
+    if (g_scheduler.num_workers > 1) {
+        worker_kick_idle();
+    }
+
+    scheduler_block(&g_ring.inflight);
+    *res = self->io_result;
+
+    preemption_enable();
+    return 0;
+}
+
+/* ==========================================================================
+ * Registration
+ * ========================================================================== */
+
+/**
+ * Replace the registered file set.
+ *
+ * @param fds   Descriptors (NULL/0 to unregister)
+ * @param count Number of descriptors
+ * @return 0 on success, -1 with errno set
+ */
+int ring_register_files(const int *fds, unsigned int count)
+{
+    if (ring_setup() != 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if (g_ring.nfixed > 0) {
+        sys_io_uring_register(g_ring.fd, IORING_UNREGISTER_FILES, NULL, 0);
+        free(g_ring.fixed_files);
+        g_ring.fixed_files = NULL;
+        g_ring.nfixed = 0;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    int max_fd = -1;
+    for (unsigned int i = 0; i < count; i++) {
+        if (fds[i] > max_fd) {
+            max_fd = fds[i];
+        }
+    }
+    if (max_fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    int *map = malloc((size_t)(max_fd + 1) * sizeof(*map));
+    if (map == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (int fd = 0; fd <= max_fd; fd++) {
+        map[fd] = -1;
+    }
+
+    if (sys_io_uring_register(g_ring.fd, IORING_REGISTER_FILES, fds, count) != 0) {
+        free(map);
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (fds[i] >= 0) {
+            map[fds[i]] = (int)i;
+        }
+    }
+    g_ring.fixed_files = map;
+    g_ring.nfixed = max_fd + 1;
+
+    return 0;
+}
+
+/**
+ * Replace the registered buffer set.
+ *
+ * @param iovs  Buffers (NULL/0 to unregister)
+ * @param count Number of buffers
+ * @return 0 on success, -1 with errno set
+ */
+int ring_register_buffers(const struct iovec *iovs, unsigned int count)
+{
+    if (ring_setup() != 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    if (g_ring.nbuffers > 0) {
+        sys_io_uring_register(g_ring.fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        free(g_ring.buffers);
+        g_ring.buffers = NULL;
+        g_ring.nbuffers = 0;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    struct iovec *copy = malloc(count * sizeof(*copy));
+    if (copy == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(copy, iovs, count * sizeof(*copy));
+
+    if (sys_io_uring_register(g_ring.fd, IORING_REGISTER_BUFFERS, iovs, count) != 0) {
+        free(copy);
+        return -1;
+    }
+
+    g_ring.buffers = copy;
+    g_ring.nbuffers = count;
+
+    return 0;
+}
+
+/**
+ * Cancel the requests on a descriptor that is about to be closed and
+ * drop it from the fixed-file set. The cancelled threads see EBADF.
+ *
+ * @param fd Descriptor
+ */
+void ring_forget_fd(int fd)
+{
+    if (g_ring.fd < 0) {
+        return;
+    }
+
+    bool cancelled = false;
+    for (struct uthread_internal *t = g_ring.inflight.head; t != NULL;
+         t = t->next) {
+        if (t->io_ring_fd != fd) {
+            continue;
+        }
+
+        struct io_uring_sqe *sqe = ring_get_sqe();
+        if (sqe == NULL) {
+            break;
+        }
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)t;
+        ring_commit();
+
+        t->io_ring_fd = -1;
+        cancelled = true;
+    }
+    if (cancelled) {
+        ring_enter();
+    }
+
+    if (fd < 0 || fd >= g_ring.nfixed || g_ring.fixed_files[fd] < 0) {
+        return;
+    }
+
+    int none = -1;
+    struct io_uring_files_update update = {
+        .offset = (uint32_t)g_ring.fixed_files[fd],
+        .fds = (uint64_t)(uintptr_t)&none
+    };
+    sys_io_uring_register(g_ring.fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+    g_ring.fixed_files[fd] = -1;
+}
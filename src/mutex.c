@@ -1,7 +1,15 @@
 /**
  * LibUThread Mutex Implementation
  *
- * Blocking mutex with support for normal, recursive, and error-checking types.
+ * Blocking mutex with support for normal, recursive, error-checking and
+ * adaptive types. Waiters queue on the mutex itself. A released mutex is
+ * normally free for anyone to take, but a waiter that was woken and lost
+ * the race for it is handed ownership directly on the next unlock, so it
+ * does not have to compete again. Threads signaled on a condition variable
+ * are moved straight onto the queue of a held mutex, so an unlock wakes
+ * them one at a time instead of all waking only to block on it. Adaptive
+ * mutexes first wait a bounded, self-tuned time for the owner to release
+ * before blocking.
  *
  * @file mutex.c
  */
@@ -10,6 +18,10 @@
 #include "internal.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+
+/* Upper bound on busy-wait iterations of an adaptive mutex */
+#define MUTEX_SPIN_MAX          200
 
 /* ==========================================================================
  * Mutex Attribute Functions
@@ -43,7 +55,8 @@ int uthread_mutexattr_settype(uthread_mutexattr_t *attr, int type)
 
     if (type != UTHREAD_MUTEX_NORMAL &&
         type != UTHREAD_MUTEX_RECURSIVE &&
-        type != UTHREAD_MUTEX_ERRORCHECK) {
+        type != UTHREAD_MUTEX_ERRORCHECK &&
+        type != UTHREAD_MUTEX_ADAPTIVE) {
         return UTHREAD_EINVAL;
     }
 
@@ -61,6 +74,165 @@ int uthread_mutexattr_gettype(const uthread_mutexattr_t *attr, int *type)
     return UTHREAD_SUCCESS;
 }
 
+/* ==========================================================================
+ * Acquire and Release
+ * ========================================================================== */
+
+/**
+ * Take a mutex, blocking until it is free or handed over.
+ *
+ * Called with preemption disabled; also used by the condition variable
+ * to reacquire the mutex after a wait.
+ *
+ * @param mutex Mutex
+ * @param self  Calling thread
+ */
+void mutex_acquire_locked(uthread_mutex_t *mutex, struct uthread_internal *self)
+{
+    uint64_t wait_start = (mutex->lock != 0) ? lock_wait_start() : 0;
+
+    /* Requeued by a condvar signal: already queued once, woken by an unlock */
+    if (self != NULL && self->mutex_requeued) {
+        self->mutex_requeued = false;
+        wait_start = self->lock_wait_since;
+        if (mutex->lock != 0) {
+            self->mutex_handoff = true;
+        }
+    }
+
+    while (mutex->lock != 0) {
+        UTHREAD_ASSERT(self != NULL);
+
+        struct uthread_internal *owner = (struct uthread_internal *)mutex->owner;
+        trace_record(TRACE_LOCK_CONTENDED, self->tid,
+                     owner != NULL ? owner->tid : 0);
+
+        self->state = UTHREAD_STATE_BLOCKED;
+        wait_queue_add(&mutex->waiters, self);
+        scheduler_schedule();
+
+        if (mutex->owner == (uthread_t)self) {
+            /* Handed over by the unlocking thread */
+            self->mutex_handoff = false;
+            goto acquired;
+        }
+
+        /* Woken, but another thread took the lock first */
+        self->mutex_handoff = true;
+    }
+
+    mutex->lock = 1;
+    mutex->owner = (uthread_t)self;
+    mutex->recursion_count = 1;
+    if (self != NULL) {
+        self->mutex_handoff = false;
+    }
+
+acquired:
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        lock_stats_acquired(&mutex->stats, mutex, UTHREAD_LOCK_MUTEX,
+                            wait_start, true);
+    }
+}
+
+/**
+ * Release a mutex and wake the oldest waiter.
+ *
+ * A waiter that already lost a race for the mutex gets it handed over
+ * with the lock still taken. Otherwise the mutex is released, so the
+ * caller can take it again without waiting for the waiter to run (which
+ * would turn every lock into a context switch once threads queue up).
+ *
+ * Called with preemption disabled.
+ *
+ * @param mutex Mutex held by the caller
+ */
+void mutex_release_locked(uthread_mutex_t *mutex)
+{
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        lock_stats_released(mutex->stats, true);
+    }
+
+    struct uthread_internal *next = wait_queue_remove(&mutex->waiters);
+
+    if (next != NULL && next->mutex_handoff) {
+        mutex->owner = (uthread_t)next;
+        mutex->recursion_count = 1;
+        scheduler_unblock_partner(next);
+        return;
+    }
+
+    mutex->lock = 0;
+    mutex->owner = NULL;
+    mutex->recursion_count = 0;
+
+    if (next != NULL) {
+        scheduler_unblock_partner(next);
+    }
+}
+
+/**
+ * Move a thread signaled on a condition variable onto the wait queue of
+ * the mutex it will reacquire, instead of making it runnable while the
+ * mutex is held or already promised to another woken thread (wait
+ * morphing). It then waits like a thread blocked in uthread_mutex_lock(),
+ * woken by an unlock, and its condvar wait retakes the mutex from there.
+ *
+ * Called with preemption disabled, after the thread has been removed
+ * from the condvar's queue.
+ *
+ * @param mutex  Mutex the thread waited with
+ * @param thread Blocked thread
+ */
+void mutex_requeue_locked(uthread_mutex_t *mutex, struct uthread_internal *thread)
+{
+    /* Signaled: a timed wait's deadline no longer applies */
+    if (thread->sleep_index != 0) {
+        sleep_queue_remove(thread);
+    }
+
+    thread->mutex_requeued = true;
+    thread->lock_wait_since = lock_wait_start();
+    wait_queue_add(&mutex->waiters, thread);
+}
+
+/*
+ * Adaptive mutex slow path, run with preemption enabled before blocking.
+ * In M:N mode the owner may be running on another worker, so busy-wait
+ * for up to twice the spin count that sufficed recently (plus a floor). With a single
+ * worker the owner cannot run while we spin, so yield to it once instead.
+ * The caller rechecks the lock either way.
+ */
+static void mutex_adaptive_wait(uthread_mutex_t *mutex)
+{
+    if (g_scheduler.num_workers <= 1) {
+        uthread_yield();
+        return;
+    }
+
+    int limit = mutex->spin_estimate * 2 + 10;
+    if (limit > MUTEX_SPIN_MAX) {
+        limit = MUTEX_SPIN_MAX;
+    }
+
+    int spins = 0;
+    while (mutex->lock != 0 && spins < limit) {
+        cpu_relax();
+        spins++;
+    }
+
+    /*
+     * Move toward the spin count that worked, or back off when spinning
+     * did not pay (the owner was probably not running). Racy, but the
+     * estimate is only a hint.
+     */
+    if (mutex->lock == 0) {
+        mutex->spin_estimate += (spins - mutex->spin_estimate) / 8;
+    } else {
+        mutex->spin_estimate /= 2;
+    }
+}
+
 /* ==========================================================================
  * Mutex Functions
  * ========================================================================== */
@@ -82,12 +254,7 @@ int uthread_mutex_init(uthread_mutex_t *mutex, const uthread_mutexattr_t *attr)
         mutex->type = UTHREAD_MUTEX_NORMAL;
     }
 
-    /* Allocate wait queue */
-    mutex->waiters = malloc(sizeof(struct wait_queue));
-    if (mutex->waiters == NULL) {
-        return UTHREAD_ENOMEM;
-    }
-    wait_queue_init(mutex->waiters);
+    wait_queue_init(&mutex->waiters);
 
     mutex->initialized = true;
 
@@ -110,16 +277,12 @@ int uthread_mutex_destroy(uthread_mutex_t *mutex)
     }
 
     /* Cannot destroy if threads are waiting */
-    if (mutex->waiters != NULL && !wait_queue_empty(mutex->waiters)) {
+    if (!wait_queue_empty(&mutex->waiters)) {
         return UTHREAD_EBUSY;
     }
 
-    /* Free wait queue */
-    if (mutex->waiters != NULL) {
-        wait_queue_destroy(mutex->waiters);
-        free(mutex->waiters);
-        mutex->waiters = NULL;
-    }
+    wait_queue_destroy(&mutex->waiters);
+    lock_stats_free(&mutex->stats);
 
     mutex->initialized = false;
 
@@ -132,22 +295,21 @@ int uthread_mutex_lock(uthread_mutex_t *mutex)
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized mutex (static initializer) */
-    if (!mutex->initialized) {
-        mutex->waiters = malloc(sizeof(struct wait_queue));
-        if (mutex->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(mutex->waiters);
-        mutex->initialized = true;
+    /* Give the owner a chance to release before we block */
+    if (mutex->type == UTHREAD_MUTEX_ADAPTIVE && mutex->lock != 0 &&
+        mutex->owner != uthread_self()) {
+        mutex_adaptive_wait(mutex);
     }
 
     preemption_disable();
 
+    /* A zero-filled mutex is a valid unlocked normal mutex */
+    mutex->initialized = true;
+
     struct uthread_internal *self = scheduler_current();
 
     /* Handle recursive/error-checking mutex */
-    if (mutex->owner == self) {
+    if (mutex->owner == (uthread_t)self) {
         if (mutex->type == UTHREAD_MUTEX_RECURSIVE) {
             mutex->recursion_count++;
             preemption_enable();
@@ -159,29 +321,8 @@ int uthread_mutex_lock(uthread_mutex_t *mutex)
         /* Normal mutex: undefined behavior, but we'll deadlock */
     }
 
-    /* Try to acquire lock */
-    while (mutex->lock != 0) {
-        /* Lock is held by another thread - block */
-        if (self != NULL) {
-            self->state = UTHREAD_STATE_BLOCKED;
-            wait_queue_add(mutex->waiters, self);
-        }
-
-        /* Temporarily enable preemption and yield */
-        preemption_enable();
-
-        if (self != NULL) {
-            /* Schedule another thread - we'll wake up when lock is released */
-            scheduler_schedule();
-        }
-
-        preemption_disable();
-    }
-
-    /* Acquired the lock */
-    mutex->lock = 1;
-    mutex->owner = self;
-    mutex->recursion_count = 1;
+    /* Blocks with preemption disabled until the lock is handed to us */
+    mutex_acquire_locked(mutex, self);
 
     preemption_enable();
 
@@ -194,22 +335,14 @@ int uthread_mutex_trylock(uthread_mutex_t *mutex)
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized mutex */
-    if (!mutex->initialized) {
-        mutex->waiters = malloc(sizeof(struct wait_queue));
-        if (mutex->waiters == NULL) {
-            return UTHREAD_ENOMEM;
-        }
-        wait_queue_init(mutex->waiters);
-        mutex->initialized = true;
-    }
-
     preemption_disable();
 
+    mutex->initialized = true;
+
     struct uthread_internal *self = scheduler_current();
 
     /* Handle recursive mutex */
-    if (mutex->owner == self) {
+    if (mutex->owner == (uthread_t)self) {
         if (mutex->type == UTHREAD_MUTEX_RECURSIVE) {
             mutex->recursion_count++;
             preemption_enable();
@@ -222,9 +355,7 @@ int uthread_mutex_trylock(uthread_mutex_t *mutex)
 
     /* Try to acquire */
     if (mutex->lock == 0) {
-        mutex->lock = 1;
-        mutex->owner = self;
-        mutex->recursion_count = 1;
+        mutex_acquire_locked(mutex, self);
         preemption_enable();
         return UTHREAD_SUCCESS;
     }
@@ -249,14 +380,14 @@ int uthread_mutex_unlock(uthread_mutex_t *mutex)
 
     /* Check ownership for error-checking mutex */
     if (mutex->type == UTHREAD_MUTEX_ERRORCHECK) {
-        if (mutex->owner != self) {
+        if (mutex->owner != (uthread_t)self) {
             preemption_enable();
             return UTHREAD_EPERM;
         }
     }
 
     /* Handle recursive mutex */
-    if (mutex->type == UTHREAD_MUTEX_RECURSIVE && mutex->owner == self) {
+    if (mutex->type == UTHREAD_MUTEX_RECURSIVE && mutex->owner == (uthread_t)self) {
         mutex->recursion_count--;
         if (mutex->recursion_count > 0) {
             preemption_enable();
@@ -264,15 +395,8 @@ int uthread_mutex_unlock(uthread_mutex_t *mutex)
         }
     }
 
-    /* Release the lock */
-    mutex->lock = 0;
-    mutex->owner = NULL;
-    mutex->recursion_count = 0;
-
-    /* Wake one waiting thread */
-    if (mutex->waiters != NULL && !wait_queue_empty(mutex->waiters)) {
-        wait_queue_wake_one(mutex->waiters);
-    }
+    /* Release the lock, or pass it to the next waiter */
+    mutex_release_locked(mutex);
 
     preemption_enable();
 
@@ -0,0 +1,664 @@
+/**
+ * LibUThread Stack and TCB Pool
+ *
+ * Caches released thread stacks, bucketed by size, and thread control
+ * blocks so that short-lived create/join cycles reuse memory instead of
+ * going through mmap/mprotect/munmap and malloc/free each time. Cached
+ * stacks keep their guard page and are already faulted in.
+ *
+ * In the lazy stack modes stacks are mapped MAP_NORESERVE and all but
+ * their top STACK_KEEP_SIZE is handed back with MADV_DONTNEED when they
+ * are cached. Growable stacks reserve STACK_GROW_RESERVE of address space
+ * with only the requested size accessible; a SIGSEGV on the inaccessible
+ * part, taken on a per-worker alternate stack, extends them in place.
+ *
+ * When the workers span several NUMA nodes, a new stack is bound to the
+ * node of the worker its thread starts on and cached per node, so a
+ * thread created there gets memory local to it.
+ *
+ * All functions must be called with preemption disabled, except the
+ * fault handler.
+ *
+ * @file pool.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/* Global pool instance */
+struct thread_pool g_thread_pool = {
+    .max_cached = UTHREAD_STACK_CACHE_DEFAULT
+};
+
+/* ==========================================================================
+ * Stack Mapping
+ * ========================================================================== */
+
+/**
+ * Address space behind a stack of `size` usable bytes, guard page
+ * excluded. The usable part sits at the top of it.
+ */
+size_t stack_reserve_size(size_t size)
+{
+    if (g_thread_pool.stack_mode == UTHREAD_STACK_GROWABLE &&
+        size < STACK_GROW_RESERVE) {
+        return STACK_GROW_RESERVE;
+    }
+    return size;
+}
+
+/* Whether stacks are placed on NUMA nodes (the workers span several) */
+static bool stack_numa(int node)
+{
+    return g_scheduler.num_nodes > 1 && node >= 0 && node < 64;
+}
+
+/**
+ * Map a stack region with a guard page at its low end.
+ *
+ * @param size     Usable stack size (multiple of UTHREAD_GUARD_SIZE)
+ * @param populate Fault the pages in now rather than on first use
+ * @param node     NUMA node to prefer for the pages
+ * @return Start of the region (the guard page), or NULL on failure
+ */
+void *stack_map(size_t size, bool populate, int node)
+{
+    bool lazy = g_thread_pool.stack_mode != UTHREAD_STACK_COMMITTED;
+    bool numa = stack_numa(node);
+    size_t total_size = stack_reserve_size(size) + UTHREAD_GUARD_SIZE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (lazy) {
+        flags |= MAP_NORESERVE;
+    } else if (populate && !numa) {
+        flags |= MAP_POPULATE;
+    }
+
+    void *region = mmap(NULL, total_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Preferred, not bound: a full node falls back to another one */
+    if (numa) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, region, total_size, MPOL_PREFERRED, &mask,
+                sizeof(mask) * 8, 0);
+
+        /* MAP_POPULATE would have faulted the pages in before the policy */
+        if (!lazy && populate) {
+            char *top = (char *)region + total_size;
+            for (size_t off = UTHREAD_GUARD_SIZE; off <= size; off += UTHREAD_GUARD_SIZE) {
+                top[-(ptrdiff_t)off] = 0;
+            }
+        }
+    }
+
+    /* Set up guard page (no access), and the room a growable stack grows into */
+    if (mprotect(region, total_size - size, PROT_NONE) == -1) {
+        munmap(region, total_size);
+        return NULL;
+    }
+
+    /* A lazy stack only gets the top faulted in, where every thread starts */
+    if (lazy && populate) {
+        char *top = (char *)region + total_size;
+        for (size_t off = UTHREAD_GUARD_SIZE; off <= STACK_KEEP_SIZE && off <= size;
+             off += UTHREAD_GUARD_SIZE) {
+            top[-(ptrdiff_t)off] = 0;
+        }
+    }
+
+    return region;
+}
+
+size_t stack_round_size(size_t size)
+{
+    return (size + UTHREAD_GUARD_SIZE - 1) & ~((size_t)UTHREAD_GUARD_SIZE - 1);
+}
+
+static void stack_unmap(void *region, size_t size)
+{
+    munmap(region, stack_reserve_size(size) + UTHREAD_GUARD_SIZE);
+}
+
+/**
+ * Give the pages of a released stack back to the kernel in the lazy
+ * modes, all but the top STACK_KEEP_SIZE, and shrink a grown stack to its
+ * requested size again.
+ *
+ * @param thread Thread whose stack is being released (mmap'd stacks only)
+ */
+void stack_discard_pages(struct uthread_internal *thread)
+{
+    if (g_thread_pool.stack_mode == UTHREAD_STACK_COMMITTED) {
+        return;
+    }
+
+    char *base = thread->cold->stack_base;
+    char *low = thread->cold->stack_limit;
+    char *keep = base + thread->cold->stack_size - STACK_KEEP_SIZE;
+
+    if (low < base) {
+        mprotect(low, (size_t)(base - low), PROT_NONE);
+    }
+    if (keep > low) {
+        madvise(low, (size_t)(keep - low), MADV_DONTNEED);
+    }
+
+    thread->cold->stack_limit = base;
+}
+
+/* ==========================================================================
+ * Stack Growth
+ * ========================================================================== */
+
+static struct sigaction s_old_segv;
+static stack_t s_old_altstack;
+static bool s_fault_installed;
+
+/* Extend `t`'s stack if `addr` lies in the room below it; false if not */
+static bool stack_grow(struct uthread_internal *t, uintptr_t addr)
+{
+    if (t == NULL || t->cold->stack_guard == NULL) {
+        return false;
+    }
+
+    uintptr_t floor = (uintptr_t)t->cold->stack_guard + UTHREAD_GUARD_SIZE;
+    uintptr_t limit = (uintptr_t)t->cold->stack_limit;
+
+    if (addr < floor || addr >= limit) {
+        return false;
+    }
+
+    uintptr_t low = addr & ~((uintptr_t)UTHREAD_GUARD_SIZE - 1);
+    low = (low > floor + STACK_GROW_CHUNK) ? low - STACK_GROW_CHUNK : floor;
+
+    if (mprotect((void *)low, limit - low, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+
+    t->cold->stack_limit = (void *)low;
+    __atomic_fetch_add(&g_thread_pool.stack_growths, 1, __ATOMIC_RELAXED);
+
+    return true;
+}
+
+/*
+ * SIGSEGV on the inaccessible part of a growable stack: make the faulting
+ * page and STACK_GROW_CHUNK below it accessible and return, which retries
+ * the access. Runs on the worker's alternate stack. The stack is the
+ * current thread's, or during a switch the one still leaving the CPU.
+ */
+static void stack_fault_handler(int sig, siginfo_t *info, void *ucontext)
+{
+    struct worker *w = t_worker;
+    uintptr_t addr = (uintptr_t)info->si_addr;
+
+    (void)sig;
+
+    if (w != NULL) {
+#if defined(__x86_64__)
+        /*
+         * A signal frame that did not fit below the stack pointer is
+         * reported without an address: grow below the stack pointer.
+         */
+        if (info->si_code == SI_KERNEL) {
+            uintptr_t sp = (uintptr_t)
+                ((ucontext_t *)ucontext)->uc_mcontext.gregs[REG_RSP];
+            addr = (sp > STACK_GROW_CHUNK) ? sp - STACK_GROW_CHUNK : 0;
+        }
+#else
+        (void)ucontext;
+#endif
+
+        if (stack_grow(w->current, addr) || stack_grow(w->switching_from, addr)) {
+#ifdef UTHREAD_TICKLESS
+            /* The lost signal may have been the one-shot: fire it again */
+            if (info->si_code == SI_KERNEL) {
+                w->timer_expiry = 0;
+                raise(PREEMPT_SIGNAL);
+            }
+#endif
+            return;
+        }
+    }
+
+    /* Not ours: the retried access faults again under the old handler */
+    sigaction(SIGSEGV, &s_old_segv, NULL);
+}
+
+/**
+ * Give a worker's kernel thread the alternate stack the fault handler
+ * runs on (growable mode only).
+ *
+ * @param w Calling worker
+ * @return 0 on success, error code on failure
+ */
+int stack_fault_worker_init(struct worker *w)
+{
+    if (g_thread_pool.stack_mode != UTHREAD_STACK_GROWABLE) {
+        return UTHREAD_SUCCESS;
+    }
+
+    w->fault_stack = malloc(STACK_FAULT_ALTSTACK);
+    if (w->fault_stack == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+
+    stack_t ss = {
+        .ss_sp = w->fault_stack,
+        .ss_size = STACK_FAULT_ALTSTACK,
+        .ss_flags = 0
+    };
+    if (sigaltstack(&ss, (w->id == 0) ? &s_old_altstack : NULL) == -1) {
+        free(w->fault_stack);
+        w->fault_stack = NULL;
+        return UTHREAD_EAGAIN;
+    }
+
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Remove the alternate stack of the calling worker; worker 0 gets back
+ * the one the application had.
+ *
+ * @param w Calling worker
+ */
+void stack_fault_worker_shutdown(struct worker *w)
+{
+    if (w->fault_stack == NULL) {
+        return;
+    }
+
+    if (w->id == 0) {
+        sigaltstack(&s_old_altstack, NULL);
+    } else {
+        stack_t ss = { .ss_flags = SS_DISABLE };
+        sigaltstack(&ss, NULL);
+    }
+
+    free(w->fault_stack);
+    w->fault_stack = NULL;
+}
+
+/**
+ * Point a signal frame's saved alternate stack at the calling worker's.
+ *
+ * Returning from a signal restores the alternate stack recorded when it
+ * was delivered. The preemption handler can switch threads, so its frame
+ * may be returned from on another worker, which would then share the
+ * delivering worker's alternate stack.
+ *
+ * @param ucontext Context argument of an SA_SIGINFO handler
+ */
+void stack_fault_fix_frame(void *ucontext)
+{
+    struct worker *w = t_worker;
+
+    if (w == NULL || w->fault_stack == NULL) {
+        return;
+    }
+
+    ucontext_t *uc = ucontext;
+    uc->uc_stack.ss_sp = w->fault_stack;
+    uc->uc_stack.ss_size = STACK_FAULT_ALTSTACK;
+    uc->uc_stack.ss_flags = 0;
+}
+
+/**
+ * Install the growth handler and worker 0's alternate stack when stacks
+ * are growable. Called from uthread_init() on worker 0.
+ *
+ * @return 0 on success, error code on failure
+ */
+int stack_fault_init(void)
+{
+    if (g_thread_pool.stack_mode != UTHREAD_STACK_GROWABLE) {
+        return UTHREAD_SUCCESS;
+    }
+
+    int ret = stack_fault_worker_init(&g_scheduler.workers[0]);
+    if (ret != UTHREAD_SUCCESS) {
+        return ret;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = stack_fault_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+
+    /*
+     * Keep the preemption signal out: its handler may switch threads, and
+     * another thread faulting would reuse the alternate stack under us.
+     */
+    sigfillset(&sa.sa_mask);
+
+    if (sigaction(SIGSEGV, &sa, &s_old_segv) == -1) {
+        stack_fault_worker_shutdown(&g_scheduler.workers[0]);
+        return UTHREAD_EAGAIN;
+    }
+    s_fault_installed = true;
+
+    return UTHREAD_SUCCESS;
+}
+
+/** Restore the SIGSEGV disposition and worker 0's alternate stack */
+void stack_fault_shutdown(void)
+{
+    if (s_fault_installed) {
+        sigaction(SIGSEGV, &s_old_segv, NULL);
+        s_fault_installed = false;
+    }
+    stack_fault_worker_shutdown(&g_scheduler.workers[0]);
+}
+
+/* ==========================================================================
+ * Stack Cache
+ * ========================================================================== */
+
+/* The free list link lives in the top word, which stays accessible and resident */
+static void **stack_link(void *region, size_t size)
+{
+    char *top = (char *)region + UTHREAD_GUARD_SIZE + stack_reserve_size(size);
+    return (void **)top - 1;
+}
+
+static struct stack_bucket *bucket_find(size_t size, int node, bool claim)
+{
+    struct stack_bucket *unused = NULL;
+
+    /* Without NUMA placement every stack counts as node 0 */
+    if (!stack_numa(node)) {
+        node = 0;
+    }
+
+    for (int i = 0; i < UTHREAD_POOL_BUCKETS; i++) {
+        struct stack_bucket *b = &g_thread_pool.buckets[i];
+        if (b->size == size && b->node == node) {
+            return b;
+        }
+        if (unused == NULL && b->count == 0) {
+            unused = b;
+        }
+    }
+
+    /* Reassign an empty bucket to the new size */
+    if (claim && unused != NULL) {
+        unused->size = size;
+        unused->node = node;
+        return unused;
+    }
+
+    return NULL;
+}
+
+void *stack_pool_get(size_t size, int node)
+{
+    struct stack_bucket *b = bucket_find(size, node, false);
+
+    if (b == NULL || b->count == 0) {
+        g_thread_pool.stack_misses++;
+        return NULL;
+    }
+
+    void *region = b->head;
+    b->head = *stack_link(region, size);
+    b->count--;
+    g_thread_pool.stack_hits++;
+
+    return region;
+}
+
+bool stack_pool_put(void *region, size_t size, int node)
+{
+    struct stack_bucket *b = bucket_find(size, node, true);
+
+    if (b == NULL || b->count >= g_thread_pool.max_cached) {
+        return false;
+    }
+
+    *stack_link(region, size) = b->head;
+    b->head = region;
+    b->count++;
+
+    return true;
+}
+
+static void bucket_trim(struct stack_bucket *b, int keep)
+{
+    while (b->count > keep) {
+        void *region = b->head;
+        b->head = *stack_link(region, b->size);
+        b->count--;
+        stack_unmap(region, b->size);
+    }
+}
+
+/* ==========================================================================
+ * TCB Freelist
+ * ========================================================================== */
+
+/**
+ * Allocate a zeroed TCB: the hot header on its own cache lines and the
+ * cold part beside it.
+ */
+struct uthread_internal *tcb_alloc(void)
+{
+    struct uthread_internal *t = aligned_alloc(UTHREAD_CACHE_LINE, sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+
+    struct uthread_cold *cold = calloc(1, sizeof(*cold));
+    if (cold == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    memset(t, 0, sizeof(*t));
+    t->cold = cold;
+    return t;
+}
+
+/** Free a TCB from tcb_alloc() */
+void tcb_free(struct uthread_internal *thread)
+{
+    free(thread->cold);
+    free(thread);
+}
+
+struct uthread_internal *tcb_pool_get(void)
+{
+    struct uthread_internal *t = g_thread_pool.free_tcbs;
+
+    if (t == NULL) {
+        g_thread_pool.tcb_misses++;
+        return NULL;
+    }
+
+    g_thread_pool.free_tcbs = t->next;
+    g_thread_pool.free_tcb_count--;
+    g_thread_pool.tcb_hits++;
+
+    /* The cold part stays attached while cached */
+    struct uthread_cold *cold = t->cold;
+    memset(t, 0, sizeof(*t));
+    memset(cold, 0, sizeof(*cold));
+    t->cold = cold;
+    return t;
+}
+
+bool tcb_pool_put(struct uthread_internal *thread)
+{
+    if (g_thread_pool.free_tcb_count >= g_thread_pool.max_cached) {
+        return false;
+    }
+
+    thread->next = g_thread_pool.free_tcbs;
+    g_thread_pool.free_tcbs = thread;
+    g_thread_pool.free_tcb_count++;
+
+    return true;
+}
+
+static void tcb_trim(int keep)
+{
+    while (g_thread_pool.free_tcb_count > keep) {
+        struct uthread_internal *t = g_thread_pool.free_tcbs;
+        g_thread_pool.free_tcbs = t->next;
+        g_thread_pool.free_tcb_count--;
+        tcb_free(t);
+    }
+}
+
+void pool_drain(void)
+{
+    for (int i = 0; i < UTHREAD_POOL_BUCKETS; i++) {
+        bucket_trim(&g_thread_pool.buckets[i], 0);
+    }
+    tcb_trim(0);
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+int uthread_stack_prewarm(size_t stack_size, int count)
+{
+    if (count < 0) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (stack_size == 0) {
+        stack_size = UTHREAD_STACK_DEFAULT;
+    }
+    if (stack_size < UTHREAD_STACK_MIN || stack_size > UTHREAD_STACK_MAX) {
+        return UTHREAD_EINVAL;
+    }
+    stack_size = stack_round_size(stack_size);
+
+    int result = UTHREAD_SUCCESS;
+
+    preemption_disable();
+
+    /* Stacks for threads created on the caller's node */
+    int node = (t_worker != NULL) ? t_worker->node : 0;
+    struct stack_bucket *b = bucket_find(stack_size, node, true);
+    if (b == NULL) {
+        result = UTHREAD_EAGAIN;
+    }
+
+    while (result == UTHREAD_SUCCESS && b->count < count &&
+           b->count < g_thread_pool.max_cached) {
+        void *region = stack_map(stack_size, true, node);
+        if (region == NULL) {
+            result = UTHREAD_ENOMEM;
+            break;
+        }
+        stack_pool_put(region, stack_size, node);
+    }
+
+    /* Keep TCBs on hand for the same number of threads */
+    while (result == UTHREAD_SUCCESS && g_thread_pool.free_tcb_count < count &&
+           g_thread_pool.free_tcb_count < g_thread_pool.max_cached) {
+        struct uthread_internal *t = tcb_alloc();
+        if (t == NULL) {
+            result = UTHREAD_ENOMEM;
+            break;
+        }
+        tcb_pool_put(t);
+    }
+
+    preemption_enable();
+
+    return result;
+}
+
+int uthread_set_stack_cache(int max_cached)
+{
+    if (max_cached < 0) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    g_thread_pool.max_cached = max_cached;
+
+    /* Release anything above the new limit */
+    for (int i = 0; i < UTHREAD_POOL_BUCKETS; i++) {
+        bucket_trim(&g_thread_pool.buckets[i], max_cached);
+    }
+    tcb_trim(max_cached);
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_set_stack_mode(uthread_stack_mode_t mode)
+{
+    if (mode != UTHREAD_STACK_COMMITTED && mode != UTHREAD_STACK_LAZY &&
+        mode != UTHREAD_STACK_GROWABLE) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (g_scheduler.initialized) {
+        return UTHREAD_EBUSY;
+    }
+
+    /* Cached stacks have the old layout: unmap them while it still applies */
+    if (mode != g_thread_pool.stack_mode) {
+        pool_drain();
+        g_thread_pool.stack_mode = mode;
+    }
+
+    return UTHREAD_SUCCESS;
+}
+
+size_t uthread_stack_high_watermark(uthread_t thread)
+{
+    if (!g_scheduler.initialized || thread == NULL) {
+        return 0;
+    }
+
+    struct uthread_internal *t = (struct uthread_internal *)thread;
+    size_t used = 0;
+
+    preemption_disable();
+
+    if (registry_contains(t) && t->cold->stack_base != NULL) {
+        uintptr_t top = (uintptr_t)t->cold->stack_base + t->cold->stack_size;
+        uintptr_t p = (uintptr_t)t->cold->stack_limit & ~((uintptr_t)UTHREAD_GUARD_SIZE - 1);
+        unsigned char vec[64];
+
+        /* The lowest resident page is the deepest the stack has reached */
+        while (p < top && used == 0) {
+            size_t pages = (top - p + UTHREAD_GUARD_SIZE - 1) / UTHREAD_GUARD_SIZE;
+            if (pages > sizeof(vec)) {
+                pages = sizeof(vec);
+            }
+            if (mincore((void *)p, pages * UTHREAD_GUARD_SIZE, vec) != 0) {
+                break;
+            }
+            for (size_t i = 0; i < pages; i++) {
+                if (vec[i] & 1) {
+                    used = top - (p + i * UTHREAD_GUARD_SIZE);
+                    break;
+                }
+            }
+            p += pages * UTHREAD_GUARD_SIZE;
+        }
+    }
+
+    preemption_enable();
+
+    return used;
+}
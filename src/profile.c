@@ -0,0 +1,383 @@
+/**
+ * LibUThread Sampling Profiler
+ *
+ * While profiling, every worker's timer ticks at least once per sampling
+ * period, and the timer signal handler records the interrupted thread
+ * and the top of its call stack into the worker's ring before deciding
+ * whether to preempt. The stack is found by walking the frame-pointer
+ * chain, trusting only frames inside the part of the thread's own stack
+ * above the interrupted stack pointer, so a sample costs a few loads and
+ * never faults. Code built without frame pointers, the main thread (on
+ * the process stack) and generator bodies get the interrupted pc alone.
+ *
+ * uthread_profile_export() aggregates the samples into the folded-stack
+ * format of flamegraph.pl and speedscope: one line per distinct stack,
+ * rooted at the thread it ran in. Frames are named with dladdr(), which
+ * only knows dynamic symbols; the rest are written as module+offset for
+ * addr2line.
+ *
+ * @file profile.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+/* Whether timer_signal_handler() records samples */
+atomic_bool g_profile_enabled = false;
+
+/* ==========================================================================
+ * Sampling
+ * ========================================================================== */
+
+/* Walk the frame-pointer chain of the interrupted code into `s` */
+static void profile_walk(struct profile_sample *s,
+                         const struct uthread_internal *t, const void *ucontext)
+{
+#if defined(__x86_64__)
+    const ucontext_t *uc = ucontext;
+    uintptr_t sp = (uintptr_t)uc->uc_mcontext.gregs[REG_RSP];
+    uintptr_t fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+
+    s->pc[0] = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    s->depth = 1;
+
+    /* Everything between sp and the top of the stack is mapped */
+    uintptr_t lo = (uintptr_t)t->cold->stack_base;
+    uintptr_t hi = lo + t->cold->stack_size;
+    if (lo == 0 || sp < lo || sp >= hi) {
+        return;
+    }
+
+    while (s->depth < PROFILE_MAX_DEPTH &&
+           fp >= sp && fp <= hi - 2 * sizeof(uintptr_t) &&
+           (fp & (sizeof(uintptr_t) - 1)) == 0) {
+        const uintptr_t *frame = (const uintptr_t *)fp;
+        if (frame[1] == 0) {
+            break;
+        }
+        s->pc[s->depth++] = frame[1];
+
+        /* Callers' frames are higher up; anything else ends the chain */
+        if (frame[0] <= fp) {
+            break;
+        }
+        sp = fp;
+        fp = frame[0];
+    }
+#else
+    (void)t;
+    (void)ucontext;
+    s->depth = 0;
+#endif
+}
+
+/**
+ * Record a sample of the thread running on `w`. Called from the timer
+ * signal handler while g_profile_enabled is set.
+ */
+void profile_sample(struct worker *w, const void *ucontext)
+{
+    struct uthread_internal *t = w->current;
+    if (t == NULL || t == &w->idle_thread) {
+        return;
+    }
+
+    struct profile_ring *ring = &w->profile;
+
+    /* Pairs with profile_quiesce(): it stops us first, then waits */
+    atomic_store(&ring->busy, true);
+    if (atomic_load(&g_profile_enabled)) {
+        struct profile_sample *s = &ring->samples[ring->head & ring->mask];
+        s->tid = t->tid;
+        memcpy(s->name, t->cold->name, UTHREAD_NAME_MAX);
+        profile_walk(s, t, ucontext);
+        if (s->depth > 0) {
+            ring->head++;
+        }
+    }
+    atomic_store_explicit(&ring->busy, false, memory_order_release);
+}
+
+/* ==========================================================================
+ * Ring Management
+ * ========================================================================== */
+
+/* Stop sampling and wait until no handler is still writing a sample */
+static bool profile_quiesce(void)
+{
+    bool was = atomic_exchange(&g_profile_enabled, false);
+
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        while (atomic_load_explicit(&g_scheduler.workers[i].profile.busy,
+                                    memory_order_acquire)) {
+            sched_yield();
+        }
+    }
+
+    return was;
+}
+
+static void profile_free_rings(void)
+{
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct profile_ring *ring = &g_scheduler.workers[i].profile;
+        free(ring->samples);
+        ring->samples = NULL;
+        ring->head = 0;
+        ring->mask = 0;
+    }
+}
+
+/**
+ * Stop profiling and free the rings. Called from uthread_shutdown() while
+ * the workers still exist.
+ */
+void profile_shutdown(void)
+{
+    profile_quiesce();
+    timer_set_sample_period(0);
+    profile_free_rings();
+}
+
+/* ==========================================================================
+ * Export
+ * ========================================================================== */
+
+/* Order samples by thread, then by stack, so equal ones are adjacent */
+static int profile_compare(const void *a, const void *b)
+{
+    const struct profile_sample *x = a;
+    const struct profile_sample *y = b;
+
+    if (x->tid != y->tid) {
+        return (x->tid < y->tid) ? -1 : 1;
+    }
+    int names = strncmp(x->name, y->name, UTHREAD_NAME_MAX);
+    if (names != 0) {
+        return names;
+    }
+    if (x->depth != y->depth) {
+        return (x->depth < y->depth) ? -1 : 1;
+    }
+    for (uint32_t i = 0; i < x->depth; i++) {
+        if (x->pc[i] != y->pc[i]) {
+            return (x->pc[i] < y->pc[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static bool profile_same_stack(const struct profile_sample *x,
+                               const struct profile_sample *y)
+{
+    return profile_compare(x, y) == 0;
+}
+
+/* Write a frame name without the separators of the folded format */
+static void profile_write_name(FILE *f, const char *s)
+{
+    for (; *s != '\0'; s++) {
+        fputc((*s == ';' || *s == '\n') ? '_' : *s, f);
+    }
+}
+
+/* The thread a stack is rooted at: its name and tid */
+static void profile_write_thread(FILE *f, const struct profile_sample *s)
+{
+    char name[UTHREAD_NAME_MAX];
+    memcpy(name, s->name, UTHREAD_NAME_MAX);
+    name[UTHREAD_NAME_MAX - 1] = '\0';
+
+    profile_write_name(f, (name[0] != '\0') ? name : "thread");
+    fprintf(f, "[%d]", s->tid);
+}
+
+/*
+ * Name one frame. Return addresses point past their call, which may be
+ * the first byte of the next function, so callers are looked up one
+ * byte earlier.
+ */
+static void profile_write_frame(FILE *f, uintptr_t pc, bool leaf)
+{
+    uintptr_t addr = leaf ? pc : pc - 1;
+    Dl_info info;
+
+    if (dladdr((void *)addr, &info) == 0) {
+        fprintf(f, "0x%lx", (unsigned long)addr);
+        return;
+    }
+    if (info.dli_sname != NULL) {
+        profile_write_name(f, info.dli_sname);
+        return;
+    }
+
+    const char *module = (info.dli_fname != NULL) ? info.dli_fname : "?";
+    const char *slash = strrchr(module, '/');
+    profile_write_name(f, (slash != NULL) ? slash + 1 : module);
+    fprintf(f, "+0x%lx", (unsigned long)(addr - (uintptr_t)info.dli_fbase));
+}
+
+/* One folded line: thread;outermost;...;innermost count */
+static void profile_write_stack(FILE *f, const struct profile_sample *s,
+                                uint64_t count)
+{
+    profile_write_thread(f, s);
+    for (uint32_t i = s->depth; i-- > 0;) {
+        fputc(';', f);
+        profile_write_frame(f, s->pc[i], i == 0);
+    }
+    fprintf(f, " %lu\n", (unsigned long)count);
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+int uthread_profile_start(unsigned int period_us, size_t samples_per_worker)
+{
+    if (!g_scheduler.initialized || samples_per_worker > PROFILE_MAX_SAMPLES) {
+        return UTHREAD_EINVAL;
+    }
+
+#ifdef UTHREAD_COOPERATIVE
+    /* No timer to sample from */
+    (void)period_us;
+    return UTHREAD_EINVAL;
+#else
+    uint64_t period_ns = (period_us != 0) ?
+        (uint64_t)period_us * 1000 : PROFILE_DEFAULT_PERIOD_NS;
+    if (period_ns < TIMER_MIN_NS) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (samples_per_worker == 0) {
+        samples_per_worker = PROFILE_DEFAULT_SAMPLES;
+    }
+
+    /* Round up to a power of two so the ring index is a mask */
+    size_t capacity = 2;
+    while (capacity < samples_per_worker) {
+        capacity <<= 1;
+    }
+
+    preemption_disable();
+
+    if (atomic_load(&g_profile_enabled)) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    /* A new profile replaces the previous one */
+    profile_free_rings();
+
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct profile_ring *ring = &g_scheduler.workers[i].profile;
+        ring->samples = calloc(capacity, sizeof(struct profile_sample));
+        if (ring->samples == NULL) {
+            profile_free_rings();
+            preemption_enable();
+            return UTHREAD_ENOMEM;
+        }
+        ring->mask = capacity - 1;
+    }
+
+    timer_set_sample_period(period_ns);
+    atomic_store(&g_profile_enabled, true);
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+#endif
+}
+
+void uthread_profile_stop(void)
+{
+    if (!g_scheduler.initialized) {
+        return;
+    }
+
+    preemption_disable();
+    if (profile_quiesce()) {
+        timer_set_sample_period(0);
+    }
+    preemption_enable();
+}
+
+int uthread_profile_export(const char *path)
+{
+    if (!g_scheduler.initialized || path == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Writing holds off scheduling, like uthread_trace_export() */
+    preemption_disable();
+
+    /* Nothing recorded: there is no profile to export */
+    if (g_scheduler.workers[0].profile.samples == NULL) {
+        preemption_enable();
+        return UTHREAD_EINVAL;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        int err = errno;
+        preemption_enable();
+        return err;
+    }
+
+    /* Sampling pauses while the rings are read */
+    bool was = profile_quiesce();
+
+    size_t count = 0;
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        const struct profile_ring *ring = &g_scheduler.workers[i].profile;
+        count += (ring->head > ring->mask) ? ring->mask + 1 : ring->head;
+    }
+
+    struct profile_sample *all = malloc((count > 0 ? count : 1) * sizeof(*all));
+    if (all == NULL) {
+        atomic_store(&g_profile_enabled, was);
+        preemption_enable();
+        fclose(f);
+        return UTHREAD_ENOMEM;
+    }
+
+    size_t n = 0;
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        const struct profile_ring *ring = &g_scheduler.workers[i].profile;
+        uint64_t first = (ring->head > ring->mask) ? ring->head - ring->mask - 1 : 0;
+        for (uint64_t j = first; j < ring->head; j++) {
+            all[n++] = ring->samples[j & ring->mask];
+        }
+    }
+
+    atomic_store(&g_profile_enabled, was);
+
+    qsort(all, n, sizeof(*all), profile_compare);
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && profile_same_stack(&all[i], &all[j])) {
+            j++;
+        }
+        profile_write_stack(f, &all[i], j - i);
+        i = j;
+    }
+
+    free(all);
+
+    preemption_enable();
+
+    if (fclose(f) != 0) {
+        return errno;
+    }
+
+    return UTHREAD_SUCCESS;
+}
@@ -0,0 +1,242 @@
+/**
+ * LibUThread Thread Registry
+ *
+ * Slab-indexed table of every live thread. Slots are handed out from a
+ * stack of released indices, so adding, removing and looking up a thread
+ * are O(1). Each slot carries a generation that becomes part of the tid,
+ * which lets uthread_lookup() reject tids of threads that have exited.
+ * The table doubles when full; the sleep queue heap is resized with it
+ * since only registered threads can sleep.
+ *
+ * All functions must be called with preemption disabled.
+ *
+ * @file registry.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ==========================================================================
+ * Table Management
+ * ========================================================================== */
+
+/* Resize every per-slot array to `capacity` entries */
+static int registry_resize(int capacity)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+    size_t n = (size_t)capacity;
+
+    struct uthread_internal **slots = realloc(reg->slots, n * sizeof(*slots));
+    if (slots == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    reg->slots = slots;
+
+    uint16_t *generations = realloc(reg->generations, n * sizeof(*generations));
+    if (generations == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    reg->generations = generations;
+
+    int *free_slots = realloc(reg->free_slots, n * sizeof(*free_slots));
+    if (free_slots == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    reg->free_slots = free_slots;
+
+    struct uthread_internal **heap = realloc(g_scheduler.sleepers.heap,
+                                             n * sizeof(*heap));
+    if (heap == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    g_scheduler.sleepers.heap = heap;
+
+    /* Slots beyond the old capacity start empty at generation 0 */
+    size_t old = (size_t)reg->capacity;
+    memset(&reg->slots[old], 0, (n - old) * sizeof(*slots));
+    memset(&reg->generations[old], 0, (n - old) * sizeof(*generations));
+
+    reg->capacity = capacity;
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Allocate the registry with room for UTHREAD_MAX_THREADS threads.
+ *
+ * @return 0 on success, UTHREAD_ENOMEM on failure
+ */
+int registry_init(void)
+{
+    memset(&g_scheduler.threads, 0, sizeof(g_scheduler.threads));
+
+    if (registry_resize(UTHREAD_MAX_THREADS) != 0) {
+        registry_destroy();
+        return UTHREAD_ENOMEM;
+    }
+
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Free the registry tables. Threads still registered are not touched.
+ */
+void registry_destroy(void)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+
+    free(reg->slots);
+    free(reg->generations);
+    free(reg->free_slots);
+    free(g_scheduler.sleepers.heap);
+
+    memset(reg, 0, sizeof(*reg));
+    g_scheduler.sleepers.heap = NULL;
+    g_scheduler.sleepers.count = 0;
+}
+
+/* ==========================================================================
+ * Registration
+ * ========================================================================== */
+
+/**
+ * Register a thread and assign its tid.
+ *
+ * @param thread Thread to add
+ * @return 0 on success, UTHREAD_EAGAIN if the tid space is exhausted,
+ *         UTHREAD_ENOMEM if the table could not grow
+ */
+int registry_add(struct uthread_internal *thread)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+
+    if (thread == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    int slot;
+    if (reg->free_count > 0) {
+        /* Most recently freed slot first: its cache lines are warm */
+        slot = reg->free_slots[--reg->free_count];
+    } else {
+        if (reg->used == reg->capacity) {
+            if (reg->capacity >= REGISTRY_MAX_SLOTS) {
+                return UTHREAD_EAGAIN;
+            }
+
+            int capacity = reg->capacity * 2;
+            if (capacity > REGISTRY_MAX_SLOTS) {
+                capacity = REGISTRY_MAX_SLOTS;
+            }
+            if (registry_resize(capacity) != 0) {
+                return UTHREAD_ENOMEM;
+            }
+        }
+        slot = reg->used++;
+    }
+
+    reg->slots[slot] = thread;
+    thread->cold->slot = slot;
+    thread->tid = (reg->generations[slot] << TID_SLOT_BITS) | (slot + 1);
+
+    /* Push onto the live list */
+    thread->cold->reg_prev = NULL;
+    thread->cold->reg_next = reg->live;
+    if (reg->live != NULL) {
+        reg->live->cold->reg_prev = thread;
+    }
+    reg->live = thread;
+    reg->count++;
+
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Unregister a thread. Its tid stops resolving at once.
+ *
+ * @param thread Registered thread
+ */
+void registry_remove(struct uthread_internal *thread)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+
+    if (!registry_contains(thread)) {
+        return;
+    }
+
+    int slot = thread->cold->slot;
+    reg->slots[slot] = NULL;
+    reg->generations[slot] = (reg->generations[slot] + 1) & TID_GEN_MASK;
+    reg->free_slots[reg->free_count++] = slot;
+
+    if (thread->cold->reg_prev != NULL) {
+        thread->cold->reg_prev->cold->reg_next = thread->cold->reg_next;
+    } else {
+        reg->live = thread->cold->reg_next;
+    }
+    if (thread->cold->reg_next != NULL) {
+        thread->cold->reg_next->cold->reg_prev = thread->cold->reg_prev;
+    }
+    thread->cold->reg_next = NULL;
+    thread->cold->reg_prev = NULL;
+    reg->count--;
+}
+
+/* ==========================================================================
+ * Lookup
+ * ========================================================================== */
+
+/**
+ * Find the live thread with the given tid.
+ *
+ * @param tid Thread ID
+ * @return Thread, or NULL if no live thread has this tid
+ */
+struct uthread_internal *registry_lookup(int tid)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+
+    if (tid <= 0) {
+        return NULL;
+    }
+
+    int slot = (tid & TID_SLOT_MASK) - 1;
+    if (slot < 0 || slot >= reg->used) {
+        return NULL;
+    }
+
+    struct uthread_internal *t = reg->slots[slot];
+    return (t != NULL && t->tid == tid) ? t : NULL;
+}
+
+/**
+ * Check that a TCB is currently registered.
+ *
+ * @param thread TCB that was registered at some point
+ * @return true if it still holds its slot
+ */
+bool registry_contains(const struct uthread_internal *thread)
+{
+    struct thread_registry *reg = &g_scheduler.threads;
+
+    return thread != NULL && thread->cold->slot >= 0 && thread->cold->slot < reg->used &&
+           reg->slots[thread->cold->slot] == thread;
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+uthread_t uthread_lookup(int tid)
+{
+    if (!g_scheduler.initialized) {
+        return NULL;
+    }
+
+    preemption_disable();
+    struct uthread_internal *t = registry_lookup(tid);
+    preemption_enable();
+
+    return (uthread_t)t;
+}
@@ -1,7 +1,23 @@
 /**
  * LibUThread Read-Write Lock Implementation
  *
- * Allows multiple readers or one writer.
+ * Allows multiple readers or one writer. The policy decides who goes
+ * first when both wait: writers (the default), readers, or phase-fair
+ * alternation. Phase fairness numbers the write phases: a reader that
+ * arrives while a writer waits or holds the lock stays out until that
+ * write phase ends, and a released write lock is granted to every reader
+ * waiting at that point, with writers held off until they are all in.
+ *
+ * A read-biased lock also admits readers without the scheduler lock,
+ * BRAVO style. A reader increments the slot of its worker, then checks
+ * that the bias is still enabled, backing out if not; the slot it marked
+ * is remembered in its TCB and dropped on unlock. A writer clears the
+ * bias under the scheduler lock, after which the slots can only drain,
+ * and waits for them to sum to zero; a fast reader that leaves after the
+ * bias was cleared wakes it. Slow-path readers enable the bias again once
+ * it has been off for RWLOCK_BIAS_INHIBIT times as long as the last
+ * revocation took to drain, so write-heavy phases fall back to the plain
+ * counter.
  *
  * @file rwlock.c
  */
@@ -15,13 +31,24 @@
  * Read-Write Lock Attribute Functions
  * ========================================================================== */
 
+/* The policy in effect: a cleared prefer_writer still means readers first */
+static uthread_rwlock_policy_t rwlockattr_policy(const uthread_rwlockattr_t *attr)
+{
+    if (attr->policy == UTHREAD_RWLOCK_PREFER_WRITER && !attr->prefer_writer) {
+        return UTHREAD_RWLOCK_PREFER_READER;
+    }
+    return attr->policy;
+}
+
 int uthread_rwlockattr_init(uthread_rwlockattr_t *attr)
 {
     if (attr == NULL) {
         return UTHREAD_EINVAL;
     }
 
-    attr->prefer_writer = 1;  /* Default: prefer writers */
+    attr->prefer_writer = 1;
+    attr->policy = UTHREAD_RWLOCK_PREFER_WRITER;
+    attr->read_biased = false;
     return UTHREAD_SUCCESS;
 }
 
@@ -35,6 +62,54 @@ int uthread_rwlockattr_destroy(uthread_rwlockattr_t *attr)
     return UTHREAD_SUCCESS;
 }
 
+int uthread_rwlockattr_setpolicy(uthread_rwlockattr_t *attr, int policy)
+{
+    if (attr == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (policy != UTHREAD_RWLOCK_PREFER_WRITER &&
+        policy != UTHREAD_RWLOCK_PREFER_READER &&
+        policy != UTHREAD_RWLOCK_PHASE_FAIR) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Keep the deprecated field from overriding an explicit choice */
+    attr->prefer_writer = (policy != UTHREAD_RWLOCK_PREFER_READER);
+    attr->policy = (uthread_rwlock_policy_t)policy;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_rwlockattr_getpolicy(const uthread_rwlockattr_t *attr, int *policy)
+{
+    if (attr == NULL || policy == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    *policy = rwlockattr_policy(attr);
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_rwlockattr_setreadbias(uthread_rwlockattr_t *attr, int enabled)
+{
+    if (attr == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    attr->read_biased = (enabled != 0);
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_rwlockattr_getreadbias(const uthread_rwlockattr_t *attr, int *enabled)
+{
+    if (attr == NULL || enabled == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    *enabled = attr->read_biased ? 1 : 0;
+    return UTHREAD_SUCCESS;
+}
+
 /* ==========================================================================
  * Read-Write Lock Functions
  * ========================================================================== */
@@ -46,33 +121,61 @@ int uthread_rwlock_init(uthread_rwlock_t *rwlock,
         return UTHREAD_EINVAL;
     }
 
-    (void)attr;  /* Currently unused */
-
     memset(rwlock, 0, sizeof(*rwlock));
     rwlock->readers = 0;
     rwlock->writer = 0;
     rwlock->writer_owner = NULL;
     rwlock->pending_writers = 0;
+    rwlock->policy = (attr != NULL) ? rwlockattr_policy(attr) : UTHREAD_RWLOCK_PREFER_WRITER;
 
     /* Allocate wait queues */
-    rwlock->read_waiters = malloc(sizeof(struct wait_queue));
+    rwlock->read_waiters = wait_queue_alloc();
     if (rwlock->read_waiters == NULL) {
         return UTHREAD_ENOMEM;
     }
-    wait_queue_init(rwlock->read_waiters);
 
-    rwlock->write_waiters = malloc(sizeof(struct wait_queue));
+    rwlock->write_waiters = wait_queue_alloc();
     if (rwlock->write_waiters == NULL) {
-        free(rwlock->read_waiters);
+        wait_queue_free(rwlock->read_waiters);
         return UTHREAD_ENOMEM;
     }
-    wait_queue_init(rwlock->write_waiters);
+
+    /* Read indicators, one cache line per worker */
+    if (attr != NULL && attr->read_biased) {
+        rwlock->bias = aligned_alloc(UTHREAD_CACHE_LINE, sizeof(struct rwlock_bias));
+        if (rwlock->bias == NULL) {
+            wait_queue_free(rwlock->write_waiters);
+            wait_queue_free(rwlock->read_waiters);
+            return UTHREAD_ENOMEM;
+        }
+        memset(rwlock->bias, 0, sizeof(struct rwlock_bias));
+        rwlock->bias->enabled = 1;
+    }
 
     rwlock->initialized = true;
 
     return UTHREAD_SUCCESS;
 }
 
+/* Whether any reader holds the lock through a worker slot */
+static bool rwlock_fast_readers(const uthread_rwlock_t *rwlock)
+{
+    const struct rwlock_bias *bias = rwlock->bias;
+    if (bias == NULL) {
+        return false;
+    }
+
+    /*
+     * Once the bias is off the slots only drain, and a hold that started
+     * before is visible here, so a zero sum means no fast reader is left.
+     */
+    int sum = 0;
+    for (int i = 0; i < UTHREAD_MAX_WORKERS; i++) {
+        sum += __atomic_load_n(&bias->slots[i].count, __ATOMIC_SEQ_CST);
+    }
+    return sum != 0;
+}
+
 int uthread_rwlock_destroy(uthread_rwlock_t *rwlock)
 {
     if (rwlock == NULL) {
@@ -84,7 +187,7 @@ int uthread_rwlock_destroy(uthread_rwlock_t *rwlock)
     }
 
     /* Cannot destroy if in use */
-    if (rwlock->readers > 0 || rwlock->writer != 0) {
+    if (rwlock->readers > 0 || rwlock->writer != 0 || rwlock_fast_readers(rwlock)) {
         return UTHREAD_EBUSY;
     }
 
@@ -97,63 +200,300 @@ int uthread_rwlock_destroy(uthread_rwlock_t *rwlock)
     }
 
     /* Free wait queues */
-    if (rwlock->read_waiters != NULL) {
-        wait_queue_destroy(rwlock->read_waiters);
-        free(rwlock->read_waiters);
-        rwlock->read_waiters = NULL;
-    }
+    wait_queue_free(rwlock->read_waiters);
+    rwlock->read_waiters = NULL;
 
-    if (rwlock->write_waiters != NULL) {
-        wait_queue_destroy(rwlock->write_waiters);
-        free(rwlock->write_waiters);
-        rwlock->write_waiters = NULL;
-    }
+    wait_queue_free(rwlock->write_waiters);
+    rwlock->write_waiters = NULL;
+
+    free(rwlock->bias);
+    rwlock->bias = NULL;
+
+    lock_stats_free(&rwlock->stats);
 
     rwlock->initialized = false;
 
     return UTHREAD_SUCCESS;
 }
 
+/*
+ * Contention statistics. Readers share one hold period, from the first
+ * reader in to the last one out. Called with preemption disabled, after
+ * the lock is taken or before it is released.
+ */
+static inline void rwlock_stats_acquired(uthread_rwlock_t *rwlock,
+                                         uint64_t wait_start)
+{
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        bool first = rwlock->writer != 0 || rwlock->readers == 1;
+        lock_stats_acquired(&rwlock->stats, rwlock, UTHREAD_LOCK_RWLOCK,
+                            wait_start, first);
+    }
+}
+
+static inline void rwlock_stats_released(uthread_rwlock_t *rwlock, bool last)
+{
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        lock_stats_released(rwlock->stats, last);
+    }
+}
+
+/*
+ * Allocate the wait queues of an rwlock created with the static
+ * initializer on first use.
+ * Done under the scheduler lock so two workers cannot both allocate.
+ */
+static int rwlock_lazy_init(uthread_rwlock_t *rwlock)
+{
+    int result = UTHREAD_SUCCESS;
+
+    preemption_disable();
+
+    if (rwlock->read_waiters == NULL) {
+        struct wait_queue *readers = wait_queue_alloc();
+        struct wait_queue *writers = wait_queue_alloc();
+        if (readers == NULL || writers == NULL) {
+            wait_queue_free(readers);
+            wait_queue_free(writers);
+            result = UTHREAD_ENOMEM;
+        } else {
+            rwlock->write_waiters = writers;
+            rwlock->read_waiters = readers;
+            rwlock->initialized = true;
+        }
+    }
+
+    preemption_enable();
+
+    return result;
+}
+
+/* ==========================================================================
+ * Admission (called with preemption disabled)
+ * ========================================================================== */
+
+/* Whether a reader that arrived during write phase `phase` may enter */
+static bool rwlock_admits_reader(const uthread_rwlock_t *rwlock, uint64_t phase)
+{
+    if (rwlock->writer != 0) {
+        return false;
+    }
+
+    switch (rwlock->policy) {
+    case UTHREAD_RWLOCK_PREFER_READER:
+        return true;
+    case UTHREAD_RWLOCK_PHASE_FAIR:
+        /* A waiting writer holds us back only until its phase is over */
+        return rwlock->pending_writers == 0 || rwlock->write_phases != phase;
+    default:
+        return rwlock->pending_writers == 0;
+    }
+}
+
+static bool rwlock_admits_writer(const uthread_rwlock_t *rwlock)
+{
+    return rwlock->readers == 0 && rwlock->writer == 0 &&
+           rwlock->read_grants == 0 && !rwlock_fast_readers(rwlock);
+}
+
+/* Wake every waiting reader; phase-fair counts them in ahead of writers */
+static void rwlock_wake_readers(uthread_rwlock_t *rwlock)
+{
+    if (rwlock->policy == UTHREAD_RWLOCK_PHASE_FAIR) {
+        rwlock->read_grants += rwlock->read_waiters->count;
+    }
+    wait_queue_wake_all(rwlock->read_waiters);
+}
+
+/* Wake one writer if the lock has become free for it */
+static void rwlock_wake_writer(uthread_rwlock_t *rwlock)
+{
+    if (rwlock->write_waiters != NULL &&
+        !wait_queue_empty(rwlock->write_waiters) &&
+        rwlock_admits_writer(rwlock)) {
+        wait_queue_wake_one(rwlock->write_waiters);
+    }
+}
+
+/* Clear the bias so that fast readers drain; the caller is a writer */
+static void rwlock_bias_revoke(uthread_rwlock_t *rwlock)
+{
+    struct rwlock_bias *bias = rwlock->bias;
+    if (bias != NULL && bias->enabled) {
+        __atomic_store_n(&bias->enabled, 0, __ATOMIC_SEQ_CST);
+        bias->revoked_at = sched_clock_ns();
+    }
+}
+
+/* A writer got in: hold the bias off in proportion to the drain */
+static void rwlock_bias_revoked(uthread_rwlock_t *rwlock)
+{
+    struct rwlock_bias *bias = rwlock->bias;
+    if (bias != NULL && bias->revoked_at != 0) {
+        uint64_t now = sched_clock_ns();
+        uint64_t took = (now > bias->revoked_at) ? now - bias->revoked_at : 0;
+        bias->inhibit_until = now + took * RWLOCK_BIAS_INHIBIT;
+        bias->revoked_at = 0;
+    }
+}
+
+/* A slow reader got in: turn the bias back on if writers have gone quiet */
+static void rwlock_bias_restore(uthread_rwlock_t *rwlock)
+{
+    struct rwlock_bias *bias = rwlock->bias;
+    if (bias == NULL || bias->enabled || rwlock->pending_writers > 0 ||
+        g_contention.enabled) {
+        return;
+    }
+
+    if (sched_clock_ns() >= bias->inhibit_until) {
+        __atomic_store_n(&bias->enabled, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* ==========================================================================
+ * Read-Biased Fast Path (called with preemption enabled)
+ * ========================================================================== */
+
+/*
+ * Take a read hold through the caller's worker slot. Fails while the bias
+ * is off, while contention statistics are collected (they count holders
+ * under the scheduler lock), and when the caller's table of fast holds is
+ * full.
+ */
+static bool rwlock_fast_rdlock(uthread_rwlock_t *rwlock)
+{
+    struct rwlock_bias *bias = rwlock->bias;
+    if (bias == NULL || !__atomic_load_n(&bias->enabled, __ATOMIC_RELAXED) ||
+        g_contention.enabled) {
+        return false;
+    }
+
+    bool acquired = false;
+    bool backed_out = false;
+
+    /* Stay on this worker until the slot is marked and recorded */
+    struct worker *w = preemption_pin();
+    struct uthread_internal *self = (w != NULL) ? w->current : NULL;
+
+    if (self != NULL && self->cold->read_hold_count < RWLOCK_FAST_HOLDS) {
+        int *count = &bias->slots[w->id].count;
+        __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&bias->enabled, __ATOMIC_SEQ_CST)) {
+            struct uthread_cold *cold = self->cold;
+            cold->read_holds[cold->read_hold_count].lock = rwlock;
+            cold->read_holds[cold->read_hold_count].slot = w->id;
+            cold->read_hold_count++;
+            acquired = true;
+        } else {
+            /* A writer revoked the bias in between */
+            __atomic_fetch_sub(count, 1, __ATOMIC_SEQ_CST);
+            backed_out = true;
+        }
+    }
+
+    preemption_unpin();
+
+    /* The writer may have seen our mark and be waiting for it to go */
+    if (backed_out) {
+        preemption_disable();
+        rwlock_wake_writer(rwlock);
+        preemption_enable();
+    }
+
+    return acquired;
+}
+
+/* Drop the caller's fast read hold on `rwlock`, if it has one */
+static bool rwlock_fast_unlock(uthread_rwlock_t *rwlock)
+{
+    struct rwlock_bias *bias = rwlock->bias;
+    if (bias == NULL) {
+        return false;
+    }
+
+    struct worker *w = preemption_pin();
+    struct uthread_internal *self = (w != NULL) ? w->current : NULL;
+    struct uthread_cold *cold = (self != NULL) ? self->cold : NULL;
+
+    int i = (cold != NULL) ? cold->read_hold_count - 1 : -1;
+    while (i >= 0 && cold->read_holds[i].lock != rwlock) {
+        i--;
+    }
+
+    if (i < 0) {
+        preemption_unpin();
+        return false;
+    }
+
+    int slot = cold->read_holds[i].slot;
+    cold->read_holds[i] = cold->read_holds[--cold->read_hold_count];
+
+    /* The slot may belong to another worker by now; migrating is rare */
+    __atomic_fetch_sub(&bias->slots[slot].count, 1, __ATOMIC_SEQ_CST);
+    bool revoked = !__atomic_load_n(&bias->enabled, __ATOMIC_SEQ_CST);
+
+    preemption_unpin();
+
+    /* Last one out after a revocation lets the writer in */
+    if (revoked) {
+        preemption_disable();
+        rwlock_wake_writer(rwlock);
+        preemption_enable();
+    }
+
+    return true;
+}
+
+/* ==========================================================================
+ * Locking
+ * ========================================================================== */
+
 int uthread_rwlock_rdlock(uthread_rwlock_t *rwlock)
 {
     if (rwlock == NULL) {
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized rwlock (static initializer) */
-    if (!rwlock->initialized) {
-        int ret = uthread_rwlock_init(rwlock, NULL);
-        if (ret != UTHREAD_SUCCESS) {
-            return ret;
-        }
+    if (rwlock->read_waiters == NULL && rwlock_lazy_init(rwlock) != 0) {
+        return UTHREAD_ENOMEM;
+    }
+
+    if (rwlock_fast_rdlock(rwlock)) {
+        return UTHREAD_SUCCESS;
     }
 
     preemption_disable();
 
     struct uthread_internal *self = scheduler_current();
+    uint64_t phase = rwlock->write_phases;
+    uint64_t wait_start = !rwlock_admits_reader(rwlock, phase) ? lock_wait_start() : 0;
+    bool waited = false;
 
-    /*
-     * Wait while:
-     * - A writer holds the lock, OR
-     * - Writers are waiting (to prevent writer starvation)
-     */
-    while (rwlock->writer != 0 || rwlock->pending_writers > 0) {
+    /* Wait while a writer holds the lock or the policy puts one first */
+    while (!rwlock_admits_reader(rwlock, phase)) {
         if (self != NULL) {
             self->state = UTHREAD_STATE_BLOCKED;
             wait_queue_add(rwlock->read_waiters, self);
         }
 
-        preemption_enable();
-
+        /* Switch away still holding off preemption (and other workers) */
         if (self != NULL) {
             scheduler_schedule();
         }
+        waited = true;
+    }
 
-        preemption_disable();
+    /* A reader woken into a read phase uses up its grant */
+    if (waited && rwlock->read_grants > 0) {
+        rwlock->read_grants--;
     }
 
     /* Acquire read lock */
     rwlock->readers++;
+    rwlock_stats_acquired(rwlock, wait_start);
+    rwlock_bias_restore(rwlock);
 
     preemption_enable();
 
@@ -166,24 +506,26 @@ int uthread_rwlock_tryrdlock(uthread_rwlock_t *rwlock)
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized rwlock */
-    if (!rwlock->initialized) {
-        int ret = uthread_rwlock_init(rwlock, NULL);
-        if (ret != UTHREAD_SUCCESS) {
-            return ret;
-        }
+    if (rwlock->read_waiters == NULL && rwlock_lazy_init(rwlock) != 0) {
+        return UTHREAD_ENOMEM;
+    }
+
+    if (rwlock_fast_rdlock(rwlock)) {
+        return UTHREAD_SUCCESS;
     }
 
     preemption_disable();
 
-    /* Cannot acquire if writer holds lock or writers waiting */
-    if (rwlock->writer != 0 || rwlock->pending_writers > 0) {
+    /* Cannot acquire if a writer holds the lock or goes first */
+    if (!rwlock_admits_reader(rwlock, rwlock->write_phases)) {
         preemption_enable();
         return UTHREAD_EBUSY;
     }
 
     /* Acquire read lock */
     rwlock->readers++;
+    rwlock_stats_acquired(rwlock, 0);
+    rwlock_bias_restore(rwlock);
 
     preemption_enable();
 
@@ -196,12 +538,8 @@ int uthread_rwlock_wrlock(uthread_rwlock_t *rwlock)
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized rwlock */
-    if (!rwlock->initialized) {
-        int ret = uthread_rwlock_init(rwlock, NULL);
-        if (ret != UTHREAD_SUCCESS) {
-            return ret;
-        }
+    if (rwlock->read_waiters == NULL && rwlock_lazy_init(rwlock) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     preemption_disable();
@@ -210,25 +548,23 @@ int uthread_rwlock_wrlock(uthread_rwlock_t *rwlock)
 
     /* Increment pending writers to block new readers */
     rwlock->pending_writers++;
+    rwlock_bias_revoke(rwlock);
+    uint64_t wait_start = !rwlock_admits_writer(rwlock) ? lock_wait_start() : 0;
 
     /*
-     * Wait while:
-     * - Readers hold the lock, OR
-     * - Another writer holds the lock
+     * Wait while readers (including fast ones and readers granted the
+     * next read phase) or another writer hold the lock
      */
-    while (rwlock->readers > 0 || rwlock->writer != 0) {
+    while (!rwlock_admits_writer(rwlock)) {
         if (self != NULL) {
             self->state = UTHREAD_STATE_BLOCKED;
             wait_queue_add(rwlock->write_waiters, self);
         }
 
-        preemption_enable();
-
+        /* Switch away still holding off preemption (and other workers) */
         if (self != NULL) {
             scheduler_schedule();
         }
-
-        preemption_disable();
     }
 
     /* Decrement pending writers */
@@ -237,6 +573,8 @@ int uthread_rwlock_wrlock(uthread_rwlock_t *rwlock)
     /* Acquire write lock */
     rwlock->writer = 1;
     rwlock->writer_owner = self;
+    rwlock_bias_revoked(rwlock);
+    rwlock_stats_acquired(rwlock, wait_start);
 
     preemption_enable();
 
@@ -249,18 +587,21 @@ int uthread_rwlock_trywrlock(uthread_rwlock_t *rwlock)
         return UTHREAD_EINVAL;
     }
 
-    /* Handle uninitialized rwlock */
-    if (!rwlock->initialized) {
-        int ret = uthread_rwlock_init(rwlock, NULL);
-        if (ret != UTHREAD_SUCCESS) {
-            return ret;
-        }
+    if (rwlock->read_waiters == NULL && rwlock_lazy_init(rwlock) != 0) {
+        return UTHREAD_ENOMEM;
     }
 
     preemption_disable();
 
     /* Cannot acquire if any readers or writer */
-    if (rwlock->readers > 0 || rwlock->writer != 0) {
+    if (rwlock->readers > 0 || rwlock->writer != 0 || rwlock->read_grants > 0) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    /* Fast readers can only be ruled out with the bias off */
+    rwlock_bias_revoke(rwlock);
+    if (rwlock_fast_readers(rwlock)) {
         preemption_enable();
         return UTHREAD_EBUSY;
     }
@@ -269,6 +610,8 @@ int uthread_rwlock_trywrlock(uthread_rwlock_t *rwlock)
     struct uthread_internal *self = scheduler_current();
     rwlock->writer = 1;
     rwlock->writer_owner = self;
+    rwlock_bias_revoked(rwlock);
+    rwlock_stats_acquired(rwlock, 0);
 
     preemption_enable();
 
@@ -285,6 +628,10 @@ int uthread_rwlock_unlock(uthread_rwlock_t *rwlock)
         return UTHREAD_EINVAL;
     }
 
+    if (rwlock_fast_unlock(rwlock)) {
+        return UTHREAD_SUCCESS;
+    }
+
     preemption_disable();
 
     struct uthread_internal *self = scheduler_current();
@@ -297,31 +644,36 @@ int uthread_rwlock_unlock(uthread_rwlock_t *rwlock)
             return UTHREAD_EPERM;
         }
 
+        rwlock_stats_released(rwlock, true);
         rwlock->writer = 0;
         rwlock->writer_owner = NULL;
+        rwlock->write_phases++;
 
         /*
-         * Prefer writers: wake one writer if waiting,
-         * otherwise wake all readers.
+         * Preferring writers, wake one writer if any is waiting and the
+         * readers otherwise; the other policies start a read phase if
+         * readers are waiting.
          */
-        if (rwlock->write_waiters != NULL &&
-            !wait_queue_empty(rwlock->write_waiters)) {
+        bool readers_waiting = !wait_queue_empty(rwlock->read_waiters);
+        bool writers_waiting = !wait_queue_empty(rwlock->write_waiters);
+
+        if (writers_waiting &&
+            (rwlock->policy == UTHREAD_RWLOCK_PREFER_WRITER || !readers_waiting)) {
             wait_queue_wake_one(rwlock->write_waiters);
-        } else if (rwlock->read_waiters != NULL) {
-            wait_queue_wake_all(rwlock->read_waiters);
+        } else if (readers_waiting) {
+            rwlock_wake_readers(rwlock);
         }
 
     } else if (rwlock->readers > 0) {
         /* We're releasing a read lock */
+        rwlock_stats_released(rwlock, rwlock->readers == 1);
         rwlock->readers--;
 
         /*
          * If no more readers and writers waiting, wake one writer.
          */
-        if (rwlock->readers == 0 &&
-            rwlock->write_waiters != NULL &&
-            !wait_queue_empty(rwlock->write_waiters)) {
-            wait_queue_wake_one(rwlock->write_waiters);
+        if (rwlock->readers == 0) {
+            rwlock_wake_writer(rwlock);
         }
 
     } else {
@@ -334,3 +686,40 @@ int uthread_rwlock_unlock(uthread_rwlock_t *rwlock)
 
     return UTHREAD_SUCCESS;
 }
+
+int uthread_rwlock_downgrade(uthread_rwlock_t *rwlock)
+{
+    if (rwlock == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    if (!rwlock->initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    struct uthread_internal *self = scheduler_current();
+
+    if (rwlock->writer == 0 || rwlock->writer_owner != (uthread_t)self) {
+        preemption_enable();
+        return UTHREAD_EPERM;
+    }
+
+    /* Become a reader in the same step; the hold period carries on */
+    rwlock->writer = 0;
+    rwlock->writer_owner = NULL;
+    rwlock->readers = 1;
+    rwlock->write_phases++;
+
+    /* Let in the readers this policy admits now */
+    if (!wait_queue_empty(rwlock->read_waiters) &&
+        (rwlock->policy != UTHREAD_RWLOCK_PREFER_WRITER ||
+         rwlock->pending_writers == 0)) {
+        rwlock_wake_readers(rwlock);
+    }
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
@@ -146,6 +146,7 @@ void rb_insert(struct uthread_internal *thread)
 
     rb_insert_fixup(thread);
     g_cfs_state.count++;
+    g_cfs_state.load += (uint64_t)thread->weight;
 }
 
 static void rb_transplant(struct uthread_internal *u, struct uthread_internal *v)
@@ -289,6 +290,7 @@ void rb_remove(struct uthread_internal *z)
     z->rb_right = NULL;
 
     g_cfs_state.count--;
+    g_cfs_state.load -= (uint64_t)z->weight;
 }
 
 struct uthread_internal *rb_leftmost(void)
@@ -311,105 +313,265 @@ static void cfs_shutdown(void)
     memset(&g_cfs_state, 0, sizeof(g_cfs_state));
 }
 
-static void cfs_enqueue(struct uthread_internal *thread)
+/** A thread is queued iff it is linked into the tree */
+static bool cfs_queued(struct uthread_internal *thread)
 {
-    if (thread == NULL) return;
+    return thread->rb_parent != NULL || g_cfs_state.rb_root == thread;
+}
 
-    /* For new threads, set vruntime to min_vruntime for fairness */
+/**
+ * Advance min_vruntime to the smallest vruntime among the running thread
+ * and the queue, never moving it backwards.
+ */
+static void cfs_update_min_vruntime(struct uthread_internal *current)
+{
+    uint64_t vruntime = current->vruntime;
+    struct uthread_internal *leftmost = rb_leftmost();
+
+    if (leftmost != NULL && leftmost->vruntime < vruntime) {
+        vruntime = leftmost->vruntime;
+    }
+    if (vruntime > g_cfs_state.min_vruntime) {
+        g_cfs_state.min_vruntime = vruntime;
+    }
+}
+
+/** Place a thread's vruntime relative to the queue before it is inserted */
+static void cfs_place(struct uthread_internal *thread)
+{
     if (thread->vruntime == 0) {
+        /* New threads start level with the queue */
         thread->vruntime = g_cfs_state.min_vruntime;
+    } else {
+        /*
+         * Sleepers get at most half a latency period of credit, so they
+         * run soon after waking without starving everyone else. Threads
+         * coming off the CPU are never behind this point already.
+         */
+        uint64_t floor = 0;
+        if (g_cfs_state.min_vruntime > CFS_TARGET_LATENCY_NS / 2) {
+            floor = g_cfs_state.min_vruntime - CFS_TARGET_LATENCY_NS / 2;
+        }
+        if (thread->vruntime < floor) {
+            thread->vruntime = floor;
+        }
     }
+}
 
-    /* Ensure vruntime is at least min_vruntime */
-    if (thread->vruntime < g_cfs_state.min_vruntime) {
-        thread->vruntime = g_cfs_state.min_vruntime;
+/**
+ * Every queued thread gets a turn within the target latency, stretched
+ * once the slices would drop below the minimum granularity; each one's
+ * share of that period is proportional to its weight.
+ */
+static uint64_t cfs_slice(int weight, int queued, uint64_t load)
+{
+    uint64_t period = CFS_TARGET_LATENCY_NS;
+    uint64_t nr = (uint64_t)queued;
+    if (nr > CFS_TARGET_LATENCY_NS / CFS_MIN_GRANULARITY_NS) {
+        period = nr * CFS_MIN_GRANULARITY_NS;
     }
 
+    uint64_t slice = period * (uint64_t)weight / load;
+    if (slice < CFS_MIN_GRANULARITY_NS) {
+        slice = CFS_MIN_GRANULARITY_NS;
+    }
+    return slice;
+}
+
+static void cfs_enqueue(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    cfs_place(thread);
     rb_insert(thread);
+    thread->timeslice_remaining = cfs_slice(thread->weight, g_cfs_state.count,
+                                            g_cfs_state.load);
+}
 
-    /* Calculate timeslice based on weight and number of threads */
-    int total_weight = 0;
-    /* Approximate total weight - use count * average weight */
-    total_weight = g_cfs_state.count * CFS_NICE_0_WEIGHT;
-    if (total_weight == 0) total_weight = thread->weight;
+/* ==========================================================================
+ * Batch Enqueue
+ *
+ * A broadcast wakes many threads that all left the CPU to wait on the same
+ * event, so they are placed as one: every thread of the batch gets the
+ * largest vruntime any of them would have been placed at, and keeps its
+ * wait order among the others. Nobody gains credit over being woken
+ * alone, and the batch is already sorted, so rather than insert and
+ * rebalance once per thread it is merged with an in-order walk of the
+ * tree and the tree rebuilt balanced, linear in the size of the queue.
+ * ========================================================================== */
 
-    uint64_t slice = (CFS_TARGET_LATENCY_NS * thread->weight) / total_weight;
-    if (slice < CFS_MIN_GRANULARITY_NS) {
-        slice = CFS_MIN_GRANULARITY_NS;
+/* In-order successor, via parent links */
+static struct uthread_internal *rb_next(struct uthread_internal *x)
+{
+    if (x->rb_right != NULL) {
+        return rb_minimum(x->rb_right);
+    }
+
+    struct uthread_internal *p = x->rb_parent;
+    while (p != NULL && x == p->rb_right) {
+        x = p;
+        p = p->rb_parent;
     }
-    thread->timeslice_remaining = slice;
+    return p;
 }
 
-static struct uthread_internal *cfs_dequeue(void)
+/* Merge two vruntime-sorted lists linked through next, `a` first on ties */
+static struct uthread_internal *cfs_list_merge(struct uthread_internal *a,
+                                               struct uthread_internal *b)
 {
-    struct uthread_internal *thread = rb_leftmost();
-    if (thread != NULL) {
-        rb_remove(thread);
+    struct uthread_internal *head = NULL;
+    struct uthread_internal **link = &head;
+
+    while (a != NULL && b != NULL) {
+        if (b->vruntime < a->vruntime) {
+            *link = b;
+            b = b->next;
+        } else {
+            *link = a;
+            a = a->next;
+        }
+        link = &(*link)->next;
     }
-    return thread;
+    *link = (a != NULL) ? a : b;
+
+    return head;
 }
 
-static void cfs_remove(struct uthread_internal *thread)
+/*
+ * Build a balanced tree from the first n threads of a sorted list. Halving
+ * the count at every node leaves all empty links on the two lowest levels,
+ * so coloring the deepest level red gives every path the same number of
+ * black nodes.
+ */
+static struct uthread_internal *cfs_build(struct uthread_internal **list, int n,
+                                          int depth, int red_depth)
 {
-    if (thread == NULL) return;
+    if (n == 0) {
+        return NULL;
+    }
+
+    int left_n = (n - 1) / 2;
+    struct uthread_internal *left = cfs_build(list, left_n, depth + 1, red_depth);
+
+    struct uthread_internal *node = *list;
+    *list = node->next;
+    node->next = NULL;
+    node->prev = NULL;
+
+    struct uthread_internal *right = cfs_build(list, n - 1 - left_n,
+                                               depth + 1, red_depth);
+
+    node->rb_left = left;
+    node->rb_right = right;
+    if (left != NULL) left->rb_parent = node;
+    if (right != NULL) right->rb_parent = node;
+    node->rb_color = (depth == red_depth && depth > 0) ? RB_RED : RB_BLACK;
+
+    return node;
+}
+
+static int cfs_ilog2(uint64_t x)
+{
+    return 63 - __builtin_clzll(x | 1);
+}
+
+static void cfs_enqueue_batch(struct uthread_internal *head,
+                              struct uthread_internal *tail, int count)
+{
+    (void)tail;
+
+    uint64_t load = 0;
+    uint64_t vruntime = 0;
+    for (struct uthread_internal *t = head; t != NULL; t = t->next) {
+        cfs_place(t);
+        if (t->vruntime > vruntime) {
+            vruntime = t->vruntime;
+        }
+        load += (uint64_t)t->weight;
+    }
+
+    int total = g_cfs_state.count + count;
 
-    /* Check if thread is in the tree by looking for it */
-    struct uthread_internal *node = g_cfs_state.rb_root;
-    bool found = false;
+    /* Slices are sized for the queue with the whole batch in it */
+    for (struct uthread_internal *t = head; t != NULL; t = t->next) {
+        t->vruntime = vruntime;
+        t->prev = NULL;
+        t->timeslice_remaining = cfs_slice(t->weight, total,
+                                           g_cfs_state.load + load);
+    }
 
-    /* Simple search - could be optimized */
-    while (node != NULL) {
-        if (node == thread) {
-            found = true;
-            break;
+    /* A few threads into a big tree: inserting them is cheaper */
+    uint64_t insert_cost = (uint64_t)count * (uint64_t)cfs_ilog2((uint64_t)total);
+    if (count < 2 || insert_cost < (uint64_t)total) {
+        struct uthread_internal *t = head;
+        while (t != NULL) {
+            struct uthread_internal *next = t->next;
+            t->next = NULL;
+            rb_insert(t);
+            t = next;
         }
-        if (thread->vruntime < node->vruntime) {
-            node = node->rb_left;
-        } else {
-            node = node->rb_right;
+    } else {
+        /* Flatten the tree in order, then merge and rebuild */
+        struct uthread_internal *tree = g_cfs_state.rb_leftmost;
+        for (struct uthread_internal *t = tree; t != NULL; ) {
+            struct uthread_internal *next = rb_next(t);
+            t->next = next;
+            t = next;
         }
+
+        struct uthread_internal *list = cfs_list_merge(tree, head);
+
+        g_cfs_state.rb_leftmost = list;
+        g_cfs_state.rb_root = cfs_build(&list, total, 0, cfs_ilog2((uint64_t)total));
+        g_cfs_state.rb_root->rb_parent = NULL;
+        g_cfs_state.count = total;
+        g_cfs_state.load += load;
     }
+}
 
-    if (found) {
+static struct uthread_internal *cfs_dequeue(void)
+{
+    struct uthread_internal *thread = rb_leftmost();
+    if (thread != NULL) {
         rb_remove(thread);
     }
+    return thread;
 }
 
-static void cfs_on_yield(struct uthread_internal *thread)
+static void cfs_remove(struct uthread_internal *thread)
 {
-    if (thread == NULL) return;
+    if (thread == NULL || !cfs_queued(thread)) return;
 
-    /* Update vruntime based on time used */
-    uint64_t now = get_time_ns();
-    if (thread->start_time > 0) {
-        uint64_t delta = now - thread->start_time;
-        /* vruntime increases slower for higher-weight threads */
-        thread->vruntime += (delta * CFS_NICE_0_WEIGHT) / thread->weight;
-    }
+    rb_remove(thread);
 }
 
-static void cfs_on_tick(struct uthread_internal *thread, uint64_t elapsed_ns)
+static void cfs_on_yield(struct uthread_internal *thread)
 {
-    if (thread == NULL) return;
+    (void)thread;
+    /* Runtime is charged by scheduler_account() before the requeue */
+}
 
-    /* Update vruntime */
-    thread->vruntime += (elapsed_ns * CFS_NICE_0_WEIGHT) / thread->weight;
+static void cfs_account(struct uthread_internal *thread, uint64_t delta_ns)
+{
+    if (thread == NULL) return;
 
-    /* Update min_vruntime */
-    if (thread->vruntime > g_cfs_state.min_vruntime) {
-        /* min_vruntime should be the minimum of all runnable threads */
-        /* For simplicity, we approximate by tracking current thread */
-        g_cfs_state.min_vruntime = thread->vruntime;
-    }
+    /* vruntime increases slower for higher-weight threads */
+    thread->vruntime += (delta_ns * CFS_NICE_0_WEIGHT) / (uint64_t)thread->weight;
+    cfs_update_min_vruntime(thread);
 
     /* Decrease remaining timeslice */
-    if (thread->timeslice_remaining > elapsed_ns) {
-        thread->timeslice_remaining -= elapsed_ns;
+    if (thread->timeslice_remaining > delta_ns) {
+        thread->timeslice_remaining -= delta_ns;
     } else {
         thread->timeslice_remaining = 0;
     }
 }
 
+static int cfs_nr_queued(void)
+{
+    return g_cfs_state.count;
+}
+
 static bool cfs_should_preempt(struct uthread_internal *current)
 {
     if (current == NULL) return false;
@@ -423,8 +585,7 @@ static bool cfs_should_preempt(struct uthread_internal *current)
     struct uthread_internal *leftmost = rb_leftmost();
     if (leftmost != NULL) {
         /* Preempt if leftmost has significantly lower vruntime */
-        uint64_t delta = current->vruntime - leftmost->vruntime;
-        if (delta > CFS_MIN_GRANULARITY_NS) {
+        if (current->vruntime > leftmost->vruntime + CFS_MIN_GRANULARITY_NS) {
             return true;
         }
     }
@@ -432,15 +593,25 @@ static bool cfs_should_preempt(struct uthread_internal *current)
     return false;
 }
 
+static bool cfs_may_handoff(struct uthread_internal *thread)
+{
+    /* Only while it would not be preempted at once for the leftmost */
+    struct uthread_internal *leftmost = rb_leftmost();
+    return leftmost == NULL ||
+           thread->vruntime <= leftmost->vruntime + CFS_MIN_GRANULARITY_NS;
+}
+
 static void cfs_update_priority(struct uthread_internal *thread)
 {
     if (thread == NULL) return;
 
-    /* Update weight from nice value */
-    thread->weight = nice_to_weight(thread->nice);
-
-    /* If thread is in tree, remove and re-insert to update position */
-    /* Actually, vruntime doesn't change, so position should be fine */
+    /* Update weight from nice value; queue position keys on vruntime */
+    int weight = nice_to_weight(thread->nice);
+    if (cfs_queued(thread)) {
+        g_cfs_state.load += (uint64_t)weight;
+        g_cfs_state.load -= (uint64_t)thread->weight;
+    }
+    thread->weight = weight;
 }
 
 static const char *cfs_name(void)
@@ -453,11 +624,14 @@ struct scheduler_ops sched_cfs_ops = {
     .init = cfs_init,
     .shutdown = cfs_shutdown,
     .enqueue = cfs_enqueue,
+    .enqueue_batch = cfs_enqueue_batch,
     .dequeue = cfs_dequeue,
     .remove = cfs_remove,
     .on_yield = cfs_on_yield,
-    .on_tick = cfs_on_tick,
+    .account = cfs_account,
+    .nr_queued = cfs_nr_queued,
     .should_preempt = cfs_should_preempt,
+    .may_handoff = cfs_may_handoff,
     .update_priority = cfs_update_priority,
     .name = cfs_name
 };
@@ -0,0 +1,696 @@
+/**
+ * LibUThread Grouped CFS
+ *
+ * CFS in two levels for large thread counts. Threads belong to scheduling
+ * groups; each group keeps its ready threads in a pairing heap keyed by
+ * vruntime, and the groups with ready threads sit in a pairing heap keyed
+ * by group vruntime. The next thread is the front of the front group.
+ *
+ * A pairing heap inserts with one comparison against the root and
+ * touches nothing else, so waking one of 100k idle threads costs the
+ * same as waking one of ten; the O(log n) work is deferred to the
+ * dequeue, which only walks the children of the thread it takes. The
+ * groups bound how large any one heap grows and give each tenant a share
+ * of the CPU by weight rather than by thread count.
+ *
+ * Placement, slices and preemption follow sched_cfs.c at both levels.
+ *
+ * @file sched_cfs_group.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <string.h>
+
+/* Global grouped CFS state */
+struct sched_cfs_group_state g_cfs_group_state = {0};
+
+static struct slab_cache s_group_slab = SLAB_CACHE_INIT(struct sched_group);
+
+#define PH_THREAD(n)    ((struct uthread_internal *)((char *)(n) - \
+                         offsetof(struct uthread_internal, ph)))
+#define PH_GROUP(n)     ((struct sched_group *)(n))
+
+/* ==========================================================================
+ * Pairing Heap
+ *
+ * Every node links to its first child and its siblings; a node's prev is
+ * its left sibling, or its parent if it is the first child, so any node
+ * can be cut out in O(1). Only the root has a NULL prev.
+ * ========================================================================== */
+
+typedef bool (*ph_less_fn)(const struct ph_node *a, const struct ph_node *b);
+
+static bool ph_thread_less(const struct ph_node *a, const struct ph_node *b)
+{
+    return PH_THREAD(a)->vruntime < PH_THREAD(b)->vruntime;
+}
+
+static bool ph_group_less(const struct ph_node *a, const struct ph_node *b)
+{
+    return PH_GROUP(a)->vruntime < PH_GROUP(b)->vruntime;
+}
+
+/* Link two roots; the larger becomes the first child of the smaller */
+static inline struct ph_node *ph_meld(struct ph_node *a, struct ph_node *b,
+                                      ph_less_fn less)
+{
+    if (a == NULL) return b;
+    if (b == NULL) return a;
+
+    /* On a tie the existing root stays on top */
+    if (less(b, a)) {
+        struct ph_node *t = a;
+        a = b;
+        b = t;
+    }
+
+    b->prev = a;
+    b->next = a->child;
+    if (a->child != NULL) {
+        a->child->prev = b;
+    }
+    a->child = b;
+
+    return a;
+}
+
+/*
+ * Combine a list of sibling trees: meld them in pairs left to right, then
+ * meld the pairs right to left. The pairs are kept on a stack through
+ * next, which gives the right-to-left order for free.
+ */
+static struct ph_node *ph_merge_pairs(struct ph_node *first, ph_less_fn less)
+{
+    struct ph_node *pairs = NULL;
+
+    while (first != NULL) {
+        struct ph_node *a = first;
+        struct ph_node *b = a->next;
+        first = (b != NULL) ? b->next : NULL;
+
+        a->next = a->prev = NULL;
+        if (b != NULL) {
+            b->next = b->prev = NULL;
+            a = ph_meld(a, b, less);
+        }
+        a->next = pairs;
+        pairs = a;
+    }
+
+    struct ph_node *root = NULL;
+    while (pairs != NULL) {
+        struct ph_node *n = pairs;
+        pairs = n->next;
+        n->next = NULL;
+        root = ph_meld(root, n, less);
+    }
+
+    return root;
+}
+
+static inline struct ph_node *ph_insert(struct ph_node *root, struct ph_node *n,
+                                        ph_less_fn less)
+{
+    n->child = n->next = n->prev = NULL;
+    return ph_meld(root, n, less);
+}
+
+/* Take `n` out of the heap rooted at `root`; returns the new root */
+static struct ph_node *ph_remove(struct ph_node *root, struct ph_node *n,
+                                 ph_less_fn less)
+{
+    struct ph_node *children = n->child;
+    n->child = NULL;
+
+    if (n == root) {
+        return ph_merge_pairs(children, less);
+    }
+
+    /* Cut the subtree out of its sibling list */
+    if (n->prev->child == n) {
+        n->prev->child = n->next;
+    } else {
+        n->prev->next = n->next;
+    }
+    if (n->next != NULL) {
+        n->next->prev = n->prev;
+    }
+    n->next = n->prev = NULL;
+
+    return ph_meld(root, ph_merge_pairs(children, less), less);
+}
+
+static inline bool ph_linked(const struct ph_node *root, const struct ph_node *n)
+{
+    return n->prev != NULL || n == root;
+}
+
+/* ==========================================================================
+ * Groups
+ * ========================================================================== */
+
+static inline struct sched_group *group_of(struct uthread_internal *thread)
+{
+    return thread->group != NULL ? thread->group : &g_cfs_group_state.root;
+}
+
+static inline bool group_queued(struct sched_group *g)
+{
+    return ph_linked(g_cfs_group_state.groups, &g->node);
+}
+
+static inline bool thread_queued(struct sched_group *g, struct uthread_internal *thread)
+{
+    return ph_linked(g->threads, &thread->ph);
+}
+
+static inline struct sched_group *front_group(void)
+{
+    return g_cfs_group_state.groups != NULL ? PH_GROUP(g_cfs_group_state.groups) : NULL;
+}
+
+static inline struct uthread_internal *front_thread(struct sched_group *g)
+{
+    return g->threads != NULL ? PH_THREAD(g->threads) : NULL;
+}
+
+/* A group that gained its first ready thread joins the heap of groups */
+static void group_activate(struct sched_group *g)
+{
+    struct sched_cfs_group_state *s = &g_cfs_group_state;
+
+    /* Same rule as sched_cfs.c places a thread, one level up */
+    if (g->vruntime == 0) {
+        g->vruntime = s->min_vruntime;
+    } else if (s->min_vruntime > CFS_TARGET_LATENCY_NS / 2 &&
+               g->vruntime < s->min_vruntime - CFS_TARGET_LATENCY_NS / 2) {
+        g->vruntime = s->min_vruntime - CFS_TARGET_LATENCY_NS / 2;
+    }
+
+    s->groups = ph_insert(s->groups, &g->node, ph_group_less);
+    s->load += (uint64_t)g->weight;
+}
+
+static void group_deactivate(struct sched_group *g)
+{
+    struct sched_cfs_group_state *s = &g_cfs_group_state;
+
+    s->groups = ph_remove(s->groups, &g->node, ph_group_less);
+    s->load -= (uint64_t)g->weight;
+}
+
+/* Place a thread's vruntime relative to its group before it is queued */
+static void group_place(struct sched_group *g, struct uthread_internal *thread)
+{
+    if (thread->vruntime == 0) {
+        thread->vruntime = g->min_vruntime;
+    } else if (g->min_vruntime > CFS_TARGET_LATENCY_NS / 2 &&
+               thread->vruntime < g->min_vruntime - CFS_TARGET_LATENCY_NS / 2) {
+        thread->vruntime = g->min_vruntime - CFS_TARGET_LATENCY_NS / 2;
+    }
+}
+
+/*
+ * The period is shared among groups by weight and a group's part among
+ * its threads by weight, with the same stretch and floor as sched_cfs.c.
+ */
+static uint64_t group_slice(struct sched_group *g, struct uthread_internal *thread)
+{
+    struct sched_cfs_group_state *s = &g_cfs_group_state;
+
+    uint64_t period = CFS_TARGET_LATENCY_NS;
+    uint64_t nr = (uint64_t)s->count;
+    if (nr > CFS_TARGET_LATENCY_NS / CFS_MIN_GRANULARITY_NS) {
+        period = nr * CFS_MIN_GRANULARITY_NS;
+    }
+
+    uint64_t group_load = s->load + (group_queued(g) ? 0 : (uint64_t)g->weight);
+    uint64_t thread_load = g->load + (thread_queued(g, thread) ? 0 : (uint64_t)thread->weight);
+
+    uint64_t slice = period * (uint64_t)g->weight / group_load;
+    slice = slice * (uint64_t)thread->weight / thread_load;
+    if (slice < CFS_MIN_GRANULARITY_NS) {
+        slice = CFS_MIN_GRANULARITY_NS;
+    }
+    return slice;
+}
+
+static void group_enqueue(struct sched_group *g, struct uthread_internal *thread)
+{
+    g->threads = ph_insert(g->threads, &thread->ph, ph_thread_less);
+    g->load += (uint64_t)thread->weight;
+    g->nr_queued++;
+    g_cfs_group_state.count++;
+
+    if (g->nr_queued == 1) {
+        group_activate(g);
+    }
+}
+
+static void group_dequeue(struct sched_group *g, struct uthread_internal *thread)
+{
+    g->threads = ph_remove(g->threads, &thread->ph, ph_thread_less);
+    g->load -= (uint64_t)thread->weight;
+    g->nr_queued--;
+    g_cfs_group_state.count--;
+
+    if (g->nr_queued == 0) {
+        group_deactivate(g);
+    }
+}
+
+/* ==========================================================================
+ * Scheduler Operations
+ * ========================================================================== */
+
+static int cfsg_init(void)
+{
+    memset(&g_cfs_group_state, 0, sizeof(g_cfs_group_state));
+    g_cfs_group_state.root.weight = UTHREAD_GROUP_WEIGHT_DEFAULT;
+    return 0;
+}
+
+static void cfsg_shutdown(void)
+{
+    /* Threads are gone by now: release the groups nobody destroyed */
+    while (g_cfs_group_state.created != NULL) {
+        struct sched_group *g = g_cfs_group_state.created;
+        g_cfs_group_state.created = g->next;
+        slab_free(&s_group_slab, g);
+    }
+
+    memset(&g_cfs_group_state, 0, sizeof(g_cfs_group_state));
+}
+
+static void cfsg_enqueue(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    struct sched_group *g = group_of(thread);
+
+    group_place(g, thread);
+    group_enqueue(g, thread);
+    thread->timeslice_remaining = group_slice(g, thread);
+}
+
+static void cfsg_enqueue_batch(struct uthread_internal *head,
+                               struct uthread_internal *tail, int count)
+{
+    (void)tail;
+    (void)count;
+
+    /*
+     * Inserting is O(1), so each thread goes in on its own. The heap does
+     * not order equal keys, so each thread is placed at least just behind
+     * the one woken before it in its group to keep the wait order.
+     */
+    struct uthread_internal *t = head;
+    while (t != NULL) {
+        struct uthread_internal *next = t->next;
+        struct sched_group *g = group_of(t);
+
+        group_place(g, t);
+        if (t->prev != NULL && group_of(t->prev) == g &&
+            t->vruntime <= t->prev->vruntime) {
+            t->vruntime = t->prev->vruntime + 1;
+        }
+        t = next;
+    }
+
+    t = head;
+    while (t != NULL) {
+        struct uthread_internal *next = t->next;
+        struct sched_group *g = group_of(t);
+
+        t->next = NULL;
+        t->prev = NULL;
+        group_enqueue(g, t);
+        t->timeslice_remaining = group_slice(g, t);
+        t = next;
+    }
+}
+
+static struct uthread_internal *cfsg_dequeue(void)
+{
+    struct sched_group *g = front_group();
+    if (g == NULL) {
+        return NULL;
+    }
+
+    struct uthread_internal *thread = front_thread(g);
+    group_dequeue(g, thread);
+    return thread;
+}
+
+static void cfsg_remove(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    struct sched_group *g = group_of(thread);
+    if (thread_queued(g, thread)) {
+        group_dequeue(g, thread);
+    }
+}
+
+static void cfsg_on_yield(struct uthread_internal *thread)
+{
+    (void)thread;
+    /* Runtime is charged by scheduler_account() before the requeue */
+}
+
+static void cfsg_account(struct uthread_internal *thread, uint64_t delta_ns)
+{
+    if (thread == NULL) return;
+
+    struct sched_cfs_group_state *s = &g_cfs_group_state;
+    struct sched_group *g = group_of(thread);
+
+    thread->vruntime += (delta_ns * CFS_NICE_0_WEIGHT) / (uint64_t)thread->weight;
+
+    /* A queued group is keyed on its vruntime: requeue it around the change */
+    bool queued = group_queued(g);
+    if (queued) {
+        s->groups = ph_remove(s->groups, &g->node, ph_group_less);
+    }
+    g->vruntime += (delta_ns * CFS_NICE_0_WEIGHT) / (uint64_t)g->weight;
+    if (queued) {
+        s->groups = ph_insert(s->groups, &g->node, ph_group_less);
+    }
+
+    /* Advance both floors to the running thread or the front, whichever is behind */
+    uint64_t vruntime = thread->vruntime;
+    struct uthread_internal *front = front_thread(g);
+    if (front != NULL && front->vruntime < vruntime) {
+        vruntime = front->vruntime;
+    }
+    if (vruntime > g->min_vruntime) {
+        g->min_vruntime = vruntime;
+    }
+
+    vruntime = g->vruntime;
+    struct sched_group *first = front_group();
+    if (first != NULL && first->vruntime < vruntime) {
+        vruntime = first->vruntime;
+    }
+    if (vruntime > s->min_vruntime) {
+        s->min_vruntime = vruntime;
+    }
+
+    if (thread->timeslice_remaining > delta_ns) {
+        thread->timeslice_remaining -= delta_ns;
+    } else {
+        thread->timeslice_remaining = 0;
+    }
+}
+
+static int cfsg_nr_queued(void)
+{
+    return g_cfs_group_state.count;
+}
+
+/* Is `thread` no more than a granule behind both fronts? */
+static bool cfsg_ahead(struct uthread_internal *thread)
+{
+    struct sched_group *g = group_of(thread);
+
+    struct sched_group *first = front_group();
+    if (first != NULL && first != g &&
+        g->vruntime > first->vruntime + CFS_MIN_GRANULARITY_NS) {
+        return false;
+    }
+
+    struct uthread_internal *front = front_thread(g);
+    if (front != NULL && front != thread &&
+        thread->vruntime > front->vruntime + CFS_MIN_GRANULARITY_NS) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool cfsg_should_preempt(struct uthread_internal *current)
+{
+    if (current == NULL) return false;
+
+    if (current->timeslice_remaining == 0) {
+        return g_cfs_group_state.count > 0;
+    }
+
+    return !cfsg_ahead(current);
+}
+
+static bool cfsg_may_handoff(struct uthread_internal *thread)
+{
+    return cfsg_ahead(thread);
+}
+
+static void cfsg_update_priority(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    int weight = nice_to_weight(thread->nice);
+    struct sched_group *g = group_of(thread);
+    if (thread_queued(g, thread)) {
+        g->load += (uint64_t)weight;
+        g->load -= (uint64_t)thread->weight;
+    }
+    thread->weight = weight;
+}
+
+static const char *cfsg_name(void)
+{
+    return "CFS-group";
+}
+
+/* Scheduler operations structure */
+struct scheduler_ops sched_cfs_group_ops = {
+    .init = cfsg_init,
+    .shutdown = cfsg_shutdown,
+    .enqueue = cfsg_enqueue,
+    .enqueue_batch = cfsg_enqueue_batch,
+    .dequeue = cfsg_dequeue,
+    .remove = cfsg_remove,
+    .on_yield = cfsg_on_yield,
+    .account = cfsg_account,
+    .nr_queued = cfsg_nr_queued,
+    .should_preempt = cfsg_should_preempt,
+    .may_handoff = cfsg_may_handoff,
+    .update_priority = cfsg_update_priority,
+    .name = cfsg_name
+};
+
+/* ==========================================================================
+ * Membership
+ *
+ * thread->group shares its storage with fields other policies use, so
+ * it is only touched while this policy is active.
+ * ========================================================================== */
+
+static inline bool groups_active(void)
+{
+    return g_scheduler.ops == &sched_cfs_group_ops;
+}
+
+/**
+ * Put a new thread in `group`, or in the group of the thread creating it.
+ * Called with preemption disabled.
+ */
+void sched_group_join(struct uthread_internal *thread, uthread_group_t group)
+{
+    if (!groups_active()) {
+        return;
+    }
+
+    struct sched_group *g = (struct sched_group *)group;
+    if (g == NULL) {
+        struct uthread_internal *creator = CURRENT_THREAD();
+        if (creator != NULL && creator != &t_worker->idle_thread) {
+            g = creator->group;
+        }
+    }
+
+    thread->group = g;
+    if (g != NULL) {
+        g->nr_threads++;
+    }
+}
+
+/**
+ * Drop a thread's membership when it exits or is freed, so its group can
+ * be destroyed before the thread is joined. Called with preemption
+ * disabled.
+ */
+void sched_group_leave(struct uthread_internal *thread)
+{
+    if (!groups_active() || thread->group == NULL) {
+        return;
+    }
+
+    /* The time it ran since the last charge still counts for the group */
+    if (thread == CURRENT_THREAD()) {
+        scheduler_account(thread, sched_clock_ns());
+    }
+
+    thread->group->nr_threads--;
+    thread->group = NULL;
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+static bool group_weight_valid(int weight)
+{
+    return weight >= 1 && weight <= UTHREAD_GROUP_WEIGHT_MAX;
+}
+
+int uthread_group_create(uthread_group_t *group, int weight)
+{
+    if (!g_scheduler.initialized || !groups_active() || group == NULL ||
+        !group_weight_valid(weight)) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct sched_group *g = slab_alloc(&s_group_slab);
+    if (g == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    g->weight = weight;
+
+    preemption_disable();
+    g->next = g_cfs_group_state.created;
+    if (g->next != NULL) {
+        g->next->prev = g;
+    }
+    g_cfs_group_state.created = g;
+    preemption_enable();
+
+    *group = (uthread_group_t)g;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_group_destroy(uthread_group_t group)
+{
+    if (!g_scheduler.initialized || !groups_active() || group == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct sched_group *g = (struct sched_group *)group;
+
+    preemption_disable();
+
+    if (g->nr_threads > 0) {
+        preemption_enable();
+        return UTHREAD_EBUSY;
+    }
+
+    if (g->prev != NULL) {
+        g->prev->next = g->next;
+    } else {
+        g_cfs_group_state.created = g->next;
+    }
+    if (g->next != NULL) {
+        g->next->prev = g->prev;
+    }
+
+    preemption_enable();
+
+    slab_free(&s_group_slab, g);
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_group_setweight(uthread_group_t group, int weight)
+{
+    if (!g_scheduler.initialized || !groups_active() || group == NULL ||
+        !group_weight_valid(weight)) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct sched_group *g = (struct sched_group *)group;
+
+    preemption_disable();
+    if (group_queued(g)) {
+        g_cfs_group_state.load += (uint64_t)weight;
+        g_cfs_group_state.load -= (uint64_t)g->weight;
+    }
+    g->weight = weight;
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_group_getweight(uthread_group_t group, int *weight)
+{
+    if (group == NULL || weight == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    *weight = ((struct sched_group *)group)->weight;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_setgroup(uthread_t thread, uthread_group_t group)
+{
+    if (!g_scheduler.initialized || !groups_active() || thread == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *t = (struct uthread_internal *)thread;
+    struct sched_group *to = (struct sched_group *)group;
+
+    preemption_disable();
+
+    if (t->exited || t == &t_worker->idle_thread) {
+        preemption_enable();
+        return UTHREAD_EINVAL;
+    }
+
+    struct sched_group *from = group_of(t);
+    struct sched_group *dest = (to != NULL) ? to : &g_cfs_group_state.root;
+    if (from == dest) {
+        preemption_enable();
+        return UTHREAD_SUCCESS;
+    }
+
+    /* Charge the old group for what the caller ran so far */
+    if (t == CURRENT_THREAD()) {
+        scheduler_account(t, sched_clock_ns());
+    }
+
+    bool queued = thread_queued(from, t);
+    if (queued) {
+        group_dequeue(from, t);
+    }
+
+    /* Keep its lag behind the old group's floor */
+    uint64_t lag = (t->vruntime > from->min_vruntime) ? t->vruntime - from->min_vruntime : 0;
+    t->vruntime = dest->min_vruntime + lag;
+
+    if (t->group != NULL) {
+        t->group->nr_threads--;
+    }
+    t->group = to;
+    if (to != NULL) {
+        to->nr_threads++;
+    }
+
+    if (queued) {
+        group_enqueue(dest, t);
+    }
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_getgroup(uthread_t thread, uthread_group_t *group)
+{
+    if (thread == NULL || group == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *t = (struct uthread_internal *)thread;
+    *group = groups_active() ? (uthread_group_t)t->group : NULL;
+    return UTHREAD_SUCCESS;
+}
@@ -1,10 +1,14 @@
 /**
  * LibUThread Priority Scheduler
  *
- * Multi-level priority queue scheduler with 32 priority levels.
+ * Multi-level priority queue scheduler with UTHREAD_PRIORITY_LEVELS levels.
  * Higher priority threads always run before lower priority ones.
  * Within the same priority level, threads run in round-robin fashion.
  *
+ * Each level is a doubly linked list with a tail pointer and every queued
+ * thread records its level, so enqueue, dequeue, remove and priority
+ * changes are O(1). Non-empty levels are tracked in a two-level bitmap.
+ *
  * @file sched_priority.c
  */
 
@@ -20,83 +24,98 @@ struct sched_priority_state g_priority_state = {0};
  * Helper Functions
  * ========================================================================== */
 
+/* Clamp a thread priority to a valid queue level */
+static int priority_level(int priority)
+{
+    if (priority < 0) {
+        return 0;
+    }
+    if (priority >= UTHREAD_PRIORITY_LEVELS) {
+        return UTHREAD_PRIORITY_LEVELS - 1;
+    }
+    return priority;
+}
+
 /**
  * Find the highest priority non-empty queue.
- * Uses the bitmap for O(1) lookup.
+ *
+ * The summary word says which bitmap words are non-zero, so two
+ * count-leading-zeros instructions find the level.
  *
  * @return Highest priority level with threads, or -1 if all empty
  */
 static int find_highest_priority(void)
 {
-    if (g_priority_state.bitmap == 0) {
+    if (g_priority_state.summary == 0) {
         return -1;
     }
 
-    /* Find the position of the highest set bit */
-    /* Priority 31 is highest, stored in bit 31 */
-    for (int i = UTHREAD_PRIORITY_LEVELS - 1; i >= 0; i--) {
-        if (g_priority_state.bitmap & (1U << i)) {
-            return i;
-        }
-    }
+    int word = 63 - __builtin_clzll(g_priority_state.summary);
+    int bit = 63 - __builtin_clzll(g_priority_state.bitmap[word]);
 
-    return -1;
+    return word * 64 + bit;
 }
 
 /**
- * Add thread to a specific priority queue.
+ * Add thread to the tail of a priority queue.
  *
  * @param thread Thread to add
- * @param priority Priority level (0-31)
+ * @param priority Priority level
  */
 static void add_to_priority_queue(struct uthread_internal *thread, int priority)
 {
+    struct priority_level *level = &g_priority_state.levels[priority];
+
     thread->next = NULL;
+    thread->prev = level->tail;
 
-    /* Find the tail of this priority queue */
-    struct uthread_internal *tail = g_priority_state.queues[priority];
-    if (tail == NULL) {
-        /* Queue was empty */
-        g_priority_state.queues[priority] = thread;
-        thread->prev = NULL;
-        /* Set bitmap bit */
-        g_priority_state.bitmap |= (1U << priority);
+    if (level->tail != NULL) {
+        level->tail->next = thread;
     } else {
-        /* Find actual tail */
-        while (tail->next != NULL) {
-            tail = tail->next;
-        }
-        tail->next = thread;
-        thread->prev = tail;
+        /* Queue was empty */
+        level->head = thread;
+        g_priority_state.bitmap[priority / 64] |= 1ULL << (priority % 64);
+        g_priority_state.summary |= 1ULL << (priority / 64);
     }
+    level->tail = thread;
+
+    thread->priority_slot = priority + 1;
 }
 
 /**
- * Remove thread from a specific priority queue.
+ * Remove thread from the priority queue that holds it.
  *
- * @param thread Thread to remove
- * @param priority Priority level (0-31)
+ * @param thread Queued thread
  */
-static void remove_from_priority_queue(struct uthread_internal *thread, int priority)
+static void remove_from_priority_queue(struct uthread_internal *thread)
 {
+    int priority = thread->priority_slot - 1;
+    struct priority_level *level = &g_priority_state.levels[priority];
+
     /* Update links */
     if (thread->prev != NULL) {
         thread->prev->next = thread->next;
     } else {
-        /* Was head of queue */
-        g_priority_state.queues[priority] = thread->next;
+        level->head = thread->next;
     }
 
     if (thread->next != NULL) {
         thread->next->prev = thread->prev;
+    } else {
+        level->tail = thread->prev;
     }
 
     thread->next = NULL;
     thread->prev = NULL;
-
-    /* Clear bitmap bit if queue is now empty */
-    if (g_priority_state.queues[priority] == NULL) {
-        g_priority_state.bitmap &= ~(1U << priority);
+    thread->priority_slot = 0;
+
+    /* Clear bitmap bits if queue is now empty */
+    if (level->head == NULL) {
+        uint64_t *word = &g_priority_state.bitmap[priority / 64];
+        *word &= ~(1ULL << (priority % 64));
+        if (*word == 0) {
+            g_priority_state.summary &= ~(1ULL << (priority / 64));
+        }
     }
 }
 
@@ -119,17 +138,53 @@ static void priority_enqueue(struct uthread_internal *thread)
 {
     if (thread == NULL) return;
 
-    int priority = thread->priority;
-    if (priority < 0) priority = 0;
-    if (priority >= UTHREAD_PRIORITY_LEVELS) priority = UTHREAD_PRIORITY_LEVELS - 1;
-
-    add_to_priority_queue(thread, priority);
+    add_to_priority_queue(thread, priority_level(thread->priority));
     g_priority_state.count++;
 
     /* Reset timeslice */
     thread->timeslice_remaining = g_scheduler.timeslice_ns;
 }
 
+static void priority_enqueue_batch(struct uthread_internal *head,
+                                   struct uthread_internal *tail, int count)
+{
+    (void)tail;
+
+    /* Splice each run of threads sharing a priority onto its level */
+    struct uthread_internal *first = head;
+    while (first != NULL) {
+        int priority = priority_level(first->priority);
+        struct uthread_internal *last = first;
+
+        first->timeslice_remaining = g_scheduler.timeslice_ns;
+        first->priority_slot = priority + 1;
+        while (last->next != NULL &&
+               priority_level(last->next->priority) == priority) {
+            last = last->next;
+            last->timeslice_remaining = g_scheduler.timeslice_ns;
+            last->priority_slot = priority + 1;
+        }
+
+        struct uthread_internal *rest = last->next;
+        struct priority_level *level = &g_priority_state.levels[priority];
+
+        first->prev = level->tail;
+        last->next = NULL;
+        if (level->tail != NULL) {
+            level->tail->next = first;
+        } else {
+            level->head = first;
+            g_priority_state.bitmap[priority / 64] |= 1ULL << (priority % 64);
+            g_priority_state.summary |= 1ULL << (priority / 64);
+        }
+        level->tail = last;
+
+        first = rest;
+    }
+
+    g_priority_state.count += count;
+}
+
 static struct uthread_internal *priority_dequeue(void)
 {
     int highest = find_highest_priority();
@@ -138,46 +193,19 @@ static struct uthread_internal *priority_dequeue(void)
     }
 
     /* Get head of highest priority queue */
-    struct uthread_internal *thread = g_priority_state.queues[highest];
-    if (thread != NULL) {
-        remove_from_priority_queue(thread, highest);
-        g_priority_state.count--;
-    }
+    struct uthread_internal *thread = g_priority_state.levels[highest].head;
+    remove_from_priority_queue(thread);
+    g_priority_state.count--;
 
     return thread;
 }
 
 static void priority_remove(struct uthread_internal *thread)
 {
-    if (thread == NULL) return;
-
-    int priority = thread->priority;
-    if (priority < 0) priority = 0;
-    if (priority >= UTHREAD_PRIORITY_LEVELS) priority = UTHREAD_PRIORITY_LEVELS - 1;
-
-    /* Check if in this queue */
-    struct uthread_internal *t = g_priority_state.queues[priority];
-    while (t != NULL) {
-        if (t == thread) {
-            remove_from_priority_queue(thread, priority);
-            g_priority_state.count--;
-            return;
-        }
-        t = t->next;
-    }
+    if (thread == NULL || thread->priority_slot == 0) return;
 
-    /* Thread might have been moved to different priority - search all */
-    for (int i = 0; i < UTHREAD_PRIORITY_LEVELS; i++) {
-        t = g_priority_state.queues[i];
-        while (t != NULL) {
-            if (t == thread) {
-                remove_from_priority_queue(thread, i);
-                g_priority_state.count--;
-                return;
-            }
-            t = t->next;
-        }
-    }
+    remove_from_priority_queue(thread);
+    g_priority_state.count--;
 }
 
 static void priority_on_yield(struct uthread_internal *thread)
@@ -186,18 +214,23 @@ static void priority_on_yield(struct uthread_internal *thread)
     /* Thread goes to back of its priority queue */
 }
 
-static void priority_on_tick(struct uthread_internal *thread, uint64_t elapsed_ns)
+static void priority_account(struct uthread_internal *thread, uint64_t delta_ns)
 {
     if (thread == NULL) return;
 
     /* Decrease remaining timeslice */
-    if (thread->timeslice_remaining > elapsed_ns) {
-        thread->timeslice_remaining -= elapsed_ns;
+    if (thread->timeslice_remaining > delta_ns) {
+        thread->timeslice_remaining -= delta_ns;
     } else {
         thread->timeslice_remaining = 0;
     }
 }
 
+static int priority_nr_queued(void)
+{
+    return g_priority_state.count;
+}
+
 static bool priority_should_preempt(struct uthread_internal *current)
 {
     if (current == NULL) return false;
@@ -213,33 +246,37 @@ static bool priority_should_preempt(struct uthread_internal *current)
     }
 
     if (current->timeslice_remaining == 0 &&
-        g_priority_state.queues[current->priority] != NULL) {
+        g_priority_state.levels[priority_level(current->priority)].head != NULL) {
         return true;
     }
 
     return false;
 }
 
+static bool priority_may_handoff(struct uthread_internal *thread)
+{
+    /* Never ahead of a higher-priority thread */
+    return priority_level(thread->priority) >= find_highest_priority();
+}
+
 static void priority_update_priority(struct uthread_internal *thread)
 {
     if (thread == NULL) return;
 
-    /* If thread is in a queue, move it to the new priority queue */
-    /* First, try to remove from current location */
-    for (int i = 0; i < UTHREAD_PRIORITY_LEVELS; i++) {
-        struct uthread_internal *t = g_priority_state.queues[i];
-        while (t != NULL) {
-            if (t == thread) {
-                /* Found it - remove and re-add at new priority */
-                remove_from_priority_queue(thread, i);
-                add_to_priority_queue(thread, thread->priority);
-                return;
-            }
-            t = t->next;
-        }
+    /* Thread isn't in any queue (probably running) - nothing to do */
+    if (thread->priority_slot == 0) {
+        return;
+    }
+
+    /* Same level: keep its place in the queue */
+    int level = priority_level(thread->priority);
+    if (level == thread->priority_slot - 1) {
+        return;
     }
 
-    /* Thread wasn't in any queue (probably running) - nothing to do */
+    /* Move it to the tail of its new level */
+    remove_from_priority_queue(thread);
+    add_to_priority_queue(thread, level);
 }
 
 static const char *priority_name(void)
@@ -252,11 +289,14 @@ struct scheduler_ops sched_priority_ops = {
     .init = priority_init,
     .shutdown = priority_shutdown,
     .enqueue = priority_enqueue,
+    .enqueue_batch = priority_enqueue_batch,
     .dequeue = priority_dequeue,
     .remove = priority_remove,
     .on_yield = priority_on_yield,
-    .on_tick = priority_on_tick,
+    .account = priority_account,
+    .nr_queued = priority_nr_queued,
     .should_preempt = priority_should_preempt,
+    .may_handoff = priority_may_handoff,
     .update_priority = priority_update_priority,
     .name = priority_name
 };
@@ -51,6 +51,25 @@ static void rr_enqueue(struct uthread_internal *thread)
     thread->timeslice_remaining = g_scheduler.timeslice_ns;
 }
 
+static void rr_enqueue_batch(struct uthread_internal *head,
+                             struct uthread_internal *tail, int count)
+{
+    for (struct uthread_internal *t = head; t != NULL; t = t->next) {
+        t->timeslice_remaining = g_scheduler.timeslice_ns;
+    }
+
+    /* Splice the whole list onto the tail */
+    head->prev = g_rr_state.tail;
+    if (g_rr_state.tail != NULL) {
+        g_rr_state.tail->next = head;
+    } else {
+        g_rr_state.head = head;
+    }
+
+    g_rr_state.tail = tail;
+    g_rr_state.count += count;
+}
+
 static struct uthread_internal *rr_dequeue(void)
 {
     if (g_rr_state.head == NULL) {
@@ -76,20 +95,8 @@ static struct uthread_internal *rr_dequeue(void)
 
 static void rr_remove(struct uthread_internal *thread)
 {
-    if (thread == NULL) return;
-
-    /* Check if in queue */
-    bool found = false;
-    struct uthread_internal *t = g_rr_state.head;
-    while (t != NULL) {
-        if (t == thread) {
-            found = true;
-            break;
-        }
-        t = t->next;
-    }
-
-    if (!found) return;
+    /* Only ready threads are queued (exiting ones remove themselves) */
+    if (thread == NULL || thread->state != UTHREAD_STATE_READY) return;
 
     /* Unlink from queue */
     if (thread->prev != NULL) {
@@ -115,18 +122,23 @@ static void rr_on_yield(struct uthread_internal *thread)
     /* Nothing special for yield in RR - thread goes to back of queue */
 }
 
-static void rr_on_tick(struct uthread_internal *thread, uint64_t elapsed_ns)
+static void rr_account(struct uthread_internal *thread, uint64_t delta_ns)
 {
     if (thread == NULL) return;
 
     /* Decrease remaining timeslice */
-    if (thread->timeslice_remaining > elapsed_ns) {
-        thread->timeslice_remaining -= elapsed_ns;
+    if (thread->timeslice_remaining > delta_ns) {
+        thread->timeslice_remaining -= delta_ns;
     } else {
         thread->timeslice_remaining = 0;
     }
 }
 
+static int rr_nr_queued(void)
+{
+    return g_rr_state.count;
+}
+
 static bool rr_should_preempt(struct uthread_internal *current)
 {
     if (current == NULL) return false;
@@ -135,6 +147,13 @@ static bool rr_should_preempt(struct uthread_internal *current)
     return (current->timeslice_remaining == 0 && g_rr_state.count > 0);
 }
 
+static bool rr_may_handoff(struct uthread_internal *thread)
+{
+    (void)thread;
+    /* The hand-off chain limit keeps the rest of the queue moving */
+    return true;
+}
+
 static void rr_update_priority(struct uthread_internal *thread)
 {
     (void)thread;
@@ -151,11 +170,14 @@ struct scheduler_ops sched_rr_ops = {
     .init = rr_init,
     .shutdown = rr_shutdown,
     .enqueue = rr_enqueue,
+    .enqueue_batch = rr_enqueue_batch,
     .dequeue = rr_dequeue,
     .remove = rr_remove,
     .on_yield = rr_on_yield,
-    .on_tick = rr_on_tick,
+    .account = rr_account,
+    .nr_queued = rr_nr_queued,
     .should_preempt = rr_should_preempt,
+    .may_handoff = rr_may_handoff,
     .update_priority = rr_update_priority,
     .name = rr_name
 };
@@ -0,0 +1,306 @@
+/**
+ * LibUThread Work-Stealing Scheduler
+ *
+ * Run queues for M:N mode. Every worker has a FIFO of ready threads;
+ * a thread is queued on the worker that last ran it, and a worker whose
+ * queue is empty steals the oldest thread from a randomly chosen victim,
+ * trying workers on its own NUMA node before the others. Threads are
+ * only stolen by workers their affinity allows. Within a worker,
+ * scheduling is round-robin.
+ *
+ * All operations run under the scheduler lock.
+ *
+ * @file sched_ws.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ==========================================================================
+ * Local Queue Helpers
+ * ========================================================================== */
+
+static void rq_push(struct worker *w, struct uthread_internal *thread)
+{
+    thread->next = NULL;
+    thread->prev = w->rq_tail;
+
+    if (w->rq_tail != NULL) {
+        w->rq_tail->next = thread;
+    } else {
+        w->rq_head = thread;
+    }
+
+    w->rq_tail = thread;
+    w->rq_count++;
+    thread->rq_worker = w;
+}
+
+static void rq_unlink(struct worker *w, struct uthread_internal *thread)
+{
+    if (thread->prev != NULL) {
+        thread->prev->next = thread->next;
+    } else {
+        w->rq_head = thread->next;
+    }
+
+    if (thread->next != NULL) {
+        thread->next->prev = thread->prev;
+    } else {
+        w->rq_tail = thread->prev;
+    }
+
+    thread->next = NULL;
+    thread->prev = NULL;
+    thread->rq_worker = NULL;
+    w->rq_count--;
+}
+
+static uint32_t steal_random(struct worker *w)
+{
+    /* xorshift32 */
+    uint32_t x = w->steal_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    w->steal_seed = x;
+    return x;
+}
+
+/* Oldest thread of the victim that is allowed to move to the thief */
+static struct uthread_internal *rq_first_allowed(struct worker *victim,
+                                                 struct worker *thief)
+{
+    struct uthread_internal *t = victim->rq_head;
+
+    while (t != NULL && !thread_allowed_on(t, thief)) {
+        t = t->next;
+    }
+
+    return t;
+}
+
+static struct uthread_internal *rq_steal(struct worker *victim, struct worker *thief)
+{
+    struct uthread_internal *t = rq_first_allowed(victim, thief);
+
+    if (t != NULL) {
+        rq_unlink(victim, t);
+    }
+
+    return t;
+}
+
+/* ==========================================================================
+ * Work-Stealing Scheduler Implementation
+ * ========================================================================== */
+
+static int ws_init(void)
+{
+    return 0;
+}
+
+static void ws_shutdown(void)
+{
+    /* Queues live in the workers, which are freed by uthread_shutdown() */
+}
+
+static void ws_enqueue(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    /* Stay on the worker whose caches hold the thread, if it has one */
+    struct worker *target = thread->worker;
+    if (target == NULL) {
+        target = t_worker;
+    }
+
+    rq_push(target, thread);
+    thread->timeslice_remaining = g_scheduler.timeslice_ns;
+
+    /* Wake the owner, or an idle worker that can steal the thread */
+    if (target->idle) {
+        target->idle = false;
+        worker_kick(target);
+    } else if (!thread->pinned) {
+        worker_kick_idle_for(thread);
+    }
+}
+
+static void ws_enqueue_batch(struct uthread_internal *head,
+                             struct uthread_internal *tail, int count)
+{
+    (void)tail;
+    (void)count;
+
+    /* Threads go home one by one; idle workers are kicked once at the end */
+    int stealable = 0;
+
+    struct uthread_internal *t = head;
+    while (t != NULL) {
+        struct uthread_internal *next = t->next;
+
+        struct worker *target = t->worker;
+        if (target == NULL) {
+            target = t_worker;
+        }
+
+        rq_push(target, t);
+        t->timeslice_remaining = g_scheduler.timeslice_ns;
+
+        if (target->idle) {
+            target->idle = false;
+            worker_kick(target);
+        } else if (!t->pinned) {
+            stealable++;
+        }
+
+        t = next;
+    }
+
+    /* One idle worker per thread that could be stolen, as enqueue would */
+    for (int i = 0; i < g_scheduler.num_workers && stealable > 0; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (w->idle) {
+            w->idle = false;
+            worker_kick(w);
+            stealable--;
+        }
+    }
+}
+
+static struct uthread_internal *ws_dequeue(void)
+{
+    struct worker *self = t_worker;
+
+    if (self->rq_head != NULL) {
+        struct uthread_internal *t = self->rq_head;
+        rq_unlink(self, t);
+        return t;
+    }
+
+    /*
+     * Local queue empty: try every other worker, starting at a random one,
+     * those on this node on the first pass and the rest on the second.
+     */
+    int n = g_scheduler.num_workers;
+    int start = (int)(steal_random(self) % (uint32_t)n);
+    int passes = (g_scheduler.num_nodes > 1) ? 2 : 1;
+
+    for (int pass = 0; pass < passes; pass++) {
+        for (int i = 0; i < n; i++) {
+            struct worker *victim = &g_scheduler.workers[(start + i) % n];
+            if (victim == self || victim->rq_count == 0) {
+                continue;
+            }
+            bool remote = victim->node != self->node;
+            if (passes > 1 && remote != (pass == 1)) {
+                continue;
+            }
+
+            struct uthread_internal *t = rq_steal(victim, self);
+            if (t != NULL) {
+                self->steals++;
+                if (remote) {
+                    self->remote_steals++;
+                }
+                return t;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void ws_remove(struct uthread_internal *thread)
+{
+    if (thread == NULL || thread->rq_worker == NULL) return;
+
+    rq_unlink(thread->rq_worker, thread);
+}
+
+static void ws_on_yield(struct uthread_internal *thread)
+{
+    (void)thread;
+    /* Thread goes to the back of its worker's queue */
+}
+
+static void ws_account(struct uthread_internal *thread, uint64_t delta_ns)
+{
+    if (thread == NULL) return;
+
+    /* Decrease remaining timeslice */
+    if (thread->timeslice_remaining > delta_ns) {
+        thread->timeslice_remaining -= delta_ns;
+    } else {
+        thread->timeslice_remaining = 0;
+    }
+}
+
+static int ws_nr_queued(void)
+{
+    int count = 0;
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        count += g_scheduler.workers[i].rq_count;
+    }
+    return count;
+}
+
+static bool ws_should_preempt(struct uthread_internal *current)
+{
+    if (current == NULL || current->timeslice_remaining > 0) return false;
+
+    /* Preempt if anything this worker could run is waiting */
+    struct worker *self = t_worker;
+    if (self->rq_count > 0) {
+        return true;
+    }
+
+    /* Elsewhere, only what ws_dequeue() could steal counts */
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct worker *victim = &g_scheduler.workers[i];
+        if (victim != self && victim->rq_count > 0 &&
+            rq_first_allowed(victim, self) != NULL) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool ws_may_handoff(struct uthread_internal *thread)
+{
+    (void)thread;
+    /* Taken from any worker's queue, as a steal would */
+    return true;
+}
+
+static void ws_update_priority(struct uthread_internal *thread)
+{
+    (void)thread;
+    /* Work stealing ignores priority */
+}
+
+static const char *ws_name(void)
+{
+    return "Work-Stealing";
+}
+
+/* Scheduler operations structure */
+struct scheduler_ops sched_ws_ops = {
+    .init = ws_init,
+    .shutdown = ws_shutdown,
+    .enqueue = ws_enqueue,
+    .enqueue_batch = ws_enqueue_batch,
+    .dequeue = ws_dequeue,
+    .remove = ws_remove,
+    .on_yield = ws_on_yield,
+    .account = ws_account,
+    .nr_queued = ws_nr_queued,
+    .should_preempt = ws_should_preempt,
+    .may_handoff = ws_may_handoff,
+    .update_priority = ws_update_priority,
+    .name = ws_name
+};
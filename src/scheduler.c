@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
 
 /* ==========================================================================
  * Wait Queue Operations
@@ -118,16 +119,159 @@ void wait_queue_wake_one(struct wait_queue *wq)
     }
 }
 
+/* Wake the oldest waiter as the caller's partner (see scheduler_unblock_partner) */
+void wait_queue_wake_partner(struct wait_queue *wq)
+{
+    if (wq == NULL) return;
+
+    struct uthread_internal *thread = wait_queue_remove(wq);
+    if (thread != NULL) {
+        scheduler_unblock_partner(thread);
+    }
+}
+
 void wait_queue_wake_all(struct wait_queue *wq)
 {
     if (wq == NULL) return;
 
-    struct uthread_internal *thread;
-    while ((thread = wait_queue_remove(wq)) != NULL) {
+    if (wq->head == NULL) return;
+
+    /* Hand the whole queue to the scheduler in one batch */
+    struct uthread_internal *head = wq->head;
+    struct uthread_internal *tail = wq->tail;
+    int count = wq->count;
+
+    wq->head = NULL;
+    wq->tail = NULL;
+    wq->count = 0;
+
+    scheduler_unblock_batch(head, tail, count);
+}
+
+/* ==========================================================================
+ * Sleep Queue Operations
+ *
+ * Binary min-heap keyed by wake_time. Each thread records its heap slot
+ * (plus one) so cancellation on an early wakeup is O(log n).
+ * ========================================================================== */
+
+static void sleep_queue_place(int index, struct uthread_internal *thread)
+{
+    g_scheduler.sleepers.heap[index] = thread;
+    thread->sleep_index = index + 1;
+}
+
+static void sleep_queue_sift_up(int index)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+    struct uthread_internal *thread = sq->heap[index];
+
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (sq->heap[parent]->wake_time <= thread->wake_time) {
+            break;
+        }
+        sleep_queue_place(index, sq->heap[parent]);
+        index = parent;
+    }
+
+    sleep_queue_place(index, thread);
+}
+
+static void sleep_queue_sift_down(int index)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+    struct uthread_internal *thread = sq->heap[index];
+
+    while (1) {
+        int child = 2 * index + 1;
+        if (child >= sq->count) {
+            break;
+        }
+        if (child + 1 < sq->count &&
+            sq->heap[child + 1]->wake_time < sq->heap[child]->wake_time) {
+            child++;
+        }
+        if (thread->wake_time <= sq->heap[child]->wake_time) {
+            break;
+        }
+        sleep_queue_place(index, sq->heap[child]);
+        index = child;
+    }
+
+    sleep_queue_place(index, thread);
+}
+
+void sleep_queue_add(struct uthread_internal *thread, uint64_t deadline)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+
+    if (thread == NULL || thread->sleep_index != 0) return;
+
+    UTHREAD_ASSERT(sq->count < g_scheduler.threads.capacity);
+
+    thread->wake_time = deadline;
+    thread->timed_out = false;
+    sq->heap[sq->count] = thread;
+    sq->count++;
+    sleep_queue_sift_up(sq->count - 1);
+
+    /* New earliest deadline: an idle worker must shorten its wait */
+    if (g_scheduler.num_workers > 1 && sq->heap[0] == thread) {
+        worker_kick_idle();
+    }
+}
+
+void sleep_queue_remove(struct uthread_internal *thread)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+
+    if (thread == NULL || thread->sleep_index == 0) return;
+
+    int index = thread->sleep_index - 1;
+    thread->sleep_index = 0;
+    sq->count--;
+
+    if (index == sq->count) {
+        return;
+    }
+
+    /* Move the last entry into the hole and restore heap order */
+    struct uthread_internal *last = sq->heap[sq->count];
+    sleep_queue_place(index, last);
+    if (index > 0 && sq->heap[(index - 1) / 2]->wake_time > last->wake_time) {
+        sleep_queue_sift_up(index);
+    } else {
+        sleep_queue_sift_down(index);
+    }
+}
+
+void sleep_queue_expire(uint64_t now)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+
+    while (sq->count > 0 && sq->heap[0]->wake_time <= now) {
+        struct uthread_internal *thread = sq->heap[0];
+
+        sleep_queue_remove(thread);
+
+        /* Timed wait: leave the primitive's queue as well */
+        if (thread->blocked_queue != NULL) {
+            wait_queue_remove_specific(thread->blocked_queue, thread);
+        }
+
+        thread->timed_out = true;
         scheduler_unblock(thread);
     }
 }
 
+uint64_t sleep_queue_next_deadline(void)
+{
+    struct sleep_queue *sq = &g_scheduler.sleepers;
+
+    return (sq->count > 0) ? sq->heap[0]->wake_time : 0;
+}
+
 /* ==========================================================================
  * Scheduler Core Operations
  * ========================================================================== */
@@ -139,57 +283,124 @@ void scheduler_init_common(void)
 
 struct uthread_internal *scheduler_current(void)
 {
-    return g_scheduler.current;
+    struct worker *w = t_worker;
+    return (w != NULL) ? w->current : NULL;
 }
 
-void scheduler_add_thread(struct uthread_internal *thread)
+/**
+ * The thread to switch to directly instead of asking the run queue, if
+ * any. A wakeup is only handed over when the waker is now blocking, the
+ * policy allows the partner to run ahead, and fewer than
+ * SCHED_HANDOFF_MAX hand-offs ran in a row; uthread_yield_to() only
+ * needs the target to be runnable here. The thread is taken out of the
+ * run queue, so its wait there and the dequeue are skipped.
+ */
+static struct uthread_internal *scheduler_take_handoff(struct worker *w,
+                                                      struct uthread_internal *current)
 {
-    if (thread == NULL) return;
+    struct uthread_internal *next = w->handoff;
+    bool yield_to = w->handoff_yield;
+
+    w->handoff = NULL;
+    w->handoff_yield = false;
+
+    if (next->state != UTHREAD_STATE_READY || !thread_allowed_on(next, w)) {
+        return NULL;
+    }
 
-    /* Find a free slot */
-    for (int i = 0; i < UTHREAD_MAX_THREADS; i++) {
-        if (g_scheduler.all_threads[i] == NULL) {
-            g_scheduler.all_threads[i] = thread;
-            g_scheduler.thread_count++;
-            return;
+    if (!yield_to) {
+        if (current == NULL || current->state != UTHREAD_STATE_BLOCKED ||
+            w->handoff_chain >= SCHED_HANDOFF_MAX ||
+            !g_scheduler.ops->may_handoff(next)) {
+            return NULL;
         }
+        w->handoff_chain++;
     }
 
-    UTHREAD_ASSERT(0 && "scheduler_add_thread: no free slots");
+    g_scheduler.ops->remove(next);
+    w->handoffs++;
+
+    return next;
 }
 
-void scheduler_remove_thread(struct uthread_internal *thread)
+void scheduler_schedule(void)
 {
-    if (thread == NULL) return;
+    struct worker *w = t_worker;
+    struct uthread_internal *current = w->current;
 
-    for (int i = 0; i < UTHREAD_MAX_THREADS; i++) {
-        if (g_scheduler.all_threads[i] == thread) {
-            g_scheduler.all_threads[i] = NULL;
-            g_scheduler.thread_count--;
-            return;
-        }
+    /* A task blocked: its runner stays with it, the queue needs another */
+    if (current != NULL && current->task != NULL &&
+        current->state == UTHREAD_STATE_BLOCKED && !current->task_promoted) {
+        task_promote(current);
     }
-}
 
-void scheduler_schedule(void)
-{
+    /* Every primitive parks this way, so blocking is traced once, here */
+    if (current != NULL && current->state == UTHREAD_STATE_BLOCKED) {
+        trace_record(TRACE_BLOCK, current->tid, 0);
+    }
+
+    /* Every switch is a safe point to snapshot the scheduler at */
+    introspect_poll();
+
     g_scheduler.scheduler_invocations++;
-    g_scheduler.in_scheduler = true;
+    w->in_scheduler = true;
+
+    /* Wake sleepers whose deadline has passed */
+    if (g_scheduler.sleepers.count > 0) {
+        sleep_queue_expire(get_time_ns());
+    }
 
-    struct uthread_internal *current = g_scheduler.current;
-    struct uthread_internal *next;
+    /* Pick up I/O readiness every few switches unless a worker polls */
+    if (g_io.waiting > 0 && g_io.poller == NULL &&
+        ++g_io.polls_skipped >= IO_POLL_INTERVAL) {
+        io_poll();
+    }
+
+#ifdef UTHREAD_IO_URING
+    /* Reap ring completions; submit early only once a batch is full */
+    if (g_ring.inflight.count > 0) {
+        ring_poll(false);
+    }
+#endif
+
+    struct uthread_internal *next = NULL;
+
+    /* Charge a thread leaving the CPU; requeued ones were charged first */
+    uint64_t now = sched_clock_ns();
+    if (current != NULL && current->state != UTHREAD_STATE_READY) {
+        scheduler_account(current, now);
+    }
 
-    /* Get next thread from scheduler */
-    next = g_scheduler.ops->dequeue();
+    /* Get next thread from scheduler; stopping workers only run idle */
+    if (!(g_scheduler.stopping && w->id > 0)) {
+        if (w->handoff != NULL) {
+            next = scheduler_take_handoff(w, current);
+        }
+        if (next == NULL) {
+            w->handoff_chain = 0;
+            next = g_scheduler.ops->dequeue();
+        }
+
+#ifdef UTHREAD_IO_URING
+        /* Nothing else will queue requests: submit the batch */
+        if (next == NULL && g_ring.pending > 0) {
+            ring_poll(true);
+            next = g_scheduler.ops->dequeue();
+        }
+#endif
+    }
 
     /* If no thread ready, use idle thread */
     if (next == NULL) {
-        next = &g_scheduler.idle_thread;
+        next = &w->idle_thread;
     }
 
     /* If same thread, just return */
     if (next == current) {
-        g_scheduler.in_scheduler = false;
+        current->preempted = false;
+        current->state = UTHREAD_STATE_RUNNING;
+        w->in_scheduler = false;
+        timer_reprogram(current, now);
         return;
     }
 
@@ -198,35 +409,52 @@ void scheduler_schedule(void)
         current->state = UTHREAD_STATE_READY;
     }
 
+    if (current != NULL) {
+        if (current->preempted) {
+            current->involuntary_switches++;
+            current->preempted = false;
+        } else {
+            current->voluntary_switches++;
+        }
+    }
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        thread_stats_switch(current, next, now);
+    }
+
     next->state = UTHREAD_STATE_RUNNING;
-    g_scheduler.current = next;
+    next->worker = w;
+    next->start_time = now;
+    w->switching_from = current;
+    w->current = next;
 
     UTHREAD_DEBUG("Switch: %d '%s' -> %d '%s'",
                   current ? current->tid : -1,
-                  current ? current->name : "none",
-                  next->tid, next->name);
+                  current ? current->cold->name : "none",
+                  next->tid, next->cold->name);
 
-    g_scheduler.in_scheduler = false;
+    w->in_scheduler = false;
+    timer_reprogram(next, now);
 
     /* Perform context switch */
     if (current != NULL) {
         context_switch_to(current, next);
     } else {
         /* First switch - just restore next */
-        setcontext(&next->context);
+        context_start(next);
     }
 }
 
 void scheduler_yield(void)
 {
-    struct uthread_internal *current = g_scheduler.current;
+    struct uthread_internal *current = CURRENT_THREAD();
 
-    if (current == NULL || current == &g_scheduler.idle_thread) {
+    if (current == NULL || current == &t_worker->idle_thread) {
         return;
     }
 
     /* Put current thread back in run queue */
     if (current->state == UTHREAD_STATE_RUNNING) {
+        scheduler_account(current, sched_clock_ns());
         current->state = UTHREAD_STATE_READY;
         g_scheduler.ops->enqueue(current);
     }
@@ -234,9 +462,21 @@ void scheduler_yield(void)
     scheduler_schedule();
 }
 
+/**
+ * Yield to a specific thread: the caller is requeued as by
+ * scheduler_yield(), and `thread` runs next if it is ready and allowed on
+ * this worker. Called with preemption disabled.
+ */
+void scheduler_yield_to(struct uthread_internal *thread)
+{
+    t_worker->handoff = thread;
+    t_worker->handoff_yield = true;
+    scheduler_yield();
+}
+
 void scheduler_block(struct wait_queue *wq)
 {
-    struct uthread_internal *current = g_scheduler.current;
+    struct uthread_internal *current = CURRENT_THREAD();
 
     if (current == NULL) {
         return;
@@ -250,60 +490,254 @@ void scheduler_block(struct wait_queue *wq)
     scheduler_schedule();
 }
 
+/**
+ * Block the current thread until woken or until a deadline passes.
+ *
+ * @param wq       Wait queue to block on, or NULL to just sleep
+ * @param deadline Absolute CLOCK_MONOTONIC deadline in nanoseconds
+ * @return UTHREAD_SUCCESS if woken, UTHREAD_ETIMEDOUT if the deadline passed
+ */
+int scheduler_block_until(struct wait_queue *wq, uint64_t deadline)
+{
+    struct uthread_internal *current = CURRENT_THREAD();
+
+    if (current == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    uint64_t now = get_time_ns();
+    trace_record(TRACE_SLEEP, current->tid,
+                 deadline > now ? (int)((deadline - now) / 1000) : 0);
+
+    current->state = UTHREAD_STATE_BLOCKED;
+    if (wq != NULL) {
+        wait_queue_add(wq, current);
+    }
+    sleep_queue_add(current, deadline);
+
+    scheduler_schedule();
+
+    return current->timed_out ? UTHREAD_ETIMEDOUT : UTHREAD_SUCCESS;
+}
+
+/* Per-thread part of a wakeup, before the thread is queued */
+static inline void scheduler_wake_prepare(struct uthread_internal *thread,
+                                          int waker_tid)
+{
+    /* Woken before its deadline: cancel the timer */
+    if (thread->sleep_index != 0) {
+        sleep_queue_remove(thread);
+    }
+
+    trace_record(TRACE_UNBLOCK, thread->tid, waker_tid);
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        thread_stats_wake(thread);
+    }
+
+    thread->state = UTHREAD_STATE_READY;
+}
+
 void scheduler_unblock(struct uthread_internal *thread)
 {
     if (thread == NULL) return;
 
-    thread->state = UTHREAD_STATE_READY;
+    struct uthread_internal *waker = t_worker->current;
+    scheduler_wake_prepare(thread, waker != NULL ? waker->tid : 0);
     g_scheduler.ops->enqueue(thread);
+
+    /* The running thread is no longer alone */
+    timer_queue_changed();
+}
+
+/**
+ * Wake a thread the caller is about to wait for, such as the other end
+ * of a request/response exchange (mutex unlock, semaphore post, channel
+ * hand-off). The thread is queued as usual; if the caller blocks before
+ * anything else is scheduled, scheduler_schedule() switches straight to
+ * it rather than to the head of the run queue.
+ */
+void scheduler_unblock_partner(struct uthread_internal *thread)
+{
+    if (thread == NULL) return;
+
+    scheduler_unblock(thread);
+
+    struct worker *w = t_worker;
+    if (w->current != NULL && w->current != &w->idle_thread) {
+        w->handoff = thread;
+        w->handoff_yield = false;
+    }
+}
+
+/** Drop hand-off hints naming a thread that is exiting */
+void scheduler_forget_handoff(struct uthread_internal *thread)
+{
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        if (g_scheduler.workers[i].handoff == thread) {
+            g_scheduler.workers[i].handoff = NULL;
+        }
+    }
+}
+
+/**
+ * Wake a list of blocked threads at once, such as a whole wait queue.
+ *
+ * The threads are queued with a single enqueue_batch() call, so the run
+ * queue is updated once rather than per thread: a splice for the FIFO
+ * schedulers, a merge and rebuild of the tree for CFS.
+ *
+ * @param head  First thread, linked through next/prev
+ * @param tail  Last thread
+ * @param count Number of threads in the list
+ */
+void scheduler_unblock_batch(struct uthread_internal *head,
+                             struct uthread_internal *tail, int count)
+{
+    if (head == NULL) return;
+
+    struct uthread_internal *waker = t_worker->current;
+    int waker_tid = waker != NULL ? waker->tid : 0;
+
+    for (struct uthread_internal *t = head; t != NULL; t = t->next) {
+        t->blocked_queue = NULL;
+        scheduler_wake_prepare(t, waker_tid);
+    }
+
+    g_scheduler.ops->enqueue_batch(head, tail, count);
+
+    /* The running thread is no longer alone */
+    timer_queue_changed();
+}
+
+/**
+ * Charge a thread for the CPU time it used since it was last charged.
+ *
+ * Runs at every switch away from a thread and at every tick, so threads
+ * that block before a tick pay for their runtime too. Must be called
+ * before the thread is queued: CFS orders its run queue by vruntime.
+ *
+ * @param thread Thread that has been running
+ * @param now    Current sched_clock_ns()
+ */
+void scheduler_account(struct uthread_internal *thread, uint64_t now)
+{
+    if (thread == &t_worker->idle_thread) {
+        return;
+    }
+
+    uint64_t delta = 0;
+    if (thread->start_time != 0 && now > thread->start_time) {
+        delta = now - thread->start_time;
+    }
+    thread->start_time = now;
+
+    thread->total_runtime += delta;
+    g_scheduler.total_runtime_ns += delta;
+    g_scheduler.ops->account(thread, delta);
 }
 
 void scheduler_tick(void)
 {
     g_scheduler.scheduler_ticks++;
 
-    struct uthread_internal *current = g_scheduler.current;
-    if (current == NULL || current == &g_scheduler.idle_thread) {
+    /* Ticks are safe points too, for a thread that runs without switching */
+    introspect_poll();
+
+    uint64_t now = get_time_ns();
+
+    /* Make expired sleepers runnable so they compete for this tick */
+    if (g_scheduler.sleepers.count > 0) {
+        sleep_queue_expire(now);
+    }
+
+    /* Keep I/O moving while threads run without switching */
+    if (g_io.waiting > 0 && g_io.poller == NULL) {
+        io_poll();
+    }
+#ifdef UTHREAD_IO_URING
+    /* Bound the time a request waits in the submission queue */
+    if (g_ring.inflight.count > 0) {
+        ring_poll(true);
+    }
+#endif
+
+    struct uthread_internal *current = CURRENT_THREAD();
+    if (current == NULL || current == &t_worker->idle_thread) {
         return;
     }
 
-    /* Calculate elapsed time */
-    uint64_t now = get_time_ns();
-    uint64_t elapsed = now - current->start_time;
+    /* A wakeup older than a tick is no longer part of an exchange */
+    t_worker->handoff = NULL;
 
-    /* Notify scheduler */
-    g_scheduler.ops->on_tick(current, elapsed);
+    scheduler_account(current, sched_clock_ns());
 
     /* Check if preemption needed */
     if (g_scheduler.preemption_enabled &&
         g_scheduler.ops->should_preempt(current)) {
 
-        UTHREAD_DEBUG("Preempting thread %d '%s'", current->tid, current->name);
+        UTHREAD_DEBUG("Preempting thread %d '%s'", current->tid, current->cold->name);
 
         /* Put current back in queue and reschedule */
+        current->preempted = true;
         current->state = UTHREAD_STATE_READY;
         g_scheduler.ops->enqueue(current);
         scheduler_schedule();
+        return;
     }
+
+    timer_reprogram(current, sched_clock_ns());
 }
 
 /* ==========================================================================
  * Idle Thread
  * ========================================================================== */
 
-static void idle_thread_func(void)
+/**
+ * Idle thread entry point.
+ *
+ * Each worker has one. It runs whenever no thread is ready and hands the
+ * CPU back as soon as one is. The idle thread is never enqueued, so
+ * scheduler_schedule() simply returns to it while nothing is runnable.
+ * Instead of spinning, the kernel thread sleeps until the earliest
+ * sleep-queue deadline, until another worker queues work for it, or until
+ * a signal (e.g. the preemption timer) arrives. While threads wait on
+ * file descriptors, one idle worker sleeps in epoll_wait() instead so the
+ * I/O can wake them.
+ *
+ * Note: Idle thread initialization is handled in worker_setup()
+ */
+void *scheduler_idle_loop(void *arg)
 {
-    /*
-     * Idle thread just yields in a loop.
-     * In a real implementation, this could:
-     * - Put the CPU in a low-power state
-     * - Poll for I/O completions
-     * - Run background tasks
-     */
+    (void)arg;
+
     while (1) {
-        /* Yield to any ready thread */
-        scheduler_yield();
+        struct worker *w = t_worker;
+
+        preemption_disable();
+        w->idle = false;
+
+        /* Additional workers return to their pthread on shutdown */
+        if (g_scheduler.stopping && w->id > 0) {
+            w->current = &w->host;
+            context_switch_to(&w->idle_thread, &w->host);
+        }
+
+        scheduler_schedule();
+
+        /* Nothing runnable: publish that we are idle, then wait */
+        w->idle = true;
+        unsigned int seq = atomic_load_explicit(&w->wake_seq,
+                                                memory_order_acquire);
+        uint64_t deadline = sleep_queue_next_deadline();
+        bool poll_io = io_idle_claim(w);
+        preemption_enable();
+
+        if (poll_io) {
+            io_idle_wait(w, deadline);
+        } else {
+            worker_wait(w, seq, deadline);
+        }
     }
-}
 
-/* Note: Idle thread initialization is handled in uthread_init() */
+    return NULL;
+}
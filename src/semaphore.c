@@ -31,11 +31,10 @@ int uthread_sem_init(uthread_sem_t *sem, int pshared, unsigned int value)
     sem->value = (int)value;
 
     /* Allocate wait queue */
-    sem->waiters = malloc(sizeof(struct wait_queue));
+    sem->waiters = wait_queue_alloc();
     if (sem->waiters == NULL) {
         return UTHREAD_ENOMEM;
     }
-    wait_queue_init(sem->waiters);
 
     sem->initialized = true;
 
@@ -59,8 +58,7 @@ int uthread_sem_destroy(uthread_sem_t *sem)
 
     /* Free wait queue */
     if (sem->waiters != NULL) {
-        wait_queue_destroy(sem->waiters);
-        free(sem->waiters);
+        wait_queue_free(sem->waiters);
         sem->waiters = NULL;
     }
 
@@ -90,13 +88,10 @@ int uthread_sem_wait(uthread_sem_t *sem)
             wait_queue_add(sem->waiters, self);
         }
 
-        preemption_enable();
-
+        /* Switch away still holding off preemption (and other workers) */
         if (self != NULL) {
             scheduler_schedule();
         }
-
-        preemption_disable();
     }
 
     /* Decrement the semaphore value */
@@ -149,33 +144,14 @@ int uthread_sem_timedwait(uthread_sem_t *sem, const struct timespec *abstime)
     int result = UTHREAD_SUCCESS;
 
     while (sem->value <= 0) {
-        /* Check timeout */
-        uint64_t now = get_time_ns();
-        if (now >= deadline) {
+        if (self == NULL || get_time_ns() >= deadline) {
             preemption_enable();
             return UTHREAD_ETIMEDOUT;
         }
 
-        if (self != NULL) {
-            self->state = UTHREAD_STATE_BLOCKED;
-            wait_queue_add(sem->waiters, self);
-        }
-
-        preemption_enable();
-
-        if (self != NULL) {
-            /* Yield for a short time */
-            scheduler_schedule();
-        }
-
-        preemption_disable();
-
-        /* If we timed out while blocked, remove from queue */
-        now = get_time_ns();
-        if (now >= deadline) {
-            if (self != NULL && self->blocked_queue != NULL) {
-                wait_queue_remove_specific(sem->waiters, self);
-            }
+        /* Sleep until posted or until the deadline passes */
+        if (scheduler_block_until(sem->waiters, deadline) == UTHREAD_ETIMEDOUT &&
+            sem->value <= 0) {
             preemption_enable();
             return UTHREAD_ETIMEDOUT;
         }
@@ -206,7 +182,7 @@ int uthread_sem_post(uthread_sem_t *sem)
 
     /* Wake one waiting thread if any */
     if (sem->waiters != NULL && !wait_queue_empty(sem->waiters)) {
-        wait_queue_wake_one(sem->waiters);
+        wait_queue_wake_partner(sem->waiters);
     }
 
     preemption_enable();
@@ -0,0 +1,296 @@
+/**
+ * LibUThread Contention Statistics
+ *
+ * Per-thread time spent READY and BLOCKED, and per-lock acquisition,
+ * contention, wait and hold counters, for finding the starved thread and
+ * the hot lock. Collected only while uthread_set_contention_stats() has
+ * enabled them; every call site checks g_contention.enabled first.
+ *
+ * A thread's state_since is stamped when it leaves the CPU and again when
+ * it is woken, so the time up to the wakeup counts as blocked and the
+ * time from there to the next switch in counts as waiting for a CPU.
+ *
+ * Lock counters live in a record allocated on first acquisition and
+ * listed in a table for iteration. The table persists across
+ * uthread_shutdown(), since locks may outlive the library's threads.
+ *
+ * All state is protected by disabling preemption.
+ *
+ * @file stats.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Global contention statistics state */
+struct contention_state g_contention;
+
+/* Per-lock records */
+static struct slab_cache s_lock_stats_slab = SLAB_CACHE_INIT(struct lock_stats);
+
+/* ==========================================================================
+ * Threads
+ * ========================================================================== */
+
+/**
+ * Account a context switch: `prev` starts waiting, `next` stops.
+ * Called from scheduler_schedule() with the switch timestamp.
+ */
+void thread_stats_switch(struct uthread_internal *prev,
+                         struct uthread_internal *next, uint64_t now)
+{
+    if (prev != NULL) {
+        prev->state_since = now;
+    }
+
+    if (next->state_since != 0 && now > next->state_since) {
+        uint64_t wait = now - next->state_since;
+        next->ready_ns += wait;
+        if (wait > next->max_ready_ns) {
+            next->max_ready_ns = wait;
+        }
+    }
+    next->state_since = 0;
+}
+
+/** Account a blocked thread becoming READY */
+void thread_stats_wake(struct uthread_internal *thread)
+{
+    uint64_t now = sched_clock_ns();
+
+    if (thread->state_since != 0 && now > thread->state_since) {
+        thread->blocked_ns += now - thread->state_since;
+    }
+    thread->state_since = now;
+}
+
+static void thread_stats_fill(struct uthread_internal *t,
+                              uthread_thread_stats_t *stats)
+{
+    stats->tid = t->tid;
+    memcpy(stats->name, t->cold->name, UTHREAD_NAME_MAX);
+    stats->state = t->state;
+    stats->voluntary_switches = t->voluntary_switches;
+    stats->involuntary_switches = t->involuntary_switches;
+    stats->run_ns = t->total_runtime;
+    stats->ready_ns = t->ready_ns;
+    stats->max_ready_ns = t->max_ready_ns;
+    stats->blocked_ns = t->blocked_ns;
+}
+
+/* ==========================================================================
+ * Locks
+ * ========================================================================== */
+
+static struct lock_stats *lock_stats_create(const void *lock,
+                                            uthread_lock_kind_t kind)
+{
+    if (g_contention.count == g_contention.capacity) {
+        int capacity = g_contention.capacity ? g_contention.capacity * 2 : 64;
+        struct lock_stats **locks = realloc(g_contention.locks,
+                                            capacity * sizeof(*locks));
+        if (locks == NULL) {
+            return NULL;
+        }
+        g_contention.locks = locks;
+        g_contention.capacity = capacity;
+    }
+
+    struct lock_stats *stats = slab_alloc(&s_lock_stats_slab);
+    if (stats == NULL) {
+        return NULL;
+    }
+
+    stats->lock = lock;
+    stats->kind = kind;
+    stats->index = g_contention.count;
+    g_contention.locks[g_contention.count++] = stats;
+
+    return stats;
+}
+
+/**
+ * Count an acquisition. Called with preemption disabled once the lock is
+ * held.
+ *
+ * @param slot         The lock's stats pointer, filled in on first use
+ * @param lock         The lock, recorded for identification
+ * @param kind         Mutex or rwlock
+ * @param wait_start   lock_wait_start() from when the caller found the
+ *                     lock held, 0 if it was free
+ * @param first_holder Nobody else holds it (always, except shared readers)
+ */
+void lock_stats_acquired(struct lock_stats **slot, const void *lock,
+                         uthread_lock_kind_t kind, uint64_t wait_start,
+                         bool first_holder)
+{
+    struct lock_stats *stats = *slot;
+    if (stats == NULL) {
+        stats = lock_stats_create(lock, kind);
+        if (stats == NULL) {
+            return;
+        }
+        *slot = stats;
+    }
+
+    uint64_t now = sched_clock_ns();
+
+    stats->acquisitions++;
+    if (wait_start != 0) {
+        stats->contended++;
+        if (now > wait_start) {
+            stats->wait_ns += now - wait_start;
+        }
+    }
+
+    if (first_holder) {
+        stats->held_since = now;
+    }
+}
+
+/**
+ * Account a release. Called with preemption disabled while still held.
+ *
+ * @param stats       The lock's stats (may be NULL)
+ * @param last_holder The lock becomes free (always, except shared readers)
+ */
+void lock_stats_released(struct lock_stats *stats, bool last_holder)
+{
+    if (stats == NULL || !last_holder || stats->held_since == 0) {
+        return;
+    }
+
+    uint64_t now = sched_clock_ns();
+    if (now > stats->held_since && now - stats->held_since > stats->max_hold_ns) {
+        stats->max_hold_ns = now - stats->held_since;
+    }
+    stats->held_since = 0;
+}
+
+/** Drop a destroyed lock's counters */
+void lock_stats_free(struct lock_stats **slot)
+{
+    struct lock_stats *stats = *slot;
+    if (stats == NULL) {
+        return;
+    }
+
+    preemption_disable();
+
+    /* Move the last record into the freed slot */
+    struct lock_stats *last = g_contention.locks[--g_contention.count];
+    g_contention.locks[stats->index] = last;
+    last->index = stats->index;
+
+    preemption_enable();
+
+    slab_free(&s_lock_stats_slab, stats);
+    *slot = NULL;
+}
+
+/** Zero all counters; called from uthread_reset_stats() */
+void contention_stats_reset(void)
+{
+    REGISTRY_FOREACH(t) {
+        t->voluntary_switches = 0;
+        t->involuntary_switches = 0;
+        t->ready_ns = 0;
+        t->max_ready_ns = 0;
+        t->blocked_ns = 0;
+    }
+
+    for (int i = 0; i < g_contention.count; i++) {
+        struct lock_stats *stats = g_contention.locks[i];
+        stats->acquisitions = 0;
+        stats->contended = 0;
+        stats->wait_ns = 0;
+        stats->max_hold_ns = 0;
+    }
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+void uthread_set_contention_stats(bool enabled)
+{
+    preemption_disable();
+
+    /* Stamps left from an earlier period would count the gap as waiting */
+    if (enabled && !g_contention.enabled && g_scheduler.initialized) {
+        REGISTRY_FOREACH(t) {
+            t->state_since = 0;
+        }
+    }
+
+    g_contention.enabled = enabled;
+
+    preemption_enable();
+}
+
+int uthread_get_thread_stats(uthread_t thread, uthread_thread_stats_t *stats)
+{
+    if (thread == NULL || stats == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+    thread_stats_fill((struct uthread_internal *)thread, stats);
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+bool uthread_thread_stats_next(int *cursor, uthread_thread_stats_t *stats)
+{
+    if (cursor == NULL || stats == NULL || !g_scheduler.initialized) {
+        return false;
+    }
+
+    bool found = false;
+
+    preemption_disable();
+
+    /* The cursor is a registry slot, so it stays valid across calls */
+    struct thread_registry *reg = &g_scheduler.threads;
+    while (*cursor >= 0 && *cursor < reg->used) {
+        struct uthread_internal *t = reg->slots[(*cursor)++];
+        if (t != NULL) {
+            thread_stats_fill(t, stats);
+            found = true;
+            break;
+        }
+    }
+
+    preemption_enable();
+
+    return found;
+}
+
+bool uthread_lock_stats_next(int *cursor, uthread_lock_stats_t *stats)
+{
+    if (cursor == NULL || stats == NULL) {
+        return false;
+    }
+
+    bool found = false;
+
+    preemption_disable();
+
+    if (*cursor >= 0 && *cursor < g_contention.count) {
+        const struct lock_stats *ls = g_contention.locks[(*cursor)++];
+        stats->lock = ls->lock;
+        stats->kind = ls->kind;
+        stats->acquisitions = ls->acquisitions;
+        stats->contended = ls->contended;
+        stats->wait_ns = ls->wait_ns;
+        stats->max_hold_ns = ls->max_hold_ns;
+        found = true;
+    }
+
+    preemption_enable();
+
+    return found;
+}
@@ -0,0 +1,280 @@
+/**
+ * LibUThread Tasks
+ *
+ * Run-to-completion closures that do not get a thread of their own.
+ * Submitted tasks go on a FIFO that a small pool of runner threads, one
+ * per worker at most, drains back to back: a task costs a queue push and
+ * a function call instead of a stack, a TCB and two context switches.
+ *
+ * A task may still block on any uthread primitive. When it does, the
+ * runner it borrowed becomes that task's thread (scheduler_schedule()
+ * calls task_promote()) and leaves the pool, and a replacement runner
+ * keeps the queue moving. Once the task completes, the promoted runner
+ * rejoins the pool if it is short, or exits.
+ *
+ * Every task completes into the group of whoever submitted it: the
+ * submitting thread, or the submitting task. uthread_task_group_wait()
+ * waits for that group to drain, and a task's own group is drained
+ * before the task counts as complete. Threads drain theirs on exit.
+ *
+ * All state is protected by disabling preemption.
+ *
+ * @file task.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Global task state */
+struct task_state g_tasks;
+
+/* Descriptors beyond the free list */
+static struct slab_cache s_task_slab = SLAB_CACHE_INIT(struct uthread_task);
+
+/* ==========================================================================
+ * Descriptor Allocation
+ * ========================================================================== */
+
+static struct uthread_task *task_alloc(void)
+{
+    struct uthread_task *task = g_tasks.free;
+
+    if (task != NULL) {
+        g_tasks.free = task->next;
+        g_tasks.free_count--;
+        memset(task, 0, sizeof(*task));
+        return task;
+    }
+
+    return slab_alloc(&s_task_slab);
+}
+
+static void task_release(struct uthread_task *task)
+{
+    if (g_tasks.free_count >= TASK_FREE_MAX) {
+        slab_free(&s_task_slab, task);
+        return;
+    }
+
+    task->next = g_tasks.free;
+    g_tasks.free = task;
+    g_tasks.free_count++;
+}
+
+/* ==========================================================================
+ * Runners
+ * ========================================================================== */
+
+static void *task_runner(void *arg);
+
+/**
+ * Make sure a runner will pick up the queue: wake a parked one, or start
+ * a new one while the pool has fewer runners than workers.
+ *
+ * @return UTHREAD_SUCCESS, or an error if a needed runner could not start
+ */
+static int task_ensure_runner(void)
+{
+    if (!wait_queue_empty(&g_tasks.idle)) {
+        wait_queue_wake_one(&g_tasks.idle);
+        return UTHREAD_SUCCESS;
+    }
+
+    if (g_tasks.runners >= g_scheduler.num_workers) {
+        return UTHREAD_SUCCESS;
+    }
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setdetachstate(&attr, UTHREAD_CREATE_DETACHED);
+    uthread_attr_setname(&attr, "task-runner");
+
+    uthread_t runner;
+    int ret = uthread_create(&runner, &attr, task_runner, NULL);
+    uthread_attr_destroy(&attr);
+    if (ret != UTHREAD_SUCCESS) {
+        return ret;
+    }
+
+    g_tasks.runners++;
+    return UTHREAD_SUCCESS;
+}
+
+/* Count a finished task against its group and wake the group's waiters */
+static void task_complete(struct uthread_task *task)
+{
+    struct task_group *parent = task->parent;
+
+    if (--parent->pending == 0) {
+        wait_queue_wake_all(&parent->waiters);
+    }
+
+    g_tasks.completed++;
+    task_release(task);
+}
+
+static void *task_runner(void *arg)
+{
+    (void)arg;
+
+    struct uthread_internal *self = CURRENT_THREAD();
+
+    preemption_disable();
+
+    for (;;) {
+        struct uthread_task *task = g_tasks.head;
+
+        /* Park until a submit wakes us */
+        if (task == NULL) {
+            self->state = UTHREAD_STATE_BLOCKED;
+            wait_queue_add(&g_tasks.idle, self);
+            scheduler_schedule();
+            continue;
+        }
+
+        g_tasks.head = task->next;
+        if (g_tasks.head == NULL) {
+            g_tasks.tail = NULL;
+        }
+
+        self->task = task;
+        preemption_enable();
+
+        task->fn(task->arg);
+
+        preemption_disable();
+
+        /* Implicit sync: a task is done once the tasks it spawned are */
+        task_group_sync(&task->children);
+        task_complete(task);
+        self->task = NULL;
+
+        /* Blocked earlier and left the pool: rejoin it or retire */
+        if (self->task_promoted) {
+            if (g_tasks.runners >= g_scheduler.num_workers) {
+                break;
+            }
+            self->task_promoted = false;
+            g_tasks.runners++;
+        }
+    }
+
+    preemption_enable();
+
+    return NULL;
+}
+
+/**
+ * Called by scheduler_schedule() when a runner blocks inside a task.
+ *
+ * The runner stays with the task until it completes, so it no longer
+ * counts towards the pool and another runner is brought in for the queue.
+ */
+void task_promote(struct uthread_internal *runner)
+{
+    runner->task_promoted = true;
+    g_tasks.runners--;
+    g_tasks.promotions++;
+
+    if (g_tasks.head != NULL) {
+        task_ensure_runner();
+    }
+}
+
+/**
+ * Block the calling thread until `group` has no pending tasks.
+ * Must be called with preemption disabled.
+ */
+void task_group_sync(struct task_group *group)
+{
+    struct uthread_internal *self = CURRENT_THREAD();
+
+    while (group->pending > 0) {
+        self->state = UTHREAD_STATE_BLOCKED;
+        wait_queue_add(&group->waiters, self);
+        scheduler_schedule();
+    }
+}
+
+/**
+ * Free queued tasks and cached descriptors. Called from uthread_shutdown()
+ * once all threads, runners included, have been released.
+ */
+void task_shutdown(void)
+{
+    while (g_tasks.head != NULL) {
+        struct uthread_task *task = g_tasks.head;
+        g_tasks.head = task->next;
+        slab_free(&s_task_slab, task);
+    }
+
+    while (g_tasks.free != NULL) {
+        struct uthread_task *task = g_tasks.free;
+        g_tasks.free = task->next;
+        slab_free(&s_task_slab, task);
+    }
+
+    memset(&g_tasks, 0, sizeof(g_tasks));
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+int uthread_task_submit(void (*fn)(void *), void *arg)
+{
+    if (!g_scheduler.initialized || fn == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    struct uthread_internal *self = CURRENT_THREAD();
+
+    /* Nobody would ever run it: fail rather than queue */
+    int ret = task_ensure_runner();
+    if (ret != UTHREAD_SUCCESS && g_tasks.runners == 0) {
+        preemption_enable();
+        return ret;
+    }
+
+    struct uthread_task *task = task_alloc();
+    if (task == NULL) {
+        preemption_enable();
+        return UTHREAD_ENOMEM;
+    }
+
+    task->fn = fn;
+    task->arg = arg;
+    task->parent = (self->task != NULL) ? &self->task->children : &self->cold->tasks;
+    task->parent->pending++;
+
+    if (g_tasks.tail != NULL) {
+        g_tasks.tail->next = task;
+    } else {
+        g_tasks.head = task;
+    }
+    g_tasks.tail = task;
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_task_group_wait(void)
+{
+    if (!g_scheduler.initialized) {
+        return UTHREAD_EINVAL;
+    }
+
+    preemption_disable();
+
+    struct uthread_internal *self = CURRENT_THREAD();
+    task_group_sync((self->task != NULL) ? &self->task->children : &self->cold->tasks);
+
+    preemption_enable();
+
+    return UTHREAD_SUCCESS;
+}
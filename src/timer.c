@@ -1,7 +1,24 @@
 /**
  * LibUThread Timer and Preemption
  *
- * Implements preemptive scheduling using SIGALRM/SIGVTALRM.
+ * Implements preemptive scheduling using a timer signal (PREEMPT_SIGNAL).
+ *
+ * Preemption is disabled either by masking the signal with sigprocmask(),
+ * or, when built with UTHREAD_LAZY_PREEMPTION, by a counter alone: the
+ * signal stays unmasked and the handler defers the tick while the counter
+ * is non-zero, so disable/enable pairs make no syscalls.
+ *
+ * In M:N mode the preemption state is per worker, each worker has its own
+ * POSIX timer aimed at its kernel thread, and disabling preemption also
+ * takes the scheduler lock that serializes all library state.
+ *
+ * With UTHREAD_TICKLESS every worker, including a single one, gets such a
+ * timer on a real-time signal, armed one-shot for the running thread's
+ * remaining slice or the next sleeper deadline. Nothing re-arms it while a
+ * thread runs alone, so a lone thread or an idle worker takes no ticks.
+ *
+ * While the profiler runs, the timer ticks at least once per sampling
+ * period, and the handler takes a sample before anything else.
  *
  * @file timer.c
  */
@@ -12,13 +29,91 @@
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
+#include <sched.h>
+#include <unistd.h>
 #include <sys/time.h>
 
-/* Preemption state */
-static volatile sig_atomic_t s_preemption_disabled = 0;
-static volatile sig_atomic_t s_preempt_pending = 0;
+/* Older glibc headers only expose the raw union member */
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define WORKER_LOCAL _Thread_local __attribute__((tls_model("initial-exec")))
+
+/* Preemption state of the worker running on this kernel thread */
+static WORKER_LOCAL volatile sig_atomic_t s_preemption_disabled = 0;
+static WORKER_LOCAL volatile sig_atomic_t s_preempt_pending = 0;
 static volatile sig_atomic_t s_timer_active = 0;
 
+/* Profiler sampling period while profiling, 0 otherwise */
+static uint64_t s_sample_ns = 0;
+
+/* Set whenever the signal may be blocked in the mask of the running thread */
+static WORKER_LOCAL volatile sig_atomic_t s_signal_blocked = 0;
+
+/* Scheduler lock, only used when more than one worker runs */
+static atomic_int s_sched_lock = 0;
+static WORKER_LOCAL bool s_sched_lock_held = false;
+
+/* ==========================================================================
+ * Scheduler Lock
+ * ========================================================================== */
+
+/*
+ * Taken on the outermost preemption_disable() of a worker and dropped on
+ * the matching enable. Context switches happen with it held, so the lock
+ * travels with the worker rather than with the user thread.
+ */
+static void sched_lock(void)
+{
+    if (g_scheduler.num_workers <= 1) {
+        return;
+    }
+
+    int spins = 0;
+    while (atomic_exchange_explicit(&s_sched_lock, 1, memory_order_acquire)) {
+        while (atomic_load_explicit(&s_sched_lock, memory_order_relaxed)) {
+            /* The holder may be descheduled by the kernel */
+            if (++spins >= 100) {
+                spins = 0;
+                sched_yield();
+            }
+        }
+    }
+    s_sched_lock_held = true;
+}
+
+static void sched_unlock(void)
+{
+    if (!s_sched_lock_held) {
+        return;
+    }
+
+    s_sched_lock_held = false;
+    atomic_store_explicit(&s_sched_lock, 0, memory_order_release);
+}
+
+/*
+ * Run a scheduler tick as a preemption-disabled region. The tick may
+ * switch away; when this thread resumes (possibly on another worker) the
+ * depth restored for it is the one saved here.
+ */
+static void preemption_tick(void)
+{
+    s_preemption_disabled++;
+    sched_lock();
+
+    struct uthread_internal *current = t_worker->current;
+    trace_record(TRACE_PREEMPT, current != NULL ? current->tid : 0, 0);
+
+    scheduler_tick();
+
+    if (s_preemption_disabled == 1) {
+        sched_unlock();
+    }
+    s_preemption_disabled--;
+}
+
 /* ==========================================================================
  * Signal Handler
  * ========================================================================== */
@@ -26,17 +121,28 @@ static volatile sig_atomic_t s_timer_active = 0;
 /**
  * Timer signal handler for preemption.
  *
- * Called when SIGALRM fires. Triggers scheduler if preemption
+ * Called when PREEMPT_SIGNAL fires. Triggers scheduler if preemption
  * is enabled and not in a critical section.
  */
-static void timer_signal_handler(int signum)
+static void timer_signal_handler(int signum, siginfo_t *info, void *ucontext)
 {
     (void)signum;
+    (void)info;
 
-    if (!g_scheduler.initialized) {
+    struct worker *w = t_worker;
+    if (!g_scheduler.initialized || w == NULL) {
         return;
     }
 
+    /* A one-shot timer is spent once it fires; the next tick re-arms it */
+    w->timer_expiry = 0;
+
+    /* Sample whatever was interrupted, whether it may be preempted or not */
+    if (__builtin_expect(atomic_load_explicit(&g_profile_enabled,
+                                              memory_order_relaxed), 0)) {
+        profile_sample(w, ucontext);
+    }
+
     /* If preemption disabled, just mark it pending */
     if (s_preemption_disabled > 0) {
         s_preempt_pending = 1;
@@ -44,48 +150,88 @@ static void timer_signal_handler(int signum)
     }
 
     /* If already in scheduler, don't recurse */
-    if (g_scheduler.in_scheduler) {
+    if (w->in_scheduler) {
         return;
     }
 
     /* Check if current thread is in critical section */
-    struct uthread_internal *current = g_scheduler.current;
+    struct uthread_internal *current = w->current;
     if (current != NULL && current->in_critical_section) {
         s_preempt_pending = 1;
         return;
     }
 
-    /* Trigger scheduler tick */
-    scheduler_tick();
+    /*
+     * Trigger scheduler tick. The kernel blocks the signal while we run,
+     * and any thread we switch to inherits that mask.
+     */
+    s_signal_blocked = 1;
+    preemption_tick();
+
+    /* Returning restores the interrupted mask, where the signal was deliverable */
+    s_signal_blocked = 0;
+
+    /* ...and the alternate stack of the worker the tick started on */
+    stack_fault_fix_frame(ucontext);
 }
 
 /* ==========================================================================
  * Timer Management
  * ========================================================================== */
 
+/* Tick period: the timeslice, or the sampling period if shorter */
+static uint64_t timer_period_ns(void)
+{
+    if (s_sample_ns != 0 && s_sample_ns < g_scheduler.timeslice_ns) {
+        return s_sample_ns;
+    }
+    return g_scheduler.timeslice_ns;
+}
+
+/* Whether each worker drives its own POSIX timer instead of setitimer() */
+static bool timer_per_worker(void)
+{
+#ifdef UTHREAD_TICKLESS
+    return true;
+#else
+    return g_scheduler.num_workers > 1;
+#endif
+}
+
 int timer_init(void)
 {
     /* Set up signal handler */
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = timer_signal_handler;
-    sa.sa_flags = SA_RESTART;
+    sa.sa_sigaction = timer_signal_handler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
 
-    /* Block all signals during handler */
-    sigfillset(&sa.sa_mask);
+    /*
+     * Block nothing extra during the handler: the handler may switch to
+     * another thread, which would otherwise inherit a fully blocked mask.
+     */
+    sigemptyset(&sa.sa_mask);
 
-    if (sigaction(SIGALRM, &sa, &g_scheduler.old_sigaction) == -1) {
+    if (sigaction(PREEMPT_SIGNAL, &sa, &g_scheduler.old_sigaction) == -1) {
         perror("sigaction");
         return -1;
     }
 
     /* Set up signal mask for blocking during critical sections */
     sigemptyset(&g_scheduler.block_mask);
-    sigaddset(&g_scheduler.block_mask, SIGALRM);
+    sigaddset(&g_scheduler.block_mask, PREEMPT_SIGNAL);
 
     s_preemption_disabled = 0;
     s_preempt_pending = 0;
     s_timer_active = 0;
+    s_signal_blocked = 0;
+
+    /* Per-worker timers: worker 0 gets one like the others */
+    if (timer_per_worker() &&
+        timer_worker_init(&g_scheduler.workers[0]) != 0) {
+        sigaction(PREEMPT_SIGNAL, &g_scheduler.old_sigaction, NULL);
+        return -1;
+    }
 
     UTHREAD_DEBUG("Timer initialized");
 
@@ -96,22 +242,179 @@ void timer_shutdown(void)
 {
     /* Stop timer first */
     timer_stop();
+    if (timer_per_worker()) {
+        timer_worker_shutdown(&g_scheduler.workers[0]);
+    }
 
     /* Restore old signal handler */
-    sigaction(SIGALRM, &g_scheduler.old_sigaction, NULL);
+    sigaction(PREEMPT_SIGNAL, &g_scheduler.old_sigaction, NULL);
 
     UTHREAD_DEBUG("Timer shutdown");
 }
 
+/*
+ * Program (or with ns == 0, disarm) the timer of one worker: periodic, or
+ * in tickless mode a one-shot that timer_reprogram() keeps re-arming.
+ */
+static void timer_worker_arm(struct worker *w, uint64_t ns)
+{
+    if (!w->timer_created) {
+        return;
+    }
+
+    struct itimerspec its;
+    its.it_value.tv_sec = ns / 1000000000ULL;
+    its.it_value.tv_nsec = ns % 1000000000ULL;
+#ifdef UTHREAD_TICKLESS
+    memset(&its.it_interval, 0, sizeof(its.it_interval));
+    w->timer_expiry = (ns != 0) ? sched_clock_ns() + ns : 0;
+#else
+    its.it_interval = its.it_value;
+#endif
+
+    timer_settime(w->timer, 0, &its, NULL);
+}
+
+#ifdef UTHREAD_TICKLESS
+/**
+ * Make sure this worker's timer fires when a thread about to run (or
+ * running) must next be looked at.
+ *
+ * That is the end of its slice if anything else could use the CPU, the
+ * earliest sleeper deadline, or a plain timeslice while I/O needs polling.
+ * The timer is only ever moved earlier: one that fires too soon finds
+ * nothing to do and re-arms from the tick, and one left armed when the
+ * thread ends up alone expires once and is not re-armed. Either way the
+ * common switch makes no timer syscall.
+ *
+ * @param next Thread running, or about to run, on this worker
+ * @param now  Current sched_clock_ns()
+ */
+void timer_reprogram(struct uthread_internal *next, uint64_t now)
+{
+    struct worker *w = t_worker;
+
+    /* The idle thread sleeps until the next deadline by itself */
+    if (!s_timer_active || !w->timer_created || next == &w->idle_thread) {
+        return;
+    }
+
+    uint64_t ns = UINT64_MAX;
+
+    /* Another worker may queue to us without a way to arm our timer */
+    if (g_scheduler.num_workers > 1 || g_scheduler.ops->nr_queued() > 0) {
+        uint64_t ran = now - next->start_time;
+        ns = (next->timeslice_remaining > ran) ?
+             next->timeslice_remaining - ran : 0;
+    }
+
+    if (g_scheduler.sleepers.count > 0) {
+        uint64_t deadline = sleep_queue_next_deadline();
+        uint64_t mono = get_time_ns();
+        uint64_t due = (deadline > mono) ? deadline - mono : 0;
+        if (due < ns) {
+            ns = due;
+        }
+    }
+
+    /* Ticks keep I/O moving while threads run without switching */
+    bool io_busy = g_io.waiting > 0 && g_io.poller == NULL;
+#ifdef UTHREAD_IO_URING
+    io_busy = io_busy || g_ring.inflight.count > 0;
+#endif
+    if (io_busy && g_scheduler.timeslice_ns < ns) {
+        ns = g_scheduler.timeslice_ns;
+    }
+
+    /* The profiler samples running threads, alone or not */
+    if (s_sample_ns != 0 && s_sample_ns < ns) {
+        ns = s_sample_ns;
+    }
+
+    if (ns == UINT64_MAX) {
+        return;
+    }
+    if (ns < TIMER_MIN_NS) {
+        ns = TIMER_MIN_NS;
+    }
+
+    /* Already due in time */
+    if (w->timer_expiry > now && w->timer_expiry <= now + ns) {
+        return;
+    }
+
+    timer_worker_arm(w, ns);
+}
+
+/**
+ * A thread became runnable without a switch: arm the timer if the running
+ * thread was alone and nothing was going to interrupt it.
+ */
+void timer_queue_changed(void)
+{
+    struct worker *w = t_worker;
+
+    if (w->timer_expiry == 0) {
+        timer_reprogram(w->current, sched_clock_ns());
+    }
+}
+#endif
+
+/**
+ * Create the preemption timer of a worker.
+ *
+ * Must be called on the worker's own kernel thread: the signal is directed
+ * at the calling thread. The timer is armed if preemption is running.
+ *
+ * @param w Worker
+ * @return 0 on success, -1 on failure
+ */
+int timer_worker_init(struct worker *w)
+{
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PREEMPT_SIGNAL;
+    sev.sigev_notify_thread_id = gettid();
+
+    if (timer_create(CLOCK_MONOTONIC, &sev, &w->timer) == -1) {
+        perror("timer_create");
+        return -1;
+    }
+    w->timer_created = true;
+
+    if (s_timer_active) {
+        timer_worker_arm(w, timer_period_ns());
+    }
+
+    return 0;
+}
+
+void timer_worker_shutdown(struct worker *w)
+{
+    if (w->timer_created) {
+        timer_delete(w->timer);
+        w->timer_created = false;
+    }
+}
+
 void timer_start(void)
 {
     if (s_timer_active) {
         return;
     }
 
+    if (timer_per_worker()) {
+        for (int i = 0; i < g_scheduler.num_workers; i++) {
+            timer_worker_arm(&g_scheduler.workers[i], timer_period_ns());
+        }
+        s_timer_active = 1;
+        return;
+    }
+
     /* Set up interval timer */
     struct itimerval itv;
-    uint64_t ns = g_scheduler.timeslice_ns;
+    uint64_t ns = timer_period_ns();
 
     /* Convert nanoseconds to seconds + microseconds */
     itv.it_interval.tv_sec = ns / 1000000000ULL;
@@ -136,6 +439,14 @@ void timer_stop(void)
         return;
     }
 
+    if (timer_per_worker()) {
+        for (int i = 0; i < g_scheduler.num_workers; i++) {
+            timer_worker_arm(&g_scheduler.workers[i], 0);
+        }
+        s_timer_active = 0;
+        return;
+    }
+
     /* Disable timer */
     struct itimerval itv;
     memset(&itv, 0, sizeof(itv));
@@ -162,15 +473,72 @@ void timer_set_interval(uint64_t ns)
     }
 }
 
+/**
+ * Set the profiler's sampling period, or with ns == 0 go back to ticking
+ * for the timeslice alone. Extra ticks only account run time until the
+ * slice is used up.
+ */
+void timer_set_sample_period(uint64_t ns)
+{
+    bool was_active = s_timer_active;
+
+    if (was_active) {
+        timer_stop();
+    }
+
+    s_sample_ns = ns;
+
+    if (was_active) {
+        timer_start();
+    }
+}
+
+/**
+ * Make a worker take a tick soon, from any kernel thread. A running
+ * thread is interrupted as if its timer fired (the tick waits if
+ * preemption is disabled), and an idle worker wakes from its wait.
+ */
+void timer_poke(struct worker *w)
+{
+    pthread_kill(w->pthread, PREEMPT_SIGNAL);
+}
+
 /* ==========================================================================
  * Preemption Control
  * ========================================================================== */
 
 void preemption_disable(void)
 {
-    /* Block SIGALRM */
+#ifndef UTHREAD_LAZY_PREEMPTION
+    /* Block PREEMPT_SIGNAL */
     sigprocmask(SIG_BLOCK, &g_scheduler.block_mask, NULL);
-    s_preemption_disabled++;
+    s_signal_blocked = 1;
+#endif
+    if (s_preemption_disabled++ == 0) {
+        sched_lock();
+    }
+
+    /* Keep the critical section after the increment */
+    atomic_signal_fence(memory_order_seq_cst);
+}
+
+/* Take a tick that arrived while preemption was disabled */
+static void preemption_run_pending(void)
+{
+    if (!s_preempt_pending) {
+        return;
+    }
+    s_preempt_pending = 0;
+
+    /* Don't preempt if in scheduler or current is in critical section */
+    struct worker *w = t_worker;
+    if (w != NULL && !w->in_scheduler) {
+        struct uthread_internal *current = w->current;
+        if (current == NULL || !current->in_critical_section) {
+            /* Same protection as the tick taken from the handler */
+            preemption_tick();
+        }
+    }
 }
 
 void preemption_enable(void)
@@ -179,24 +547,52 @@ void preemption_enable(void)
         return;
     }
 
+    atomic_signal_fence(memory_order_seq_cst);
+
+    /*
+     * Drop the scheduler lock while the depth still reads non-zero: a tick
+     * taken in between would otherwise try to lock it a second time.
+     */
+    if (s_preemption_disabled == 1) {
+        sched_unlock();
+    }
     s_preemption_disabled--;
 
     if (s_preemption_disabled == 0) {
-        /* Unblock SIGALRM */
+#ifndef UTHREAD_LAZY_PREEMPTION
+        /* Unblock PREEMPT_SIGNAL */
+        s_signal_blocked = 0;
         sigprocmask(SIG_UNBLOCK, &g_scheduler.block_mask, NULL);
+#endif
 
-        /* Check if preemption was pending */
-        if (s_preempt_pending) {
-            s_preempt_pending = 0;
+        preemption_run_pending();
+    }
+}
 
-            /* Don't preempt if in scheduler or current is in critical section */
-            if (!g_scheduler.in_scheduler) {
-                struct uthread_internal *current = g_scheduler.current;
-                if (current == NULL || !current->in_critical_section) {
-                    scheduler_tick();
-                }
-            }
-        }
+/**
+ * Keep the running thread on this worker without taking the scheduler
+ * lock: a tick that arrives meanwhile is deferred, as with preemption
+ * disabled. For a few lock-free instructions that must not migrate, such
+ * as the read-biased rwlock fast path. Nothing in between may block or
+ * call preemption_disable().
+ *
+ * @return The worker the caller is pinned to
+ */
+struct worker *preemption_pin(void)
+{
+    s_preemption_disabled++;
+    atomic_signal_fence(memory_order_seq_cst);
+    return t_worker;
+}
+
+/** End a preemption_pin() section, taking a tick deferred by it */
+void preemption_unpin(void)
+{
+    atomic_signal_fence(memory_order_seq_cst);
+    s_preemption_disabled--;
+
+    if (s_preemption_disabled == 0) {
+        preemption_run_pending();
     }
 }
 
@@ -204,3 +600,44 @@ bool preemption_is_enabled(void)
 {
     return (s_preemption_disabled == 0);
 }
+
+/**
+ * Get the preemption depth of the running thread.
+ *
+ * Called by the context switch so the depth can travel with the thread.
+ *
+ * @return Current preemption-disable depth
+ */
+int preemption_save(void)
+{
+    return s_preemption_disabled;
+}
+
+/**
+ * Restore the preemption depth of a thread that was just switched to.
+ *
+ * The register switch does not carry the signal mask, so a thread that
+ * resumes with preemption enabled unblocks the timer signal if the
+ * previous thread left it blocked. With lazy preemption the signal is never masked on
+ * purpose, so it is unblocked whatever the depth. A thread that starts
+ * with preemption enabled also releases the scheduler lock the switch
+ * was made under.
+ *
+ * @param count Preemption-disable depth saved for the resumed thread
+ */
+void preemption_restore(int count)
+{
+    if (count == 0) {
+        sched_unlock();
+    }
+    s_preemption_disabled = count;
+
+#ifdef UTHREAD_LAZY_PREEMPTION
+    if (s_signal_blocked) {
+#else
+    if (count == 0 && s_signal_blocked) {
+#endif
+        s_signal_blocked = 0;
+        sigprocmask(SIG_UNBLOCK, &g_scheduler.block_mask, NULL);
+    }
+}
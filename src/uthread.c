@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
 /* Global scheduler state */
@@ -21,18 +22,72 @@ struct scheduler_state g_scheduler = {0};
  * Library Initialization
  * ========================================================================== */
 
+/* Release the workers allocated by uthread_init_workers() */
+static void workers_free(void)
+{
+    if (g_scheduler.workers != NULL) {
+        for (int i = 0; i < g_scheduler.num_workers; i++) {
+            worker_release(&g_scheduler.workers[i]);
+        }
+        free(g_scheduler.workers);
+    }
+
+    /* The process's own thread was worker 0 */
+    workers_unbind();
+
+    g_scheduler.workers = NULL;
+    g_scheduler.num_workers = 0;
+    g_scheduler.num_nodes = 0;
+    t_worker = NULL;
+}
+
 int uthread_init(sched_policy_t policy)
+{
+    return uthread_init_workers(policy, 1);
+}
+
+int uthread_init_workers(sched_policy_t policy, int num_workers)
 {
     if (g_scheduler.initialized) {
         return UTHREAD_EINVAL;
     }
 
+#ifdef UTHREAD_COOPERATIVE
+    /* Single worker: without preemption_disable() there is no scheduler lock */
+    if (num_workers == 0) {
+        num_workers = 1;
+    } else if (num_workers > 1) {
+        return UTHREAD_EINVAL;
+    }
+#endif
+
+    if (num_workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = (cpus > 0) ? (int)cpus : 1;
+        if (num_workers > UTHREAD_MAX_WORKERS) {
+            num_workers = UTHREAD_MAX_WORKERS;
+        }
+    }
+
+    if (num_workers < 1 || num_workers > UTHREAD_MAX_WORKERS) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Only round-robin has per-worker run queues */
+    if (num_workers > 1 && policy != SCHED_ROUND_ROBIN) {
+        return UTHREAD_EINVAL;
+    }
+
+    /* Runtime accounting clock (calibrated on first init only) */
+    sched_clock_init();
+
     /* Initialize scheduler state */
     memset(&g_scheduler, 0, sizeof(g_scheduler));
     g_scheduler.policy = policy;
     g_scheduler.timeslice_ns = UTHREAD_TIMESLICE_DEFAULT_NS;
+#ifndef UTHREAD_COOPERATIVE
     g_scheduler.preemption_enabled = true;
-    g_scheduler.next_tid = 1;
+#endif
 
     /* Select scheduler implementation */
     switch (policy) {
@@ -45,55 +100,110 @@ int uthread_init(sched_policy_t policy)
     case SCHED_CFS:
         g_scheduler.ops = &sched_cfs_ops;
         break;
+    case SCHED_CFS_GROUP:
+        g_scheduler.ops = &sched_cfs_group_ops;
+        break;
     default:
         return UTHREAD_EINVAL;
     }
 
+    if (num_workers > 1) {
+        g_scheduler.ops = &sched_ws_ops;
+    }
+
+    /* Set up the workers and their idle threads (TCBs are line-aligned) */
+    size_t workers_size = (size_t)num_workers * sizeof(struct worker);
+    g_scheduler.workers = aligned_alloc(UTHREAD_CACHE_LINE, workers_size);
+    if (g_scheduler.workers == NULL) {
+        return UTHREAD_ENOMEM;
+    }
+    memset(g_scheduler.workers, 0, workers_size);
+    g_scheduler.num_workers = num_workers;
+
+    /* CPUs and NUMA nodes first: idle stacks go on their worker's node */
+    workers_place();
+
+    for (int i = 0; i < num_workers; i++) {
+        if (worker_setup(&g_scheduler.workers[i], i) != 0) {
+            workers_free();
+            return UTHREAD_ENOMEM;
+        }
+    }
+
+    /* The calling kernel thread is worker 0 */
+    struct worker *self = &g_scheduler.workers[0];
+    t_worker = self;
+    self->pthread = pthread_self();
+    worker_bind(self);
+
     /* Initialize the scheduler */
     if (g_scheduler.ops->init() != 0) {
+        workers_free();
         return UTHREAD_ENOMEM;
     }
 
-    /* Set up the idle thread */
-    memset(&g_scheduler.idle_thread, 0, sizeof(g_scheduler.idle_thread));
-    g_scheduler.idle_thread.tid = 0;
-    g_scheduler.idle_thread.state = UTHREAD_STATE_READY;
-    strncpy(g_scheduler.idle_thread.name, "idle", UTHREAD_NAME_MAX - 1);
+    /* Table of all threads, sized for UTHREAD_MAX_THREADS to start */
+    if (registry_init() != 0) {
+        g_scheduler.ops->shutdown();
+        workers_free();
+        return UTHREAD_ENOMEM;
+    }
 
     /* Initialize main thread as the first user thread */
     struct uthread_internal *main_thread = thread_alloc();
     if (main_thread == NULL) {
+        registry_destroy();
         g_scheduler.ops->shutdown();
+        workers_free();
         return UTHREAD_ENOMEM;
     }
 
-    main_thread->tid = g_scheduler.next_tid++;
     main_thread->state = UTHREAD_STATE_RUNNING;
     main_thread->priority = UTHREAD_PRIORITY_DEFAULT;
     main_thread->nice = 0;
     main_thread->weight = CFS_NICE_0_WEIGHT;
-    main_thread->detached = false;
-    strncpy(main_thread->name, "main", UTHREAD_NAME_MAX - 1);
+    main_thread->timeslice_remaining = g_scheduler.timeslice_ns;
+    main_thread->cold->detached = false;
+    strncpy(main_thread->cold->name, "main", UTHREAD_NAME_MAX - 1);
+
+    /* Main stays on the process's own thread so shutdown runs there */
+    main_thread->worker = self;
+    main_thread->pinned = true;
 
     /* Get the current context for main thread */
-    if (getcontext(&main_thread->context) == -1) {
+    if (context_init_self(main_thread) == -1) {
         thread_free(main_thread);
+        registry_destroy();
         g_scheduler.ops->shutdown();
+        workers_free();
         return UTHREAD_ENOMEM;
     }
 
     /* Main thread uses the process stack, so no separate allocation */
-    main_thread->stack_base = NULL;
-    main_thread->stack_size = 0;
+    main_thread->cold->stack_base = NULL;
+    main_thread->cold->stack_size = 0;
 
-    /* Set as current thread */
-    g_scheduler.current = main_thread;
-    scheduler_add_thread(main_thread);
+    /* Set as current thread; the empty registry gives it tid 1 */
+    main_thread->start_time = sched_clock_ns();
+    self->current = main_thread;
+    registry_add(main_thread);
+
+    /* Growable stacks are extended from SIGSEGV */
+    if (stack_fault_init() != 0) {
+        thread_free(main_thread);
+        registry_destroy();
+        g_scheduler.ops->shutdown();
+        workers_free();
+        return UTHREAD_ENOMEM;
+    }
 
     /* Initialize the timer for preemption */
     if (timer_init() != 0) {
+        stack_fault_shutdown();
         thread_free(main_thread);
+        registry_destroy();
         g_scheduler.ops->shutdown();
+        workers_free();
         return UTHREAD_ENOMEM;
     }
 
@@ -102,8 +212,15 @@ int uthread_init(sched_policy_t policy)
     /* Start the preemption timer */
     timer_start();
 
-    UTHREAD_DEBUG("Library initialized with %s scheduler",
-                  g_scheduler.ops->name());
+    /* Start the additional kernel threads */
+    int ret = workers_start();
+    if (ret != 0) {
+        uthread_shutdown();
+        return ret;
+    }
+
+    UTHREAD_DEBUG("Library initialized with %s scheduler, %d worker(s)",
+                  g_scheduler.ops->name(), num_workers);
 
     return UTHREAD_SUCCESS;
 }
@@ -114,24 +231,42 @@ void uthread_shutdown(void)
         return;
     }
 
+    /* The endpoint pokes the workers, so it goes before they do */
+    introspect_shutdown();
+
+    /* Let the other workers finish their current thread and exit */
+    workers_stop();
+    stack_fault_shutdown();
+
     /* Stop preemption */
     timer_stop();
     timer_shutdown();
 
+    /* Cancel outstanding I/O before the stacks it targets go away */
+    io_shutdown();
+
     /* Clean up all threads */
-    for (int i = 0; i < UTHREAD_MAX_THREADS; i++) {
-        struct uthread_internal *t = g_scheduler.all_threads[i];
-        if (t != NULL) {
-            thread_free(t);
-            g_scheduler.all_threads[i] = NULL;
-        }
+    while (g_scheduler.threads.live != NULL) {
+        struct uthread_internal *t = g_scheduler.threads.live;
+        registry_remove(t);
+        thread_free(t);
     }
+    thread_reap_zombies();
+    task_shutdown();
 
     /* Shutdown scheduler */
     if (g_scheduler.ops != NULL) {
         g_scheduler.ops->shutdown();
     }
 
+    registry_destroy();
+
+    trace_shutdown();
+    profile_shutdown();
+    workers_free();
+    pool_drain();
+    arena_drain();
+
     g_scheduler.initialized = false;
 
     UTHREAD_DEBUG("Library shutdown complete");
@@ -166,6 +301,9 @@ int uthread_create(uthread_t *thread,
 
     preemption_disable();
 
+    /* Release detached threads that exited since the last create */
+    thread_reap_zombies();
+
     /* Allocate thread structure */
     struct uthread_internal *t = thread_alloc();
     if (t == NULL) {
@@ -173,55 +311,79 @@ int uthread_create(uthread_t *thread,
         return UTHREAD_ENOMEM;
     }
 
-    /* Set thread ID */
-    t->tid = g_scheduler.next_tid++;
-
     /* Set up from attributes or defaults */
     size_t stack_size = UTHREAD_STACK_DEFAULT;
     if (attr != NULL) {
         if (attr->stack_size >= UTHREAD_STACK_MIN) {
             stack_size = attr->stack_size;
         }
+        if (attr->affinity != 0) {
+            /* Only bits of workers that exist count */
+            uint64_t valid = (g_scheduler.num_workers >= 64) ? ~UINT64_C(0) :
+                             (UINT64_C(1) << g_scheduler.num_workers) - 1;
+            t->affinity = attr->affinity & valid;
+            if (t->affinity == 0) {
+                thread_free(t);
+                preemption_enable();
+                return UTHREAD_EINVAL;
+            }
+        }
         t->priority = attr->priority;
         t->nice = attr->nice;
-        t->detached = (attr->detach_state == UTHREAD_CREATE_DETACHED);
+        t->cold->detached = (attr->detach_state == UTHREAD_CREATE_DETACHED);
         if (attr->name[0] != '\0') {
-            strncpy(t->name, attr->name, UTHREAD_NAME_MAX - 1);
+            strncpy(t->cold->name, attr->name, UTHREAD_NAME_MAX - 1);
         }
     } else {
         t->priority = UTHREAD_PRIORITY_DEFAULT;
         t->nice = 0;
-        t->detached = false;
+        t->cold->detached = false;
     }
 
     /* Calculate CFS weight */
     t->weight = nice_to_weight(t->nice);
+    sched_group_join(t, attr != NULL ? attr->group : NULL);
+
+    /* Queue it where it may run, with its stack on that worker's node */
+    struct worker *home = worker_home(t);
+    if (home != t_worker) {
+        t->worker = home;
+    }
 
     /* Allocate stack */
-    if (thread_setup_stack(t, stack_size) != 0) {
+    if (thread_setup_stack(t, stack_size, home->node) != 0) {
         thread_free(t);
         preemption_enable();
         return UTHREAD_ENOMEM;
     }
 
     /* Set entry point */
-    t->start_routine = start;
-    t->arg = arg;
+    t->cold->start_routine = start;
+    t->cold->arg = arg;
     t->state = UTHREAD_STATE_READY;
 
     /* Initialize context */
     context_init(t);
 
-    /* Add to scheduler */
-    scheduler_add_thread(t);
+    /* Register (assigns the tid) and make runnable */
+    int ret = registry_add(t);
+    if (ret != UTHREAD_SUCCESS) {
+        thread_free(t);
+        preemption_enable();
+        return ret;
+    }
+    if (__builtin_expect(g_contention.enabled, 0)) {
+        t->state_since = sched_clock_ns();
+    }
     g_scheduler.ops->enqueue(t);
+    timer_queue_changed();
 
     g_scheduler.total_threads_created++;
 
     *thread = t;
 
     UTHREAD_DEBUG("Created thread %d '%s' (stack=%zu, priority=%d)",
-                  t->tid, t->name, t->stack_size, t->priority);
+                  t->tid, t->cold->name, t->cold->stack_size, t->priority);
 
     preemption_enable();
 
@@ -235,7 +397,7 @@ int uthread_join(uthread_t thread, void **retval)
     }
 
     struct uthread_internal *t = (struct uthread_internal *)thread;
-    struct uthread_internal *self = g_scheduler.current;
+    struct uthread_internal *self = CURRENT_THREAD();
 
     /* Cannot join self */
     if (t == self) {
@@ -243,22 +405,28 @@ int uthread_join(uthread_t thread, void **retval)
     }
 
     /* Cannot join detached thread */
-    if (t->detached) {
+    if (t->cold->detached) {
         return UTHREAD_EINVAL;
     }
 
     preemption_disable();
 
+    /* Handle of a thread that was already joined or released */
+    if (!registry_contains(t)) {
+        preemption_enable();
+        return UTHREAD_ESRCH;
+    }
+
     /* Check if already joined by another thread */
-    if (t->joiner != NULL && t->joiner != self) {
+    if (t->cold->joiner != NULL && t->cold->joiner != self) {
         preemption_enable();
         return UTHREAD_EINVAL;
     }
 
     /* If thread hasn't exited yet, block */
     while (!t->exited) {
-        t->joiner = self;
-        self->waiting_on = t;
+        t->cold->joiner = self;
+        self->cold->waiting_on = t;
         self->state = UTHREAD_STATE_BLOCKED;
 
         /* Schedule another thread */
@@ -269,11 +437,11 @@ int uthread_join(uthread_t thread, void **retval)
 
     /* Thread has exited, get return value */
     if (retval != NULL) {
-        *retval = t->retval;
+        *retval = t->cold->retval;
     }
 
     /* Clean up the thread */
-    scheduler_remove_thread(t);
+    registry_remove(t);
     thread_free(t);
 
     preemption_enable();
@@ -291,21 +459,26 @@ int uthread_detach(uthread_t thread)
 
     preemption_disable();
 
-    if (t->detached) {
+    if (!registry_contains(t)) {
+        preemption_enable();
+        return UTHREAD_ESRCH;
+    }
+
+    if (t->cold->detached) {
         preemption_enable();
         return UTHREAD_EINVAL;
     }
 
-    if (t->joiner != NULL) {
+    if (t->cold->joiner != NULL) {
         preemption_enable();
         return UTHREAD_EINVAL;
     }
 
-    t->detached = true;
+    t->cold->detached = true;
 
     /* If thread already exited, clean up now */
     if (t->exited) {
-        scheduler_remove_thread(t);
+        registry_remove(t);
         thread_free(t);
     }
 
@@ -322,7 +495,7 @@ void uthread_yield(void)
 
     preemption_disable();
 
-    struct uthread_internal *self = g_scheduler.current;
+    struct uthread_internal *self = CURRENT_THREAD();
     if (self != NULL) {
         g_scheduler.ops->on_yield(self);
         scheduler_yield();
@@ -331,6 +504,41 @@ void uthread_yield(void)
     preemption_enable();
 }
 
+int uthread_yield_to(uthread_t thread)
+{
+    if (!g_scheduler.initialized || thread == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    struct uthread_internal *t = (struct uthread_internal *)thread;
+
+    preemption_disable();
+
+    struct uthread_internal *self = CURRENT_THREAD();
+    if (self == NULL || t == self) {
+        preemption_enable();
+        return UTHREAD_EINVAL;
+    }
+
+    if (!registry_contains(t)) {
+        preemption_enable();
+        return UTHREAD_ESRCH;
+    }
+
+    int result = 0;
+    g_scheduler.ops->on_yield(self);
+    if (t->state == UTHREAD_STATE_READY &&
+        thread_allowed_on(t, t_worker)) {
+        scheduler_yield_to(t);
+    } else {
+        result = UTHREAD_EAGAIN;
+        scheduler_yield();
+    }
+
+    preemption_enable();
+    return result;
+}
+
 void uthread_exit(void *retval)
 {
     if (!g_scheduler.initialized) {
@@ -339,42 +547,55 @@ void uthread_exit(void *retval)
 
     preemption_disable();
 
-    struct uthread_internal *self = g_scheduler.current;
+    struct uthread_internal *self = CURRENT_THREAD();
     if (self == NULL) {
         preemption_enable();
         exit(0);
     }
 
-    UTHREAD_DEBUG("Thread %d '%s' exiting", self->tid, self->name);
+    UTHREAD_DEBUG("Thread %d '%s' exiting", self->tid, self->cold->name);
+
+    /* Tasks complete into this TCB: let them finish first */
+    task_group_sync(&self->cold->tasks);
 
     /* Run cleanup handlers in reverse order */
-    while (self->cleanup_count > 0) {
-        self->cleanup_count--;
-        if (self->cleanup_handlers[self->cleanup_count] != NULL) {
-            self->cleanup_handlers[self->cleanup_count](
-                self->cleanup_args[self->cleanup_count]);
+    while (self->cold->cleanup_count > 0) {
+        self->cold->cleanup_count--;
+        if (self->cold->cleanup_handlers[self->cold->cleanup_count] != NULL) {
+            self->cold->cleanup_handlers[self->cold->cleanup_count](
+                self->cold->cleanup_args[self->cold->cleanup_count]);
         }
     }
 
     /* Store return value */
-    self->retval = retval;
+    self->cold->retval = retval;
     self->exited = true;
     self->state = UTHREAD_STATE_TERMINATED;
 
-    /* Remove from run queue */
+    /* Remove from run queue, and from any worker's hand-off hint */
     g_scheduler.ops->remove(self);
+    scheduler_forget_handoff(self);
+    sched_group_leave(self);
 
     /* Wake up joiner if any */
-    if (self->joiner != NULL) {
-        self->joiner->waiting_on = NULL;
-        self->joiner->state = UTHREAD_STATE_READY;
-        g_scheduler.ops->enqueue(self->joiner);
+    if (self->cold->joiner != NULL) {
+        trace_record(TRACE_UNBLOCK, self->cold->joiner->tid, self->tid);
+        if (__builtin_expect(g_contention.enabled, 0)) {
+            thread_stats_wake(self->cold->joiner);
+        }
+        self->cold->joiner->cold->waiting_on = NULL;
+        self->cold->joiner->state = UTHREAD_STATE_READY;
+        g_scheduler.ops->enqueue(self->cold->joiner);
     }
 
-    /* If detached, schedule cleanup */
-    if (self->detached) {
-        scheduler_remove_thread(self);
-        thread_free(self);
+    /*
+     * If detached, schedule cleanup. We are still running on our own
+     * stack, so the next uthread_create() releases it after we're gone.
+     */
+    if (self->cold->detached) {
+        registry_remove(self);
+        self->next = g_scheduler.zombies;
+        g_scheduler.zombies = self;
     }
 
     /* Schedule next thread (never returns) */
@@ -390,7 +611,7 @@ uthread_t uthread_self(void)
     if (!g_scheduler.initialized) {
         return NULL;
     }
-    return (uthread_t)g_scheduler.current;
+    return (uthread_t)CURRENT_THREAD();
 }
 
 int uthread_equal(uthread_t t1, uthread_t t2)
@@ -404,16 +625,12 @@ void uthread_sleep(unsigned int milliseconds)
         return;
     }
 
-    /*
-     * Simple implementation: busy-yield until time elapsed.
-     * A better implementation would use a sleep queue.
-     */
-    uint64_t start = get_time_ns();
-    uint64_t target = start + (uint64_t)milliseconds * 1000000ULL;
+    uint64_t deadline = get_time_ns() + (uint64_t)milliseconds * 1000000ULL;
 
-    while (get_time_ns() < target) {
-        uthread_yield();
-    }
+    /* Park on the sleep queue; the scheduler wakes us at the deadline */
+    preemption_disable();
+    scheduler_block_until(NULL, deadline);
+    preemption_enable();
 }
 
 int uthread_get_tid(uthread_t thread)
@@ -432,8 +649,8 @@ int uthread_setname(uthread_t thread, const char *name)
     }
 
     struct uthread_internal *t = (struct uthread_internal *)thread;
-    strncpy(t->name, name, UTHREAD_NAME_MAX - 1);
-    t->name[UTHREAD_NAME_MAX - 1] = '\0';
+    strncpy(t->cold->name, name, UTHREAD_NAME_MAX - 1);
+    t->cold->name[UTHREAD_NAME_MAX - 1] = '\0';
 
     return UTHREAD_SUCCESS;
 }
@@ -445,7 +662,7 @@ int uthread_getname(uthread_t thread, char *name, size_t len)
     }
 
     struct uthread_internal *t = (struct uthread_internal *)thread;
-    strncpy(name, t->name, len - 1);
+    strncpy(name, t->cold->name, len - 1);
     name[len - 1] = '\0';
 
     return UTHREAD_SUCCESS;
@@ -551,6 +768,26 @@ int uthread_attr_getnice(const uthread_attr_t *attr, int *nice)
     return UTHREAD_SUCCESS;
 }
 
+int uthread_attr_setgroup(uthread_attr_t *attr, uthread_group_t group)
+{
+    if (attr == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    attr->group = group;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_attr_getgroup(const uthread_attr_t *attr, uthread_group_t *group)
+{
+    if (attr == NULL || group == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    *group = attr->group;
+    return UTHREAD_SUCCESS;
+}
+
 int uthread_attr_setdetachstate(uthread_attr_t *attr, int detachstate)
 {
     if (attr == NULL) {
@@ -576,6 +813,26 @@ int uthread_attr_getdetachstate(const uthread_attr_t *attr, int *detachstate)
     return UTHREAD_SUCCESS;
 }
 
+int uthread_attr_setaffinity(uthread_attr_t *attr, uint64_t workers)
+{
+    if (attr == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    attr->affinity = workers;
+    return UTHREAD_SUCCESS;
+}
+
+int uthread_attr_getaffinity(const uthread_attr_t *attr, uint64_t *workers)
+{
+    if (attr == NULL || workers == NULL) {
+        return UTHREAD_EINVAL;
+    }
+
+    *workers = attr->affinity;
+    return UTHREAD_SUCCESS;
+}
+
 int uthread_attr_setname(uthread_attr_t *attr, const char *name)
 {
     if (attr == NULL) {
@@ -598,7 +855,11 @@ int uthread_attr_setname(uthread_attr_t *attr, const char *name)
 
 struct uthread_internal *thread_alloc(void)
 {
-    struct uthread_internal *t = calloc(1, sizeof(struct uthread_internal));
+    /* Reuse a cached TCB when one is available */
+    struct uthread_internal *t = tcb_pool_get();
+    if (t == NULL) {
+        t = tcb_alloc();
+    }
     if (t == NULL) {
         return NULL;
     }
@@ -617,60 +878,91 @@ void thread_free(struct uthread_internal *thread)
         return;
     }
 
+    /* A thread that never exited still holds its arena */
+    arena_thread_release(thread);
+    sched_group_leave(thread);
+
+    thread_release_stack(thread);
+    if (!tcb_pool_put(thread)) {
+        tcb_free(thread);
+    }
+}
+
+void thread_release_stack(struct uthread_internal *thread)
+{
     /* Free the stack if we allocated one */
-    if (thread->stack_base != NULL) {
-        /* If we used mmap with guard page, unmap the whole region */
-        if (thread->stack_guard != NULL) {
-            munmap(thread->stack_guard, thread->stack_size + UTHREAD_GUARD_SIZE);
+    if (thread->cold->stack_base != NULL) {
+        /* Cache mmap'd stacks for reuse, or unmap the whole region */
+        if (thread->cold->stack_guard != NULL) {
+            stack_discard_pages(thread);
+            if (!stack_pool_put(thread->cold->stack_guard, thread->cold->stack_size,
+                                thread->cold->stack_node)) {
+                munmap(thread->cold->stack_guard, stack_reserve_size(thread->cold->stack_size) +
+                       UTHREAD_GUARD_SIZE);
+            }
         } else {
-            free(thread->stack_base);
+            free(thread->cold->stack_base);
         }
     }
 
-    free(thread);
+    thread->cold->stack_base = NULL;
+    thread->cold->stack_guard = NULL;
+    thread->cold->stack_limit = NULL;
+    thread->cold->stack_size = 0;
 }
 
-int thread_setup_stack(struct uthread_internal *thread, size_t size)
+int thread_setup_stack(struct uthread_internal *thread, size_t size, int node)
 {
     /*
      * Allocate stack with guard page for overflow detection.
      *
      * Memory layout:
-     * [guard page (PROT_NONE)] [usable stack]
+     * [guard page (PROT_NONE)] [growth room (PROT_NONE)] [usable stack]
      *
-     * Stack grows down, so guard page is at the low address.
+     * Stack grows down, so guard page is at the low address. The growth
+     * room is only there in UTHREAD_STACK_GROWABLE mode.
+     * Stacks released earlier are reused from the pool when one of the
+     * same size is cached on the same NUMA node.
      */
-    size_t total_size = size + UTHREAD_GUARD_SIZE;
+    size = stack_round_size(size);
 
-    void *region = mmap(NULL, total_size,
-                        PROT_READ | PROT_WRITE,
-                        MAP_PRIVATE | MAP_ANONYMOUS,
-                        -1, 0);
+    void *region = stack_pool_get(size, node);
+    if (region == NULL) {
+        region = stack_map(size, false, node);
+    }
+    thread->cold->stack_node = node;
 
-    if (region == MAP_FAILED) {
+    if (region == NULL) {
         /* Fall back to simple allocation without guard */
-        thread->stack_base = aligned_alloc(16, size);
-        if (thread->stack_base == NULL) {
+        thread->cold->stack_base = aligned_alloc(16, size);
+        if (thread->cold->stack_base == NULL) {
             return UTHREAD_ENOMEM;
         }
-        thread->stack_size = size;
-        thread->stack_guard = NULL;
+        thread->cold->stack_size = size;
+        thread->cold->stack_guard = NULL;
+        thread->cold->stack_limit = thread->cold->stack_base;
         return UTHREAD_SUCCESS;
     }
 
-    /* Set up guard page (no access) */
-    if (mprotect(region, UTHREAD_GUARD_SIZE, PROT_NONE) == -1) {
-        munmap(region, total_size);
-        return UTHREAD_ENOMEM;
-    }
-
-    thread->stack_guard = region;
-    thread->stack_base = (char *)region + UTHREAD_GUARD_SIZE;
-    thread->stack_size = size;
+    /* A growable stack's usable part is the top of a larger reservation */
+    thread->cold->stack_guard = region;
+    thread->cold->stack_base = (char *)region + UTHREAD_GUARD_SIZE +
+                         (stack_reserve_size(size) - size);
+    thread->cold->stack_size = size;
+    thread->cold->stack_limit = thread->cold->stack_base;
 
     return UTHREAD_SUCCESS;
 }
 
+void thread_reap_zombies(void)
+{
+    while (g_scheduler.zombies != NULL) {
+        struct uthread_internal *t = g_scheduler.zombies;
+        g_scheduler.zombies = t->next;
+        thread_free(t);
+    }
+}
+
 void thread_cleanup(struct uthread_internal *thread)
 {
     if (thread == NULL) {
@@ -678,15 +970,34 @@ void thread_cleanup(struct uthread_internal *thread)
     }
 
     /* Run cleanup handlers */
-    while (thread->cleanup_count > 0) {
-        thread->cleanup_count--;
-        if (thread->cleanup_handlers[thread->cleanup_count] != NULL) {
-            thread->cleanup_handlers[thread->cleanup_count](
-                thread->cleanup_args[thread->cleanup_count]);
+    while (thread->cold->cleanup_count > 0) {
+        thread->cold->cleanup_count--;
+        if (thread->cold->cleanup_handlers[thread->cold->cleanup_count] != NULL) {
+            thread->cold->cleanup_handlers[thread->cold->cleanup_count](
+                thread->cold->cleanup_args[thread->cold->cleanup_count]);
         }
     }
 }
 
+/**
+ * Queue a handler to run when `thread` exits, before those queued
+ * earlier. Called with preemption disabled.
+ *
+ * @return 0 on success, UTHREAD_EAGAIN if all UTHREAD_CLEANUP_MAX slots are used
+ */
+int thread_cleanup_push(struct uthread_internal *thread, void (*handler)(void *), void *arg)
+{
+    if (thread->cold->cleanup_count >= UTHREAD_CLEANUP_MAX) {
+        return UTHREAD_EAGAIN;
+    }
+
+    thread->cold->cleanup_handlers[thread->cold->cleanup_count] = handler;
+    thread->cold->cleanup_args[thread->cold->cleanup_count] = arg;
+    thread->cold->cleanup_count++;
+
+    return UTHREAD_SUCCESS;
+}
+
 /* ==========================================================================
  * Scheduler Control
  * ========================================================================== */
@@ -697,7 +1008,7 @@ int uthread_set_timeslice(uint64_t ns)
         return UTHREAD_EINVAL;
     }
 
-    if (ns < 1000000) {  /* Minimum 1ms */
+    if (ns < TIMESLICE_MIN_NS) {
         return UTHREAD_EINVAL;
     }
 
@@ -716,6 +1027,11 @@ uint64_t uthread_get_timeslice(void)
 
 bool uthread_set_preemption(bool enable)
 {
+#ifdef UTHREAD_COOPERATIVE
+    /* Built without the timer: threads only switch when they call in */
+    (void)enable;
+    return false;
+#else
     bool old = g_scheduler.preemption_enabled;
     g_scheduler.preemption_enabled = enable;
 
@@ -726,6 +1042,7 @@ bool uthread_set_preemption(bool enable)
     }
 
     return old;
+#endif
 }
 
 int uthread_setpriority(uthread_t thread, int priority)
@@ -774,7 +1091,6 @@ int uthread_setnice(uthread_t thread, int nice)
 
     preemption_disable();
     t->nice = nice;
-    t->weight = nice_to_weight(nice);
     g_scheduler.ops->update_priority(t);
     preemption_enable();
 
@@ -806,22 +1122,44 @@ int uthread_get_stats(uthread_stats_t *stats)
     preemption_disable();
 
     stats->total_threads = g_scheduler.total_threads_created;
-    stats->active_threads = g_scheduler.thread_count;
+    stats->active_threads = g_scheduler.threads.count;
     stats->context_switches = g_scheduler.context_switches;
     stats->scheduler_invocations = g_scheduler.scheduler_invocations;
     stats->total_runtime_ns = g_scheduler.total_runtime_ns;
+    stats->timer_ticks = g_scheduler.scheduler_ticks;
+    stats->stack_cache_hits = g_thread_pool.stack_hits;
+    stats->stack_cache_misses = g_thread_pool.stack_misses;
+    stats->tcb_cache_hits = g_thread_pool.tcb_hits;
+    stats->tcb_cache_misses = g_thread_pool.tcb_misses;
+    stats->stack_growths = g_thread_pool.stack_growths;
+    stats->tasks_completed = g_tasks.completed;
+    stats->task_promotions = g_tasks.promotions;
+
+    stats->work_steals = 0;
+    stats->cross_node_steals = 0;
+    stats->direct_handoffs = 0;
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        stats->work_steals += g_scheduler.workers[i].steals;
+        stats->cross_node_steals += g_scheduler.workers[i].remote_steals;
+        stats->direct_handoffs += g_scheduler.workers[i].handoffs;
+    }
+
+#ifdef UTHREAD_IO_URING
+    stats->io_ring_requests = g_ring.requests;
+    stats->io_ring_enters = g_ring.enters;
+#else
+    stats->io_ring_requests = 0;
+    stats->io_ring_enters = 0;
+#endif
 
     /* Count ready and blocked threads */
     stats->ready_threads = 0;
     stats->blocked_threads = 0;
-    for (int i = 0; i < UTHREAD_MAX_THREADS; i++) {
-        struct uthread_internal *t = g_scheduler.all_threads[i];
-        if (t != NULL) {
-            if (t->state == UTHREAD_STATE_READY) {
-                stats->ready_threads++;
-            } else if (t->state == UTHREAD_STATE_BLOCKED) {
-                stats->blocked_threads++;
-            }
+    REGISTRY_FOREACH(t) {
+        if (t->state == UTHREAD_STATE_READY) {
+            stats->ready_threads++;
+        } else if (t->state == UTHREAD_STATE_BLOCKED) {
+            stats->blocked_threads++;
         }
     }
 
@@ -836,6 +1174,24 @@ void uthread_reset_stats(void)
     g_scheduler.context_switches = 0;
     g_scheduler.scheduler_invocations = 0;
     g_scheduler.total_runtime_ns = 0;
+    g_scheduler.scheduler_ticks = 0;
+    g_thread_pool.stack_hits = 0;
+    g_thread_pool.stack_misses = 0;
+    g_thread_pool.tcb_hits = 0;
+    g_thread_pool.tcb_misses = 0;
+    g_thread_pool.stack_growths = 0;
+    g_tasks.completed = 0;
+    g_tasks.promotions = 0;
+    contention_stats_reset();
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        g_scheduler.workers[i].steals = 0;
+        g_scheduler.workers[i].remote_steals = 0;
+        g_scheduler.workers[i].handoffs = 0;
+    }
+#ifdef UTHREAD_IO_URING
+    g_ring.requests = 0;
+    g_ring.enters = 0;
+#endif
     preemption_enable();
 }
 
@@ -847,25 +1203,22 @@ void uthread_debug_dump(void)
     fprintf(stderr, "Scheduler: %s\n", g_scheduler.ops->name());
     fprintf(stderr, "Timeslice: %lu ns\n", (unsigned long)g_scheduler.timeslice_ns);
     fprintf(stderr, "Total threads created: %d\n", g_scheduler.total_threads_created);
-    fprintf(stderr, "Active threads: %d\n", g_scheduler.thread_count);
+    fprintf(stderr, "Active threads: %d\n", g_scheduler.threads.count);
     fprintf(stderr, "Context switches: %lu\n", (unsigned long)g_scheduler.context_switches);
     fprintf(stderr, "\nThread list:\n");
 
-    for (int i = 0; i < UTHREAD_MAX_THREADS; i++) {
-        struct uthread_internal *t = g_scheduler.all_threads[i];
-        if (t != NULL) {
-            const char *state_str;
-            switch (t->state) {
-            case UTHREAD_STATE_READY: state_str = "READY"; break;
-            case UTHREAD_STATE_RUNNING: state_str = "RUNNING"; break;
-            case UTHREAD_STATE_BLOCKED: state_str = "BLOCKED"; break;
-            case UTHREAD_STATE_TERMINATED: state_str = "TERMINATED"; break;
-            default: state_str = "UNKNOWN"; break;
-            }
-
-            fprintf(stderr, "  [%d] '%s' state=%s priority=%d nice=%d\n",
-                    t->tid, t->name, state_str, t->priority, t->nice);
+    REGISTRY_FOREACH(t) {
+        const char *state_str;
+        switch (t->state) {
+        case UTHREAD_STATE_READY: state_str = "READY"; break;
+        case UTHREAD_STATE_RUNNING: state_str = "RUNNING"; break;
+        case UTHREAD_STATE_BLOCKED: state_str = "BLOCKED"; break;
+        case UTHREAD_STATE_TERMINATED: state_str = "TERMINATED"; break;
+        default: state_str = "UNKNOWN"; break;
         }
+
+        fprintf(stderr, "  [%d] '%s' state=%s priority=%d nice=%d\n",
+                t->tid, t->cold->name, state_str, t->priority, t->nice);
     }
 
     fprintf(stderr, "==========================\n\n");
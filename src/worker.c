@@ -0,0 +1,505 @@
+/**
+ * LibUThread Workers
+ *
+ * Kernel threads that run user threads. In the default 1:N mode the
+ * thread that called uthread_init() is the only worker. In M:N mode
+ * (uthread_init_workers() with more than one worker) additional pthreads
+ * are started; each runs its own idle thread and takes user threads from
+ * the work-stealing run queues.
+ *
+ * M:N workers are pinned to CPUs, grouped by NUMA node as read from
+ * sysfs, so that stack placement and same-node stealing stay meaningful.
+ *
+ * @file worker.c
+ */
+
+#define _GNU_SOURCE
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Worker of the calling kernel thread */
+_Thread_local struct worker *t_worker = NULL;
+
+/* ==========================================================================
+ * Idle Wakeup
+ * ========================================================================== */
+
+static long futex(atomic_uint *uaddr, int op, unsigned int val,
+                  const struct timespec *timeout)
+{
+    return syscall(SYS_futex, (unsigned int *)uaddr, op, val, timeout,
+                   NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+/**
+ * Wake a worker waiting in worker_wait() or io_idle_wait().
+ *
+ * @param w Worker to wake
+ */
+void worker_kick(struct worker *w)
+{
+    atomic_fetch_add_explicit(&w->wake_seq, 1, memory_order_release);
+    futex(&w->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+    io_kick(w);
+}
+
+/**
+ * Wake one idle worker, if any, so it looks for work.
+ *
+ * Called with the scheduler lock held.
+ */
+void worker_kick_idle(void)
+{
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (w->idle) {
+            w->idle = false;
+            worker_kick(w);
+            return;
+        }
+    }
+}
+
+/**
+ * Put the kernel thread to sleep until kicked, a signal arrives or the
+ * deadline passes. Must be called with preemption enabled.
+ *
+ * @param w        Calling worker
+ * @param seq      Value of wake_seq read before the run queues were found
+ *                 empty; a kick since then makes this return at once
+ * @param deadline Absolute CLOCK_MONOTONIC time in ns, or 0 for none
+ */
+void worker_wait(struct worker *w, unsigned int seq, uint64_t deadline)
+{
+    struct timespec ts;
+    struct timespec *timeout = NULL;
+
+    if (deadline != 0) {
+        ts.tv_sec = (time_t)(deadline / 1000000000ULL);
+        ts.tv_nsec = (long)(deadline % 1000000000ULL);
+        timeout = &ts;
+    }
+
+    /* Absolute timeout on CLOCK_MONOTONIC */
+    futex(&w->wake_seq, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, seq, timeout);
+}
+
+/**
+ * Wake an idle worker allowed to run `thread`, one on the node of the
+ * worker it was queued on first.
+ *
+ * Called with the scheduler lock held.
+ */
+void worker_kick_idle_for(const struct uthread_internal *thread)
+{
+    struct worker *pick = NULL;
+    int node = (thread->rq_worker != NULL) ? thread->rq_worker->node : 0;
+
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (!w->idle || !thread_allowed_on(thread, w)) {
+            continue;
+        }
+        if (pick == NULL || w->node == node) {
+            pick = w;
+        }
+        if (w->node == node) {
+            break;
+        }
+    }
+
+    if (pick != NULL) {
+        pick->idle = false;
+        worker_kick(pick);
+    }
+}
+
+/* ==========================================================================
+ * CPU and NUMA Placement
+ * ========================================================================== */
+
+/* Pin M:N workers to CPUs (uthread_set_worker_pinning()) */
+static bool s_pin_workers = true;
+
+/* Affinity of the process's own thread before it was pinned as worker 0 */
+static cpu_set_t s_main_cpus;
+static bool s_main_pinned;
+
+/* NUMA node of every CPU, and the allowed CPUs ordered by node */
+static short s_cpu_node[CPU_SETSIZE];
+static int s_cpus[CPU_SETSIZE];
+
+/* Fill s_cpu_node from the cpulist of each /sys/devices/system/node/nodeN */
+static void topology_read(void)
+{
+    memset(s_cpu_node, 0, sizeof(s_cpu_node));
+
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int node;
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+
+        /* Ranges like "0-3,8-11" */
+        int lo, hi;
+        while (fscanf(f, "%d", &lo) == 1) {
+            hi = lo;
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%d", &hi) != 1) {
+                    break;
+                }
+                c = fgetc(f);
+            }
+            for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+                if (cpu >= 0) {
+                    s_cpu_node[cpu] = (short)node;
+                }
+            }
+            if (c != ',') {
+                break;
+            }
+        }
+        fclose(f);
+    }
+
+    closedir(dir);
+}
+
+static int cpu_compare(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+
+    if (s_cpu_node[x] != s_cpu_node[y]) {
+        return s_cpu_node[x] - s_cpu_node[y];
+    }
+    return x - y;
+}
+
+/**
+ * Choose a CPU and NUMA node for every worker.
+ *
+ * Workers take the process's allowed CPUs in node order, wrapping around
+ * when there are more workers than CPUs, so a node fills up before the
+ * next one is used. In 1:N mode, or with pinning off, no worker is
+ * pinned and all count as node 0.
+ */
+void workers_place(void)
+{
+    int n = g_scheduler.num_workers;
+
+    for (int i = 0; i < n; i++) {
+        g_scheduler.workers[i].cpu = -1;
+        g_scheduler.workers[i].node = 0;
+    }
+    g_scheduler.num_nodes = 1;
+
+    cpu_set_t allowed;
+    if (n <= 1 || !s_pin_workers || sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    topology_read();
+
+    int count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            s_cpus[count++] = cpu;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    qsort(s_cpus, (size_t)count, sizeof(s_cpus[0]), cpu_compare);
+
+    int nodes = 0;
+    for (int i = 0; i < n; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        w->cpu = s_cpus[i % count];
+        w->node = s_cpu_node[w->cpu];
+
+        bool seen = false;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = g_scheduler.workers[j].node == w->node;
+        }
+        if (!seen) {
+            nodes++;
+        }
+    }
+    g_scheduler.num_nodes = nodes;
+}
+
+/**
+ * Pin the calling kernel thread to its worker's CPU, if it has one.
+ * Worker 0's previous affinity is kept for workers_unbind().
+ *
+ * @param w Calling worker
+ */
+void worker_bind(struct worker *w)
+{
+    if (w->cpu < 0) {
+        return;
+    }
+
+    if (w->id == 0 && !s_main_pinned) {
+        if (pthread_getaffinity_np(pthread_self(), sizeof(s_main_cpus), &s_main_cpus) != 0) {
+            return;
+        }
+        s_main_pinned = true;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/** Give the process's own thread back the affinity it had before init */
+void workers_unbind(void)
+{
+    if (s_main_pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(s_main_cpus), &s_main_cpus);
+        s_main_pinned = false;
+    }
+}
+
+/**
+ * Worker a new thread is queued on first: the creating worker if the
+ * thread may run there, otherwise the allowed worker with the shortest
+ * queue, preferring the creator's node.
+ *
+ * @param thread New thread, its affinity set
+ * @return Worker to start on
+ */
+struct worker *worker_home(const struct uthread_internal *thread)
+{
+    struct worker *self = t_worker;
+
+    if (thread_allowed_on(thread, self)) {
+        return self;
+    }
+
+    struct worker *best = NULL;
+    for (int i = 0; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (!thread_allowed_on(thread, w)) {
+            continue;
+        }
+        bool local = w->node == self->node;
+        bool best_local = best != NULL && best->node == self->node;
+        if (best == NULL || (local && !best_local) ||
+            (local == best_local && w->rq_count < best->rq_count)) {
+            best = w;
+        }
+    }
+
+    return (best != NULL) ? best : self;
+}
+
+/* ==========================================================================
+ * Worker Setup
+ * ========================================================================== */
+
+/**
+ * Initialize a worker and its idle thread.
+ *
+ * @param w  Worker (zeroed, then placed by workers_place())
+ * @param id Worker index
+ * @return 0 on success, error code on failure
+ */
+int worker_setup(struct worker *w, int id)
+{
+    w->id = id;
+    w->steal_seed = (uint32_t)id * 2654435761u + 1;
+    atomic_init(&w->wake_seq, 0);
+
+    /* Both TCBs are embedded in the worker, and so are their cold parts */
+    w->host.cold = &w->host_cold;
+
+    struct uthread_internal *idle = &w->idle_thread;
+    idle->cold = &w->idle_cold;
+    idle->tid = 0;
+    idle->state = UTHREAD_STATE_READY;
+    idle->weight = CFS_NICE_0_WEIGHT;
+    idle->cold->start_routine = scheduler_idle_loop;
+    idle->worker = w;
+    idle->pinned = true;
+    strncpy(idle->cold->name, "idle", UTHREAD_NAME_MAX - 1);
+
+    if (thread_setup_stack(idle, UTHREAD_STACK_MIN, w->node) != 0) {
+        return UTHREAD_ENOMEM;
+    }
+    context_init(idle);
+
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Release the resources of a worker that is no longer running.
+ *
+ * @param w Worker
+ */
+void worker_release(struct worker *w)
+{
+    thread_release_stack(&w->idle_thread);
+}
+
+/* ==========================================================================
+ * M:N Worker Threads
+ * ========================================================================== */
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+
+    t_worker = w;
+    worker_bind(w);
+
+    /* Timer setup and the first switch happen under the scheduler lock */
+    preemption_disable();
+
+    if (timer_worker_init(w) != 0) {
+        preemption_enable();
+        return NULL;
+    }
+    if (stack_fault_worker_init(w) != 0) {
+        preemption_enable();
+        timer_worker_shutdown(w);
+        return NULL;
+    }
+
+    /* Run the idle thread; it switches back here when stopping */
+    if (context_init_self(&w->host) == -1) {
+        preemption_enable();
+        stack_fault_worker_shutdown(w);
+        timer_worker_shutdown(w);
+        return NULL;
+    }
+    w->host.worker = w;
+    w->host.pinned = true;
+
+    w->idle_thread.state = UTHREAD_STATE_RUNNING;
+    w->current = &w->idle_thread;
+    context_switch_to(&w->host, &w->idle_thread);
+
+    preemption_enable();
+
+    stack_fault_worker_shutdown(w);
+    timer_worker_shutdown(w);
+    t_worker = NULL;
+
+    return NULL;
+}
+
+/**
+ * Start the kernel threads of workers 1..num_workers-1.
+ *
+ * @return 0 on success, error code on failure
+ */
+int workers_start(void)
+{
+    for (int i = 1; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+
+        if (pthread_create(&w->pthread, NULL, worker_main, w) != 0) {
+            workers_stop();
+            return UTHREAD_EAGAIN;
+        }
+        w->started = true;
+    }
+
+    return UTHREAD_SUCCESS;
+}
+
+/**
+ * Ask all additional workers to exit and wait for them.
+ *
+ * Called from uthread_shutdown() on worker 0. Workers leave once their
+ * current user thread is switched out; user threads still queued are
+ * released by the caller.
+ */
+void workers_stop(void)
+{
+    if (g_scheduler.num_workers <= 1) {
+        return;
+    }
+
+    preemption_disable();
+    g_scheduler.stopping = true;
+    for (int i = 1; i < g_scheduler.num_workers; i++) {
+        worker_kick(&g_scheduler.workers[i]);
+    }
+    preemption_enable();
+
+    for (int i = 1; i < g_scheduler.num_workers; i++) {
+        struct worker *w = &g_scheduler.workers[i];
+        if (w->started) {
+            pthread_join(w->pthread, NULL);
+            w->started = false;
+        }
+    }
+}
+
+/* ==========================================================================
+ * Public API
+ * ========================================================================== */
+
+int uthread_worker_id(void)
+{
+    struct worker *w = t_worker;
+
+    if (!g_scheduler.initialized || w == NULL) {
+        return -1;
+    }
+
+    return w->id;
+}
+
+int uthread_get_num_workers(void)
+{
+    return g_scheduler.initialized ? g_scheduler.num_workers : 0;
+}
+
+int uthread_worker_node(void)
+{
+    struct worker *w = t_worker;
+
+    if (!g_scheduler.initialized || w == NULL) {
+        return -1;
+    }
+
+    return w->node;
+}
+
+int uthread_set_worker_pinning(int enabled)
+{
+    if (g_scheduler.initialized) {
+        return UTHREAD_EBUSY;
+    }
+
+    s_pin_workers = (enabled != 0);
+    return UTHREAD_SUCCESS;
+}
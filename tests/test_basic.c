@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <fenv.h>
 #include "uthread.h"
 
 static int test_count = 0;
@@ -67,6 +68,17 @@ static void *sleep_thread(void *arg)
     return NULL;
 }
 
+static int g_wake_order[3];
+static int g_wake_index;
+
+static void *ordered_sleep_thread(void *arg)
+{
+    int ms = (int)(intptr_t)arg;
+    uthread_sleep(ms);
+    g_wake_order[g_wake_index++] = ms;
+    return NULL;
+}
+
 static void *self_thread(void *arg)
 {
     uthread_t *result = (uthread_t *)arg;
@@ -74,6 +86,19 @@ static void *self_thread(void *arg)
     return NULL;
 }
 
+static void *rounding_thread(void *arg)
+{
+    int *ok = (int *)arg;
+    fesetround(FE_UPWARD);
+    for (int i = 0; i < 5; i++) {
+        uthread_yield();
+        if (fegetround() != FE_UPWARD) {
+            *ok = 0;
+        }
+    }
+    return NULL;
+}
+
 static void *exit_thread(void *arg)
 {
     uthread_exit((void *)42);
@@ -153,6 +178,75 @@ void test_create_many(void)
     }
 }
 
+void test_lookup(void)
+{
+    TEST("Thread lookup by ID");
+    int counter = 0;
+    uthread_t thread;
+
+    uthread_create(&thread, NULL, simple_thread, &counter);
+    int tid = uthread_get_tid(thread);
+    uthread_t found = uthread_lookup(tid);
+    uthread_join(thread, NULL);
+
+    /* The next thread takes the same slot with a new generation */
+    uthread_t next;
+    uthread_create(&next, NULL, simple_thread, &counter);
+    int next_tid = uthread_get_tid(next);
+    uthread_join(next, NULL);
+
+    uthread_t self = uthread_self();
+    if (found == thread && uthread_lookup(tid) == NULL && next_tid != tid &&
+        uthread_lookup(uthread_get_tid(self)) == self) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "tid=%d next=%d found=%d", tid, next_tid,
+                 found == thread);
+        FAIL(msg);
+    }
+}
+
+void test_registry_growth(void)
+{
+    TEST("More than UTHREAD_MAX_THREADS live threads");
+    enum { COUNT = UTHREAD_MAX_THREADS + 500 };
+    static uthread_t threads[COUNT];
+    int counter = 0;
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setstacksize(&attr, UTHREAD_STACK_MIN);
+
+    for (int i = 0; i < COUNT; i++) {
+        if (uthread_create(&threads[i], &attr, simple_thread, &counter) != 0) {
+            FAIL("uthread_create failed");
+            return;
+        }
+    }
+    uthread_attr_destroy(&attr);
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+
+    int found = 0;
+    for (int i = 0; i < COUNT; i++) {
+        found += uthread_lookup(uthread_get_tid(threads[i])) == threads[i];
+    }
+    for (int i = 0; i < COUNT; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    if (counter == COUNT && found == COUNT && stats.active_threads == COUNT + 1) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "ran=%d found=%d active=%d",
+                 counter, found, stats.active_threads);
+        FAIL(msg);
+    }
+}
+
 void test_return_value(void)
 {
     TEST("Thread return value");
@@ -210,6 +304,38 @@ void test_yield(void)
     }
 }
 
+void test_fpu_state(void)
+{
+    TEST("FPU control state preserved across switches");
+    int ok = 1;
+    uthread_t thread;
+
+    int ret = uthread_create(&thread, NULL, rounding_thread, &ok);
+    if (ret != 0) {
+        FAIL("uthread_create failed");
+        return;
+    }
+
+    for (int i = 0; i < 5; i++) {
+        uthread_yield();
+        if (fegetround() != FE_TONEAREST) {
+            ok = 0;
+        }
+    }
+
+    ret = uthread_join(thread, NULL);
+    if (ret != 0) {
+        FAIL("uthread_join failed");
+        return;
+    }
+
+    if (ok) {
+        PASS();
+    } else {
+        FAIL("Rounding mode leaked between threads");
+    }
+}
+
 void test_self(void)
 {
     TEST("uthread_self");
@@ -320,6 +446,74 @@ void test_sleep(void)
     }
 }
 
+void test_sleep_order(void)
+{
+    TEST("Sleepers wake in deadline order");
+    int delays[3] = {30, 10, 20};
+    uthread_t threads[3];
+    g_wake_index = 0;
+
+    for (int i = 0; i < 3; i++) {
+        int ret = uthread_create(&threads[i], NULL, ordered_sleep_thread,
+                                 (void *)(intptr_t)delays[i]);
+        if (ret != 0) {
+            FAIL("uthread_create failed");
+            return;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    if (g_wake_index == 3 && g_wake_order[0] == 10 &&
+        g_wake_order[1] == 20 && g_wake_order[2] == 30) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Order: %d, %d, %d",
+                 g_wake_order[0], g_wake_order[1], g_wake_order[2]);
+        FAIL(msg);
+    }
+}
+
+void test_stack_cache(void)
+{
+    TEST("Stack and descriptor cache reuse");
+    int counter = 0;
+    uthread_t thread;
+
+    if (uthread_stack_prewarm(0, 4) != 0) {
+        FAIL("uthread_stack_prewarm failed");
+        return;
+    }
+    uthread_reset_stats();
+
+    /* Spawn/join cycles should be served entirely from the cache */
+    for (int i = 0; i < 8; i++) {
+        if (uthread_create(&thread, NULL, simple_thread, &counter) != 0 ||
+            uthread_join(thread, NULL) != 0) {
+            FAIL("create/join failed");
+            return;
+        }
+    }
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+
+    if (counter == 8 && stats.stack_cache_hits == 8 &&
+        stats.stack_cache_misses == 0 && stats.tcb_cache_misses == 0) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "stack hits=%lu misses=%lu, tcb misses=%lu",
+                 (unsigned long)stats.stack_cache_hits,
+                 (unsigned long)stats.stack_cache_misses,
+                 (unsigned long)stats.tcb_cache_misses);
+        FAIL(msg);
+    }
+}
+
 void test_attributes(void)
 {
     TEST("Thread attributes");
@@ -396,6 +590,297 @@ void test_shutdown(void)
     }
 }
 
+/* Each level keeps about 1KB live on the stack */
+static int recurse(int depth)
+{
+    volatile char buf[1024];
+    buf[0] = (char)depth;
+    if (depth == 0) {
+        return buf[0];
+    }
+    return recurse(depth - 1) + buf[0];
+}
+
+static void *deep_thread(void *arg)
+{
+    size_t *watermark = (size_t *)arg;
+
+    recurse((int)(*watermark / 1024));
+    *watermark = uthread_stack_high_watermark(uthread_self());
+
+    return NULL;
+}
+
+void test_stack_watermark(void)
+{
+    TEST("Lazy stacks: high watermark, pages returned to the cache");
+
+    if (uthread_set_stack_mode(UTHREAD_STACK_LAZY) != 0 ||
+        uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        FAIL("setup failed");
+        return;
+    }
+
+    if (uthread_set_stack_mode(UTHREAD_STACK_COMMITTED) != UTHREAD_EBUSY) {
+        FAIL("mode changed while initialized");
+        uthread_shutdown();
+        return;
+    }
+
+    size_t deep = 32 * 1024;
+    size_t shallow = 0;
+    uthread_t thread;
+
+    /* The second thread reuses the first one's stack */
+    uthread_create(&thread, NULL, deep_thread, &deep);
+    uthread_join(thread, NULL);
+    uthread_create(&thread, NULL, deep_thread, &shallow);
+    uthread_join(thread, NULL);
+
+    uthread_shutdown();
+    uthread_set_stack_mode(UTHREAD_STACK_COMMITTED);
+
+    if (deep >= 32 * 1024 && deep < UTHREAD_STACK_DEFAULT &&
+        shallow > 0 && shallow <= 16 * 1024) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "deep=%zu shallow=%zu", deep, shallow);
+        FAIL(msg);
+    }
+}
+
+void test_stack_growth(void)
+{
+    TEST("Growable stack extends past its size on overflow");
+
+    if (uthread_set_stack_mode(UTHREAD_STACK_GROWABLE) != 0 ||
+        uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        FAIL("setup failed");
+        return;
+    }
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setstacksize(&attr, UTHREAD_STACK_MIN);
+
+    /* 16x the stack it was created with */
+    size_t used = 16 * UTHREAD_STACK_MIN;
+    uthread_t thread;
+    uthread_create(&thread, &attr, deep_thread, &used);
+    uthread_join(thread, NULL);
+
+    /* Reused from the cache: should be back to its requested size */
+    size_t again = 16 * UTHREAD_STACK_MIN;
+    uthread_create(&thread, &attr, deep_thread, &again);
+    uthread_join(thread, NULL);
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+
+    uthread_shutdown();
+    uthread_set_stack_mode(UTHREAD_STACK_COMMITTED);
+
+    if (used >= 16 * UTHREAD_STACK_MIN && again >= 16 * UTHREAD_STACK_MIN &&
+        stats.stack_growths >= 2) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "used=%zu growths=%lu", used,
+                 (unsigned long)stats.stack_growths);
+        FAIL(msg);
+    }
+}
+
+/* Allocates, checks alignment and contents, and rewinds */
+static void *arena_thread(void *arg)
+{
+    int *result = (int *)arg;
+    unsigned char *small[64];
+
+    uthread_arena_mark_t start = uthread_arena_mark();
+
+    /* Enough to spill over several blocks, yielding in between */
+    for (int round = 0; round < 8; round++) {
+        for (int i = 0; i < 64; i++) {
+            small[i] = uthread_arena_alloc(200 + i);
+            if (small[i] == NULL || ((uintptr_t)small[i] & 15) != 0) {
+                return NULL;
+            }
+            memset(small[i], round * 64 + i, 200 + i);
+        }
+        uthread_yield();
+        for (int i = 0; i < 64; i++) {
+            if (small[i][0] != (unsigned char)(round * 64 + i) ||
+                small[i][199 + i] != (unsigned char)(round * 64 + i)) {
+                return NULL;
+            }
+        }
+    }
+
+    /* Too large for a block: mapped on its own */
+    char *big = uthread_arena_calloc(1, 256 * 1024);
+    if (big == NULL || big[0] != 0 || big[256 * 1024 - 1] != 0) {
+        return NULL;
+    }
+    big[256 * 1024 - 1] = 1;
+
+    /* Rewinding hands out the same memory again */
+    uthread_arena_rewind(start);
+    void *first = uthread_arena_alloc(32);
+    uthread_arena_mark_t mark = uthread_arena_mark();
+    void *second = uthread_arena_alloc(32);
+    uthread_arena_rewind(mark);
+    void *again = uthread_arena_alloc(32);
+
+    uthread_arena_reset();
+    void *fresh = uthread_arena_alloc(32);
+
+    *result = (first != NULL && second == again && fresh == first);
+    return NULL;
+}
+
+/* Reports the address of its first allocation */
+static void *arena_first_thread(void *arg)
+{
+    *(void **)arg = uthread_arena_alloc(64);
+    return NULL;
+}
+
+void test_arena(void)
+{
+    TEST("Thread arenas: alignment, isolation, mark/rewind, reset");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        FAIL("init failed");
+        return;
+    }
+
+    int results[4] = {0};
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], NULL, arena_thread, &results[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    int ok = 1;
+    for (int i = 0; i < 4; i++) {
+        ok &= results[i];
+    }
+
+    /* The main thread has one too, released at shutdown */
+    void *in_main = uthread_arena_alloc(16);
+
+    uthread_shutdown();
+
+    void *outside = uthread_arena_alloc(16);
+
+    if (ok && in_main != NULL && outside == NULL) {
+        PASS();
+    } else {
+        FAIL("arena allocation, rewind or isolation broken");
+    }
+}
+
+void test_arena_reuse(void)
+{
+    TEST("Arena blocks return to the pool when their thread exits");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        FAIL("init failed");
+        return;
+    }
+
+    void *first = NULL;
+    void *second = NULL;
+    uthread_t thread;
+
+    uthread_create(&thread, NULL, arena_first_thread, &first);
+    uthread_join(thread, NULL);
+    uthread_create(&thread, NULL, arena_first_thread, &second);
+    uthread_join(thread, NULL);
+
+    uthread_shutdown();
+
+    if (first != NULL && second == first) {
+        PASS();
+    } else {
+        FAIL("exited thread's block was not reused");
+    }
+}
+
+/* Setup runs once; each clone checks the copied locals and its own copy */
+static int clone_setups = 0;
+
+static void *clone_template_thread(void *arg)
+{
+    (void)arg;
+    int table[256];
+    for (int i = 0; i < 256; i++) {
+        table[i] = i * i;
+    }
+    int *cursor = &table[128];
+    clone_setups++;
+
+    intptr_t id = (intptr_t)uthread_clone_park();
+
+    int ok = (cursor == &table[128] && *cursor == 128 * 128);
+    for (int i = 1; i < 256; i++) {
+        ok &= (table[i] == i * i);
+    }
+    table[0] = (int)id;
+    uthread_yield();
+    ok &= (table[0] == (int)id);
+
+    return (void *)(ok ? id : -1);
+}
+
+void test_clone(void)
+{
+    TEST("Clones continue from the template's park with their own stack");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        FAIL("init failed");
+        return;
+    }
+
+    clone_setups = 0;
+    uthread_t tmpl;
+    uthread_create(&tmpl, NULL, clone_template_thread, NULL);
+
+    /* Not cloneable until parked */
+    uthread_t clones[64];
+    int ok = (uthread_clone(&clones[0], tmpl, NULL) == UTHREAD_EINVAL);
+    uthread_yield();
+
+    for (int i = 0; i < 64 && ok; i++) {
+        ok = (uthread_clone(&clones[i], tmpl, (void *)(intptr_t)(i + 1)) == 0);
+    }
+    for (int i = 0; i < 64 && ok; i++) {
+        void *ret = NULL;
+        uthread_join(clones[i], &ret);
+        ok = ((intptr_t)ret == i + 1);
+    }
+
+    /* The template itself, once released */
+    void *ret = NULL;
+    ok = ok && uthread_clone_release(tmpl, (void *)(intptr_t)1000) == 0;
+    uthread_join(tmpl, &ret);
+    ok = ok && (intptr_t)ret == 1000 && clone_setups == 1;
+    ok = ok && uthread_clone(&clones[0], uthread_self(), NULL) == UTHREAD_EINVAL;
+    ok = ok && uthread_clone_park() == NULL;
+
+    uthread_shutdown();
+
+    if (ok) {
+        PASS();
+    } else {
+        FAIL("clone lost its locals or shared its copy");
+    }
+}
+
 /* ==========================================================================
  * Main
  * ========================================================================== */
@@ -407,15 +892,25 @@ int main(void)
     test_init();
     test_create_single();
     test_create_many();
+    test_lookup();
+    test_registry_growth();
     test_return_value();
     test_yield();
+    test_fpu_state();
     test_self();
     test_exit();
     test_detached();
     test_sleep();
+    test_sleep_order();
+    test_stack_cache();
     test_attributes();
     test_thread_name();
     test_shutdown();
+    test_stack_watermark();
+    test_stack_growth();
+    test_arena();
+    test_arena_reuse();
+    test_clone();
 
     printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
 
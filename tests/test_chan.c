@@ -0,0 +1,649 @@
+/**
+ * LibUThread Channel Tests
+ *
+ * Tests for bounded channels: ring order, blocking and unbuffered
+ * hand-off, timeouts, close, batches, select, and M:N producers and
+ * consumers.
+ *
+ * @file test_chan.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Shared Data
+ * ========================================================================== */
+
+#define NUM_PRODUCERS   4
+#define NUM_CONSUMERS   4
+#define ITEMS_EACH      5000
+#define BATCH_ITEMS     10000
+#define BATCH_SIZE      16
+
+static uthread_chan_t g_chan;
+static uthread_chan_t g_chan2;
+static atomic_long g_sum;
+static atomic_int g_received;
+static atomic_int g_errors;
+
+static struct timespec deadline_in_ms(int ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += (long)ms * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    return ts;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ==========================================================================
+ * Thread Functions
+ * ========================================================================== */
+
+/* Sends producer id * ITEMS_EACH + sequence number */
+static void *producer(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+
+    for (int i = 0; i < ITEMS_EACH; i++) {
+        int item = id * ITEMS_EACH + i;
+        if (uthread_chan_send(&g_chan, &item) != 0) {
+            g_errors++;
+        }
+        if (i % 64 == 0) {
+            uthread_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* Receives until the channel is closed */
+static void *consumer(void *arg)
+{
+    (void)arg;
+    int item;
+
+    while (uthread_chan_recv(&g_chan, &item) == 0) {
+        atomic_fetch_add(&g_sum, item);
+        atomic_fetch_add(&g_received, 1);
+    }
+
+    return NULL;
+}
+
+static void *blocked_receiver(void *arg)
+{
+    int *result = (int *)arg;
+    int item;
+
+    *result = uthread_chan_recv(&g_chan, &item);
+    return NULL;
+}
+
+static void *rendezvous_receiver(void *arg)
+{
+    int *received = (int *)arg;
+
+    uthread_chan_recv(&g_chan, received);
+    return NULL;
+}
+
+static void *batch_producer(void *arg)
+{
+    (void)arg;
+    int items[BATCH_SIZE];
+
+    for (int next = 0; next < BATCH_ITEMS; ) {
+        int n = BATCH_ITEMS - next < BATCH_SIZE ? BATCH_ITEMS - next : BATCH_SIZE;
+        for (int i = 0; i < n; i++) {
+            items[i] = next + i;
+        }
+
+        size_t sent = 0;
+        if (uthread_chan_send_batch(&g_chan, items, (size_t)n, &sent) != 0 || sent == 0) {
+            g_errors++;
+            break;
+        }
+        next += (int)sent;
+    }
+
+    uthread_chan_close(&g_chan);
+    return NULL;
+}
+
+static void *late_sender(void *arg)
+{
+    uthread_chan_t *chan = (uthread_chan_t *)arg;
+    int item = 42;
+
+    uthread_sleep(5);
+    uthread_chan_send(chan, &item);
+    return NULL;
+}
+
+/* Sends onto both channels, for the select consumer on several workers */
+static void *dual_producer(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    uthread_chan_t *chan = (id % 2 == 0) ? &g_chan : &g_chan2;
+
+    for (int i = 0; i < ITEMS_EACH; i++) {
+        int item = id * ITEMS_EACH + i;
+        if (uthread_chan_send(chan, &item) != 0) {
+            g_errors++;
+        }
+    }
+
+    return NULL;
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+static void test_init_and_ring(void)
+{
+    TEST("Init checks capacity, ring keeps FIFO order across wraps");
+
+    uthread_chan_t chan;
+    if (uthread_chan_init(&chan, sizeof(int), 6) != UTHREAD_EINVAL ||
+        uthread_chan_init(&chan, 0, 8) != UTHREAD_EINVAL) {
+        FAIL("bad capacity or element size accepted");
+        return;
+    }
+
+    if (uthread_chan_init(&chan, sizeof(int), 4) != 0) {
+        FAIL("init failed");
+        return;
+    }
+
+    int item;
+    if (uthread_chan_tryrecv(&chan, &item) != UTHREAD_EAGAIN) {
+        FAIL("tryrecv on an empty channel did not fail");
+        return;
+    }
+
+    int next_in = 0, next_out = 0;
+    for (int round = 0; round < 5; round++) {
+        while (uthread_chan_trysend(&chan, &next_in) == 0) {
+            next_in++;
+        }
+        if (next_in - next_out != 4) {
+            FAIL("ring did not hold exactly its capacity");
+            return;
+        }
+        /* Take three of the four, so the next round wraps */
+        for (int i = 0; i < 3; i++) {
+            if (uthread_chan_tryrecv(&chan, &item) != 0 || item != next_out++) {
+                FAIL("items out of order");
+                return;
+            }
+        }
+    }
+
+    while (uthread_chan_tryrecv(&chan, &item) == 0) {
+        if (item != next_out++) {
+            FAIL("items out of order while draining");
+            return;
+        }
+    }
+
+    uthread_chan_destroy(&chan);
+    PASS();
+}
+
+static void test_producers_consumers(void)
+{
+    TEST("Four producers and four consumers through an 8-slot channel");
+
+    uthread_chan_init(&g_chan, sizeof(int), 8);
+    atomic_store(&g_sum, 0);
+    atomic_store(&g_received, 0);
+    atomic_store(&g_errors, 0);
+
+    uthread_t producers[NUM_PRODUCERS], consumers[NUM_CONSUMERS];
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        uthread_create(&consumers[i], NULL, consumer, NULL);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        uthread_create(&producers[i], NULL, producer, (void *)(intptr_t)i);
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        uthread_join(producers[i], NULL);
+    }
+    uthread_chan_close(&g_chan);
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        uthread_join(consumers[i], NULL);
+    }
+    uthread_chan_destroy(&g_chan);
+
+    long total = (long)NUM_PRODUCERS * ITEMS_EACH;
+    if (g_received != total || g_sum != total * (total - 1) / 2 || g_errors != 0) {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "received %d of %ld, %d errors",
+                 atomic_load(&g_received), total, atomic_load(&g_errors));
+        FAIL(msg);
+        return;
+    }
+
+    PASS();
+}
+
+static void test_unbuffered(void)
+{
+    TEST("Unbuffered send completes only by hand-off to a receiver");
+
+    uthread_chan_init(&g_chan, sizeof(int), 0);
+
+    int item = 7;
+    if (uthread_chan_trysend(&g_chan, &item) != UTHREAD_EAGAIN) {
+        FAIL("trysend without a receiver succeeded");
+        return;
+    }
+
+    int received = 0;
+    uthread_t receiver;
+    uthread_create(&receiver, NULL, rendezvous_receiver, &received);
+    uthread_yield();
+
+    /* The receiver is parked, so the hand-off completes at once */
+    if (uthread_chan_trysend(&g_chan, &item) != 0) {
+        FAIL("trysend to a parked receiver failed");
+        return;
+    }
+    uthread_join(receiver, NULL);
+    uthread_chan_destroy(&g_chan);
+
+    if (received != 7) {
+        FAIL("receiver did not get the item");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_timeouts(void)
+{
+    TEST("Timed send and receive time out");
+
+    uthread_chan_init(&g_chan, sizeof(int), 1);
+    int item = 1;
+
+    struct timespec ts = deadline_in_ms(10);
+    uint64_t start = now_ns();
+    if (uthread_chan_timedrecv(&g_chan, &item, &ts) != UTHREAD_ETIMEDOUT) {
+        FAIL("timedrecv on an empty channel did not time out");
+        return;
+    }
+    if (now_ns() - start < 9 * 1000000ULL) {
+        FAIL("timedrecv returned early");
+        return;
+    }
+
+    uthread_chan_send(&g_chan, &item);
+    ts = deadline_in_ms(10);
+    if (uthread_chan_timedsend(&g_chan, &item, &ts) != UTHREAD_ETIMEDOUT) {
+        FAIL("timedsend on a full channel did not time out");
+        return;
+    }
+
+    /* The timed-out sender left nothing behind */
+    if (uthread_chan_tryrecv(&g_chan, &item) != 0 ||
+        uthread_chan_tryrecv(&g_chan, &item) != UTHREAD_EAGAIN) {
+        FAIL("channel count wrong after a timeout");
+        return;
+    }
+
+    if (uthread_chan_destroy(&g_chan) != 0) {
+        FAIL("timed-out waiter kept the channel busy");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_close(void)
+{
+    TEST("Close fails parked receivers and later sends, drains buffered items");
+
+    uthread_chan_init(&g_chan, sizeof(int), 0);
+
+    int results[3];
+    uthread_t receivers[3];
+    for (int i = 0; i < 3; i++) {
+        results[i] = -1;
+        uthread_create(&receivers[i], NULL, blocked_receiver, &results[i]);
+    }
+    uthread_yield();
+
+    if (uthread_chan_destroy(&g_chan) != UTHREAD_EBUSY) {
+        FAIL("destroy with parked receivers did not fail");
+        return;
+    }
+
+    uthread_chan_close(&g_chan);
+    for (int i = 0; i < 3; i++) {
+        uthread_join(receivers[i], NULL);
+        if (results[i] != UTHREAD_EPIPE) {
+            FAIL("parked receiver not failed by close");
+            return;
+        }
+    }
+    uthread_chan_destroy(&g_chan);
+
+    uthread_chan_init(&g_chan, sizeof(int), 4);
+    int item = 5;
+    uthread_chan_send(&g_chan, &item);
+    uthread_chan_close(&g_chan);
+
+    if (uthread_chan_send(&g_chan, &item) != UTHREAD_EPIPE ||
+        uthread_chan_close(&g_chan) != UTHREAD_EPIPE) {
+        FAIL("send or close after close did not fail");
+        return;
+    }
+
+    item = 0;
+    if (uthread_chan_recv(&g_chan, &item) != 0 || item != 5 ||
+        uthread_chan_recv(&g_chan, &item) != UTHREAD_EPIPE) {
+        FAIL("buffered item not drained before EPIPE");
+        return;
+    }
+
+    uthread_chan_destroy(&g_chan);
+    PASS();
+}
+
+static void test_batches(void)
+{
+    TEST("Batch send and receive move several items per call, in order");
+
+    uthread_chan_init(&g_chan, sizeof(int), 32);
+    g_errors = 0;
+
+    uthread_t thread;
+    uthread_create(&thread, NULL, batch_producer, NULL);
+
+    int items[BATCH_SIZE * 2];
+    int expected = 0;
+    int calls = 0;
+    size_t received;
+
+    while (uthread_chan_recv_batch(&g_chan, items, BATCH_SIZE * 2, &received) == 0) {
+        calls++;
+        for (size_t i = 0; i < received; i++) {
+            if (items[i] != expected++) {
+                g_errors++;
+            }
+        }
+    }
+
+    uthread_join(thread, NULL);
+    uthread_chan_destroy(&g_chan);
+
+    if (expected != BATCH_ITEMS || g_errors != 0) {
+        FAIL("items lost or out of order");
+        return;
+    }
+
+    /* One item per call would take BATCH_ITEMS calls */
+    if (calls > BATCH_ITEMS / 4) {
+        printf("(%d calls) ", calls);
+        FAIL("batches were not amortized");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_select_ready(void)
+{
+    TEST("Select performs a ready case and rotates between ready cases");
+
+    uthread_chan_init(&g_chan, sizeof(int), 64);
+    uthread_chan_init(&g_chan2, sizeof(int), 64);
+
+    int a = 0, b = 0, item = 0;
+    for (int i = 0; i < 32; i++) {
+        uthread_chan_send(&g_chan, &i);
+        uthread_chan_send(&g_chan2, &i);
+    }
+
+    uthread_select_case_t cases[2] = {
+        { &g_chan, UTHREAD_CHAN_RECV, &item },
+        { &g_chan2, UTHREAD_CHAN_RECV, &item },
+    };
+    for (int i = 0; i < 32; i++) {
+        int selected = -1;
+        if (uthread_select(cases, 2, NULL, &selected) != 0) {
+            FAIL("select failed");
+            return;
+        }
+        if (selected == 0) {
+            a++;
+        } else {
+            b++;
+        }
+    }
+
+    /* Both channels stay ready, so both must be served */
+    if (a == 0 || b == 0) {
+        FAIL("one ready case starved the other");
+        return;
+    }
+
+    /* A send case on a full channel is skipped, a ready one performed */
+    uthread_chan_t full;
+    uthread_chan_init(&full, sizeof(int), 1);
+    uthread_chan_send(&full, &item);
+    int value = 9;
+    uthread_select_case_t send_cases[2] = {
+        { &full, UTHREAD_CHAN_SEND, &value },
+        { &g_chan, UTHREAD_CHAN_SEND, &value },
+    };
+    int selected = -1;
+    if (uthread_select(send_cases, 2, NULL, &selected) != 0 || selected != 1) {
+        FAIL("send case not selected");
+        return;
+    }
+
+    /* Nothing ready and a deadline already passed: polls */
+    uthread_chan_t empty;
+    uthread_chan_init(&empty, sizeof(int), 4);
+    struct timespec past = deadline_in_ms(0);
+    uthread_select_case_t poll_cases[2] = {
+        { &empty, UTHREAD_CHAN_RECV, &item },
+        { &full, UTHREAD_CHAN_SEND, &value },
+    };
+    if (uthread_select(poll_cases, 2, &past, &selected) != UTHREAD_ETIMEDOUT ||
+        selected != -1) {
+        FAIL("poll did not time out");
+        return;
+    }
+
+    uthread_chan_destroy(&empty);
+    uthread_chan_destroy(&full);
+    uthread_chan_destroy(&g_chan2);
+    uthread_chan_destroy(&g_chan);
+    PASS();
+}
+
+static void test_select_blocking(void)
+{
+    TEST("Select parks on every case, completes one, withdraws the rest");
+
+    /* More cases than are kept on the stack */
+    enum { NCHANS = 12 };
+    uthread_chan_t chans[NCHANS];
+    int items[NCHANS];
+    uthread_select_case_t cases[NCHANS];
+    for (int i = 0; i < NCHANS; i++) {
+        uthread_chan_init(&chans[i], sizeof(int), 0);
+        cases[i] = (uthread_select_case_t) { &chans[i], UTHREAD_CHAN_RECV, &items[i] };
+    }
+    cases[3].chan = NULL;
+
+    uthread_t thread;
+    uthread_create(&thread, NULL, late_sender, &chans[NCHANS - 2]);
+
+    int selected = -1;
+    struct timespec ts = deadline_in_ms(2000);
+    int ret = uthread_select(cases, NCHANS, &ts, &selected);
+    uthread_join(thread, NULL);
+
+    if (ret != 0 || selected != NCHANS - 2 || items[NCHANS - 2] != 42) {
+        FAIL("select did not complete the late send");
+        return;
+    }
+
+    /* Our receive cases were withdrawn: nobody takes a hand-off anymore */
+    int item = 1;
+    for (int i = 0; i < NCHANS; i++) {
+        if (uthread_chan_trysend(&chans[i], &item) != UTHREAD_EAGAIN) {
+            FAIL("a withdrawn case took an item");
+            return;
+        }
+        if (uthread_chan_destroy(&chans[i]) != 0) {
+            FAIL("withdrawn case kept a channel busy");
+            return;
+        }
+    }
+
+    /* A closed channel makes its receive case ready */
+    uthread_chan_init(&g_chan, sizeof(int), 0);
+    uthread_chan_close(&g_chan);
+    uthread_select_case_t closed_case = { &g_chan, UTHREAD_CHAN_RECV, &item };
+    if (uthread_select(&closed_case, 1, NULL, &selected) != UTHREAD_EPIPE ||
+        selected != 0) {
+        FAIL("closed channel case not selected with EPIPE");
+        return;
+    }
+    uthread_chan_destroy(&g_chan);
+
+    PASS();
+}
+
+static void test_mn_select(void)
+{
+    TEST("Select consumer on four workers (M:N)");
+
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 4) != 0) {
+        FAIL("uthread_init_workers failed");
+        return;
+    }
+
+    uthread_chan_init(&g_chan, sizeof(int), 16);
+    uthread_chan_init(&g_chan2, sizeof(int), 0);
+    g_errors = 0;
+
+    uthread_t producers[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        uthread_create(&producers[i], NULL, dual_producer, (void *)(intptr_t)i);
+    }
+
+    int last[NUM_PRODUCERS];
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        last[i] = -1;
+    }
+
+    int item = 0;
+    long sum = 0;
+    uthread_select_case_t cases[2] = {
+        { &g_chan, UTHREAD_CHAN_RECV, &item },
+        { &g_chan2, UTHREAD_CHAN_RECV, &item },
+    };
+    for (int n = 0; n < NUM_PRODUCERS * ITEMS_EACH; n++) {
+        int selected;
+        if (uthread_select(cases, 2, NULL, &selected) != 0) {
+            g_errors++;
+            break;
+        }
+        int id = item / ITEMS_EACH;
+        if (item % ITEMS_EACH <= last[id]) {
+            g_errors++;
+        }
+        last[id] = item % ITEMS_EACH;
+        sum += item;
+    }
+
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        uthread_join(producers[i], NULL);
+    }
+    uthread_chan_destroy(&g_chan2);
+    uthread_chan_destroy(&g_chan);
+    uthread_shutdown();
+
+    long total = (long)NUM_PRODUCERS * ITEMS_EACH;
+    if (g_errors != 0 || sum != total * (total - 1) / 2) {
+        FAIL("items lost or out of order");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Channel Tests ===\n\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize uthread library\n");
+        return 1;
+    }
+
+    test_init_and_ring();
+    test_producers_consumers();
+    test_unbuffered();
+    test_timeouts();
+    test_close();
+    test_batches();
+    test_select_ready();
+    test_select_blocking();
+
+    uthread_shutdown();
+
+    test_mn_select();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
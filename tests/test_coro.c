@@ -0,0 +1,676 @@
+/**
+ * LibUThread Generator and Future Tests
+ *
+ * Tests for generators (values in and out, nesting, resuming from other
+ * threads, blocking and preemption inside the body, stack reuse) and
+ * futures (awaiters, continuations, chaining), alone and in M:N mode.
+ *
+ * @file test_coro.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Shared Data
+ * ========================================================================== */
+
+#define NUM_AWAITERS    8
+#define MN_THREADS      8
+#define MN_VALUES       2000
+
+static uthread_sem_t g_sem;
+static uthread_future_t g_future;
+static atomic_int g_counter;
+static atomic_int g_errors;
+static atomic_int g_flag;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ==========================================================================
+ * Generator Bodies
+ * ========================================================================== */
+
+/* Yields 0 .. n-1, returns n * 10 */
+static void *count_gen(void *arg)
+{
+    intptr_t n = (intptr_t)arg;
+    for (intptr_t i = 0; i < n; i++) {
+        uthread_gen_yield((void *)i);
+    }
+    return (void *)(n * 10);
+}
+
+/* Yields the running total of the values it is resumed with */
+static void *sum_gen(void *arg)
+{
+    (void)arg;
+    intptr_t total = 0;
+    for (;;) {
+        intptr_t in = (intptr_t)uthread_gen_yield((void *)total);
+        if (in < 0) {
+            return (void *)total;
+        }
+        total += in;
+    }
+}
+
+/* Yields twice what an inner count_gen yields */
+static void *outer_gen(void *arg)
+{
+    uthread_gen_t self = uthread_gen_self();
+    uthread_gen_t inner;
+    if (uthread_gen_create(&inner, count_gen, arg, 0) != 0) {
+        return (void *)-1;
+    }
+
+    void *v;
+    while (uthread_gen_resume(inner, NULL, &v) == 0) {
+        if (uthread_gen_self() != self) {
+            atomic_fetch_add(&g_errors, 1);
+        }
+        uthread_gen_yield((void *)((intptr_t)v * 2));
+    }
+    uthread_gen_destroy(inner);
+    return NULL;
+}
+
+/* Tries to resume itself */
+static void *self_resume_gen(void *arg)
+{
+    (void)arg;
+    return (void *)(intptr_t)uthread_gen_resume(uthread_gen_self(), NULL, NULL);
+}
+
+/* Blocks on the semaphore between yields */
+static void *blocking_gen(void *arg)
+{
+    (void)arg;
+    for (intptr_t i = 0; i < 3; i++) {
+        uthread_sem_wait(&g_sem);
+        uthread_gen_yield((void *)i);
+    }
+    return NULL;
+}
+
+/* Spins until another thread sets the flag, which needs preemption */
+static void *spinning_gen(void *arg)
+{
+    (void)arg;
+    uint64_t deadline = now_ns() + 2000000000ULL;
+    while (atomic_load(&g_flag) == 0 && now_ns() < deadline) {
+    }
+    return (void *)(intptr_t)atomic_load(&g_flag);
+}
+
+/* Yields 0 .. n-1, giving up the CPU between values */
+static void *yielding_gen(void *arg)
+{
+    intptr_t n = (intptr_t)arg;
+    for (intptr_t i = 0; i < n; i++) {
+        if (i % 7 == 0) {
+            uthread_yield();
+        }
+        uthread_gen_yield((void *)i);
+    }
+    return NULL;
+}
+
+/* ==========================================================================
+ * Thread Functions
+ * ========================================================================== */
+
+/* Resumes the generator once after each semaphore post */
+static void *resume_thread(void *arg)
+{
+    uthread_gen_t gen = arg;
+    void *v;
+    for (int i = 0; i < 5; i++) {
+        uthread_sem_wait(&g_sem);
+        if (uthread_gen_resume(gen, NULL, &v) != 0) {
+            atomic_fetch_add(&g_errors, 1);
+        }
+        if ((intptr_t)v != atomic_fetch_add(&g_counter, 1)) {
+            atomic_fetch_add(&g_errors, 1);
+        }
+    }
+    return NULL;
+}
+
+static void *counting_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 3; i++) {
+        atomic_fetch_add(&g_counter, 1);
+        uthread_sem_post(&g_sem);
+        uthread_yield();
+    }
+    return NULL;
+}
+
+static void *flag_thread(void *arg)
+{
+    (void)arg;
+    atomic_store(&g_flag, 1);
+    return NULL;
+}
+
+static void *await_thread(void *arg)
+{
+    (void)arg;
+    void *v = NULL;
+    if (uthread_future_await(&g_future, &v) != 0 || (intptr_t)v != 42) {
+        atomic_fetch_add(&g_errors, 1);
+    }
+    atomic_fetch_add(&g_counter, 1);
+    return NULL;
+}
+
+/* Drains its own generator; joins return the sum of the values */
+static void *mn_gen_thread(void *arg)
+{
+    (void)arg;
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, yielding_gen, (void *)(intptr_t)MN_VALUES, 0) != 0) {
+        atomic_fetch_add(&g_errors, 1);
+        return NULL;
+    }
+
+    intptr_t expect = 0;
+    void *v;
+    while (uthread_gen_resume(gen, NULL, &v) == 0) {
+        if ((intptr_t)v != expect++) {
+            atomic_fetch_add(&g_errors, 1);
+        }
+    }
+    if (expect != MN_VALUES) {
+        atomic_fetch_add(&g_errors, 1);
+    }
+    uthread_gen_destroy(gen);
+
+    if (uthread_future_await(&g_future, &v) != 0 || (intptr_t)v != 42) {
+        atomic_fetch_add(&g_errors, 1);
+    }
+    return NULL;
+}
+
+/* ==========================================================================
+ * Continuations
+ * ========================================================================== */
+
+static void *add_one(void *value, void *arg)
+{
+    (void)arg;
+    return (void *)((intptr_t)value + 1);
+}
+
+static void *times_two(void *value, void *arg)
+{
+    (void)arg;
+    return (void *)((intptr_t)value * 2);
+}
+
+/* Appends its tag to the order string */
+static void *record_order(void *value, void *arg)
+{
+    char *order = value;
+    size_t len = strlen(order);
+    order[len] = (char)(intptr_t)arg;
+    order[len + 1] = '\0';
+    return value;
+}
+
+/* ==========================================================================
+ * Generator Tests
+ * ========================================================================== */
+
+static void test_gen_values(void)
+{
+    TEST("Generator yields values, then its return value with EPIPE");
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, count_gen, (void *)(intptr_t)10, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    void *v = NULL;
+    for (intptr_t i = 0; i < 10; i++) {
+        if (uthread_gen_resume(gen, NULL, &v) != 0 || (intptr_t)v != i) {
+            FAIL("wrong yielded value");
+            uthread_gen_destroy(gen);
+            return;
+        }
+    }
+    if (uthread_gen_resume(gen, NULL, &v) != UTHREAD_EPIPE || (intptr_t)v != 100) {
+        FAIL("return value not reported");
+        uthread_gen_destroy(gen);
+        return;
+    }
+    v = NULL;
+    if (uthread_gen_resume(gen, NULL, &v) != UTHREAD_EPIPE || (intptr_t)v != 100) {
+        FAIL("finished generator resumed");
+        uthread_gen_destroy(gen);
+        return;
+    }
+    if (uthread_gen_destroy(gen) != 0) {
+        FAIL("uthread_gen_destroy failed");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_in_values(void)
+{
+    TEST("Generator receives the resume values");
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, sum_gen, NULL, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    void *v = NULL;
+    int ok = uthread_gen_resume(gen, (void *)(intptr_t)1000, &v) == 0 && v == NULL;
+    intptr_t total = 0;
+    for (intptr_t i = 1; i <= 20 && ok; i++) {
+        total += i;
+        ok = uthread_gen_resume(gen, (void *)i, &v) == 0 && (intptr_t)v == total;
+    }
+    ok = ok && uthread_gen_resume(gen, (void *)(intptr_t)-1, &v) == UTHREAD_EPIPE &&
+         (intptr_t)v == 210;
+    uthread_gen_destroy(gen);
+
+    if (!ok) {
+        FAIL("wrong running total");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_nested(void)
+{
+    TEST("Nested generators and uthread_gen_self()");
+
+    g_errors = 0;
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, outer_gen, (void *)(intptr_t)8, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    int ok = 1;
+    void *v;
+    for (intptr_t i = 0; i < 8 && ok; i++) {
+        ok = uthread_gen_resume(gen, NULL, &v) == 0 && (intptr_t)v == i * 2;
+    }
+    ok = ok && uthread_gen_resume(gen, NULL, &v) == UTHREAD_EPIPE && v == NULL;
+    uthread_gen_destroy(gen);
+
+    if (!ok || g_errors != 0 || uthread_gen_self() != NULL) {
+        FAIL("wrong values from nested generator");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_errors(void)
+{
+    TEST("Generator errors: self-resume, yield outside, bad arguments");
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, self_resume_gen, NULL, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    void *v;
+    int ok = uthread_gen_resume(gen, NULL, &v) == UTHREAD_EPIPE &&
+             (intptr_t)v == UTHREAD_EBUSY;
+    uthread_gen_destroy(gen);
+
+    ok = ok && uthread_gen_yield((void *)1) == NULL;
+    ok = ok && uthread_gen_create(&gen, NULL, NULL, 0) == UTHREAD_EINVAL;
+    ok = ok && uthread_gen_create(&gen, count_gen, NULL, 1024) == UTHREAD_EINVAL;
+    ok = ok && uthread_gen_resume(NULL, NULL, NULL) == UTHREAD_EINVAL;
+
+    /* A generator that never ran, and one stopped mid-way, can go */
+    ok = ok && uthread_gen_create(&gen, count_gen, (void *)(intptr_t)5, 0) == 0 &&
+         uthread_gen_destroy(gen) == 0;
+    ok = ok && uthread_gen_create(&gen, count_gen, (void *)(intptr_t)5, 0) == 0 &&
+         uthread_gen_resume(gen, NULL, NULL) == 0 && uthread_gen_destroy(gen) == 0;
+
+    if (!ok) {
+        FAIL("unexpected result");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_other_threads(void)
+{
+    TEST("Generator resumed by two other threads in turn");
+
+    g_errors = 0;
+    g_counter = 0;
+    uthread_sem_init(&g_sem, 0, 0);
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, count_gen, (void *)(intptr_t)10, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    uthread_t a, b;
+    uthread_create(&a, NULL, resume_thread, gen);
+    uthread_create(&b, NULL, resume_thread, gen);
+
+    /* One resume at a time */
+    for (int i = 0; i < 10; i++) {
+        uthread_sem_post(&g_sem);
+        while (atomic_load(&g_counter) <= i) {
+            uthread_yield();
+        }
+    }
+    uthread_join(a, NULL);
+    uthread_join(b, NULL);
+
+    void *v;
+    int done = uthread_gen_resume(gen, NULL, &v) == UTHREAD_EPIPE && (intptr_t)v == 100;
+    uthread_gen_destroy(gen);
+    uthread_sem_destroy(&g_sem);
+
+    if (g_errors != 0 || g_counter != 10 || !done) {
+        FAIL("values lost between resumers");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_blocking(void)
+{
+    TEST("Generator blocks its resumer while other threads run");
+
+    g_counter = 0;
+    uthread_sem_init(&g_sem, 0, 0);
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, blocking_gen, NULL, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    uthread_t t;
+    uthread_create(&t, NULL, counting_thread, NULL);
+
+    int ok = 1;
+    void *v;
+    for (intptr_t i = 0; i < 3 && ok; i++) {
+        ok = uthread_gen_resume(gen, NULL, &v) == 0 && (intptr_t)v == i &&
+             atomic_load(&g_counter) > i;
+    }
+    ok = ok && uthread_gen_resume(gen, NULL, NULL) == UTHREAD_EPIPE;
+
+    uthread_join(t, NULL);
+    uthread_gen_destroy(gen);
+    uthread_sem_destroy(&g_sem);
+
+    if (!ok) {
+        FAIL("generator did not wait for the semaphore");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_preempted(void)
+{
+    TEST("Generator body is preempted like its resumer");
+
+    g_flag = 0;
+
+    uthread_gen_t gen;
+    if (uthread_gen_create(&gen, spinning_gen, NULL, 0) != 0) {
+        FAIL("uthread_gen_create failed");
+        return;
+    }
+
+    uthread_t t;
+    uthread_create(&t, NULL, flag_thread, NULL);
+
+    void *v = NULL;
+    int ret = uthread_gen_resume(gen, NULL, &v);
+    uthread_join(t, NULL);
+    uthread_gen_destroy(gen);
+
+    if (ret != UTHREAD_EPIPE || (intptr_t)v != 1) {
+        FAIL("other thread never ran");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_gen_stack_reuse(void)
+{
+    TEST("Finished generators give their stacks to the next ones");
+
+    uthread_stats_t before, after;
+    uthread_get_stats(&before);
+
+    int ok = 1;
+    for (int i = 0; i < 8 && ok; i++) {
+        uthread_gen_t gen;
+        ok = uthread_gen_create(&gen, count_gen, (void *)(intptr_t)3, 0) == 0;
+        while (ok && uthread_gen_resume(gen, NULL, NULL) == 0) {
+        }
+        ok = ok && uthread_gen_destroy(gen) == 0;
+    }
+
+    uthread_get_stats(&after);
+
+    if (!ok || after.stack_cache_hits - before.stack_cache_hits < 7) {
+        printf("(hits %lu) ", (unsigned long)(after.stack_cache_hits - before.stack_cache_hits));
+        FAIL("stacks not reused");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Future Tests
+ * ========================================================================== */
+
+static void test_future_await(void)
+{
+    TEST("Future wakes every awaiter with its value");
+
+    g_errors = 0;
+    g_counter = 0;
+    uthread_future_init(&g_future);
+
+    uthread_t threads[NUM_AWAITERS];
+    for (int i = 0; i < NUM_AWAITERS; i++) {
+        uthread_create(&threads[i], NULL, await_thread, NULL);
+    }
+    /* Let them all block */
+    for (int i = 0; i < 4; i++) {
+        uthread_yield();
+    }
+
+    int early = !(uthread_future_try(&g_future, NULL) == UTHREAD_EAGAIN &&
+                  atomic_load(&g_counter) == 0);
+    int busy = uthread_future_destroy(&g_future) != UTHREAD_EBUSY;
+
+    uthread_future_set(&g_future, (void *)(intptr_t)42);
+    for (int i = 0; i < NUM_AWAITERS; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    void *v = NULL;
+    int late = uthread_future_try(&g_future, &v) != 0 || (intptr_t)v != 42;
+    int twice = uthread_future_set(&g_future, NULL) != UTHREAD_EBUSY;
+    uthread_future_destroy(&g_future);
+
+    if (early || busy || late || twice || g_errors != 0 || g_counter != NUM_AWAITERS) {
+        FAIL("awaiters not woken with the value");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_future_then(void)
+{
+    TEST("Future continuations: order, chaining, already set");
+
+    uthread_future_t f1 = UTHREAD_FUTURE_INITIALIZER;
+    uthread_future_t f2, f3;
+    uthread_future_init(&f2);
+    uthread_future_init(&f3);
+
+    int ok = uthread_future_then(&f1, add_one, NULL, &f2) == 0 &&
+             uthread_future_then(&f2, times_two, NULL, &f3) == 0;
+    ok = ok && uthread_future_try(&f3, NULL) == UTHREAD_EAGAIN;
+    ok = ok && uthread_future_set(&f1, (void *)(intptr_t)5) == 0;
+
+    void *v = NULL;
+    ok = ok && uthread_future_await(&f3, &v) == 0 && (intptr_t)v == 12;
+
+    /* A set future continues right away */
+    uthread_future_t f4;
+    uthread_future_init(&f4);
+    ok = ok && uthread_future_then(&f3, add_one, NULL, &f4) == 0 &&
+         uthread_future_try(&f4, &v) == 0 && (intptr_t)v == 13;
+
+    /* Continuations run in the order added */
+    char order[8] = "";
+    uthread_future_t f5;
+    uthread_future_init(&f5);
+    uthread_future_then(&f5, record_order, (void *)(intptr_t)'a', NULL);
+    uthread_future_then(&f5, record_order, (void *)(intptr_t)'b', NULL);
+    uthread_future_then(&f5, record_order, (void *)(intptr_t)'c', NULL);
+    uthread_future_set(&f5, order);
+    ok = ok && strcmp(order, "abc") == 0;
+
+    ok = ok && uthread_future_then(&f5, NULL, NULL, NULL) == UTHREAD_EINVAL;
+
+    uthread_future_destroy(&f1);
+    uthread_future_destroy(&f2);
+    uthread_future_destroy(&f3);
+    uthread_future_destroy(&f4);
+    uthread_future_destroy(&f5);
+
+    if (!ok) {
+        FAIL("wrong continuation results");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * M:N Tests
+ * ========================================================================== */
+
+static void test_mn_generators(void)
+{
+    TEST("Generators and a future across four workers (M:N)");
+
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 4) != 0) {
+        FAIL("uthread_init_workers failed");
+        return;
+    }
+
+    g_errors = 0;
+    uthread_future_init(&g_future);
+
+    uthread_t threads[MN_THREADS];
+    for (int i = 0; i < MN_THREADS; i++) {
+        uthread_create(&threads[i], NULL, mn_gen_thread, NULL);
+    }
+    uthread_future_set(&g_future, (void *)(intptr_t)42);
+    for (int i = 0; i < MN_THREADS; i++) {
+        uthread_join(threads[i], NULL);
+    }
+    uthread_future_destroy(&g_future);
+    uthread_shutdown();
+
+    if (g_errors != 0) {
+        FAIL("generator values lost or out of order");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Generator and Future Tests ===\n\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize uthread library\n");
+        return 1;
+    }
+
+    test_gen_values();
+    test_gen_in_values();
+    test_gen_nested();
+    test_gen_errors();
+    test_gen_other_threads();
+    test_gen_blocking();
+    test_gen_preempted();
+    test_gen_stack_reuse();
+    test_future_await();
+    test_future_then();
+
+    uthread_shutdown();
+
+    test_mn_generators();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
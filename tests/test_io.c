@@ -0,0 +1,622 @@
+/**
+ * LibUThread Non-blocking I/O Tests
+ *
+ * Tests for uthread_read/write/accept/connect/poll_fd and pread/pwrite.
+ * Also built against the io_uring backend as test_io_uring.
+ *
+ * @file test_io.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* ==========================================================================
+ * Thread Functions
+ * ========================================================================== */
+
+struct read_args {
+    int fd;
+    char buf[64];
+    ssize_t result;
+    int err;
+    volatile int done;
+};
+
+static void *reader_thread(void *arg)
+{
+    struct read_args *args = arg;
+
+    args->result = uthread_read(args->fd, args->buf, sizeof(args->buf) - 1);
+    args->err = errno;
+    if (args->result > 0) {
+        args->buf[args->result] = '\0';
+    }
+    args->done = 1;
+
+    return NULL;
+}
+
+static volatile int g_ticks;
+static volatile int g_stop;
+
+static void *ticker_thread(void *arg)
+{
+    (void)arg;
+
+    while (!g_stop) {
+        g_ticks++;
+        uthread_yield();
+    }
+
+    return NULL;
+}
+
+static void *delayed_writer_thread(void *arg)
+{
+    int fd = *(int *)arg;
+
+    uthread_sleep(20);
+    uthread_write(fd, "late", 4);
+
+    return NULL;
+}
+
+#define BULK_BYTES (1024 * 1024)
+
+static void *bulk_writer_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char chunk[4096];
+    size_t sent = 0;
+
+    while (sent < BULK_BYTES) {
+        for (size_t i = 0; i < sizeof(chunk); i++) {
+            chunk[i] = (char)((sent + i) & 0xff);
+        }
+        ssize_t n = uthread_write(fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            return (void *)-1;
+        }
+        /* Partial writes resume at the right offset */
+        sent += (size_t)n;
+    }
+
+    return NULL;
+}
+
+static void *bulk_reader_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    char chunk[1000];
+    size_t received = 0;
+
+    for (;;) {
+        ssize_t n = uthread_read(fd, chunk, sizeof(chunk));
+        if (n < 0) {
+            return (void *)-1;
+        }
+        if (n == 0) {
+            break;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (chunk[i] != (char)((received + (size_t)i) & 0xff)) {
+                return (void *)-1;
+            }
+        }
+        received += (size_t)n;
+    }
+
+    return (void *)(intptr_t)received;
+}
+
+static void *echo_server_thread(void *arg)
+{
+    int listener = *(int *)arg;
+
+    int conn = uthread_accept(listener, NULL, NULL);
+    if (conn < 0) {
+        return (void *)-1;
+    }
+
+    char buf[64];
+    ssize_t n = uthread_read(conn, buf, sizeof(buf));
+    if (n > 0) {
+        uthread_write(conn, buf, (size_t)n);
+    }
+    uthread_close(conn);
+
+    return NULL;
+}
+
+static void *ping_thread(void *arg)
+{
+    int *fds = arg;
+
+    for (int i = 0; i < 1000; i++) {
+        char out = (char)i, in;
+        if (uthread_write(fds[0], &out, 1) != 1 ||
+            uthread_read(fds[1], &in, 1) != 1 || in != out) {
+            return (void *)-1;
+        }
+    }
+
+    return NULL;
+}
+
+static void *pong_thread(void *arg)
+{
+    int *fds = arg;
+    char c;
+
+    for (int i = 0; i < 1000; i++) {
+        if (uthread_read(fds[0], &c, 1) != 1 ||
+            uthread_write(fds[1], &c, 1) != 1) {
+            return (void *)-1;
+        }
+    }
+
+    return NULL;
+}
+
+struct pread_args {
+    int fd;
+    char *buf;
+    size_t len;
+    off_t offset;
+    ssize_t result;
+};
+
+static void *pread_thread(void *arg)
+{
+    struct pread_args *args = arg;
+
+    args->result = uthread_pread(args->fd, args->buf, args->len, args->offset);
+
+    return NULL;
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+void test_read_parks_thread(void)
+{
+    TEST("Blocked read parks only the reader");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    struct read_args args = { .fd = fds[0] };
+    g_ticks = 0;
+    g_stop = 0;
+
+    uthread_t reader, ticker;
+    uthread_create(&reader, NULL, reader_thread, &args);
+    uthread_create(&ticker, NULL, ticker_thread, NULL);
+
+    for (int i = 0; i < 50; i++) {
+        uthread_yield();
+    }
+    int ticks = g_ticks;
+    int parked = !args.done;
+
+    uthread_write(fds[1], "hello", 5);
+    uthread_join(reader, NULL);
+
+    g_stop = 1;
+    uthread_join(ticker, NULL);
+    uthread_close(fds[0]);
+    uthread_close(fds[1]);
+
+    if (parked && ticks >= 40 && args.result == 5 &&
+        strcmp(args.buf, "hello") == 0) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "parked=%d ticks=%d result=%zd",
+                 parked, ticks, args.result);
+        FAIL(msg);
+    }
+}
+
+void test_read_idle_wakeup(void)
+{
+    TEST("Idle worker waits for readiness");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    struct read_args args = { .fd = fds[0] };
+
+    uthread_t reader, writer;
+    uthread_create(&reader, NULL, reader_thread, &args);
+    uthread_create(&writer, NULL, delayed_writer_thread, &fds[1]);
+
+    /* Everyone is blocked until the writer's sleep ends */
+    uthread_join(reader, NULL);
+    uthread_join(writer, NULL);
+    uthread_close(fds[0]);
+    uthread_close(fds[1]);
+
+    if (args.result == 4 && strcmp(args.buf, "late") == 0) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "result=%zd errno=%d", args.result, args.err);
+        FAIL(msg);
+    }
+}
+
+void test_bulk_transfer(void)
+{
+    TEST("Writer parks while the pipe is full");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    uthread_t writer, reader;
+    uthread_create(&reader, NULL, bulk_reader_thread, &fds[0]);
+    uthread_create(&writer, NULL, bulk_writer_thread, &fds[1]);
+
+    void *wret, *rret;
+    uthread_join(writer, &wret);
+    uthread_close(fds[1]);
+    uthread_join(reader, &rret);
+    uthread_close(fds[0]);
+
+    if (wret == NULL && (intptr_t)rret == BULK_BYTES) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "received %ld bytes", (long)(intptr_t)rret);
+        FAIL(msg);
+    }
+}
+
+void test_accept_connect(void)
+{
+    TEST("Accept and connect over loopback");
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    socklen_t len = sizeof(addr);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listener, 4) != 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &len) != 0) {
+        FAIL("loopback listener unavailable");
+        if (listener >= 0) {
+            close(listener);
+        }
+        return;
+    }
+
+    uthread_t server;
+    uthread_create(&server, NULL, echo_server_thread, &listener);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    int ret = uthread_connect(client, (struct sockaddr *)&addr, sizeof(addr));
+
+    char buf[16] = {0};
+    ssize_t n = -1;
+    if (ret == 0) {
+        uthread_write(client, "ping", 4);
+        n = uthread_read(client, buf, sizeof(buf) - 1);
+    }
+
+    void *sret;
+    uthread_join(server, &sret);
+    uthread_close(client);
+    uthread_close(listener);
+
+    if (ret == 0 && n == 4 && strcmp(buf, "ping") == 0 && sret == NULL) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "connect=%d read=%zd", ret, n);
+        FAIL(msg);
+    }
+}
+
+void test_poll_fd_timeout(void)
+{
+    TEST("poll_fd timeout and readiness");
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    int immediate = uthread_poll_fd(fds[0], POLLIN, 0);
+
+    uint64_t start = now_ms();
+    int timed = uthread_poll_fd(fds[0], POLLIN, 30);
+    uint64_t elapsed = now_ms() - start;
+
+    uthread_write(fds[1], "x", 1);
+    int ready = uthread_poll_fd(fds[0], POLLIN, -1);
+    int writable = uthread_poll_fd(fds[1], POLLOUT, 0);
+
+    uthread_close(fds[0]);
+    uthread_close(fds[1]);
+
+    if (immediate == 0 && timed == 0 && elapsed >= 25 &&
+        (ready & POLLIN) && (writable & POLLOUT)) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "immediate=%d timed=%d elapsed=%lu ready=%d",
+                 immediate, timed, (unsigned long)elapsed, ready);
+        FAIL(msg);
+    }
+}
+
+void test_close_wakes_waiter(void)
+{
+    TEST("Closing a descriptor wakes its waiters");
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        FAIL("socketpair failed");
+        return;
+    }
+
+    struct read_args args = { .fd = sv[0] };
+
+    uthread_t reader;
+    uthread_create(&reader, NULL, reader_thread, &args);
+    uthread_yield();  /* Reader parks on sv[0] */
+
+    uthread_close(sv[0]);
+    uthread_join(reader, NULL);
+    uthread_close(sv[1]);
+
+    if (args.result == -1 && args.err == EBADF) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "result=%zd errno=%d", args.result, args.err);
+        FAIL(msg);
+    }
+}
+
+void test_plain_close_reuse(void)
+{
+    TEST("Descriptor number reused after plain close()");
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        FAIL("socketpair failed");
+        return;
+    }
+
+    /* Park once on sv[0] so it is known, non-blocking and in the epoll set */
+    struct read_args first = { .fd = sv[0] };
+    uthread_t reader;
+    uthread_create(&reader, NULL, reader_thread, &first);
+    uthread_yield();
+    uthread_write(sv[1], "one", 3);
+    uthread_join(reader, NULL);
+
+    int old_fd = sv[0];
+    close(sv[0]);
+    close(sv[1]);
+
+    /* The new pair is blocking and gets the lowest free numbers again */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+        FAIL("socketpair failed");
+        return;
+    }
+    bool reused = sv[0] == old_fd || sv[1] == old_fd;
+    int rfd = (sv[1] == old_fd) ? sv[1] : sv[0];
+    int wfd = (rfd == sv[0]) ? sv[1] : sv[0];
+
+    struct read_args second = { .fd = rfd };
+    uthread_create(&reader, NULL, reader_thread, &second);
+    uthread_yield();  /* Reader parks instead of blocking the worker */
+    int parked = !second.done;
+
+    uthread_write(wfd, "two", 3);
+    uthread_join(reader, NULL);
+
+    uthread_close(sv[0]);
+    uthread_close(sv[1]);
+
+    if (reused && parked && first.result == 3 && second.result == 3 &&
+        strcmp(second.buf, "two") == 0) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "reused=%d parked=%d result=%zd/%zd",
+                 reused, parked, first.result, second.result);
+        FAIL(msg);
+    }
+}
+
+void test_pread_registered(void)
+{
+    TEST("pread into registered buffers");
+
+    char path[] = "/tmp/uthread_test_io_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        FAIL("mkstemp failed");
+        return;
+    }
+    unlink(path);
+
+    char data[8192];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 7);
+    }
+    ssize_t written = uthread_pwrite(fd, data, sizeof(data), 0);
+
+    static char buffer[8192];
+    struct iovec iov = { .iov_base = buffer, .iov_len = sizeof(buffer) };
+    int rf = uthread_io_register_files(&fd, 1);
+    int rb = uthread_io_register_buffers(&iov, 1);
+
+    /* Registration is only available with the io_uring backend */
+    bool ring = strcmp(uthread_io_backend(), "io_uring") == 0;
+    bool registered = ring ? (rf == 0 && rb == 0) :
+                             (rf == -1 && rb == -1 && errno == ENOSYS);
+
+    /* Read the two halves in reverse order from two threads */
+    struct pread_args args[2] = {
+        { .fd = fd, .buf = buffer, .len = 4096, .offset = 4096 },
+        { .fd = fd, .buf = buffer + 4096, .len = 4096, .offset = 0 }
+    };
+    uthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        uthread_create(&threads[i], NULL, pread_thread, &args[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    bool match = args[0].result == 4096 && args[1].result == 4096 &&
+                 memcmp(buffer, data + 4096, 4096) == 0 &&
+                 memcmp(buffer + 4096, data, 4096) == 0;
+
+    if (ring) {
+        uthread_io_register_buffers(NULL, 0);
+        uthread_io_register_files(NULL, 0);
+    }
+    uthread_close(fd);
+
+    if (written == (ssize_t)sizeof(data) && registered && match) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "backend=%s written=%zd rf=%d rb=%d match=%d",
+                 uthread_io_backend(), written, rf, rb, match);
+        FAIL(msg);
+    }
+}
+
+void test_workers_ping_pong(void)
+{
+    TEST("Ping-pong across workers");
+
+    uthread_shutdown();
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 2) != 0) {
+        FAIL("uthread_init_workers failed");
+        uthread_init(SCHED_ROUND_ROBIN);
+        return;
+    }
+
+    int a[2], b[2];
+    if (pipe(a) != 0 || pipe(b) != 0) {
+        FAIL("pipe failed");
+        return;
+    }
+
+    /* ping writes a and reads b, pong reads a and writes b */
+    int ping_fds[2] = { a[1], b[0] };
+    int pong_fds[2] = { a[0], b[1] };
+
+    uthread_t ping, pong;
+    uthread_create(&ping, NULL, ping_thread, ping_fds);
+    uthread_create(&pong, NULL, pong_thread, pong_fds);
+
+    void *pret, *qret;
+    uthread_join(ping, &pret);
+    uthread_join(pong, &qret);
+
+    uthread_close(a[0]);
+    uthread_close(a[1]);
+    uthread_close(b[0]);
+    uthread_close(b[1]);
+
+    if (pret == NULL && qret == NULL) {
+        PASS();
+    } else {
+        FAIL("round trips failed");
+    }
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread I/O Tests ===\n\n");
+
+    /* Initialize library */
+    int ret = uthread_init(SCHED_ROUND_ROBIN);
+    if (ret != 0) {
+        printf("Failed to initialize library\n");
+        return 1;
+    }
+
+    test_read_parks_thread();
+    test_read_idle_wakeup();
+    test_bulk_transfer();
+    test_accept_connect();
+    test_poll_fd_timeout();
+    test_close_wakes_waiter();
+    test_plain_close_reuse();
+    test_pread_registered();
+    test_workers_ping_pong();
+
+    uthread_shutdown();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
@@ -0,0 +1,489 @@
+/**
+ * LibUThread Profiling and Introspection Tests
+ *
+ * Tests for the sampling profiler and its folded-stack export, and for
+ * the Unix-socket introspection endpoint: one-shot and streamed
+ * snapshots, and both on several workers.
+ *
+ * @file test_profile.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Helpers
+ * ========================================================================== */
+
+static char g_path[64];
+static char g_sock[64];
+static atomic_bool g_stop;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Read the exported file into a NUL-terminated buffer */
+static char *read_profile(void)
+{
+    FILE *f = fopen(g_path, "r");
+    if (f == NULL) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc((size_t)size + 1);
+    if (buf != NULL) {
+        size_t n = fread(buf, 1, (size_t)size, f);
+        buf[n] = '\0';
+    }
+    fclose(f);
+    return buf;
+}
+
+/* Total samples of the lines rooted at `root`, or -1 for a malformed line */
+static long count_samples(const char *buf, const char *root)
+{
+    long total = 0;
+    size_t len = strlen(root);
+
+    for (const char *line = buf; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == NULL) return -1;
+
+        const char *space = end;
+        while (space > line && space[-1] != ' ') space--;
+        if (space == line || space == end) return -1;
+
+        if (strncmp(line, root, len) == 0 && line[len] == ';') {
+            total += strtol(space, NULL, 10);
+        }
+        line = end + 1;
+    }
+    return total;
+}
+
+__attribute__((noinline)) void spin_inner(volatile unsigned long *acc)
+{
+    for (int i = 0; i < 1000; i++) {
+        *acc += (unsigned long)i;
+    }
+}
+
+/* Not tail calls, so that both keep a frame of their own */
+__attribute__((noinline)) void spin_mid(volatile unsigned long *acc)
+{
+    spin_inner(acc);
+    *acc ^= 1;
+}
+
+__attribute__((noinline)) void spin_outer(volatile unsigned long *acc)
+{
+    spin_mid(acc);
+    *acc ^= 1;
+}
+
+static void *spinner(void *arg)
+{
+    unsigned int ms = (unsigned int)(uintptr_t)arg;
+    volatile unsigned long acc = 0;
+
+    uint64_t end = now_ms() + ms;
+    while (now_ms() < end) {
+        spin_outer(&acc);
+    }
+    return NULL;
+}
+
+static void *sleeper(void *arg)
+{
+    (void)arg;
+
+    while (!atomic_load(&g_stop)) {
+        uthread_sleep(1);
+    }
+    return NULL;
+}
+
+/** A client on a kernel thread of its own, as an on-call tool would be */
+struct client {
+    const char *command;                    /* Sent first, or NULL */
+    int snapshots;                          /* Read this many, 0 for all */
+    char buf[64 * 1024];
+    size_t len;
+    atomic_bool done;
+};
+
+static int count_occurrences(const char *buf, const char *needle)
+{
+    int count = 0;
+    for (const char *p = strstr(buf, needle); p != NULL; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void *client_main(void *arg)
+{
+    struct client *c = arg;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, g_sock);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        if (c->command != NULL) {
+            ssize_t r = write(fd, c->command, strlen(c->command));
+            (void)r;
+        }
+        shutdown(fd, SHUT_WR);
+
+        ssize_t n;
+        while (c->len < sizeof(c->buf) - 1 &&
+               (n = read(fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len)) > 0) {
+            c->len += (size_t)n;
+            c->buf[c->len] = '\0';
+            if (c->snapshots > 0 && count_occurrences(c->buf, "\nend\n") >= c->snapshots) {
+                break;
+            }
+        }
+    }
+    close(fd);
+
+    atomic_store(&c->done, true);
+    return NULL;
+}
+
+/* Run a client, keeping the user threads going until it is done */
+static void run_client(struct client *c)
+{
+    pthread_t thread;
+    pthread_create(&thread, NULL, client_main, c);
+
+    while (!atomic_load(&c->done)) {
+        uthread_sleep(1);
+    }
+    pthread_join(thread, NULL);
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+static void test_invalid(void)
+{
+    TEST("Bad arguments and double starts fail");
+
+    if (uthread_profile_export(g_path) != UTHREAD_EINVAL) {
+        FAIL("export with nothing profiled succeeded");
+        return;
+    }
+    if (uthread_profile_start(5, 0) != UTHREAD_EINVAL) {
+        FAIL("5us period accepted");
+        return;
+    }
+    if (uthread_profile_start(0, 0) != 0) {
+        FAIL("start failed");
+        return;
+    }
+    if (uthread_profile_start(0, 0) != UTHREAD_EBUSY) {
+        FAIL("second start accepted");
+        return;
+    }
+    uthread_profile_stop();
+    if (uthread_profile_export(NULL) != UTHREAD_EINVAL) {
+        FAIL("NULL path accepted");
+        return;
+    }
+
+    char long_path[256];
+    memset(long_path, 'x', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = '\0';
+    if (uthread_introspect_start(NULL) != UTHREAD_EINVAL ||
+        uthread_introspect_start(long_path) != UTHREAD_EINVAL) {
+        FAIL("bad socket path accepted");
+        return;
+    }
+    if (uthread_introspect_start(g_sock) != 0) {
+        FAIL("introspect start failed");
+        return;
+    }
+    if (uthread_introspect_start(g_sock) != UTHREAD_EBUSY) {
+        FAIL("second introspect start accepted");
+        return;
+    }
+    uthread_introspect_stop();
+    if (access(g_sock, F_OK) == 0) {
+        FAIL("socket left behind");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_profile(void)
+{
+    TEST("A spinning thread's stacks are sampled and folded");
+
+    if (uthread_profile_start(1000, 0) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setname(&attr, "spinner");
+
+    uthread_t t;
+    uthread_create(&t, &attr, spinner, (void *)(uintptr_t)100);
+    int tid = uthread_get_tid(t);
+    uthread_join(t, NULL);
+    uthread_attr_destroy(&attr);
+
+    uthread_profile_stop();
+
+    if (uthread_profile_export(g_path) != 0) {
+        FAIL("export failed");
+        return;
+    }
+
+    char *buf = read_profile();
+    if (buf == NULL) {
+        FAIL("could not read profile");
+        return;
+    }
+
+    char root[64];
+    snprintf(root, sizeof(root), "spinner[%d]", tid);
+    long samples = count_samples(buf, root);
+    /* spin_inner() may have no frame, hiding spin_mid() but not spin_outer() */
+    bool nested = false;
+    for (const char *outer = strstr(buf, ";spin_outer;"); outer != NULL && !nested;
+         outer = strstr(outer + 1, ";spin_outer;")) {
+        const char *eol = strchr(outer, '\n');
+        const char *inner = strstr(outer, ";spin_inner ");
+        nested = inner != NULL && eol != NULL && inner < eol;
+    }
+    free(buf);
+
+    if (samples < 0) {
+        FAIL("malformed folded line");
+        return;
+    }
+    /* How many depends on the CPU time the spinner got, not on the 100ms */
+    if (samples == 0) {
+        FAIL("no samples attributed to the spinner");
+        return;
+    }
+    if (!nested) {
+        FAIL("no stack with the caller above the sampled frame");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_snapshot(void)
+{
+    TEST("The endpoint answers with the thread table");
+
+    if (uthread_introspect_start(g_sock) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setname(&attr, "sleeper");
+
+    atomic_store(&g_stop, false);
+    uthread_t t;
+    uthread_create(&t, &attr, sleeper, NULL);
+    uthread_attr_destroy(&attr);
+
+    static struct client c;
+    memset(&c, 0, sizeof(c));
+    run_client(&c);
+
+    atomic_store(&g_stop, true);
+    uthread_join(t, NULL);
+    uthread_introspect_stop();
+
+    char line[64];
+    snprintf(line, sizeof(line), "\nthread %d ", uthread_get_tid(t));
+
+    const char *expected[] = {
+        "scheduler ", "\nrunqueue ", "\nworker 0 ", "\ncontention ",
+        "name sleeper\n", "name main\n", line, NULL
+    };
+    for (int i = 0; expected[i] != NULL; i++) {
+        if (strstr(c.buf, expected[i]) == NULL) {
+            printf("(missing '%s') ", expected[i]);
+            FAIL("field missing from snapshot");
+            return;
+        }
+    }
+    if (count_occurrences(c.buf, "\nend\n") != 1 || strstr(c.buf, "no worker") != NULL) {
+        FAIL("not exactly one complete snapshot");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_watch(void)
+{
+    TEST("\"watch\" streams snapshots until the client leaves");
+
+    if (uthread_introspect_start(g_sock) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    static struct client c;
+    memset(&c, 0, sizeof(c));
+    c.command = "watch 20\n";
+    c.snapshots = 3;
+    run_client(&c);
+
+    uthread_introspect_stop();
+
+    if (count_occurrences(c.buf, "\nend\n") < 3) {
+        FAIL("fewer than three snapshots");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_mn(void)
+{
+    TEST("Profiling and snapshots on two workers (M:N)");
+
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 2) != 0) {
+        FAIL("uthread_init_workers failed");
+        return;
+    }
+
+    uthread_profile_start(500, 0);
+    uthread_introspect_start(g_sock);
+
+    uthread_t threads[2];
+    for (int i = 0; i < 2; i++) {
+        uthread_create(&threads[i], NULL, spinner, (void *)(uintptr_t)100);
+    }
+
+    static struct client c;
+    memset(&c, 0, sizeof(c));
+    run_client(&c);
+
+    int tids[2];
+    for (int i = 0; i < 2; i++) {
+        tids[i] = uthread_get_tid(threads[i]);
+        uthread_join(threads[i], NULL);
+    }
+
+    /* Export while still sampling */
+    int ret = uthread_profile_export(g_path);
+    uthread_shutdown();
+
+    char *buf = read_profile();
+    if (ret != 0 || buf == NULL) {
+        free(buf);
+        FAIL("export failed");
+        return;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < 2; i++) {
+        char root[64];
+        snprintf(root, sizeof(root), "thread[%d]", tids[i]);
+        if (count_samples(buf, root) <= 0) {
+            ok = false;
+        }
+    }
+    free(buf);
+
+    if (!ok) {
+        FAIL("a spinner has no samples");
+        return;
+    }
+    if (strstr(c.buf, "\nworker 1 ") == NULL || strstr(c.buf, "\nend\n") == NULL) {
+        FAIL("snapshot misses the second worker");
+        return;
+    }
+    if (access(g_sock, F_OK) == 0) {
+        FAIL("shutdown left the socket behind");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Profiling and Introspection Tests ===\n\n");
+
+    snprintf(g_path, sizeof(g_path), "/tmp/uthread_profile_%d.folded", (int)getpid());
+    snprintf(g_sock, sizeof(g_sock), "/tmp/uthread_introspect_%d.sock", (int)getpid());
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize library\n");
+        return 1;
+    }
+
+    test_invalid();
+    test_profile();
+    test_snapshot();
+    test_watch();
+
+    uthread_shutdown();
+
+    test_mn();
+
+    unlink(g_path);
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
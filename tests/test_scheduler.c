@@ -6,9 +6,14 @@
  * @file test_scheduler.c
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/time.h>
 #include "uthread.h"
 
 static int test_count = 0;
@@ -87,6 +92,42 @@ static void *fairness_thread(void *arg)
     return NULL;
 }
 
+static volatile int g_spin_stop;
+
+static void *spin_thread(void *arg)
+{
+    volatile int *ran = (volatile int *)arg;
+
+    /* Never yields - only preemption lets other threads run */
+    while (!g_spin_stop) {
+        *ran = 1;
+    }
+
+    return NULL;
+}
+
+static long g_mn_counter;
+
+static void *mn_counter_thread(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < 1000; i++) {
+        uthread_mutex_lock(&g_order_mutex);
+        g_mn_counter++;
+        uthread_mutex_unlock(&g_order_mutex);
+
+        if (i % 10 == 0) {
+            uthread_yield();
+        }
+        if (i % 250 == 0) {
+            uthread_sleep(1);
+        }
+    }
+
+    return NULL;
+}
+
 /* ==========================================================================
  * Round-Robin Tests
  * ========================================================================== */
@@ -149,6 +190,34 @@ void test_rr_fairness(void)
     }
 }
 
+void test_rr_preemption(void)
+{
+    TEST("RR: Preemption of CPU-bound threads");
+
+    uthread_init(SCHED_ROUND_ROBIN);
+
+    volatile int ran[2] = {0, 0};
+    uthread_t threads[2];
+    g_spin_stop = 0;
+
+    for (int i = 0; i < 2; i++) {
+        uthread_create(&threads[i], NULL, spin_thread, (void *)&ran[i]);
+    }
+
+    /* Main thread is preempted too; stop once both spinners got the CPU */
+    while (!(ran[0] && ran[1])) {
+        /* Busy wait */
+    }
+    g_spin_stop = 1;
+
+    for (int i = 0; i < 2; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_shutdown();
+    PASS();
+}
+
 /* ==========================================================================
  * Priority Scheduler Tests
  * ========================================================================== */
@@ -223,6 +292,90 @@ void test_priority_change(void)
     }
 }
 
+void test_priority_requeue(void)
+{
+    TEST("Priority: Queued thread moves to its new level");
+
+    uthread_init(SCHED_PRIORITY);
+    uthread_mutex_init(&g_order_mutex, NULL);
+    g_order_index = 0;
+
+    /* All below main's priority: they stay queued until main joins */
+    uthread_t threads[3];
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setpriority(&attr, 10);
+    for (int i = 0; i < 3; i++) {
+        uthread_create(&threads[i], &attr, priority_worker_thread, (void *)(intptr_t)i);
+    }
+    uthread_attr_destroy(&attr);
+
+    uthread_setpriority(threads[2], 12);
+
+    for (int i = 0; i < 3; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_mutex_destroy(&g_order_mutex);
+    uthread_shutdown();
+
+    if (g_order_index == 3 && g_execution_order[0] == 2 &&
+        g_execution_order[1] == 0 && g_execution_order[2] == 1) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Order: %d, %d, %d (expected 2, 0, 1)",
+                 g_execution_order[0], g_execution_order[1], g_execution_order[2]);
+        FAIL(msg);
+    }
+}
+
+static int g_fifo_next;
+static int g_fifo_errors;
+
+static void *fifo_thread(void *arg)
+{
+    if ((int)(intptr_t)arg != g_fifo_next++) {
+        g_fifo_errors++;
+    }
+    return NULL;
+}
+
+void test_priority_fifo(void)
+{
+    TEST("Priority: FIFO order among many ready threads");
+
+    uthread_init(SCHED_PRIORITY);
+    uthread_set_preemption(false);
+    g_fifo_next = 0;
+    g_fifo_errors = 0;
+
+    enum { NUM_FIFO = 2000 };
+    static uthread_t threads[NUM_FIFO];
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setpriority(&attr, 5);
+    uthread_attr_setstacksize(&attr, UTHREAD_STACK_MIN);
+    for (int i = 0; i < NUM_FIFO; i++) {
+        uthread_create(&threads[i], &attr, fifo_thread, (void *)(intptr_t)i);
+    }
+    uthread_attr_destroy(&attr);
+
+    for (int i = 0; i < NUM_FIFO; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_shutdown();
+
+    if (g_fifo_next == NUM_FIFO && g_fifo_errors == 0) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "ran %d, %d out of order", g_fifo_next, g_fifo_errors);
+        FAIL(msg);
+    }
+}
+
 /* ==========================================================================
  * CFS Scheduler Tests
  * ========================================================================== */
@@ -292,6 +445,770 @@ void test_cfs_nice_values(void)
     }
 }
 
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void spin_for(uint64_t ns)
+{
+    uint64_t end = now_ns() + ns;
+    while (now_ns() < end) {
+    }
+}
+
+#define CFS_WAKES 10
+#define CFS_BURST_NS 100000
+
+static volatile int g_hog_stop;
+static volatile uint64_t g_sleeper_deadline;   /* 0 while the sleeper runs */
+static volatile int g_stale_iterations;
+
+static void *hog_thread(void *arg)
+{
+    (void)arg;
+    while (!g_hog_stop) {
+        spin_for(1000000);
+
+        /* A sleeper already due when we yield should run before us */
+        uint64_t deadline = g_sleeper_deadline;
+        bool due = deadline != 0 && now_ns() > deadline + 100000;
+        uthread_yield();
+        if (due && g_sleeper_deadline == deadline) {
+            g_stale_iterations++;
+        }
+    }
+    return NULL;
+}
+
+static void *sleeper_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < CFS_WAKES; i++) {
+        spin_for(CFS_BURST_NS);
+        g_sleeper_deadline = now_ns() + 1000000;
+        uthread_sleep(1);
+        g_sleeper_deadline = 0;
+    }
+    g_hog_stop = 1;
+    return NULL;
+}
+
+void test_cfs_sleeper_wakeup(void)
+{
+    TEST("CFS: Woken sleeper runs ahead of a CPU hog");
+
+    uthread_init(SCHED_CFS);
+    uthread_set_preemption(false);
+    g_hog_stop = 0;
+    g_sleeper_deadline = 0;
+    g_stale_iterations = 0;
+
+    uthread_t hog, sleeper;
+    uthread_create(&hog, NULL, hog_thread, NULL);
+    uthread_create(&sleeper, NULL, sleeper_thread, NULL);
+    uthread_join(sleeper, NULL);
+    uthread_join(hog, NULL);
+
+    uthread_shutdown();
+
+    /* Without sleeper credit the hog wins every tie with the woken thread */
+    if (g_stale_iterations <= CFS_WAKES / 3) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "hog ran first after %d of %d wakeups",
+                 g_stale_iterations, CFS_WAKES);
+        FAIL(msg);
+    }
+}
+
+void test_runtime_accounting(void)
+{
+    TEST("Runtime charged at switches, not only at ticks");
+
+    uthread_init(SCHED_CFS);
+    uthread_set_preemption(false);
+    uthread_reset_stats();
+    g_hog_stop = 1;
+
+    /* The sleeper blocks after each burst, so no tick ever charges it */
+    uint64_t start = now_ns();
+    uthread_t sleeper;
+    uthread_create(&sleeper, NULL, sleeper_thread, NULL);
+    uthread_join(sleeper, NULL);
+    uint64_t elapsed = now_ns() - start;
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+    uthread_shutdown();
+
+    uint64_t expected = (uint64_t)CFS_WAKES * CFS_BURST_NS;
+    if (stats.total_runtime_ns >= expected &&
+        stats.total_runtime_ns <= elapsed) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "charged %llu ns, expected ~%llu",
+                 (unsigned long long)stats.total_runtime_ns,
+                 (unsigned long long)expected);
+        FAIL(msg);
+    }
+}
+
+/* ==========================================================================
+ * Batch Wakeup Tests
+ * ========================================================================== */
+
+#define BATCH_READERS   1000
+#define BATCH_ROUNDS    3
+
+static uthread_rwlock_t g_batch_rwlock;
+static uthread_mutex_t g_batch_mutex;
+static uthread_cond_t g_batch_next;
+static uthread_cond_t g_batch_arrived;
+static int g_batch_round;
+static int g_batch_arrivals;
+static int g_batch_done;
+static int g_batch_woken;
+static int g_batch_errors;
+static int g_batch_last_prio;
+static int g_batch_last_seq;
+static volatile int g_batch_stop;
+
+static void *batch_reader(void *arg)
+{
+    (void)arg;
+    int prio = 0;
+    uthread_getpriority(uthread_self(), &prio);
+
+    for (int round = 0; round < BATCH_ROUNDS; round++) {
+        uthread_mutex_lock(&g_batch_mutex);
+        while (g_batch_round < round) {
+            uthread_cond_wait(&g_batch_next, &g_batch_mutex);
+        }
+        int seq = g_batch_arrivals++;
+        if (g_batch_arrivals == BATCH_READERS) {
+            uthread_cond_signal(&g_batch_arrived);
+        }
+        uthread_mutex_unlock(&g_batch_mutex);
+
+        /* Blocks behind the writer until it wakes every reader at once */
+        uthread_rwlock_rdlock(&g_batch_rwlock);
+
+        /* Run in priority order, and in arrival order within a priority */
+        if (!(prio < g_batch_last_prio ||
+              (prio == g_batch_last_prio && seq > g_batch_last_seq))) {
+            g_batch_errors++;
+        }
+        g_batch_last_prio = prio;
+        g_batch_last_seq = seq;
+        g_batch_woken++;
+        uthread_rwlock_unlock(&g_batch_rwlock);
+
+        uthread_mutex_lock(&g_batch_mutex);
+        if (++g_batch_done == BATCH_READERS) {
+            uthread_cond_signal(&g_batch_arrived);
+        }
+        uthread_mutex_unlock(&g_batch_mutex);
+    }
+
+    return NULL;
+}
+
+static void *batch_spinner(void *arg)
+{
+    (void)arg;
+    while (!g_batch_stop) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+/*
+ * A writer releases a thousand blocked readers, which are woken as one
+ * batch; with spinners, the batch joins threads already queued.
+ */
+static void run_batch_wakeup(sched_policy_t policy, bool mixed_prio, int spinners)
+{
+    uthread_init(policy);
+    uthread_set_preemption(false);
+    uthread_rwlock_init(&g_batch_rwlock, NULL);
+    uthread_mutex_init(&g_batch_mutex, NULL);
+    uthread_cond_init(&g_batch_next, NULL);
+    uthread_cond_init(&g_batch_arrived, NULL);
+    g_batch_round = -1;
+    g_batch_woken = 0;
+    g_batch_errors = 0;
+    g_batch_stop = 0;
+
+    static uthread_t readers[BATCH_READERS];
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setstacksize(&attr, UTHREAD_STACK_MIN);
+    for (int i = 0; i < BATCH_READERS; i++) {
+        if (mixed_prio) {
+            uthread_attr_setpriority(&attr, UTHREAD_PRIORITY_DEFAULT - 2 + i % 4);
+        }
+        uthread_create(&readers[i], &attr, batch_reader, NULL);
+    }
+    uthread_attr_destroy(&attr);
+
+    uthread_t spin[4];
+    for (int i = 0; i < spinners; i++) {
+        uthread_create(&spin[i], NULL, batch_spinner, NULL);
+    }
+
+    for (int round = 0; round < BATCH_ROUNDS; round++) {
+        uthread_rwlock_wrlock(&g_batch_rwlock);
+
+        uthread_mutex_lock(&g_batch_mutex);
+        g_batch_round = round;
+        g_batch_arrivals = 0;
+        uthread_cond_broadcast(&g_batch_next);
+        while (g_batch_arrivals < BATCH_READERS) {
+            uthread_cond_wait(&g_batch_arrived, &g_batch_mutex);
+        }
+        g_batch_last_prio = UTHREAD_PRIORITY_MAX + 1;
+        g_batch_last_seq = -1;
+        g_batch_done = 0;
+        uthread_mutex_unlock(&g_batch_mutex);
+
+        uthread_rwlock_unlock(&g_batch_rwlock);
+
+        /* Let every reader through before taking the write lock again */
+        uthread_mutex_lock(&g_batch_mutex);
+        while (g_batch_done < BATCH_READERS) {
+            uthread_cond_wait(&g_batch_arrived, &g_batch_mutex);
+        }
+        uthread_mutex_unlock(&g_batch_mutex);
+    }
+
+    for (int i = 0; i < BATCH_READERS; i++) {
+        uthread_join(readers[i], NULL);
+    }
+    g_batch_stop = 1;
+    for (int i = 0; i < spinners; i++) {
+        uthread_join(spin[i], NULL);
+    }
+
+    uthread_cond_destroy(&g_batch_arrived);
+    uthread_cond_destroy(&g_batch_next);
+    uthread_mutex_destroy(&g_batch_mutex);
+    uthread_rwlock_destroy(&g_batch_rwlock);
+    uthread_shutdown();
+
+    if (g_batch_woken == BATCH_READERS * BATCH_ROUNDS && g_batch_errors == 0) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "woken %d of %d, %d out of order",
+                 g_batch_woken, BATCH_READERS * BATCH_ROUNDS, g_batch_errors);
+        FAIL(msg);
+    }
+}
+
+void test_batch_wakeup_rr(void)
+{
+    TEST("Round-Robin: Readers released together run in order");
+    run_batch_wakeup(SCHED_ROUND_ROBIN, false, 2);
+}
+
+void test_batch_wakeup_priority(void)
+{
+    TEST("Priority: Readers released together run in priority order");
+    run_batch_wakeup(SCHED_PRIORITY, true, 0);
+}
+
+void test_batch_wakeup_cfs(void)
+{
+    TEST("CFS: Readers released together are placed together, in order");
+    run_batch_wakeup(SCHED_CFS, false, 4);
+}
+
+/* ==========================================================================
+ * Grouped CFS Tests
+ * ========================================================================== */
+
+#define GROUP_SPIN_NS       20000
+#define GROUP_RUN_MS        400
+#define GROUP_MANY_GROUPS   16
+#define GROUP_MANY_THREADS  512
+
+static volatile int g_group_stop;
+
+static void *group_spinner(void *arg)
+{
+    volatile long *count = (volatile long *)arg;
+    while (!g_group_stop) {
+        spin_for(GROUP_SPIN_NS);
+        (*count)++;
+    }
+    return NULL;
+}
+
+void test_cfs_group_share(void)
+{
+    TEST("Grouped CFS: groups share the CPU by weight, not thread count");
+
+    uthread_init(SCHED_CFS_GROUP);
+    g_group_stop = 0;
+
+    /* One thread at 3x weight against three threads at 1x */
+    uthread_group_t heavy, light;
+    uthread_group_create(&heavy, 3 * UTHREAD_GROUP_WEIGHT_DEFAULT);
+    uthread_group_create(&light, UTHREAD_GROUP_WEIGHT_DEFAULT);
+
+    volatile long counts[4] = {0};
+    uthread_t threads[4];
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    for (int i = 0; i < 4; i++) {
+        uthread_attr_setgroup(&attr, i == 0 ? heavy : light);
+        uthread_create(&threads[i], &attr, group_spinner, (void *)&counts[i]);
+    }
+    uthread_attr_destroy(&attr);
+
+    uthread_sleep(GROUP_RUN_MS);
+    g_group_stop = 1;
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    int destroyed = uthread_group_destroy(heavy) == 0 &&
+                    uthread_group_destroy(light) == 0;
+    uthread_shutdown();
+
+    /* By thread count it would get a quarter; by weight three quarters */
+    long total = counts[0] + counts[1] + counts[2] + counts[3];
+    double share = total > 0 ? (double)counts[0] / (double)total : 0.0;
+    if (destroyed && share > 0.6 && share < 0.9) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "heavy group got %.2f of %ld spins (%ld %ld %ld)",
+                 share, total, counts[1], counts[2], counts[3]);
+        FAIL(msg);
+    }
+}
+
+static void *group_child(void *arg)
+{
+    uthread_group_t *group = (uthread_group_t *)arg;
+    uthread_getgroup(uthread_self(), group);
+    return NULL;
+}
+
+static void *group_parent(void *arg)
+{
+    /* A thread created without a group joins its creator's */
+    uthread_t child;
+    uthread_create(&child, NULL, group_child, arg);
+    uthread_join(child, NULL);
+    return NULL;
+}
+
+void test_cfs_group_api(void)
+{
+    TEST("Grouped CFS: membership, inheritance and group lifecycle");
+
+    uthread_group_t group = NULL;
+    int errors = 0;
+
+    /* Groups only exist under SCHED_CFS_GROUP */
+    uthread_init(SCHED_CFS);
+    if (uthread_group_create(&group, UTHREAD_GROUP_WEIGHT_DEFAULT) != UTHREAD_EINVAL) {
+        errors++;
+    }
+    uthread_shutdown();
+
+    uthread_init(SCHED_CFS_GROUP);
+    if (uthread_group_create(&group, 0) != UTHREAD_EINVAL ||
+        uthread_group_create(&group, UTHREAD_GROUP_WEIGHT_MAX + 1) != UTHREAD_EINVAL ||
+        uthread_group_create(&group, 512) != 0) {
+        errors++;
+    }
+
+    int weight = 0;
+    uthread_group_setweight(group, 2048);
+    uthread_group_getweight(group, &weight);
+    if (weight != 2048) {
+        errors++;
+    }
+
+    uthread_group_t inherited = NULL;
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setgroup(&attr, group);
+    uthread_t parent;
+    uthread_create(&parent, &attr, group_parent, &inherited);
+    uthread_attr_destroy(&attr);
+
+    /* Busy while a member is alive; moving it out frees the group */
+    uthread_group_t current = NULL;
+    uthread_getgroup(parent, &current);
+    if (current != group || uthread_group_destroy(group) != UTHREAD_EBUSY) {
+        errors++;
+    }
+    uthread_join(parent, NULL);
+    if (inherited != group) {
+        errors++;
+    }
+
+    uthread_t mover;
+    uthread_attr_init(&attr);
+    uthread_attr_setgroup(&attr, group);
+    uthread_create(&mover, &attr, group_child, &current);
+    uthread_attr_destroy(&attr);
+    uthread_setgroup(mover, NULL);
+    if (uthread_group_destroy(group) != 0) {
+        errors++;
+    }
+    uthread_join(mover, NULL);
+    if (current != NULL) {
+        errors++;
+    }
+
+    uthread_shutdown();
+
+    if (errors == 0) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%d checks failed", errors);
+        FAIL(msg);
+    }
+}
+
+static volatile int g_group_done;
+
+static void *group_yielder(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 3; i++) {
+        uthread_yield();
+    }
+    g_group_done++;
+    return NULL;
+}
+
+void test_cfs_group_many(void)
+{
+    TEST("Grouped CFS: thousands of threads across groups all run");
+
+    uthread_init(SCHED_CFS_GROUP);
+    g_group_done = 0;
+
+    uthread_group_t groups[GROUP_MANY_GROUPS];
+    for (int i = 0; i < GROUP_MANY_GROUPS; i++) {
+        uthread_group_create(&groups[i], UTHREAD_GROUP_WEIGHT_DEFAULT * (1 + i % 4));
+    }
+
+    static uthread_t threads[GROUP_MANY_GROUPS * GROUP_MANY_THREADS];
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setstacksize(&attr, UTHREAD_STACK_MIN);
+    int n = 0;
+    for (int i = 0; i < GROUP_MANY_THREADS; i++) {
+        for (int g = 0; g < GROUP_MANY_GROUPS; g++) {
+            uthread_attr_setgroup(&attr, groups[g]);
+            uthread_attr_setnice(&attr, (i % 5) - 2);
+            uthread_create(&threads[n++], &attr, group_yielder, NULL);
+        }
+    }
+    uthread_attr_destroy(&attr);
+
+    for (int i = 0; i < n; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    int destroyed = 0;
+    for (int i = 0; i < GROUP_MANY_GROUPS; i++) {
+        destroyed += uthread_group_destroy(groups[i]) == 0;
+    }
+    uthread_shutdown();
+
+    if (g_group_done == n && destroyed == GROUP_MANY_GROUPS) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%d of %d threads finished", g_group_done, n);
+        FAIL(msg);
+    }
+}
+
+void test_batch_wakeup_cfs_group(void)
+{
+    TEST("Grouped CFS: Readers released together run in order");
+    run_batch_wakeup(SCHED_CFS_GROUP, false, 4);
+}
+
+/* ==========================================================================
+ * Direct Hand-off Tests
+ * ========================================================================== */
+
+#define HANDOFF_ROUNDS   1000
+#define HANDOFF_SPINNERS 4
+
+static uthread_sem_t g_ping;
+static uthread_sem_t g_pong;
+static volatile int g_handoff_stop;
+static volatile long g_spinner_turns;
+
+static void *ping_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < HANDOFF_ROUNDS; i++) {
+        uthread_sem_post(&g_ping);
+        uthread_sem_wait(&g_pong);
+    }
+    return NULL;
+}
+
+static void *pong_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < HANDOFF_ROUNDS; i++) {
+        uthread_sem_wait(&g_ping);
+        uthread_sem_post(&g_pong);
+    }
+    return NULL;
+}
+
+static void *yielding_spinner(void *arg)
+{
+    (void)arg;
+    while (!g_handoff_stop) {
+        g_spinner_turns++;
+        uthread_yield();
+    }
+    return NULL;
+}
+
+void test_yield_to(void)
+{
+    TEST("Yield-to: The target runs before the queue head");
+
+    uthread_init(SCHED_ROUND_ROBIN);
+    uthread_mutex_init(&g_order_mutex, NULL);
+    g_order_index = 0;
+
+    uthread_t threads[3];
+    for (int i = 0; i < 3; i++) {
+        uthread_create(&threads[i], NULL, record_order_thread,
+                       (void *)(intptr_t)i);
+    }
+
+    int self_rc = uthread_yield_to(uthread_self());
+    int null_rc = uthread_yield_to(NULL);
+    int rc = uthread_yield_to(threads[2]);
+
+    for (int i = 0; i < 3; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    /* An exited thread is no longer ready: the caller just yields */
+    uthread_t done;
+    uthread_create(&done, NULL, record_order_thread, (void *)(intptr_t)3);
+    uthread_yield();
+    int done_rc = uthread_yield_to(done);
+    uthread_join(done, NULL);
+
+    uthread_shutdown();
+
+    if (self_rc == UTHREAD_EINVAL && null_rc == UTHREAD_EINVAL && rc == 0 &&
+        done_rc == UTHREAD_EAGAIN && g_order_index == 4 &&
+        g_execution_order[0] == 2 && g_execution_order[1] == 0 &&
+        g_execution_order[2] == 1) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "rc %d/%d/%d/%d, order %d,%d,%d",
+                 self_rc, null_rc, rc, done_rc, g_execution_order[0],
+                 g_execution_order[1], g_execution_order[2]);
+        FAIL(msg);
+    }
+}
+
+void test_handoff_pingpong(void)
+{
+    TEST("Hand-off: Woken partner runs first, other threads still progress");
+
+    uthread_init(SCHED_ROUND_ROBIN);
+    uthread_sem_init(&g_ping, 0, 0);
+    uthread_sem_init(&g_pong, 0, 0);
+    g_handoff_stop = 0;
+    g_spinner_turns = 0;
+
+    uthread_t spinners[HANDOFF_SPINNERS];
+    for (int i = 0; i < HANDOFF_SPINNERS; i++) {
+        uthread_create(&spinners[i], NULL, yielding_spinner, NULL);
+    }
+
+    uthread_reset_stats();
+    long turns_before = g_spinner_turns;
+
+    uthread_t ping, pong;
+    uthread_create(&ping, NULL, ping_thread, NULL);
+    uthread_create(&pong, NULL, pong_thread, NULL);
+    uthread_join(ping, NULL);
+    uthread_join(pong, NULL);
+
+    long turns = g_spinner_turns - turns_before;
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+
+    g_handoff_stop = 1;
+    for (int i = 0; i < HANDOFF_SPINNERS; i++) {
+        uthread_join(spinners[i], NULL);
+    }
+
+    uthread_sem_destroy(&g_ping);
+    uthread_sem_destroy(&g_pong);
+    uthread_shutdown();
+
+    /*
+     * Without hand-off every wait would let each spinner run once. The
+     * chain limit still gives them a turn every SCHED_HANDOFF_MAX switches.
+     */
+    if (stats.direct_handoffs >= HANDOFF_ROUNDS && turns > 0 &&
+        turns < (long)HANDOFF_ROUNDS * HANDOFF_SPINNERS) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "%lu hand-offs, %ld spinner turns",
+                 (unsigned long)stats.direct_handoffs, turns);
+        FAIL(msg);
+    }
+}
+
+/* ==========================================================================
+ * M:N Tests
+ * ========================================================================== */
+
+void test_workers_config(void)
+{
+    TEST("M:N: Worker configuration");
+
+    /* Only round-robin can run on several workers */
+    if (uthread_init_workers(SCHED_CFS, 2) != UTHREAD_EINVAL) {
+        FAIL("CFS accepted with 2 workers");
+        return;
+    }
+
+    uthread_init_workers(SCHED_ROUND_ROBIN, 3);
+    int workers = uthread_get_num_workers();
+    int main_worker = uthread_worker_id();
+    uthread_shutdown();
+
+    if (workers == 3 && main_worker == 0 && uthread_get_num_workers() == 0) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "workers=%d, main on worker %d",
+                 workers, main_worker);
+        FAIL(msg);
+    }
+}
+
+void test_workers_mutex(void)
+{
+    TEST("M:N: Shared counter across workers");
+
+    uthread_init_workers(SCHED_ROUND_ROBIN, 4);
+    uthread_mutex_init(&g_order_mutex, NULL);
+    g_mn_counter = 0;
+
+    uthread_t threads[8];
+    for (int i = 0; i < 8; i++) {
+        uthread_create(&threads[i], NULL, mn_counter_thread, NULL);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_mutex_destroy(&g_order_mutex);
+    uthread_shutdown();
+
+    if (g_mn_counter == 8000) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "Counter: %ld (expected 8000)", g_mn_counter);
+        FAIL(msg);
+    }
+}
+
+static volatile int g_affinity_errors;
+
+static void *affinity_thread(void *arg)
+{
+    uint64_t allowed = (uint64_t)(uintptr_t)arg;
+
+    for (int i = 0; i < 200; i++) {
+        int id = uthread_worker_id();
+        if (id < 0 || (allowed & UTHREAD_WORKER(id)) == 0) {
+            g_affinity_errors++;
+        }
+        uthread_yield();
+    }
+    return NULL;
+}
+
+void test_workers_affinity(void)
+{
+    TEST("M:N: Threads stay on the workers their affinity allows");
+
+    cpu_set_t before, after;
+    sched_getaffinity(0, sizeof(before), &before);
+
+    uthread_init_workers(SCHED_ROUND_ROBIN, 4);
+    int busy_rc = uthread_set_worker_pinning(0);
+    int node = uthread_worker_node();
+    g_affinity_errors = 0;
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+
+    /* No existing worker in the mask */
+    uthread_t none;
+    uthread_attr_setaffinity(&attr, UTHREAD_WORKER(40));
+    int none_rc = uthread_create(&none, &attr, affinity_thread, NULL);
+
+    /* Half restricted to workers 2 and 3, half free to go anywhere */
+    uint64_t mask = UTHREAD_WORKER(2) | UTHREAD_WORKER(3);
+    uthread_attr_setaffinity(&attr, mask);
+    uthread_t threads[8];
+    for (int i = 0; i < 8; i++) {
+        uthread_create(&threads[i], (i % 2 == 0) ? &attr : NULL, affinity_thread,
+                       (void *)(uintptr_t)((i % 2 == 0) ? mask : ~UINT64_C(0)));
+    }
+    for (int i = 0; i < 8; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+    uthread_shutdown();
+
+    sched_getaffinity(0, sizeof(after), &after);
+
+    if (busy_rc == UTHREAD_EBUSY && none_rc == UTHREAD_EINVAL && node >= 0 &&
+        g_affinity_errors == 0 && stats.cross_node_steals <= stats.work_steals &&
+        CPU_EQUAL(&before, &after)) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "rc %d/%d, node %d, %d misplaced, affinity %s",
+                 busy_rc, none_rc, node, g_affinity_errors,
+                 CPU_EQUAL(&before, &after) ? "restored" : "changed");
+        FAIL(msg);
+    }
+}
+
 /* ==========================================================================
  * Timeslice Tests
  * ========================================================================== */
@@ -327,6 +1244,146 @@ void test_timeslice_config(void)
  * Statistics Tests
  * ========================================================================== */
 
+void test_lone_thread_ticks(void)
+{
+    TEST("Timer ticks while one thread runs alone");
+
+    uthread_init(SCHED_ROUND_ROBIN);
+    uthread_reset_stats();
+
+    spin_for(50 * 1000 * 1000);
+
+    uthread_stats_t stats;
+    uthread_get_stats(&stats);
+    uthread_shutdown();
+
+#ifdef TEST_PERIODIC_TIMER
+    /* The periodic timer keeps firing every 10ms */
+    bool ok = stats.timer_ticks >= 2;
+#else
+    /* At most the slice armed at startup expires, and is not re-armed */
+    bool ok = stats.timer_ticks <= 1;
+#endif
+    if (ok) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%llu ticks in 50ms",
+                 (unsigned long long)stats.timer_ticks);
+        FAIL(msg);
+    }
+}
+
+#define SPIN_TURNS 5
+
+static volatile int g_last_spinner;
+static volatile int g_turns[2];
+
+/* Spin until both spinners took turns, counting how often each came back */
+static void *alternating_spin_thread(void *arg)
+{
+    int self = (int)(intptr_t)arg;
+    uint64_t end = now_ns() + 1000ULL * 1000 * 1000;
+
+    while ((g_turns[0] < SPIN_TURNS || g_turns[1] < SPIN_TURNS) &&
+           now_ns() < end) {
+        if (g_last_spinner != self + 1) {
+            g_last_spinner = self + 1;
+            g_turns[self]++;
+        }
+    }
+    return NULL;
+}
+
+void test_short_timeslice(void)
+{
+#ifdef TEST_PERIODIC_TIMER
+    TEST("Short timeslices preempt spinning threads");
+    uint64_t slice = 1000 * 1000;       /* 1ms, the periodic minimum */
+#else
+    TEST("Sub-millisecond timeslices preempt spinning threads");
+    uint64_t slice = 200 * 1000;        /* 200us */
+#endif
+
+    uthread_init(SCHED_ROUND_ROBIN);
+    if (uthread_set_timeslice(slice) != 0) {
+        uthread_shutdown();
+        FAIL("uthread_set_timeslice rejected the slice");
+        return;
+    }
+
+    uthread_t threads[2];
+    g_last_spinner = 0;
+    g_turns[0] = g_turns[1] = 0;
+    for (int i = 0; i < 2; i++) {
+        uthread_create(&threads[i], NULL, alternating_spin_thread,
+                       (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < 2; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_shutdown();
+
+    /* Without preemption the first spinner runs alone until it gives up */
+    if (g_turns[0] >= SPIN_TURNS && g_turns[1] >= SPIN_TURNS) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "turns: %d, %d", g_turns[0], g_turns[1]);
+        FAIL(msg);
+    }
+}
+
+#ifndef TEST_PERIODIC_TIMER
+static volatile sig_atomic_t g_alarms;
+
+static void alarm_handler(int signum)
+{
+    (void)signum;
+    g_alarms++;
+}
+
+void test_sigalrm_available(void)
+{
+    TEST("SIGALRM is left to the application");
+
+    uthread_init(SCHED_ROUND_ROBIN);
+    g_alarms = 0;
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = alarm_handler;
+    sigaction(SIGALRM, &sa, &old);
+
+    /* Application timer firing every 2ms */
+    struct itimerval itv = { { 0, 2000 }, { 0, 2000 } };
+    setitimer(ITIMER_REAL, &itv, NULL);
+
+    /* Preemption still works alongside it */
+    volatile int ran[2] = {0, 0};
+    uthread_t threads[2];
+    g_spin_stop = 0;
+    for (int i = 0; i < 2; i++) {
+        uthread_create(&threads[i], NULL, spin_thread, (void *)&ran[i]);
+    }
+    while (!(ran[0] && ran[1]) || g_alarms < 5) {
+        /* Busy wait */
+    }
+    g_spin_stop = 1;
+    for (int i = 0; i < 2; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    memset(&itv, 0, sizeof(itv));
+    setitimer(ITIMER_REAL, &itv, NULL);
+    sigaction(SIGALRM, &old, NULL);
+    uthread_shutdown();
+
+    PASS();
+}
+#endif
+
 void test_statistics(void)
 {
     TEST("Statistics collection");
@@ -373,17 +1430,47 @@ int main(void)
     /* Round-Robin tests */
     test_rr_basic();
     test_rr_fairness();
+    test_rr_preemption();
 
     /* Priority scheduler tests */
     test_priority_basic();
     test_priority_change();
+    test_priority_requeue();
+    test_priority_fifo();
 
     /* CFS tests */
     test_cfs_basic();
     test_cfs_nice_values();
+    test_cfs_sleeper_wakeup();
+    test_runtime_accounting();
+
+    /* Batch wakeup tests */
+    test_batch_wakeup_rr();
+    test_batch_wakeup_priority();
+    test_batch_wakeup_cfs();
+
+    /* Grouped CFS tests */
+    test_cfs_group_share();
+    test_cfs_group_api();
+    test_cfs_group_many();
+    test_batch_wakeup_cfs_group();
+
+    /* Direct hand-off tests */
+    test_yield_to();
+    test_handoff_pingpong();
+
+    /* M:N tests */
+    test_workers_config();
+    test_workers_mutex();
+    test_workers_affinity();
 
     /* Configuration tests */
     test_timeslice_config();
+    test_lone_thread_ticks();
+    test_short_timeslice();
+#ifndef TEST_PERIODIC_TIMER
+    test_sigalrm_available();
+#endif
     test_statistics();
 
     printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
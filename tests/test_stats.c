@@ -0,0 +1,379 @@
+/**
+ * LibUThread Contention Statistics Tests
+ *
+ * Tests for per-thread switch and state-time counters and per-lock
+ * contention counters, read through the iterator API.
+ *
+ * @file test_stats.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Helpers
+ * ========================================================================== */
+
+#define MS 1000000ULL
+
+static uthread_mutex_t g_mutex;
+static uthread_rwlock_t g_rwlock;
+static volatile int g_go;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Find a live thread's entry through the iterator */
+static bool find_thread(int tid, uthread_thread_stats_t *out)
+{
+    int cursor = 0;
+    while (uthread_thread_stats_next(&cursor, out)) {
+        if (out->tid == tid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool find_lock(const void *lock, uthread_lock_stats_t *out)
+{
+    int cursor = 0;
+    while (uthread_lock_stats_next(&cursor, out)) {
+        if (out->lock == lock) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *yielder(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 100; i++) {
+        uthread_yield();
+    }
+    while (!g_go) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+static void *spinner(void *arg)
+{
+    uint64_t until = now_ns() + (uint64_t)(intptr_t)arg * MS;
+    while (now_ns() < until) {
+        /* Burn the CPU until preempted */
+    }
+    while (!g_go) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+static void *sleeper(void *arg)
+{
+    (void)arg;
+    uthread_sleep(20);
+    while (!g_go) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+static void *mutex_holder(void *arg)
+{
+    (void)arg;
+    uthread_mutex_lock(&g_mutex);
+    uthread_sleep(2);
+    uthread_mutex_unlock(&g_mutex);
+    return NULL;
+}
+
+/* When each reader took and dropped its read lock */
+static uint64_t g_read_start[3];
+static uint64_t g_read_end[3];
+
+static void *reader(void *arg)
+{
+    int i = (int)(intptr_t)arg;
+    uthread_rwlock_rdlock(&g_rwlock);
+    g_read_start[i] = now_ns();
+    uthread_sleep(2);
+    g_read_end[i] = now_ns();
+    uthread_rwlock_unlock(&g_rwlock);
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    (void)arg;
+    uthread_rwlock_wrlock(&g_rwlock);
+    uthread_rwlock_unlock(&g_rwlock);
+    return NULL;
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+static void test_switch_counts(void)
+{
+    TEST("Voluntary and involuntary switches are counted per thread");
+
+    g_go = 0;
+    uthread_t y, s1, s2;
+    uthread_create(&y, NULL, yielder, NULL);
+    uthread_create(&s1, NULL, spinner, (void *)(intptr_t)60);
+    uthread_create(&s2, NULL, spinner, (void *)(intptr_t)60);
+
+    /* Let the spinners run out their time */
+    uthread_sleep(150);
+
+    uthread_thread_stats_t ys, ss;
+    bool found = find_thread(uthread_get_tid(y), &ys) &&
+                 find_thread(uthread_get_tid(s1), &ss);
+
+    g_go = 1;
+    uthread_join(y, NULL);
+    uthread_join(s1, NULL);
+    uthread_join(s2, NULL);
+
+    if (!found) {
+        FAIL("threads not found by the iterator");
+        return;
+    }
+
+    if (ys.voluntary_switches < 100) {
+        printf("(%lu) ", (unsigned long)ys.voluntary_switches);
+        FAIL("yields not counted as voluntary");
+        return;
+    }
+
+    if (ss.involuntary_switches == 0 || ss.run_ns < 30 * MS) {
+        printf("(%lu involuntary, %.1f ms run) ",
+               (unsigned long)ss.involuntary_switches, (double)ss.run_ns / MS);
+        FAIL("spinner was not preempted");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_state_times(void)
+{
+    TEST("Blocked and ready time are split per thread");
+
+    uthread_set_contention_stats(true);
+
+    g_go = 0;
+    uthread_t sl, s1, s2;
+    uthread_create(&sl, NULL, sleeper, NULL);
+    uthread_create(&s1, NULL, spinner, (void *)(intptr_t)40);
+    uthread_create(&s2, NULL, spinner, (void *)(intptr_t)40);
+
+    uthread_sleep(100);
+
+    uthread_thread_stats_t sls, ss;
+    bool found = uthread_get_thread_stats(sl, &sls) == 0 &&
+                 uthread_get_thread_stats(s1, &ss) == 0;
+
+    g_go = 1;
+    uthread_join(sl, NULL);
+    uthread_join(s1, NULL);
+    uthread_join(s2, NULL);
+    uthread_set_contention_stats(false);
+
+    if (!found) {
+        FAIL("uthread_get_thread_stats failed");
+        return;
+    }
+
+    if (sls.blocked_ns < 15 * MS) {
+        printf("(%.1f ms) ", (double)sls.blocked_ns / MS);
+        FAIL("sleep not counted as blocked");
+        return;
+    }
+
+    /* Each spinner waited out the other's slices */
+    if (ss.ready_ns < 5 * MS || ss.max_ready_ns == 0 ||
+        ss.max_ready_ns > ss.ready_ns) {
+        printf("(%.1f ms ready, %.1f ms max) ",
+               (double)ss.ready_ns / MS, (double)ss.max_ready_ns / MS);
+        FAIL("waiting for the CPU not counted");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_mutex_stats(void)
+{
+    TEST("Mutex acquisitions, contention, wait and hold time");
+
+    uthread_mutex_init(&g_mutex, NULL);
+
+    /* Disabled: no counters are attached */
+    uthread_mutex_lock(&g_mutex);
+    uthread_mutex_unlock(&g_mutex);
+    uthread_lock_stats_t ls;
+    if (find_lock(&g_mutex, &ls)) {
+        FAIL("counted while disabled");
+        return;
+    }
+
+    uthread_set_contention_stats(true);
+
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], NULL, mutex_holder, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_set_contention_stats(false);
+
+    if (!find_lock(&g_mutex, &ls)) {
+        FAIL("mutex not listed");
+        return;
+    }
+
+    if (ls.kind != UTHREAD_LOCK_MUTEX || ls.acquisitions != 4 ||
+        ls.contended != 3) {
+        printf("(%lu acquired, %lu contended) ",
+               (unsigned long)ls.acquisitions, (unsigned long)ls.contended);
+        FAIL("wrong counts");
+        return;
+    }
+
+    /* Waiters queued behind 2ms holds: 2 + 4 + 6 ms at least */
+    if (ls.wait_ns < 10 * MS || ls.max_hold_ns < 1 * MS) {
+        printf("(%.1f ms wait, %.1f ms hold) ",
+               (double)ls.wait_ns / MS, (double)ls.max_hold_ns / MS);
+        FAIL("wrong times");
+        return;
+    }
+
+    /* Destroying the mutex drops its counters */
+    uthread_mutex_destroy(&g_mutex);
+    if (find_lock(&g_mutex, &ls)) {
+        FAIL("destroyed mutex still listed");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_rwlock_stats(void)
+{
+    TEST("Rwlock readers share a hold, writer contends");
+
+    uthread_rwlock_init(&g_rwlock, NULL);
+    uthread_set_contention_stats(true);
+
+    uint64_t begin = now_ns();
+    uthread_t threads[4];
+    for (int i = 0; i < 3; i++) {
+        uthread_create(&threads[i], NULL, reader, (void *)(intptr_t)i);
+    }
+    uthread_create(&threads[3], NULL, writer, NULL);
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+    uint64_t elapsed = now_ns() - begin;
+
+    uthread_set_contention_stats(false);
+
+    uthread_lock_stats_t ls;
+    bool found = find_lock(&g_rwlock, &ls);
+    uthread_rwlock_destroy(&g_rwlock);
+
+    if (!found || ls.kind != UTHREAD_LOCK_RWLOCK) {
+        FAIL("rwlock not listed");
+        return;
+    }
+
+    if (ls.acquisitions != 4 || ls.contended != 1) {
+        printf("(%lu acquired, %lu contended) ",
+               (unsigned long)ls.acquisitions, (unsigned long)ls.contended);
+        FAIL("wrong counts");
+        return;
+    }
+
+    /* The readers held the lock at the same time */
+    uint64_t last_start = 0;
+    uint64_t first_end = UINT64_MAX;
+    for (int i = 0; i < 3; i++) {
+        if (g_read_start[i] > last_start) last_start = g_read_start[i];
+        if (g_read_end[i] < first_end) first_end = g_read_end[i];
+    }
+    if (last_start >= first_end) {
+        FAIL("read hold not shared");
+        return;
+    }
+
+    /* ...as one hold, timed from the first reader in to the last out */
+    if (ls.max_hold_ns < 1 * MS || ls.max_hold_ns > elapsed) {
+        printf("(%.1f ms hold in %.1f ms) ",
+               (double)ls.max_hold_ns / MS, (double)elapsed / MS);
+        FAIL("wrong hold time");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Contention Statistics Tests ===\n\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize library\n");
+        return 1;
+    }
+    uthread_set_timeslice(5 * MS);
+
+    test_switch_counts();
+    test_state_times();
+    test_mutex_stats();
+    test_rwlock_stats();
+
+    uthread_shutdown();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
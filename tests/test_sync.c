@@ -6,10 +6,12 @@
  * @file test_sync.c
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 #include "uthread.h"
 
 static int test_count = 0;
@@ -44,6 +46,12 @@ static uthread_rwlock_t g_rwlock;
 static int g_shared_counter;
 static int g_signal_received;
 
+/* Used without an init call: the first lock operation sets them up */
+static uthread_mutex_t g_static_mutex = UTHREAD_MUTEX_INITIALIZER;
+static uthread_cond_t g_static_cond = UTHREAD_COND_INITIALIZER;
+static uthread_rwlock_t g_static_rwlock = UTHREAD_RWLOCK_INITIALIZER;
+static int g_static_done;
+
 /* ==========================================================================
  * Mutex Test Functions
  * ========================================================================== */
@@ -78,6 +86,17 @@ static void *mutex_trylock_thread(void *arg)
     return NULL;
 }
 
+static void *mutex_lock_unlock_thread(void *arg)
+{
+    int *acquired = (int *)arg;
+
+    uthread_mutex_lock(&g_mutex);
+    (*acquired)++;
+    uthread_mutex_unlock(&g_mutex);
+
+    return NULL;
+}
+
 /* ==========================================================================
  * Condition Variable Test Functions
  * ========================================================================== */
@@ -124,6 +143,24 @@ static void *cond_broadcast_waiter(void *arg)
     return NULL;
 }
 
+static void *cond_timed_waiter(void *arg)
+{
+    int *result = (int *)arg;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += 20 * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    uthread_mutex_lock(&g_mutex);
+    *result = uthread_cond_timedwait(&g_cond, &g_mutex, &deadline);
+    g_shared_counter++;
+    uthread_mutex_unlock(&g_mutex);
+
+    return NULL;
+}
+
 /* ==========================================================================
  * Semaphore Test Functions
  * ========================================================================== */
@@ -182,6 +219,99 @@ static void *rwlock_writer_thread(void *arg)
     return NULL;
 }
 
+/* Order in which threads got an rwlock: 'R' or 'W' per acquisition */
+static char g_rw_log[16];
+static int g_rw_log_len;
+static int g_rw_inside;
+
+static void *rwlock_logging_reader(void *arg)
+{
+    (void)arg;
+    uthread_rwlock_rdlock(&g_rwlock);
+    g_rw_log[g_rw_log_len++] = 'R';
+    uthread_rwlock_unlock(&g_rwlock);
+    return NULL;
+}
+
+static void *rwlock_logging_writer(void *arg)
+{
+    (void)arg;
+    uthread_rwlock_wrlock(&g_rwlock);
+    g_rw_log[g_rw_log_len++] = 'W';
+    uthread_yield();  /* Let arriving readers queue up behind us */
+    uthread_rwlock_unlock(&g_rwlock);
+    return NULL;
+}
+
+static void *rwlock_downgrade_reader(void *arg)
+{
+    (void)arg;
+    uthread_rwlock_rdlock(&g_rwlock);
+    g_rw_inside++;
+    uthread_rwlock_unlock(&g_rwlock);
+    return NULL;
+}
+
+/* Pairs a and b are only ever unequal inside a write hold */
+static volatile long g_pair_a;
+static volatile long g_pair_b;
+static volatile int g_pair_torn;
+static volatile long g_pair_reads;
+
+static void *rwlock_pair_thread(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+
+    for (int i = 0; i < 2000; i++) {
+        if (i % 500 == id % 500) {
+            uthread_rwlock_wrlock(&g_rwlock);
+            g_pair_a++;
+            uthread_yield();
+            g_pair_b++;
+            uthread_rwlock_unlock(&g_rwlock);
+        } else {
+            uthread_rwlock_rdlock(&g_rwlock);
+            if (g_pair_a != g_pair_b) {
+                g_pair_torn = 1;
+            }
+            __atomic_fetch_add(&g_pair_reads, 1, __ATOMIC_RELAXED);
+            uthread_rwlock_unlock(&g_rwlock);
+        }
+        if (i % 64 == 0) {
+            uthread_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/* ==========================================================================
+ * Static Initializer Test Functions
+ * ========================================================================== */
+
+static void *static_init_thread(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < 50; i++) {
+        uthread_mutex_lock(&g_static_mutex);
+        g_shared_counter++;
+        uthread_yield();  /* Make the others block on the mutex */
+        uthread_mutex_unlock(&g_static_mutex);
+
+        uthread_rwlock_wrlock(&g_static_rwlock);
+        uthread_yield();
+        uthread_rwlock_unlock(&g_static_rwlock);
+    }
+
+    uthread_mutex_lock(&g_static_mutex);
+    g_static_done++;
+    uthread_cond_signal(&g_static_cond);
+    uthread_mutex_unlock(&g_static_mutex);
+
+    return NULL;
+}
+
 /* ==========================================================================
  * Test Cases
  * ========================================================================== */
@@ -379,6 +509,175 @@ void test_cond_broadcast(void)
     }
 }
 
+/* Absolute CLOCK_MONOTONIC time `ms` milliseconds from now */
+static struct timespec deadline_after_ms(long ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += ms * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    return ts;
+}
+
+static long elapsed_ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L +
+           (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+void test_cond_timedwait_timeout(void)
+{
+    TEST("Condition variable timedwait timeout");
+
+    uthread_mutex_init(&g_mutex, NULL);
+    uthread_cond_init(&g_cond, NULL);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec deadline = deadline_after_ms(20);
+
+    uthread_mutex_lock(&g_mutex);
+    int ret = uthread_cond_timedwait(&g_cond, &g_mutex, &deadline);
+    int relocked = (uthread_mutex_trylock(&g_mutex) != 0);
+    uthread_mutex_unlock(&g_mutex);
+
+    long elapsed = elapsed_ms_since(&start);
+
+    uthread_cond_destroy(&g_cond);
+    uthread_mutex_destroy(&g_mutex);
+
+    if (ret != UTHREAD_ETIMEDOUT) {
+        FAIL("Expected UTHREAD_ETIMEDOUT");
+    } else if (elapsed < 20) {
+        FAIL("Returned before the deadline");
+    } else if (!relocked) {
+        FAIL("Mutex not reacquired after timeout");
+    } else {
+        PASS();
+    }
+}
+
+void test_cond_broadcast_requeue(void)
+{
+    TEST("Condition variable broadcast requeues onto a held mutex");
+
+    enum { NUM_WAITERS = 8 };
+
+    uthread_mutex_init(&g_mutex, NULL);
+    uthread_cond_init(&g_cond, NULL);
+    g_signal_received = 0;
+    int counter = 0;
+
+    uthread_t waiters[NUM_WAITERS];
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        uthread_create(&waiters[i], NULL, cond_broadcast_waiter, &counter);
+    }
+    uthread_sleep(20);
+
+    /* Waiters must not run while we hold the mutex: they could only block */
+    uthread_mutex_lock(&g_mutex);
+    g_signal_received = 1;
+    uthread_cond_broadcast(&g_cond);
+
+    uthread_stats_t before, after;
+    uthread_get_stats(&before);
+    uthread_yield();
+    uthread_yield();
+    uthread_get_stats(&after);
+    int woken_early = counter;
+
+    uthread_mutex_unlock(&g_mutex);
+
+    for (int i = 0; i < NUM_WAITERS; i++) {
+        uthread_join(waiters[i], NULL);
+    }
+
+    uthread_cond_destroy(&g_cond);
+    uthread_mutex_destroy(&g_mutex);
+
+    uint64_t switches = after.context_switches - before.context_switches;
+    if (counter == NUM_WAITERS && woken_early == 0 && switches == 0) {
+        PASS();
+    } else {
+        char msg[96];
+        snprintf(msg, sizeof(msg), "%d wakeups, %lu switches while held",
+                 counter, (unsigned long)switches);
+        FAIL(msg);
+    }
+}
+
+void test_cond_timedwait_requeued(void)
+{
+    TEST("Signaled timedwait waits for the mutex past its deadline");
+
+    uthread_mutex_init(&g_mutex, NULL);
+    uthread_cond_init(&g_cond, NULL);
+    g_shared_counter = 0;
+    int result = -1;
+
+    uthread_t waiter;
+    uthread_create(&waiter, NULL, cond_timed_waiter, &result);
+    uthread_sleep(5);
+
+    /* Hold the mutex until after the waiter's deadline */
+    uthread_mutex_lock(&g_mutex);
+    uthread_cond_signal(&g_cond);
+    uthread_sleep(40);
+    int early = g_shared_counter;
+    uthread_mutex_unlock(&g_mutex);
+
+    uthread_join(waiter, NULL);
+
+    uthread_cond_destroy(&g_cond);
+    uthread_mutex_destroy(&g_mutex);
+
+    if (result == UTHREAD_SUCCESS && early == 0 && g_shared_counter == 1) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "result=%d, early=%d", result, early);
+        FAIL(msg);
+    }
+}
+
+void test_semaphore_timedwait(void)
+{
+    TEST("Semaphore timedwait");
+
+    uthread_sem_init(&g_sem, 0, 0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct timespec deadline = deadline_after_ms(20);
+
+    int ret = uthread_sem_timedwait(&g_sem, &deadline);
+    long elapsed = elapsed_ms_since(&start);
+
+    if (ret != UTHREAD_ETIMEDOUT || elapsed < 20) {
+        uthread_sem_destroy(&g_sem);
+        FAIL("Expected timeout after the deadline");
+        return;
+    }
+
+    /* A post before the deadline must win over the timer */
+    uthread_t producer;
+    uthread_create(&producer, NULL, sem_producer_thread, (void *)(intptr_t)1);
+    deadline = deadline_after_ms(1000);
+    ret = uthread_sem_timedwait(&g_sem, &deadline);
+    uthread_join(producer, NULL);
+
+    uthread_sem_destroy(&g_sem);
+
+    if (ret == 0) {
+        PASS();
+    } else {
+        FAIL("Post did not wake the timed waiter");
+    }
+}
+
 void test_semaphore_basic(void)
 {
     TEST("Semaphore basic");
@@ -535,6 +834,296 @@ void test_rwlock_writer_exclusive(void)
     }
 }
 
+/* Two writers and two readers queue up behind a reader; returns the log */
+static const char *rwlock_attr_order(const uthread_rwlockattr_t *attr)
+{
+    uthread_rwlock_init(&g_rwlock, attr);
+    g_rw_log_len = 0;
+
+    uthread_rwlock_rdlock(&g_rwlock);
+
+    uthread_t t[4];
+    uthread_create(&t[0], NULL, rwlock_logging_writer, NULL);
+    uthread_yield();
+    uthread_create(&t[1], NULL, rwlock_logging_reader, NULL);
+    uthread_create(&t[2], NULL, rwlock_logging_writer, NULL);
+    uthread_create(&t[3], NULL, rwlock_logging_reader, NULL);
+    uthread_yield();
+
+    uthread_rwlock_unlock(&g_rwlock);
+
+    for (int i = 0; i < 4; i++) {
+        uthread_join(t[i], NULL);
+    }
+    uthread_rwlock_destroy(&g_rwlock);
+
+    g_rw_log[g_rw_log_len] = '\0';
+    return g_rw_log;
+}
+
+static const char *rwlock_policy_order(int policy)
+{
+    uthread_rwlockattr_t attr;
+    uthread_rwlockattr_init(&attr);
+    uthread_rwlockattr_setpolicy(&attr, policy);
+    return rwlock_attr_order(&attr);
+}
+
+void test_rwlock_policies(void)
+{
+    TEST("RWLock writer-preferring, reader-preferring and phase-fair order");
+
+    char writer[8], reader[8], fair[8];
+    snprintf(writer, sizeof(writer), "%s", rwlock_policy_order(UTHREAD_RWLOCK_PREFER_WRITER));
+    snprintf(reader, sizeof(reader), "%s", rwlock_policy_order(UTHREAD_RWLOCK_PREFER_READER));
+    snprintf(fair, sizeof(fair), "%s", rwlock_policy_order(UTHREAD_RWLOCK_PHASE_FAIR));
+
+    uthread_rwlockattr_t attr;
+    uthread_rwlockattr_init(&attr);
+    int bad = uthread_rwlockattr_setpolicy(&attr, 7);
+
+    /* The deprecated field still selects readers first */
+    char legacy[8];
+    int legacy_policy = -1;
+    attr.prefer_writer = 0;
+    uthread_rwlockattr_getpolicy(&attr, &legacy_policy);
+    snprintf(legacy, sizeof(legacy), "%s", rwlock_attr_order(&attr));
+
+    /*
+     * Writers first runs both writers before the readers; readers first
+     * lets the readers in beside the held read lock; phase-fair grants
+     * the readers that queued during the first write phase before the
+     * second writer.
+     */
+    if (strcmp(writer, "WWRR") == 0 && strcmp(reader, "RRWW") == 0 &&
+        strcmp(fair, "WRRW") == 0 && bad == UTHREAD_EINVAL &&
+        strcmp(legacy, "RRWW") == 0 && legacy_policy == UTHREAD_RWLOCK_PREFER_READER) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "writer=%s reader=%s fair=%s setpolicy(7)=%d legacy=%s",
+                 writer, reader, fair, bad, legacy);
+        FAIL(msg);
+    }
+}
+
+void test_rwlock_downgrade(void)
+{
+    TEST("RWLock downgrade keeps writers out and admits readers");
+
+    uthread_rwlock_init(&g_rwlock, NULL);
+    g_rw_inside = 0;
+
+    int not_held = uthread_rwlock_downgrade(&g_rwlock);
+
+    uthread_rwlock_wrlock(&g_rwlock);
+
+    uthread_t reader;
+    uthread_create(&reader, NULL, rwlock_downgrade_reader, NULL);
+    uthread_yield();
+    int blocked = g_rw_inside;
+
+    int ret = uthread_rwlock_downgrade(&g_rwlock);
+    uthread_yield();
+    int admitted = g_rw_inside;
+
+    /* Still a reader: writers are refused, readers are not */
+    int trywr = uthread_rwlock_trywrlock(&g_rwlock);
+    int tryrd = uthread_rwlock_tryrdlock(&g_rwlock);
+    if (tryrd == 0) {
+        uthread_rwlock_unlock(&g_rwlock);
+    }
+
+    uthread_rwlock_unlock(&g_rwlock);
+    uthread_join(reader, NULL);
+
+    int free_after = uthread_rwlock_trywrlock(&g_rwlock);
+    if (free_after == 0) {
+        uthread_rwlock_unlock(&g_rwlock);
+    }
+    uthread_rwlock_destroy(&g_rwlock);
+
+    if (not_held == UTHREAD_EPERM && blocked == 0 && ret == 0 && admitted == 1 &&
+        trywr == UTHREAD_EBUSY && tryrd == 0 && free_after == 0) {
+        PASS();
+    } else {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "eperm=%d blocked=%d ret=%d admitted=%d "
+                 "trywr=%d tryrd=%d free=%d", not_held, blocked, ret, admitted,
+                 trywr, tryrd, free_after);
+        FAIL(msg);
+    }
+}
+
+/* Readers and writers on a read-biased lock; returns 0 or a failure */
+static const char *rwlock_biased_stress(int threads)
+{
+    uthread_rwlockattr_t attr;
+    uthread_rwlockattr_init(&attr);
+    uthread_rwlockattr_setreadbias(&attr, 1);
+    if (uthread_rwlock_init(&g_rwlock, &attr) != 0) {
+        return "init failed";
+    }
+
+    /* A fast read hold keeps writers and destroy out */
+    uthread_rwlock_rdlock(&g_rwlock);
+    int trywr = uthread_rwlock_trywrlock(&g_rwlock);
+    int destroy = uthread_rwlock_destroy(&g_rwlock);
+    uthread_rwlock_unlock(&g_rwlock);
+    if (trywr != UTHREAD_EBUSY || destroy != UTHREAD_EBUSY) {
+        return "held read lock not seen by trywrlock or destroy";
+    }
+
+    g_pair_a = 0;
+    g_pair_b = 0;
+    g_pair_torn = 0;
+    g_pair_reads = 0;
+
+    uthread_t t[16];
+    for (int i = 0; i < threads; i++) {
+        uthread_create(&t[i], NULL, rwlock_pair_thread, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < threads; i++) {
+        uthread_join(t[i], NULL);
+    }
+
+    if (uthread_rwlock_destroy(&g_rwlock) != 0) {
+        return "destroy failed";
+    }
+    if (g_pair_torn) {
+        return "reader saw a write in progress";
+    }
+    if (g_pair_a != threads * 4 || g_pair_b != threads * 4 ||
+        g_pair_reads != threads * (2000 - 4)) {
+        return "lost updates";
+    }
+    return NULL;
+}
+
+void test_rwlock_read_biased(void)
+{
+    TEST("RWLock read-biased mode excludes writers");
+
+    const char *err = rwlock_biased_stress(8);
+    if (err == NULL) {
+        PASS();
+    } else {
+        FAIL(err);
+    }
+}
+
+void test_rwlock_read_biased_workers(void)
+{
+    TEST("RWLock read-biased mode on four workers");
+
+    const char *err = rwlock_biased_stress(16);
+    if (err == NULL) {
+        PASS();
+    } else {
+        FAIL(err);
+    }
+}
+
+void test_static_initializers(void)
+{
+    TEST("Statically initialized mutex, cond and rwlock");
+
+    g_shared_counter = 0;
+    g_static_done = 0;
+
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], NULL, static_init_thread, NULL);
+    }
+
+    /* Waits on the cond while the threads are still contending */
+    uthread_mutex_lock(&g_static_mutex);
+    while (g_static_done < 4) {
+        uthread_cond_wait(&g_static_cond, &g_static_mutex);
+    }
+    uthread_mutex_unlock(&g_static_mutex);
+
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    if (g_shared_counter == 200) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Counter: %d (expected 200)", g_shared_counter);
+        FAIL(msg);
+    }
+}
+
+void test_mutex_adaptive(void)
+{
+    TEST("Adaptive mutex under contention");
+
+    uthread_mutexattr_t attr;
+    uthread_mutexattr_init(&attr);
+    if (uthread_mutexattr_settype(&attr, UTHREAD_MUTEX_ADAPTIVE) != 0) {
+        FAIL("UTHREAD_MUTEX_ADAPTIVE rejected");
+        return;
+    }
+
+    uthread_mutex_init(&g_mutex, &attr);
+    uthread_mutexattr_destroy(&attr);
+    g_shared_counter = 0;
+
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], NULL, mutex_increment_thread, (void *)100);
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    uthread_mutex_destroy(&g_mutex);
+
+    if (g_shared_counter == 400) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Expected 400, got %d", g_shared_counter);
+        FAIL(msg);
+    }
+}
+
+void test_mutex_handoff(void)
+{
+    TEST("Mutex handed to a waiter that lost the race");
+
+    uthread_mutex_init(&g_mutex, NULL);
+    int acquired = 0;
+
+    uthread_mutex_lock(&g_mutex);
+
+    uthread_t thread;
+    uthread_create(&thread, NULL, mutex_lock_unlock_thread, &acquired);
+    uthread_yield();  /* Waiter blocks on the mutex */
+
+    /* Wakes the waiter, but we take the mutex again before it runs */
+    uthread_mutex_unlock(&g_mutex);
+    uthread_mutex_lock(&g_mutex);
+    uthread_yield();  /* Waiter finds it taken and queues again */
+
+    /* This time the mutex goes straight to the waiter */
+    uthread_mutex_unlock(&g_mutex);
+    int busy = uthread_mutex_trylock(&g_mutex);
+
+    uthread_join(thread, NULL);
+    uthread_mutex_destroy(&g_mutex);
+
+    if (busy == UTHREAD_EBUSY && acquired == 1) {
+        PASS();
+    } else {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "trylock=%d, acquired=%d", busy, acquired);
+        FAIL(msg);
+    }
+}
+
 /* ==========================================================================
  * Main
  * ========================================================================== */
@@ -554,16 +1143,35 @@ int main(void)
     test_mutex_contention();
     test_mutex_trylock();
     test_mutex_recursive();
+    test_mutex_adaptive();
+    test_mutex_handoff();
     test_cond_signal();
     test_cond_broadcast();
+    test_cond_timedwait_timeout();
+    test_cond_broadcast_requeue();
+    test_cond_timedwait_requeued();
     test_semaphore_basic();
+    test_semaphore_timedwait();
     test_semaphore_producer_consumer();
     test_rwlock_basic();
     test_rwlock_multiple_readers();
     test_rwlock_writer_exclusive();
+    test_rwlock_policies();
+    test_rwlock_downgrade();
+    test_rwlock_read_biased();
+    test_static_initializers();
 
     uthread_shutdown();
 
+    /* Fast readers on several workers at once (one in the cooperative build) */
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 4) != 0 &&
+        uthread_init_workers(SCHED_ROUND_ROBIN, 1) != 0) {
+        printf("Failed to initialize workers\n");
+        return 1;
+    }
+    test_rwlock_read_biased_workers();
+    uthread_shutdown();
+
     printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
 
     return (pass_count == test_count) ? 0 : 1;
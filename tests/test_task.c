@@ -0,0 +1,350 @@
+/**
+ * LibUThread Task Tests
+ *
+ * Tests for run-to-completion tasks: fan-out, blocking tasks that get
+ * promoted to their runner, nested submission, and M:N execution.
+ *
+ * @file test_task.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Shared Data
+ * ========================================================================== */
+
+#define NUM_TASKS 10000
+#define NUM_BLOCKING 8
+#define NESTED_FANOUT 10
+
+static atomic_long g_sum;
+static atomic_int g_count;
+static uthread_mutex_t g_mutex;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ==========================================================================
+ * Task Functions
+ * ========================================================================== */
+
+static void add_task(void *arg)
+{
+    atomic_fetch_add(&g_sum, (long)(intptr_t)arg);
+}
+
+static void lock_task(void *arg)
+{
+    (void)arg;
+
+    uthread_mutex_lock(&g_mutex);
+    atomic_fetch_add(&g_count, 1);
+    uthread_mutex_unlock(&g_mutex);
+}
+
+static void sleep_task(void *arg)
+{
+    (void)arg;
+
+    uthread_sleep(1);
+    atomic_fetch_add(&g_count, 1);
+}
+
+static void leaf_task(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_count, 1);
+}
+
+static void inner_task(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < NESTED_FANOUT; i++) {
+        uthread_task_submit(leaf_task, NULL);
+    }
+    atomic_fetch_add(&g_count, 1);
+}
+
+static void outer_task(void *arg)
+{
+    int *children_done = (int *)arg;
+
+    for (int i = 0; i < NESTED_FANOUT; i++) {
+        uthread_task_submit(inner_task, NULL);
+    }
+
+    /* An explicit wait sees the whole subtree, grandchildren included */
+    uthread_task_group_wait();
+    *children_done = atomic_load(&g_count);
+}
+
+static void *submitting_thread(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < 100; i++) {
+        uthread_task_submit(sleep_task, NULL);
+    }
+
+    /* Returns without waiting: exit waits for the tasks */
+    return NULL;
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+static void test_submit_invalid(void)
+{
+    TEST("Submit rejects NULL function, empty wait returns");
+
+    if (uthread_task_submit(NULL, NULL) != UTHREAD_EINVAL) {
+        FAIL("NULL function accepted");
+        return;
+    }
+
+    if (uthread_task_group_wait() != 0) {
+        FAIL("wait with no tasks failed");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_fan_out(void)
+{
+    TEST("Fan-out of 10000 tasks on few threads");
+
+    uthread_stats_t before, after;
+    uthread_get_stats(&before);
+    atomic_store(&g_sum, 0);
+
+    for (int i = 1; i <= NUM_TASKS; i++) {
+        if (uthread_task_submit(add_task, (void *)(intptr_t)i) != 0) {
+            FAIL("submit failed");
+            return;
+        }
+    }
+    uthread_task_group_wait();
+
+    uthread_get_stats(&after);
+
+    long expected = (long)NUM_TASKS * (NUM_TASKS + 1) / 2;
+    if (atomic_load(&g_sum) != expected) {
+        FAIL("wrong sum");
+        return;
+    }
+
+    if (after.tasks_completed - before.tasks_completed != NUM_TASKS) {
+        FAIL("tasks_completed mismatch");
+        return;
+    }
+
+    /* Tasks share runners instead of getting a thread each */
+    if (after.total_threads - before.total_threads > uthread_get_num_workers()) {
+        printf("(%d threads) ", after.total_threads - before.total_threads);
+        FAIL("a thread was created per task");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_blocking_tasks(void)
+{
+    TEST("Tasks blocking on a mutex are promoted and complete");
+
+    uthread_stats_t before, after;
+    uthread_get_stats(&before);
+    atomic_store(&g_count, 0);
+    uthread_mutex_init(&g_mutex, NULL);
+
+    uthread_mutex_lock(&g_mutex);
+    for (int i = 0; i < NUM_BLOCKING; i++) {
+        uthread_task_submit(lock_task, NULL);
+    }
+
+    /* Let every task reach the held mutex */
+    for (int i = 0; i < NUM_BLOCKING * 4; i++) {
+        uthread_yield();
+    }
+    uthread_mutex_unlock(&g_mutex);
+
+    uthread_task_group_wait();
+    uthread_get_stats(&after);
+    uthread_mutex_destroy(&g_mutex);
+
+    if (atomic_load(&g_count) != NUM_BLOCKING) {
+        FAIL("not all tasks ran");
+        return;
+    }
+
+    if (after.task_promotions - before.task_promotions != NUM_BLOCKING) {
+        printf("(%lu promotions) ",
+               (unsigned long)(after.task_promotions - before.task_promotions));
+        FAIL("every blocked task should be promoted once");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_sleeping_tasks(void)
+{
+    TEST("Sleeping tasks overlap instead of serializing");
+
+    atomic_store(&g_count, 0);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < 100; i++) {
+        uthread_task_submit(sleep_task, NULL);
+    }
+    uthread_task_group_wait();
+    uint64_t elapsed = now_ns() - start;
+
+    if (atomic_load(&g_count) != 100) {
+        FAIL("not all tasks ran");
+        return;
+    }
+
+    /* 100 x 1ms back to back would take over 100ms */
+    if (elapsed > 50 * 1000000ULL) {
+        printf("(%.1f ms) ", (double)elapsed / 1e6);
+        FAIL("sleeps did not overlap");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_nested(void)
+{
+    TEST("Nested tasks complete before their parent");
+
+    int children_done = 0;
+    atomic_store(&g_count, 0);
+
+    uthread_task_submit(outer_task, &children_done);
+    uthread_task_group_wait();
+
+    int expected = NESTED_FANOUT + NESTED_FANOUT * NESTED_FANOUT;
+    if (children_done != expected || atomic_load(&g_count) != expected) {
+        FAIL("parent finished before its subtree");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_thread_exit_waits(void)
+{
+    TEST("Thread exit waits for its tasks");
+
+    atomic_store(&g_count, 0);
+
+    uthread_t thread;
+    uthread_create(&thread, NULL, submitting_thread, NULL);
+    uthread_join(thread, NULL);
+
+    if (atomic_load(&g_count) != 100) {
+        FAIL("thread exited with tasks pending");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_mn_fan_out(void)
+{
+    TEST("Fan-out on two workers (M:N)");
+
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 2) != 0) {
+        FAIL("uthread_init_workers failed");
+        return;
+    }
+
+    atomic_store(&g_sum, 0);
+    atomic_store(&g_count, 0);
+
+    for (int i = 1; i <= NUM_TASKS; i++) {
+        uthread_task_submit(add_task, (void *)(intptr_t)i);
+        if (i % 100 == 0) {
+            uthread_task_submit(sleep_task, NULL);
+        }
+    }
+    uthread_task_group_wait();
+
+    long expected = (long)NUM_TASKS * (NUM_TASKS + 1) / 2;
+    bool ok = atomic_load(&g_sum) == expected &&
+              atomic_load(&g_count) == NUM_TASKS / 100;
+
+    uthread_shutdown();
+
+    if (!ok) {
+        FAIL("wrong result");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Task Tests ===\n\n");
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize library\n");
+        return 1;
+    }
+
+    test_submit_invalid();
+    test_fan_out();
+    test_blocking_tasks();
+    test_sleeping_tasks();
+    test_nested();
+    test_thread_exit_waits();
+
+    uthread_shutdown();
+
+    test_mn_fan_out();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}
@@ -0,0 +1,303 @@
+/**
+ * LibUThread Tracing Tests
+ *
+ * Tests for the event trace ring and its Chrome trace export: recorded
+ * event kinds, ring wrap-around, and tracing on several workers.
+ *
+ * @file test_trace.c
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "uthread.h"
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) \
+    do { \
+        test_count++; \
+        printf("Test %d: %s... ", test_count, name); \
+        fflush(stdout); \
+    } while(0)
+
+#define PASS() \
+    do { \
+        pass_count++; \
+        printf("PASSED\n"); \
+    } while(0)
+
+#define FAIL(msg) \
+    do { \
+        printf("FAILED: %s\n", msg); \
+    } while(0)
+
+/* ==========================================================================
+ * Helpers
+ * ========================================================================== */
+
+static char g_path[64];
+static uthread_mutex_t g_mutex;
+
+/* Read the exported file into a NUL-terminated buffer */
+static char *read_trace(void)
+{
+    FILE *f = fopen(g_path, "r");
+    if (f == NULL) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc((size_t)size + 1);
+    if (buf != NULL) {
+        size_t n = fread(buf, 1, (size_t)size, f);
+        buf[n] = '\0';
+    }
+    fclose(f);
+    return buf;
+}
+
+static int count_occurrences(const char *buf, const char *needle)
+{
+    int count = 0;
+    for (const char *p = strstr(buf, needle); p != NULL; p = strstr(p + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void *contender(void *arg)
+{
+    (void)arg;
+
+    uthread_mutex_lock(&g_mutex);
+    uthread_sleep(1);
+    uthread_mutex_unlock(&g_mutex);
+    return NULL;
+}
+
+static void *yielder(void *arg)
+{
+    int n = (int)(intptr_t)arg;
+
+    for (int i = 0; i < n; i++) {
+        uthread_yield();
+    }
+    return NULL;
+}
+
+/* ==========================================================================
+ * Tests
+ * ========================================================================== */
+
+static void test_invalid(void)
+{
+    TEST("Export without a trace and bad arguments fail");
+
+    if (uthread_trace_export(g_path) != UTHREAD_EINVAL) {
+        FAIL("export with nothing traced succeeded");
+        return;
+    }
+
+    if (uthread_trace_start(0) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    if (uthread_trace_start(0) != UTHREAD_EBUSY) {
+        FAIL("second start accepted");
+        return;
+    }
+
+    uthread_trace_stop();
+
+    if (uthread_trace_export(NULL) != UTHREAD_EINVAL) {
+        FAIL("NULL path accepted");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_events(void)
+{
+    TEST("Contended mutex and sleep are traced and exported");
+
+    uthread_mutex_init(&g_mutex, NULL);
+    if (uthread_trace_start(0) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    uthread_attr_t attr;
+    uthread_attr_init(&attr);
+    uthread_attr_setname(&attr, "contender");
+
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], &attr, contender, NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+    uthread_attr_destroy(&attr);
+    uthread_mutex_destroy(&g_mutex);
+
+    uthread_trace_stop();
+
+    if (uthread_trace_export(g_path) != 0) {
+        FAIL("export failed");
+        return;
+    }
+
+    char *buf = read_trace();
+    if (buf == NULL) {
+        FAIL("could not read trace");
+        return;
+    }
+
+    const char *expected[] = {
+        "\"traceEvents\"", "\"ph\":\"X\"", "\"name\":\"block\"",
+        "\"name\":\"unblock\"", "\"name\":\"lock_contended\"",
+        "\"name\":\"sleep\"", "\"name\":\"worker 0\"", NULL
+    };
+    for (int i = 0; expected[i] != NULL; i++) {
+        if (strstr(buf, expected[i]) == NULL) {
+            printf("(missing %s) ", expected[i]);
+            FAIL("event missing from export");
+            free(buf);
+            return;
+        }
+    }
+
+    /* Three of the four contenders find the mutex held */
+    if (count_occurrences(buf, "lock_contended") < 3) {
+        FAIL("too few contended acquisitions");
+        free(buf);
+        return;
+    }
+
+    bool well_formed = strncmp(buf, "{", 1) == 0 &&
+                       strstr(buf, "\n]}\n") != NULL;
+    free(buf);
+
+    if (!well_formed) {
+        FAIL("export is not a complete JSON object");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_wrap(void)
+{
+    TEST("A small ring keeps only the newest events");
+
+    if (uthread_trace_start(16) != 0) {
+        FAIL("start failed");
+        return;
+    }
+
+    uthread_t a, b;
+    uthread_create(&a, NULL, yielder, (void *)(intptr_t)1000);
+    uthread_create(&b, NULL, yielder, (void *)(intptr_t)1000);
+    uthread_join(a, NULL);
+    uthread_join(b, NULL);
+
+    uthread_trace_stop();
+    uthread_trace_export(g_path);
+
+    char *buf = read_trace();
+    if (buf == NULL) {
+        FAIL("could not read trace");
+        return;
+    }
+
+    /* 16 events at most, plus the two metadata records */
+    int records = count_occurrences(buf, "\"ph\":");
+    free(buf);
+
+    if (records < 4 || records > 16 + 3) {
+        printf("(%d records) ", records);
+        FAIL("ring did not wrap");
+        return;
+    }
+
+    PASS();
+}
+
+static void test_mn(void)
+{
+    TEST("Tracing on two workers (M:N)");
+
+    if (uthread_init_workers(SCHED_ROUND_ROBIN, 2) != 0) {
+        FAIL("uthread_init_workers failed");
+        return;
+    }
+
+    uthread_trace_start(0);
+
+    uthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        uthread_create(&threads[i], NULL, yielder, (void *)(intptr_t)2000);
+    }
+    for (int i = 0; i < 4; i++) {
+        uthread_join(threads[i], NULL);
+    }
+
+    /* Export while still recording */
+    int ret = uthread_trace_export(g_path);
+    uthread_shutdown();
+
+    char *buf = read_trace();
+    if (ret != 0 || buf == NULL) {
+        free(buf);
+        FAIL("export failed");
+        return;
+    }
+
+    bool ok = strstr(buf, "\"name\":\"worker 1\"") != NULL &&
+              count_occurrences(buf, "\"ph\":\"X\"") > 100;
+    free(buf);
+
+    if (!ok) {
+        FAIL("missing worker track or run slices");
+        return;
+    }
+
+    PASS();
+}
+
+/* ==========================================================================
+ * Main
+ * ========================================================================== */
+
+int main(void)
+{
+    printf("=== LibUThread Tracing Tests ===\n\n");
+
+    snprintf(g_path, sizeof(g_path), "/tmp/uthread_trace_%d.json", (int)getpid());
+
+    if (uthread_init(SCHED_ROUND_ROBIN) != 0) {
+        printf("Failed to initialize library\n");
+        return 1;
+    }
+
+    test_invalid();
+    test_events();
+    test_wrap();
+
+    uthread_shutdown();
+
+    test_mn();
+
+    unlink(g_path);
+
+    printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+    return (pass_count == test_count) ? 0 : 1;
+}